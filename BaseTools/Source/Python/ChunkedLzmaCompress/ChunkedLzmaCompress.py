@@ -0,0 +1,247 @@
+## @file
+# This tool encodes and decodes GUIDed FFS sections whose data is split into
+# independently LZMA compressed chunks, so that the chunks can be decompressed
+# in parallel. The GUID of the encoding is
+#   {0x5d5ce104, 0xeffe, 0x44a3, {0xa2, 0xca, 0x7a, 0x18, 0x55, 0x31, 0x9d, 0xea}}
+#
+# The encoded data consists of:
+#
+#   UINT32 Signature         'CLZM'
+#   UINT32 ChunkCount
+#   UINT32 ChunkSize         size of each decoded chunk, except the last one
+#   UINT32 OriginalSize      size of the decoded data
+#   UINT32 ChunkOffset[ChunkCount]
+#                            offset of each chunk from the signature
+#
+# followed by the chunks. Each chunk is a complete EFI_GUID_DEFINED_SECTION of
+# the LZMA custom decompress GUID, aligned on a 4 byte boundary, so that it can
+# be passed to the LZMA GUIDed section handlers unchanged.
+#
+# The chunks are compressed and decompressed with the LzmaCompress tool.
+#
+# This program and the accompanying materials
+# are licensed and made available under the terms and conditions of the BSD License
+# which accompanies this distribution.  The full text of the license may be found at
+# http://opensource.org/licenses/bsd-license.php
+#
+# THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+# WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+#
+
+'''
+ChunkedLzmaCompress
+'''
+from __future__ import print_function
+
+import os
+import sys
+import argparse
+import subprocess
+import shutil
+import struct
+import tempfile
+import uuid
+from multiprocessing.pool import ThreadPool
+from Common.BuildVersion import gBUILD_VERSION
+
+#
+# Globals for help information
+#
+__prog__      = 'ChunkedLzmaCompress'
+__version__   = '%s Version %s' % (__prog__, '0.9 ' + gBUILD_VERSION)
+__copyright__ = 'This tool splits a file into independently LZMA compressed chunks.'
+__usage__     = '%s -e|-d [options] <input_file>' % (__prog__)
+
+#
+# The LZMA custom decompress GUID, and the header of the chunked data
+#
+LZMA_CUSTOM_DECOMPRESS_GUID = uuid.UUID('{EE4E5898-3914-4259-9D6E-DC7BD79403CF}')
+CHUNKED_LZMA_SIGNATURE      = b'CLZM'
+CHUNKED_LZMA_HEADER_STRUCT  = struct.Struct('<4sIII')
+
+#
+# EFI_GUID_DEFINED_SECTION: a 24 bit size and a type, the GUID, DataOffset,
+# and Attributes
+#
+EFI_SECTION_GUID_DEFINED               = 0x02
+EFI_GUIDED_SECTION_PROCESSING_REQUIRED = 0x01
+EFI_GUID_DEFINED_SECTION_STRUCT        = struct.Struct('<3sB16sHH')
+MAX_SECTION_SIZE                       = 0xFFFFFF
+
+DEFAULT_CHUNK_SIZE = 0x100000
+LZMA_TOOL          = 'LzmaCompress'
+
+def RunLzmaTool (Mode, Data, TempDirectory, Index):
+  '''
+  Run the LZMA tool on Data, in Mode '-e' or '-d', and return its output.
+  '''
+  InputFileName  = os.path.join (TempDirectory, 'Chunk%d.in' % Index)
+  OutputFileName = os.path.join (TempDirectory, 'Chunk%d.out' % Index)
+  with open (InputFileName, 'wb') as File:
+    File.write (Data)
+  Process = subprocess.Popen (
+              [LZMA_TOOL, Mode, '-o', OutputFileName, InputFileName],
+              stdout=subprocess.PIPE, stderr=subprocess.PIPE
+              )
+  Process.communicate ()
+  if Process.returncode != 0:
+    raise ValueError ('%s %s failed on chunk %d' % (LZMA_TOOL, Mode, Index))
+  with open (OutputFileName, 'rb') as File:
+    return File.read ()
+
+def Encode (Data, ChunkSize, TempDirectory, Jobs):
+  ChunkCount = (len (Data) + ChunkSize - 1) // ChunkSize
+  Pool = ThreadPool (Jobs)
+  try:
+    Compressed = Pool.map (
+                   lambda Index: RunLzmaTool (
+                                   '-e',
+                                   Data[Index * ChunkSize:(Index + 1) * ChunkSize],
+                                   TempDirectory,
+                                   Index
+                                   ),
+                   range (ChunkCount)
+                   )
+  finally:
+    Pool.close ()
+
+  Offset  = CHUNKED_LZMA_HEADER_STRUCT.size + 4 * ChunkCount
+  Offsets = []
+  Chunks  = b''
+  for Chunk in Compressed:
+    SectionSize = EFI_GUID_DEFINED_SECTION_STRUCT.size + len (Chunk)
+    if SectionSize > MAX_SECTION_SIZE:
+      raise ValueError ('a compressed chunk exceeds the size of a section')
+    Section = EFI_GUID_DEFINED_SECTION_STRUCT.pack (
+                struct.pack ('<I', SectionSize)[:3],
+                EFI_SECTION_GUID_DEFINED,
+                LZMA_CUSTOM_DECOMPRESS_GUID.bytes_le,
+                EFI_GUID_DEFINED_SECTION_STRUCT.size,
+                EFI_GUIDED_SECTION_PROCESSING_REQUIRED
+                ) + Chunk
+    Section += b'\0' * (-len (Section) % 4)
+    Offsets.append (Offset)
+    Offset += len (Section)
+    Chunks += Section
+
+  return (CHUNKED_LZMA_HEADER_STRUCT.pack (
+            CHUNKED_LZMA_SIGNATURE,
+            ChunkCount,
+            ChunkSize,
+            len (Data)
+            ) +
+          struct.pack ('<%dI' % ChunkCount, *Offsets) +
+          Chunks)
+
+def Decode (Data, TempDirectory, Jobs):
+  if len (Data) < CHUNKED_LZMA_HEADER_STRUCT.size:
+    raise ValueError ('the input is too small')
+  Signature, ChunkCount, ChunkSize, OriginalSize = \
+    CHUNKED_LZMA_HEADER_STRUCT.unpack_from (Data)
+  if Signature != CHUNKED_LZMA_SIGNATURE or ChunkSize == 0 or \
+     ChunkCount != (OriginalSize + ChunkSize - 1) // ChunkSize or \
+     len (Data) < CHUNKED_LZMA_HEADER_STRUCT.size + 4 * ChunkCount:
+    raise ValueError ('the input is not chunked LZMA data')
+  Offsets = struct.unpack_from ('<%dI' % ChunkCount, Data,
+              CHUNKED_LZMA_HEADER_STRUCT.size)
+
+  Sections = []
+  for Offset in Offsets:
+    if Offset + EFI_GUID_DEFINED_SECTION_STRUCT.size > len (Data):
+      raise ValueError ('a chunk lies outside of the input')
+    Size, Type, Guid, DataOffset, Attributes = \
+      EFI_GUID_DEFINED_SECTION_STRUCT.unpack_from (Data, Offset)
+    Size = struct.unpack ('<I', Size + b'\0')[0]
+    if Type != EFI_SECTION_GUID_DEFINED or \
+       uuid.UUID (bytes_le=Guid) != LZMA_CUSTOM_DECOMPRESS_GUID or \
+       DataOffset < EFI_GUID_DEFINED_SECTION_STRUCT.size or \
+       DataOffset > Size or Offset + Size > len (Data):
+      raise ValueError ('a chunk is not an LZMA GUIDed section')
+    Sections.append (Data[Offset + DataOffset:Offset + Size])
+
+  Pool = ThreadPool (Jobs)
+  try:
+    Decompressed = Pool.map (
+                     lambda Index: RunLzmaTool (
+                                     '-d',
+                                     Sections[Index],
+                                     TempDirectory,
+                                     Index
+                                     ),
+                     range (ChunkCount)
+                     )
+  finally:
+    Pool.close ()
+
+  for Index, Chunk in enumerate (Decompressed):
+    if len (Chunk) != min (ChunkSize, OriginalSize - Index * ChunkSize):
+      raise ValueError ('chunk %d has the wrong size' % Index)
+  return b''.join (Decompressed)
+
+if __name__ == '__main__':
+  #
+  # Create command line argument parser object
+  #
+  parser = argparse.ArgumentParser(prog=__prog__, usage=__usage__, description=__copyright__, conflict_handler='resolve')
+  group = parser.add_mutually_exclusive_group(required=True)
+  group.add_argument("-e", action="store_true", dest='Encode', help='encode file')
+  group.add_argument("-d", action="store_true", dest='Decode', help='decode file')
+  parser.add_argument("--version", action='version', version=__version__)
+  parser.add_argument("-o", "--output", dest='OutputFile', type=str, metavar='filename', help="specify the output filename", required=True)
+  parser.add_argument("--chunk-size", dest='ChunkSizeStr', type=str, help="specify the size of the decoded chunks. Default is 0x100000.")
+  parser.add_argument("-j", "--jobs", dest='Jobs', type=int, help="specify the number of chunks processed in parallel. Default is the number of CPUs.")
+  parser.add_argument("-v", "--verbose", dest='Verbose', action="store_true", help="increase output messages")
+  parser.add_argument("-q", "--quiet", dest='Quiet', action="store_true", help="reduce output messages")
+  parser.add_argument("--debug", dest='Debug', type=int, metavar='[0-9]', choices=range(0, 10), default=0, help="set debug level")
+  parser.add_argument(metavar="input_file", dest='InputFile', type=argparse.FileType('rb'), help="specify the input filename")
+
+  #
+  # Parse command line arguments
+  #
+  args = parser.parse_args()
+
+  ChunkSize = DEFAULT_CHUNK_SIZE
+  if args.ChunkSizeStr:
+    try:
+      ChunkSize = int (args.ChunkSizeStr, 0)
+    except:
+      ChunkSize = 0
+    if ChunkSize <= 0 or ChunkSize > MAX_SECTION_SIZE:
+      print ('ERROR: %s is not a valid chunk size.' % (args.ChunkSizeStr))
+      sys.exit (1)
+
+  Jobs = args.Jobs
+  if not Jobs or Jobs < 1:
+    try:
+      import multiprocessing
+      Jobs = multiprocessing.cpu_count ()
+    except NotImplementedError:
+      Jobs = 1
+
+  #
+  # Read input file into a buffer and save input filename
+  #
+  args.InputFileName   = args.InputFile.name
+  args.InputFileBuffer = args.InputFile.read()
+  args.InputFile.close()
+
+  TempDirectory = tempfile.mkdtemp (prefix=__prog__)
+  try:
+    if args.Encode:
+      OutputBuffer = Encode (args.InputFileBuffer, ChunkSize, TempDirectory, Jobs)
+    else:
+      OutputBuffer = Decode (args.InputFileBuffer, TempDirectory, Jobs)
+  except (ValueError, OSError) as Error:
+    print ('ERROR: %s: %s' % (args.InputFileName, Error))
+    sys.exit (1)
+  finally:
+    shutil.rmtree (TempDirectory, ignore_errors=True)
+
+  if args.Verbose:
+    print ('%s: %d bytes in, %d bytes out' % (args.InputFileName, len (args.InputFileBuffer), len (OutputBuffer)))
+
+  #
+  # Write output file that contains the encoded or decoded data
+  #
+  with open (args.OutputFile, 'wb') as File:
+    File.write (OutputBuffer)
@@ -0,0 +1,145 @@
+/** @file
+  Measure the scrolling throughput of the console output device.
+
+  The application fills the screen, then prints a fixed number of full-width
+  lines, each of which scrolls the screen by one row, and reports the elapsed
+  time. On a graphics console, every scrolled row turns into one screen-sized
+  Blt() of the Graphics Output Protocol, so the result tracks the cost of
+  Blt() in the GOP driver.
+
+  Run the application once with each build to compare. Displays that defer
+  the transfer of Blt() results to the host may show the last frame shortly
+  after the application has finished timing.
+
+  This program and the accompanying materials
+  are licensed and made available under the terms and conditions of the BSD License
+  which accompanies this distribution.  The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiApplicationEntryPoint.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+//
+// Number of lines scrolled per run, and number of runs.
+//
+#define CONOUT_BENCH_LINES  2000
+#define CONOUT_BENCH_RUNS   3
+
+/**
+  Print Count copies of Line to the console output device, and return the
+  elapsed time.
+
+  @param[in] Line   NUL-terminated line to print, including the line break.
+  @param[in] Count  Number of times to print Line.
+
+  @return  Elapsed time in nanoseconds.
+**/
+STATIC
+UINT64
+ScrollLines (
+  IN CONST CHAR16  *Line,
+  IN UINTN         Count
+  )
+{
+  UINT64  Start;
+  UINTN   Index;
+
+  Start = GetPerformanceCounter ();
+  for (Index = 0; Index < Count; Index++) {
+    gST->ConOut->OutputString (gST->ConOut, (CHAR16 *)Line);
+  }
+  return GetTimeInNanoSecond (GetPerformanceCounter () - Start);
+}
+
+/**
+  The user Entry Point for Application. The user code starts with this
+  function as the real entry point for the application.
+
+  @param[in] ImageHandle    The firmware allocated handle for the EFI image.
+  @param[in] SystemTable    A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS       The benchmark has run.
+  @retval other             The console mode could not be queried, or memory
+                            could not be allocated.
+
+**/
+EFI_STATUS
+EFIAPI
+UefiMain (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Columns;
+  UINTN       Rows;
+  CHAR16      *Line;
+  UINTN       Index;
+  UINT64      Elapsed[CONOUT_BENCH_RUNS];
+  UINT64      Best;
+
+  Status = gST->ConOut->QueryMode (
+                          gST->ConOut,
+                          gST->ConOut->Mode->Mode,
+                          &Columns,
+                          &Rows
+                          );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // Leave the last column empty, so that the line break alone moves the
+  // cursor to the next row.
+  //
+  Line = AllocatePool ((Columns + 2) * sizeof (CHAR16));
+  if (Line == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  for (Index = 0; Index + 1 < Columns; Index++) {
+    Line[Index] = (CHAR16)(L'!' + Index % (L'~' - L'!' + 1));
+  }
+  Line[Index++] = L'\r';
+  Line[Index++] = L'\n';
+  Line[Index]   = L'\0';
+
+  //
+  // Fill the screen first, so that every timed line scrolls.
+  //
+  gST->ConOut->ClearScreen (gST->ConOut);
+  ScrollLines (Line, Rows);
+
+  for (Index = 0; Index < CONOUT_BENCH_RUNS; Index++) {
+    Elapsed[Index] = ScrollLines (Line, CONOUT_BENCH_LINES);
+  }
+
+  gST->ConOut->ClearScreen (gST->ConOut);
+  Print (L"ConOut scrolling, mode %d (%Lux%Lu), %d lines per run:\n",
+    gST->ConOut->Mode->Mode, (UINT64)Columns, (UINT64)Rows,
+    CONOUT_BENCH_LINES);
+  Best = MAX_UINT64;
+  for (Index = 0; Index < CONOUT_BENCH_RUNS; Index++) {
+    Print (L"  run %Lu: %Lu us, %Lu ns/line\n", (UINT64)Index,
+      DivU64x32 (Elapsed[Index], 1000),
+      DivU64x32 (Elapsed[Index], CONOUT_BENCH_LINES));
+    Best = MIN (Best, Elapsed[Index]);
+  }
+  if (Best > 0) {
+    Print (L"  best: %Lu lines/s\n",
+      DivU64x64Remainder (MultU64x32 (CONOUT_BENCH_LINES, 1000000000), Best,
+        NULL));
+  }
+
+  FreePool (Line);
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,365 @@
+/** @file
+  Randomized stress test of the page allocator of the boot services.
+
+  The application makes a long pseudo-random sequence of AllocatePages() and
+  FreePages() calls: allocations of various sizes and memory types below any
+  address, below a maximum address, and at the address of a range freed
+  earlier, and frees of whole allocations as well as of their first or last
+  pages, which split the ranges that the memory map tracks. Every few calls
+  it reads the memory map with GetMemoryMap(), and checks that the
+  descriptors do not overlap and that every live allocation lies in one
+  descriptor of its memory type.
+
+  GetMemoryMap() also runs the consistency check of the memory map index of
+  the DXE core, under DEBUG_CODE. Run the application on a DEBUG build with
+  DEBUG_PROPERTY_DEBUG_CODE_ENABLED set in PcdDebugPropertyMask, so that the
+  check runs, and an inconsistency stops at its ASSERT.
+
+  The sequence is the same on every run. All pages allocated by the
+  application are freed before it exits.
+
+  This program and the accompanying materials
+  are licensed and made available under the terms and conditions of the BSD License
+  which accompanies this distribution.  The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiApplicationEntryPoint.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+//
+// Number of calls, number of allocations live at a time, and number of calls
+// between memory map checks.
+//
+#define PAGE_STRESS_OPERATIONS    20000
+#define PAGE_STRESS_SLOTS         256
+#define PAGE_STRESS_CHECK_PERIOD  64
+
+//
+// Extra room in the memory map buffer, in descriptors, for the descriptors
+// that the allocation of the buffer itself may add.
+//
+#define PAGE_STRESS_MAP_SLACK     16
+
+typedef struct {
+  EFI_PHYSICAL_ADDRESS  Memory;
+  UINTN                 Pages;
+  EFI_MEMORY_TYPE       Type;
+} PAGE_STRESS_SLOT;
+
+STATIC CONST EFI_MEMORY_TYPE mPageStressTypes[] = {
+  EfiLoaderData,
+  EfiBootServicesData,
+  EfiRuntimeServicesData,
+  EfiACPIReclaimMemory
+};
+
+STATIC UINT64            mPageStressSeed = 0x9E3779B97F4A7C15ULL;
+STATIC PAGE_STRESS_SLOT  mPageStressSlots[PAGE_STRESS_SLOTS];
+STATIC UINTN             mPageStressSlotCount;
+
+//
+// The range of the last whole allocation freed, reallocated at its address
+// by a later AllocateAddress call.
+//
+STATIC EFI_PHYSICAL_ADDRESS  mPageStressFreedMemory;
+STATIC UINTN                 mPageStressFreedPages;
+
+/**
+  Return the next number of the pseudo-random sequence (xorshift64).
+
+  @param[in] Limit  The upper bound of the result, exclusive; not zero.
+
+  @return  A number below Limit.
+**/
+STATIC
+UINTN
+PageStressRandom (
+  IN UINTN  Limit
+  )
+{
+  UINT64  Remainder;
+
+  mPageStressSeed ^= LShiftU64 (mPageStressSeed, 13);
+  mPageStressSeed ^= RShiftU64 (mPageStressSeed, 7);
+  mPageStressSeed ^= LShiftU64 (mPageStressSeed, 17);
+  DivU64x64Remainder (mPageStressSeed, Limit, &Remainder);
+  return (UINTN)Remainder;
+}
+
+/**
+  Allocate pages into a new slot, at a random address, below a random
+  maximum address, or at the range freed last.
+
+  @retval EFI_SUCCESS  The pages have been allocated, or the allocation
+                       failed in a way that the firmware may legitimately
+                       report.
+  @return              AllocatePages() failed unexpectedly.
+**/
+STATIC
+EFI_STATUS
+PageStressAllocate (
+  VOID
+  )
+{
+  EFI_STATUS            Status;
+  EFI_ALLOCATE_TYPE     AllocateType;
+  EFI_MEMORY_TYPE       MemoryType;
+  EFI_PHYSICAL_ADDRESS  Memory;
+  UINTN                 Pages;
+
+  MemoryType = mPageStressTypes[PageStressRandom (ARRAY_SIZE (mPageStressTypes))];
+  switch (PageStressRandom (4)) {
+  case 0:
+    AllocateType = AllocateMaxAddress;
+    Memory       = BASE_4GB - 1 - LShiftU64 (PageStressRandom (SIZE_2GB / SIZE_256MB), 28);
+    Pages        = 1 + PageStressRandom (64);
+    break;
+
+  case 1:
+    if (mPageStressFreedPages != 0) {
+      AllocateType = AllocateAddress;
+      Memory       = mPageStressFreedMemory;
+      Pages        = mPageStressFreedPages;
+      mPageStressFreedPages = 0;
+      break;
+    }
+    //
+    // Fall through.
+    //
+  default:
+    AllocateType = AllocateAnyPages;
+    Memory       = 0;
+    Pages        = (PageStressRandom (8) == 0) ? 1 + PageStressRandom (1024) :
+                     1 + PageStressRandom (16);
+    break;
+  }
+
+  Status = gBS->AllocatePages (AllocateType, MemoryType, Pages, &Memory);
+  if (Status == EFI_OUT_OF_RESOURCES || Status == EFI_NOT_FOUND) {
+    //
+    // The range freed last may have been reused since, and memory below the
+    // maximum address may run out.
+    //
+    return EFI_SUCCESS;
+  }
+  if (EFI_ERROR (Status)) {
+    Print (L"AllocatePages (%d, %d, 0x%Lx pages): %r\n", AllocateType,
+      MemoryType, (UINT64)Pages, Status);
+    return Status;
+  }
+
+  mPageStressSlots[mPageStressSlotCount].Memory = Memory;
+  mPageStressSlots[mPageStressSlotCount].Pages  = Pages;
+  mPageStressSlots[mPageStressSlotCount].Type   = MemoryType;
+  mPageStressSlotCount++;
+  return EFI_SUCCESS;
+}
+
+/**
+  Free a random slot, either entirely, or only its first or last pages.
+
+  @retval EFI_SUCCESS  The pages have been freed.
+  @return              FreePages() failed.
+**/
+STATIC
+EFI_STATUS
+PageStressFree (
+  VOID
+  )
+{
+  EFI_STATUS        Status;
+  PAGE_STRESS_SLOT  *Slot;
+  UINTN             Pages;
+
+  Slot = &mPageStressSlots[PageStressRandom (mPageStressSlotCount)];
+  Pages = Slot->Pages;
+  if (Pages > 1 && PageStressRandom (2) == 0) {
+    Pages = 1 + PageStressRandom (Slot->Pages - 1);
+  }
+
+  if (Pages == Slot->Pages || PageStressRandom (2) == 0) {
+    //
+    // Free the first pages of the slot.
+    //
+    Status = gBS->FreePages (Slot->Memory, Pages);
+    if (!EFI_ERROR (Status)) {
+      Slot->Memory += EFI_PAGES_TO_SIZE (Pages);
+    }
+  } else {
+    //
+    // Free the last pages of the slot.
+    //
+    Status = gBS->FreePages (
+                    Slot->Memory + EFI_PAGES_TO_SIZE (Slot->Pages - Pages),
+                    Pages
+                    );
+  }
+  if (EFI_ERROR (Status)) {
+    Print (L"FreePages (0x%Lx pages of 0x%Lx): %r\n", (UINT64)Pages,
+      Slot->Memory, Status);
+    return Status;
+  }
+
+  Slot->Pages -= Pages;
+  if (Slot->Pages == 0) {
+    mPageStressFreedMemory = Slot->Memory - EFI_PAGES_TO_SIZE (Pages);
+    mPageStressFreedPages  = Pages;
+    *Slot = mPageStressSlots[--mPageStressSlotCount];
+  }
+  return EFI_SUCCESS;
+}
+
+/**
+  Read the memory map, and check that the descriptors do not overlap and
+  that every live slot lies in one descriptor of its memory type.
+
+  @retval EFI_SUCCESS           The memory map is consistent.
+  @retval EFI_VOLUME_CORRUPTED  The memory map is inconsistent.
+  @return                       The memory map could not be read.
+**/
+STATIC
+EFI_STATUS
+PageStressCheckMap (
+  VOID
+  )
+{
+  EFI_STATUS             Status;
+  EFI_MEMORY_DESCRIPTOR  *Map;
+  EFI_MEMORY_DESCRIPTOR  *Desc;
+  EFI_MEMORY_DESCRIPTOR  *Other;
+  UINTN                  MapSize;
+  UINTN                  MapKey;
+  UINTN                  DescSize;
+  UINT32                 DescVersion;
+  UINTN                  Index;
+  UINTN                  OtherIndex;
+  UINTN                  Count;
+  PAGE_STRESS_SLOT       *Slot;
+
+  MapSize = 0;
+  Status = gBS->GetMemoryMap (&MapSize, NULL, &MapKey, &DescSize,
+                  &DescVersion);
+  if (Status != EFI_BUFFER_TOO_SMALL) {
+    return Status;
+  }
+  MapSize += PAGE_STRESS_MAP_SLACK * DescSize;
+  Map = AllocatePool (MapSize);
+  if (Map == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  Status = gBS->GetMemoryMap (&MapSize, Map, &MapKey, &DescSize,
+                  &DescVersion);
+  if (EFI_ERROR (Status)) {
+    FreePool (Map);
+    return Status;
+  }
+  Count = MapSize / DescSize;
+
+  Status = EFI_SUCCESS;
+  for (Index = 0; Index < Count && !EFI_ERROR (Status); Index++) {
+    Desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)Map + Index * DescSize);
+    for (OtherIndex = Index + 1; OtherIndex < Count; OtherIndex++) {
+      Other = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)Map + OtherIndex * DescSize);
+      if (Desc->PhysicalStart < Other->PhysicalStart +
+                                EFI_PAGES_TO_SIZE (Other->NumberOfPages) &&
+          Other->PhysicalStart < Desc->PhysicalStart +
+                                 EFI_PAGES_TO_SIZE (Desc->NumberOfPages)) {
+        Print (L"0x%Lx-0x%Lx overlaps 0x%Lx-0x%Lx\n", Desc->PhysicalStart,
+          Desc->PhysicalStart + EFI_PAGES_TO_SIZE (Desc->NumberOfPages) - 1,
+          Other->PhysicalStart,
+          Other->PhysicalStart + EFI_PAGES_TO_SIZE (Other->NumberOfPages) - 1);
+        Status = EFI_VOLUME_CORRUPTED;
+        break;
+      }
+    }
+  }
+
+  for (Index = 0; Index < mPageStressSlotCount && !EFI_ERROR (Status); Index++) {
+    Slot = &mPageStressSlots[Index];
+    for (OtherIndex = 0; OtherIndex < Count; OtherIndex++) {
+      Desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)Map + OtherIndex * DescSize);
+      if (Desc->PhysicalStart <= Slot->Memory &&
+          Slot->Memory + EFI_PAGES_TO_SIZE (Slot->Pages) <=
+            Desc->PhysicalStart + EFI_PAGES_TO_SIZE (Desc->NumberOfPages)) {
+        break;
+      }
+    }
+    if (OtherIndex == Count || Desc->Type != Slot->Type) {
+      Print (L"0x%Lx pages of type %d at 0x%Lx are not in the memory map\n",
+        (UINT64)Slot->Pages, Slot->Type, Slot->Memory);
+      Status = EFI_VOLUME_CORRUPTED;
+    }
+  }
+
+  FreePool (Map);
+  return Status;
+}
+
+/**
+  The user Entry Point for Application. The user code starts with this
+  function as the real entry point for the application.
+
+  @param[in] ImageHandle    The firmware allocated handle for the EFI image.
+  @param[in] SystemTable    A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS       The memory map stayed consistent.
+  @retval other             A call failed, or the memory map became
+                            inconsistent.
+
+**/
+EFI_STATUS
+EFIAPI
+UefiMain (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Operation;
+  UINTN       Checks;
+
+  Status = EFI_SUCCESS;
+  Checks = 0;
+  for (Operation = 0;
+       Operation < PAGE_STRESS_OPERATIONS && !EFI_ERROR (Status);
+       Operation++) {
+    if (mPageStressSlotCount == 0 ||
+        (mPageStressSlotCount < PAGE_STRESS_SLOTS &&
+         PageStressRandom (2) == 0)) {
+      Status = PageStressAllocate ();
+    } else {
+      Status = PageStressFree ();
+    }
+
+    if (!EFI_ERROR (Status) &&
+        (Operation + 1) % PAGE_STRESS_CHECK_PERIOD == 0) {
+      Status = PageStressCheckMap ();
+      Checks++;
+    }
+  }
+
+  while (mPageStressSlotCount > 0) {
+    mPageStressSlotCount--;
+    gBS->FreePages (
+           mPageStressSlots[mPageStressSlotCount].Memory,
+           mPageStressSlots[mPageStressSlotCount].Pages
+           );
+  }
+  if (!EFI_ERROR (Status)) {
+    Status = PageStressCheckMap ();
+    Checks++;
+  }
+
+  Print (L"%Lu page allocator calls, %Lu memory map checks: %r\n",
+    (UINT64)Operation, (UINT64)Checks, Status);
+  return Status;
+}
@@ -0,0 +1,218 @@
+/** @file
+  Measure the cost of pool allocations in the boot services.
+
+  The application times two patterns of AllocatePool() and FreePool() calls,
+  for boot services data and for runtime services data:
+
+  - pairs: an allocation of one size immediately freed again, repeated, for
+    a few sizes; this is the pattern of most temporary buffers;
+  - churn: a working set of blocks of pseudo-random sizes, where each step
+    frees a random block of the set and allocates a new one in its place.
+
+  It reports the time per AllocatePool() and FreePool() pair. Runtime
+  services data pools keep no freed blocks for reuse, so the two memory
+  types show the cost of the pool with and without that cache.
+
+  All blocks allocated by the application are freed before it exits.
+
+  This program and the accompanying materials
+  are licensed and made available under the terms and conditions of the BSD License
+  which accompanies this distribution.  The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiApplicationEntryPoint.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+//
+// Number of pairs per size, number of blocks in the churn working set,
+// number of churn steps, and the largest block size of the churn.
+//
+#define POOL_BENCH_PAIRS        100000
+#define POOL_BENCH_WORKING_SET  256
+#define POOL_BENCH_STEPS        100000
+#define POOL_BENCH_MAX_SIZE     8192
+
+STATIC CONST UINTN mPoolBenchPairSizes[] = { 16, 128, 1024, 4000 };
+
+STATIC CONST EFI_MEMORY_TYPE mPoolBenchTypes[] = {
+  EfiBootServicesData,
+  EfiRuntimeServicesData
+};
+
+STATIC CONST CHAR16 *mPoolBenchTypeNames[] = {
+  L"EfiBootServicesData",
+  L"EfiRuntimeServicesData"
+};
+
+STATIC VOID    *mPoolBenchBlocks[POOL_BENCH_WORKING_SET];
+STATIC UINT32  mPoolBenchSeed;
+
+/**
+  Return the next number of the pseudo-random sequence (xorshift32).
+
+  @param[in] Limit  The upper bound of the result, exclusive; not zero.
+
+  @return  A number below Limit.
+**/
+STATIC
+UINTN
+PoolBenchRandom (
+  IN UINT32  Limit
+  )
+{
+  mPoolBenchSeed ^= mPoolBenchSeed << 13;
+  mPoolBenchSeed ^= mPoolBenchSeed >> 17;
+  mPoolBenchSeed ^= mPoolBenchSeed << 5;
+  return mPoolBenchSeed % Limit;
+}
+
+/**
+  Time allocations of one size, each immediately freed again.
+
+  @param[in]  PoolType  The memory type to allocate.
+  @param[in]  Size      The size to allocate.
+  @param[out] Elapsed   Elapsed time in nanoseconds.
+
+  @retval EFI_SUCCESS  All pairs have been timed.
+  @return              Error returned by AllocatePool().
+**/
+STATIC
+EFI_STATUS
+PoolBenchPairs (
+  IN  EFI_MEMORY_TYPE  PoolType,
+  IN  UINTN            Size,
+  OUT UINT64           *Elapsed
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Index;
+  VOID        *Buffer;
+  UINT64      Start;
+
+  Status = EFI_SUCCESS;
+  Start = GetPerformanceCounter ();
+  for (Index = 0; Index < POOL_BENCH_PAIRS; Index++) {
+    Status = gBS->AllocatePool (PoolType, Size, &Buffer);
+    if (EFI_ERROR (Status)) {
+      break;
+    }
+    gBS->FreePool (Buffer);
+  }
+  *Elapsed = GetTimeInNanoSecond (GetPerformanceCounter () - Start);
+  return Status;
+}
+
+/**
+  Time the replacement of random blocks of a working set with new blocks of
+  random sizes.
+
+  @param[in]  PoolType  The memory type to allocate.
+  @param[out] Elapsed   Elapsed time in nanoseconds.
+
+  @retval EFI_SUCCESS  All steps have been timed.
+  @return              Error returned by AllocatePool().
+**/
+STATIC
+EFI_STATUS
+PoolBenchChurn (
+  IN  EFI_MEMORY_TYPE  PoolType,
+  OUT UINT64           *Elapsed
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Index;
+  UINTN       Step;
+  UINT64      Start;
+
+  mPoolBenchSeed = 0x2545F491;
+  Status = EFI_SUCCESS;
+  for (Index = 0; Index < POOL_BENCH_WORKING_SET && !EFI_ERROR (Status); Index++) {
+    Status = gBS->AllocatePool (PoolType, 1 + PoolBenchRandom (POOL_BENCH_MAX_SIZE),
+                    &mPoolBenchBlocks[Index]);
+  }
+
+  Start = GetPerformanceCounter ();
+  for (Step = 0; Step < POOL_BENCH_STEPS && !EFI_ERROR (Status); Step++) {
+    Index = PoolBenchRandom (POOL_BENCH_WORKING_SET);
+    gBS->FreePool (mPoolBenchBlocks[Index]);
+    mPoolBenchBlocks[Index] = NULL;
+    Status = gBS->AllocatePool (PoolType, 1 + PoolBenchRandom (POOL_BENCH_MAX_SIZE),
+                    &mPoolBenchBlocks[Index]);
+  }
+  *Elapsed = GetTimeInNanoSecond (GetPerformanceCounter () - Start);
+
+  for (Index = 0; Index < POOL_BENCH_WORKING_SET; Index++) {
+    if (mPoolBenchBlocks[Index] != NULL) {
+      gBS->FreePool (mPoolBenchBlocks[Index]);
+      mPoolBenchBlocks[Index] = NULL;
+    }
+  }
+  return Status;
+}
+
+/**
+  The user Entry Point for Application. The user code starts with this
+  function as the real entry point for the application.
+
+  @param[in] ImageHandle    The firmware allocated handle for the EFI image.
+  @param[in] SystemTable    A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS       The benchmark has run.
+  @retval other             Pool could not be allocated.
+
+**/
+EFI_STATUS
+EFIAPI
+UefiMain (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       TypeIndex;
+  UINTN       SizeIndex;
+  UINT64      Elapsed;
+
+  Status = EFI_SUCCESS;
+  for (TypeIndex = 0;
+       TypeIndex < ARRAY_SIZE (mPoolBenchTypes) && !EFI_ERROR (Status);
+       TypeIndex++) {
+    Print (L"%s:\n", mPoolBenchTypeNames[TypeIndex]);
+
+    for (SizeIndex = 0;
+         SizeIndex < ARRAY_SIZE (mPoolBenchPairSizes);
+         SizeIndex++) {
+      Status = PoolBenchPairs (mPoolBenchTypes[TypeIndex],
+                 mPoolBenchPairSizes[SizeIndex], &Elapsed);
+      if (EFI_ERROR (Status)) {
+        break;
+      }
+      Print (L"  pairs, %5Lu bytes: %6Lu ns/pair\n",
+        (UINT64)mPoolBenchPairSizes[SizeIndex],
+        DivU64x32 (Elapsed, POOL_BENCH_PAIRS));
+    }
+
+    if (!EFI_ERROR (Status)) {
+      Status = PoolBenchChurn (mPoolBenchTypes[TypeIndex], &Elapsed);
+    }
+    if (!EFI_ERROR (Status)) {
+      Print (L"  churn, %d blocks of 1-%d bytes: %6Lu ns/pair\n",
+        POOL_BENCH_WORKING_SET, POOL_BENCH_MAX_SIZE,
+        DivU64x32 (Elapsed, POOL_BENCH_STEPS));
+    }
+  }
+
+  if (EFI_ERROR (Status)) {
+    Print (L"AllocatePool(): %r\n", Status);
+  }
+  return Status;
+}
@@ -0,0 +1,346 @@
+/** @file
+  Measure the cost of handle and protocol lookups in the boot services.
+
+  The application installs a number of handles, each carrying two private
+  protocols and a device path, and times OpenProtocol() on every one of
+  them, an OpenProtocol() and CloseProtocol() pair by driver on every one of
+  them, LocateDevicePath() for every one of them, and LocateHandle() by
+  protocol and for all handles. The device paths form a two level topology,
+  a number of buses with a number of devices each. It also times the
+  installation and the removal of the handles. All of the work goes through
+  the boot services table, so the result tracks the handle and protocol
+  database of the DXE core, and grows with the number of handles that the
+  platform has already created.
+
+  Finally the application times a connect-all: ConnectController()
+  recursively on every handle in the system, as the boot manager does. This
+  may connect drivers that the platform had left unconnected, like the
+  "connect -r" shell command does. Run the application twice to time a
+  connect-all of an already connected system.
+
+  All handles created by the application are removed before it exits.
+
+  This program and the accompanying materials
+  are licensed and made available under the terms and conditions of the BSD License
+  which accompanies this distribution.  The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <Uefi.h>
+#include <Protocol/DevicePath.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiApplicationEntryPoint.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+//
+// Number of handles installed by the application, number of devices per bus
+// in their device paths, and number of passes over them per lookup step.
+//
+#define PROTOCOL_BENCH_HANDLES  1000
+#define PROTOCOL_BENCH_DEVICES  32
+#define PROTOCOL_BENCH_ROUNDS   10
+
+#pragma pack(1)
+typedef struct {
+  VENDOR_DEVICE_PATH        Node;
+  UINT32                    Number;
+} PROTOCOL_BENCH_NODE;
+
+typedef struct {
+  PROTOCOL_BENCH_NODE       Bus;
+  PROTOCOL_BENCH_NODE       Device;
+  EFI_DEVICE_PATH_PROTOCOL  End;
+} PROTOCOL_BENCH_DEVICE_PATH;
+#pragma pack()
+
+STATIC EFI_GUID mProtocolBenchGuidA = {
+  0xa7456bb6, 0x1aed, 0x4d10, { 0xaa, 0x46, 0x54, 0xd3, 0x8e, 0xcb, 0xa0, 0xdf }
+};
+
+STATIC EFI_GUID mProtocolBenchGuidB = {
+  0x12cf2df4, 0x2060, 0x4c00, { 0x9f, 0x32, 0xb8, 0x87, 0x88, 0x71, 0x3d, 0x5d }
+};
+
+/**
+  Initialize one node of a benchmark device path.
+
+  @param[out] Node    The node to initialize.
+  @param[in]  Number  The bus or device number in the node.
+**/
+STATIC
+VOID
+InitBenchNode (
+  OUT PROTOCOL_BENCH_NODE  *Node,
+  IN  UINT32               Number
+  )
+{
+  Node->Node.Header.Type      = HARDWARE_DEVICE_PATH;
+  Node->Node.Header.SubType   = HW_VENDOR_DP;
+  Node->Node.Header.Length[0] = (UINT8)sizeof *Node;
+  Node->Node.Header.Length[1] = (UINT8)(sizeof *Node >> 8);
+  CopyGuid (&Node->Node.Guid, &mProtocolBenchGuidA);
+  Node->Number                = Number;
+}
+
+/**
+  Print the result of one step.
+
+  @param[in] Name     Name of the step.
+  @param[in] Calls    Number of boot service calls made in the step.
+  @param[in] Elapsed  Elapsed time in nanoseconds.
+**/
+STATIC
+VOID
+PrintStep (
+  IN CONST CHAR16  *Name,
+  IN UINTN         Calls,
+  IN UINT64        Elapsed
+  )
+{
+  Print (L"  %-28s %7Lu calls, %8Lu us, %6Lu ns/call\n", Name,
+    (UINT64)Calls, DivU64x32 (Elapsed, 1000),
+    DivU64x64Remainder (Elapsed, Calls, NULL));
+}
+
+/**
+  The user Entry Point for Application. The user code starts with this
+  function as the real entry point for the application.
+
+  @param[in] ImageHandle    The firmware allocated handle for the EFI image.
+  @param[in] SystemTable    A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS       The benchmark has run.
+  @retval other             A handle could not be created, or memory could not
+                            be allocated.
+
+**/
+EFI_STATUS
+EFIAPI
+UefiMain (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS                  Status;
+  EFI_HANDLE                  *Handles;
+  PROTOCOL_BENCH_DEVICE_PATH  *DevicePaths;
+  EFI_DEVICE_PATH_PROTOCOL    *Remaining;
+  EFI_HANDLE                  Device;
+  EFI_HANDLE                  *Buffer;
+  UINTN                       BufferSize;
+  UINTN                       HandleCount;
+  UINTN                       Installed;
+  UINTN                       Index;
+  UINTN                       Round;
+  VOID                        *Interface;
+  UINT64                      Start;
+  UINT64                      InstallTime;
+
+  Handles     = AllocateZeroPool (PROTOCOL_BENCH_HANDLES * sizeof *Handles);
+  DevicePaths = AllocatePool (PROTOCOL_BENCH_HANDLES * sizeof *DevicePaths);
+  if (Handles == NULL || DevicePaths == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto FreeHandles;
+  }
+
+  //
+  // Handle N is device N % PROTOCOL_BENCH_DEVICES on bus
+  // N / PROTOCOL_BENCH_DEVICES.
+  //
+  for (Index = 0; Index < PROTOCOL_BENCH_HANDLES; Index++) {
+    InitBenchNode (&DevicePaths[Index].Bus,
+      (UINT32)(Index / PROTOCOL_BENCH_DEVICES));
+    InitBenchNode (&DevicePaths[Index].Device,
+      (UINT32)(Index % PROTOCOL_BENCH_DEVICES));
+    DevicePaths[Index].End.Type      = END_DEVICE_PATH_TYPE;
+    DevicePaths[Index].End.SubType   = END_ENTIRE_DEVICE_PATH_SUBTYPE;
+    DevicePaths[Index].End.Length[0] = (UINT8)sizeof DevicePaths[Index].End;
+    DevicePaths[Index].End.Length[1] = 0;
+  }
+
+  //
+  // Each handle carries its own slot of Handles as the interface of both
+  // private protocols, so that the interfaces differ.
+  //
+  Start = GetPerformanceCounter ();
+  for (Installed = 0; Installed < PROTOCOL_BENCH_HANDLES; Installed++) {
+    Status = gBS->InstallMultipleProtocolInterfaces (
+                    &Handles[Installed],
+                    &mProtocolBenchGuidA, &Handles[Installed],
+                    &mProtocolBenchGuidB, &Handles[Installed],
+                    &gEfiDevicePathProtocolGuid, &DevicePaths[Installed],
+                    NULL
+                    );
+    if (EFI_ERROR (Status)) {
+      Print (L"InstallMultipleProtocolInterfaces(): %r\n", Status);
+      goto UninstallHandles;
+    }
+  }
+  InstallTime = GetTimeInNanoSecond (GetPerformanceCounter () - Start);
+
+  BufferSize = 0;
+  Status = gBS->LocateHandle (AllHandles, NULL, NULL, &BufferSize, NULL);
+  if (Status != EFI_BUFFER_TOO_SMALL) {
+    Print (L"LocateHandle(): %r\n", Status);
+    goto UninstallHandles;
+  }
+  HandleCount = BufferSize / sizeof (EFI_HANDLE);
+  Buffer = AllocatePool (BufferSize);
+  if (Buffer == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto UninstallHandles;
+  }
+
+  Print (L"%Lu handles, %Lu of them created by the benchmark:\n",
+    (UINT64)HandleCount, (UINT64)PROTOCOL_BENCH_HANDLES);
+  PrintStep (L"InstallMultipleProtocol", PROTOCOL_BENCH_HANDLES,
+    InstallTime);
+
+  Start = GetPerformanceCounter ();
+  for (Round = 0; Round < PROTOCOL_BENCH_ROUNDS; Round++) {
+    for (Index = 0; Index < PROTOCOL_BENCH_HANDLES; Index++) {
+      gBS->OpenProtocol (
+             Handles[Index],
+             &mProtocolBenchGuidB,
+             &Interface,
+             ImageHandle,
+             NULL,
+             EFI_OPEN_PROTOCOL_GET_PROTOCOL
+             );
+    }
+  }
+  PrintStep (
+    L"OpenProtocol GET_PROTOCOL",
+    PROTOCOL_BENCH_ROUNDS * PROTOCOL_BENCH_HANDLES,
+    GetTimeInNanoSecond (GetPerformanceCounter () - Start)
+    );
+
+  Start = GetPerformanceCounter ();
+  for (Round = 0; Round < PROTOCOL_BENCH_ROUNDS; Round++) {
+    for (Index = 0; Index < PROTOCOL_BENCH_HANDLES; Index++) {
+      gBS->OpenProtocol (
+             Handles[Index],
+             &mProtocolBenchGuidA,
+             &Interface,
+             ImageHandle,
+             Handles[Index],
+             EFI_OPEN_PROTOCOL_BY_DRIVER
+             );
+      gBS->CloseProtocol (
+             Handles[Index],
+             &mProtocolBenchGuidA,
+             ImageHandle,
+             Handles[Index]
+             );
+    }
+  }
+  PrintStep (
+    L"OpenProtocol+Close BY_DRIVER",
+    PROTOCOL_BENCH_ROUNDS * PROTOCOL_BENCH_HANDLES,
+    GetTimeInNanoSecond (GetPerformanceCounter () - Start)
+    );
+
+  Start = GetPerformanceCounter ();
+  for (Round = 0; Round < PROTOCOL_BENCH_ROUNDS; Round++) {
+    for (Index = 0; Index < PROTOCOL_BENCH_HANDLES; Index++) {
+      Remaining = &DevicePaths[Index].Bus.Node.Header;
+      Status = gBS->LocateDevicePath (&mProtocolBenchGuidA, &Remaining,
+                      &Device);
+      if (EFI_ERROR (Status) || Device != Handles[Index]) {
+        Print (L"LocateDevicePath(): %r\n", Status);
+        Status = EFI_DEVICE_ERROR;
+        FreePool (Buffer);
+        goto UninstallHandles;
+      }
+    }
+  }
+  PrintStep (
+    L"LocateDevicePath",
+    PROTOCOL_BENCH_ROUNDS * PROTOCOL_BENCH_HANDLES,
+    GetTimeInNanoSecond (GetPerformanceCounter () - Start)
+    );
+
+  Start = GetPerformanceCounter ();
+  for (Round = 0; Round < PROTOCOL_BENCH_ROUNDS; Round++) {
+    BufferSize = HandleCount * sizeof (EFI_HANDLE);
+    gBS->LocateHandle (ByProtocol, &mProtocolBenchGuidA, NULL, &BufferSize,
+           Buffer);
+  }
+  PrintStep (
+    L"LocateHandle ByProtocol",
+    PROTOCOL_BENCH_ROUNDS,
+    GetTimeInNanoSecond (GetPerformanceCounter () - Start)
+    );
+
+  Start = GetPerformanceCounter ();
+  for (Round = 0; Round < PROTOCOL_BENCH_ROUNDS; Round++) {
+    BufferSize = HandleCount * sizeof (EFI_HANDLE);
+    gBS->LocateHandle (AllHandles, NULL, NULL, &BufferSize, Buffer);
+  }
+  PrintStep (
+    L"LocateHandle AllHandles",
+    PROTOCOL_BENCH_ROUNDS,
+    GetTimeInNanoSecond (GetPerformanceCounter () - Start)
+    );
+
+  FreePool (Buffer);
+  Status = EFI_SUCCESS;
+
+UninstallHandles:
+  Start = GetPerformanceCounter ();
+  for (Index = 0; Index < Installed; Index++) {
+    gBS->UninstallMultipleProtocolInterfaces (
+           Handles[Index],
+           &mProtocolBenchGuidA, &Handles[Index],
+           &mProtocolBenchGuidB, &Handles[Index],
+           &gEfiDevicePathProtocolGuid, &DevicePaths[Index],
+           NULL
+           );
+  }
+  if (EFI_ERROR (Status)) {
+    goto FreeHandles;
+  }
+  PrintStep (
+    L"UninstallMultipleProtocol",
+    Installed,
+    GetTimeInNanoSecond (GetPerformanceCounter () - Start)
+    );
+
+  //
+  // Connect-all over the handles of the platform, without the handles of the
+  // benchmark.
+  //
+  Status = gBS->LocateHandleBuffer (AllHandles, NULL, NULL, &HandleCount,
+                  &Buffer);
+  if (EFI_ERROR (Status)) {
+    Print (L"LocateHandleBuffer(): %r\n", Status);
+    goto FreeHandles;
+  }
+  Start = GetPerformanceCounter ();
+  for (Index = 0; Index < HandleCount; Index++) {
+    gBS->ConnectController (Buffer[Index], NULL, NULL, TRUE);
+  }
+  PrintStep (
+    L"ConnectController recursive",
+    HandleCount,
+    GetTimeInNanoSecond (GetPerformanceCounter () - Start)
+    );
+  FreePool (Buffer);
+
+FreeHandles:
+  if (DevicePaths != NULL) {
+    FreePool (DevicePaths);
+  }
+  if (Handles != NULL) {
+    FreePool (Handles);
+  }
+  return Status;
+}
@@ -0,0 +1,192 @@
+/** @file
+  Measure the write throughput of the non-volatile variable store.
+
+  For each of a few data sizes, the application creates a burst of
+  non-volatile variables, rewrites all of them with new contents, rewrites
+  them again with unchanged contents, and deletes them. It reports the time
+  per SetVariable() call, and the data rate, for each step. Every step goes
+  through the variable driver, the fault tolerant write driver and the
+  firmware volume block driver down to the flash device, and the larger
+  bursts make the variable driver reclaim the store. Rewriting unchanged
+  contents measures the path on which the variable driver may skip the
+  write.
+
+  The variables are created under a private vendor GUID, and all of them are
+  deleted before the application exits.
+
+  This program and the accompanying materials
+  are licensed and made available under the terms and conditions of the BSD License
+  which accompanies this distribution.  The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PrintLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiApplicationEntryPoint.h>
+#include <Library/UefiLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+
+#define VARIABLE_WRITE_BENCH_COUNT  32
+
+STATIC EFI_GUID mVariableWriteBenchGuid = {
+  0xd121f8d2, 0x3fa6, 0x4a0c, { 0x82, 0x1b, 0x9f, 0x5a, 0x11, 0x32, 0xfa, 0xb5 }
+};
+
+STATIC CONST UINTN mVariableWriteBenchSizes[] = { 16, 256, 1024, 4096 };
+
+typedef enum {
+  BenchStepCreate,
+  BenchStepUpdate,
+  BenchStepRewrite,
+  BenchStepDelete,
+  BenchStepMax
+} BENCH_STEP;
+
+STATIC CONST CHAR16 *mBenchStepNames[BenchStepMax] = {
+  L"create",
+  L"update",
+  L"rewrite",
+  L"delete"
+};
+
+/**
+  Set or delete the benchmark variables.
+
+  @param[in]  Data      Contents of the variables, or NULL to delete them.
+                        The first byte is replaced with the index of each
+                        variable, so that the variables differ.
+  @param[in]  DataSize  Size of each variable, ignored if Data is NULL.
+  @param[out] Elapsed   Elapsed time in nanoseconds.
+
+  @retval EFI_SUCCESS  All variables have been set or deleted.
+  @return              Error returned by SetVariable().
+**/
+STATIC
+EFI_STATUS
+SetBenchVariables (
+  IN  UINT8   *Data     OPTIONAL,
+  IN  UINTN   DataSize,
+  OUT UINT64  *Elapsed
+  )
+{
+  EFI_STATUS  Status;
+  CHAR16      Name[16];
+  UINTN       Index;
+  UINT64      Start;
+  UINT64      Ticks;
+
+  Ticks = 0;
+  Status = EFI_SUCCESS;
+  for (Index = 0; Index < VARIABLE_WRITE_BENCH_COUNT; Index++) {
+    UnicodeSPrint (Name, sizeof Name, L"Bench%04d", (INT32)Index);
+    if (Data != NULL) {
+      Data[0] = (UINT8)Index;
+    }
+
+    Start = GetPerformanceCounter ();
+    Status = gRT->SetVariable (
+                    Name,
+                    &mVariableWriteBenchGuid,
+                    EFI_VARIABLE_NON_VOLATILE |
+                    EFI_VARIABLE_BOOTSERVICE_ACCESS,
+                    (Data == NULL) ? 0 : DataSize,
+                    Data
+                    );
+    Ticks += GetPerformanceCounter () - Start;
+    if (EFI_ERROR (Status) && !(Data == NULL && Status == EFI_NOT_FOUND)) {
+      break;
+    }
+    Status = EFI_SUCCESS;
+  }
+
+  *Elapsed = GetTimeInNanoSecond (Ticks);
+  return Status;
+}
+
+/**
+  The user Entry Point for Application. The user code starts with this
+  function as the real entry point for the application.
+
+  @param[in] ImageHandle    The firmware allocated handle for the EFI image.
+  @param[in] SystemTable    A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS       The benchmark has run.
+  @retval other             A variable could not be written or deleted.
+
+**/
+EFI_STATUS
+EFIAPI
+UefiMain (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       SizeIndex;
+  UINTN       DataSize;
+  UINT8       *Data;
+  UINT64      Elapsed[BenchStepMax];
+  UINT64      Ignored;
+  UINTN       Step;
+
+  Print (L"%d non-volatile variables per step:\n", VARIABLE_WRITE_BENCH_COUNT);
+
+  Status = EFI_SUCCESS;
+  for (SizeIndex = 0;
+       SizeIndex < ARRAY_SIZE (mVariableWriteBenchSizes);
+       SizeIndex++) {
+    DataSize = mVariableWriteBenchSizes[SizeIndex];
+    Data = AllocatePool (DataSize);
+    if (Data == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      break;
+    }
+    SetMem (Data, DataSize, 0x5A);
+
+    ZeroMem (Elapsed, sizeof Elapsed);
+    Status = SetBenchVariables (Data, DataSize, &Elapsed[BenchStepCreate]);
+    if (!EFI_ERROR (Status)) {
+      SetMem (Data, DataSize, 0xA5);
+      Status = SetBenchVariables (Data, DataSize, &Elapsed[BenchStepUpdate]);
+    }
+    if (!EFI_ERROR (Status)) {
+      Status = SetBenchVariables (Data, DataSize, &Elapsed[BenchStepRewrite]);
+    }
+    if (!EFI_ERROR (Status)) {
+      Status = SetBenchVariables (NULL, 0, &Elapsed[BenchStepDelete]);
+    } else {
+      SetBenchVariables (NULL, 0, &Ignored);
+    }
+    FreePool (Data);
+
+    if (EFI_ERROR (Status)) {
+      Print (L"%Lu bytes: SetVariable(): %r\n", (UINT64)DataSize, Status);
+      break;
+    }
+
+    for (Step = 0; Step < BenchStepMax; Step++) {
+      Print (L"%5Lu bytes %-7s: %8Lu us/call",
+        (UINT64)DataSize, mBenchStepNames[Step],
+        DivU64x32 (Elapsed[Step], 1000 * VARIABLE_WRITE_BENCH_COUNT));
+      if (Step != BenchStepDelete && Elapsed[Step] > 0) {
+        Print (L", %8Lu KB/s",
+          DivU64x64Remainder (
+            MultU64x64 (DataSize * VARIABLE_WRITE_BENCH_COUNT, 1000000),
+            Elapsed[Step],
+            NULL
+            ));
+      }
+      Print (L"\n");
+    }
+  }
+
+  return Status;
+}
@@ -61,6 +61,16 @@ LIST_ENTRY  mFvHandleList = INITIALIZE_LIST_HEAD_VARIABLE (mFvHandleList);
 //
 EFI_LOCK  mDispatcherLock = EFI_INITIALIZE_LOCK_VARIABLE (TPL_HIGH_LEVEL);
 
+//
+// Reverse index from the GUIDs pushed by the DEPEXes and not installed yet,
+// to the drivers waiting for them. List of EFI_CORE_DEPEX_WAIT hashed by GUID.
+// mDepexWakeups counts the protocol installations seen by the index.
+//
+#define DEPEX_WAIT_INDEX_BUCKETS  64
+LIST_ENTRY  mDepexWaitIndex[DEPEX_WAIT_INDEX_BUCKETS];
+BOOLEAN     mDepexWaitIndexReady = FALSE;
+UINTN       mDepexWakeups = 0;
+
 
 //
 // Flag for the DXE Dispacher.  TRUE if dispatcher is execuing.
@@ -289,6 +299,8 @@ CoreGetDepexSectionAndPreProccess (
     DriverEntry->DepexProtocolError = FALSE;
   }
 
+  DriverEntry->DepexPending = TRUE;
+
   return Status;
 }
 
@@ -331,6 +343,7 @@ CoreSchedule (
       CoreAcquireDispatcherLock ();
       DriverEntry->Unrequested  = FALSE;
       DriverEntry->Dependent    = TRUE;
+      DriverEntry->DepexPending = TRUE;
       CoreReleaseDispatcherLock ();
 
       DEBUG ((DEBUG_DISPATCH, "Schedule FFS(%g) - EFI_SUCCESS\n", DriverName));
@@ -391,6 +404,222 @@ CoreTrust (
   return EFI_NOT_FOUND;
 }
 
+
+/**
+  Return the list of mDepexWaitIndex holding the waits for a GUID.
+
+  @param  Guid                  The GUID.
+
+  @return The list head.
+
+**/
+STATIC
+LIST_ENTRY *
+CoreGetDepexWaitBucket (
+  IN EFI_GUID  *Guid
+  )
+{
+  return &mDepexWaitIndex[ReadUnaligned32 ((UINT32 *) Guid) % DEPEX_WAIT_INDEX_BUCKETS];
+}
+
+
+/**
+  Find the GUIDs that the DEPEX of a driver pushes and that were not found
+  installed when it was evaluated.
+
+  @param  DriverEntry           The driver.
+  @param  DepexWait             If not NULL, receives the GUIDs.
+
+  @return The number of GUIDs.
+
+**/
+STATIC
+UINTN
+CoreGetDepexWaitGuids (
+  IN  EFI_CORE_DRIVER_ENTRY  *DriverEntry,
+  OUT EFI_CORE_DEPEX_WAIT    *DepexWait OPTIONAL
+  )
+{
+  UINT8  *Iterator;
+  UINT8  *End;
+  UINTN  Count;
+
+  Count    = 0;
+  Iterator = DriverEntry->Depex;
+  End      = Iterator + DriverEntry->DepexSize;
+  while (Iterator < End && *Iterator != EFI_DEP_END) {
+    switch (*Iterator) {
+    case EFI_DEP_PUSH:
+      if ((UINTN) (End - Iterator) <= sizeof (EFI_GUID)) {
+        return Count;
+      }
+      if (DepexWait != NULL) {
+        DepexWait[Count].Guid = (EFI_GUID *) (Iterator + 1);
+      }
+      Count++;
+      Iterator += sizeof (EFI_GUID);
+      break;
+
+    case EFI_DEP_BEFORE:
+    case EFI_DEP_AFTER:
+    case EFI_DEP_REPLACE_TRUE:
+      //
+      // The GUID is found installed, or it is not a protocol
+      //
+      Iterator += sizeof (EFI_GUID);
+      break;
+
+    default:
+      break;
+    }
+    Iterator++;
+  }
+
+  return Count;
+}
+
+
+/**
+  Remove a driver from the DEPEX wait index.
+  The mDispatcherLock must be owned.
+
+  @param  DriverEntry           The driver.
+
+**/
+STATIC
+VOID
+CoreDepexUnwait (
+  IN EFI_CORE_DRIVER_ENTRY  *DriverEntry
+  )
+{
+  UINTN  Index;
+
+  ASSERT_LOCKED (&mDispatcherLock);
+
+  for (Index = 0; Index < DriverEntry->DepexWaitCount; Index++) {
+    RemoveEntryList (&DriverEntry->DepexWait[Index].Link);
+  }
+  DriverEntry->DepexWaitCount = 0;
+}
+
+
+/**
+  Park a driver whose DEPEX just evaluated to FALSE in the DEPEX wait index,
+  so that it is only evaluated again once one of the GUIDs it pushes and
+  that were missing gets installed.
+
+  The evaluation result can only change when such a GUID appears: the
+  pushed GUIDs found installed were replaced by EFI_DEP_REPLACE_TRUE.
+
+  @param  DriverEntry           The driver.
+  @param  Wakeups               mDepexWakeups before the DEPEX was evaluated.
+
+**/
+STATIC
+VOID
+CoreDepexWait (
+  IN EFI_CORE_DRIVER_ENTRY  *DriverEntry,
+  IN UINTN                  Wakeups
+  )
+{
+  EFI_CORE_DEPEX_WAIT  *DepexWait;
+  UINTN                Count;
+  UINTN                Index;
+
+  //
+  // A driver without a DEPEX waits for all the architectural protocols, and
+  // the DEPEX of a driver may not have been read yet. Evaluate those in every
+  // round of the dispatcher, as before.
+  //
+  if (DriverEntry->Depex == NULL || DriverEntry->DepexProtocolError) {
+    return;
+  }
+
+  ASSERT (DriverEntry->DepexWaitCount == 0);
+
+  Count = CoreGetDepexWaitGuids (DriverEntry, NULL);
+  if (Count > DriverEntry->DepexWaitMax) {
+    DepexWait = AllocateZeroPool (Count * sizeof (EFI_CORE_DEPEX_WAIT));
+    if (DepexWait == NULL) {
+      return;
+    }
+    if (DriverEntry->DepexWait != NULL) {
+      FreePool (DriverEntry->DepexWait);
+    }
+    DriverEntry->DepexWait    = DepexWait;
+    DriverEntry->DepexWaitMax = Count;
+  }
+  CoreGetDepexWaitGuids (DriverEntry, DriverEntry->DepexWait);
+
+  CoreAcquireDispatcherLock ();
+
+  //
+  // If a protocol was installed since the DEPEX was evaluated, it may be one
+  // of the GUIDs, so keep the driver for the next round.
+  //
+  if (Wakeups == mDepexWakeups) {
+    for (Index = 0; Index < Count; Index++) {
+      DepexWait = &DriverEntry->DepexWait[Index];
+      DepexWait->Signature   = EFI_CORE_DEPEX_WAIT_SIGNATURE;
+      DepexWait->DriverEntry = DriverEntry;
+      InsertTailList (CoreGetDepexWaitBucket (DepexWait->Guid), &DepexWait->Link);
+    }
+    DriverEntry->DepexWaitCount = Count;
+    DriverEntry->DepexPending   = FALSE;
+  }
+
+  CoreReleaseDispatcherLock ();
+}
+
+
+/**
+  Make the dispatcher evaluate again the DEPEX of the drivers waiting for a
+  protocol, as it has just been installed.
+
+  @param  Protocol              The protocol installed.
+
+**/
+VOID
+CoreNotifyDepexWaiters (
+  IN EFI_GUID  *Protocol
+  )
+{
+  LIST_ENTRY             *Bucket;
+  LIST_ENTRY             *Link;
+  EFI_CORE_DEPEX_WAIT    *DepexWait;
+  EFI_CORE_DRIVER_ENTRY  *DriverEntry;
+
+  if (!mDepexWaitIndexReady) {
+    return;
+  }
+
+  CoreAcquireDispatcherLock ();
+
+  mDepexWakeups++;
+
+  Bucket = CoreGetDepexWaitBucket (Protocol);
+  Link   = Bucket->ForwardLink;
+  while (Link != Bucket) {
+    DepexWait = CR (Link, EFI_CORE_DEPEX_WAIT, Link, EFI_CORE_DEPEX_WAIT_SIGNATURE);
+    if (!CompareGuid (DepexWait->Guid, Protocol)) {
+      Link = Link->ForwardLink;
+      continue;
+    }
+
+    //
+    // Waking the driver removes all its waits, possibly more of this list
+    //
+    DriverEntry = DepexWait->DriverEntry;
+    CoreDepexUnwait (DriverEntry);
+    DriverEntry->DepexPending = TRUE;
+    DriverEntry->DepexWakeups++;
+    Link = Bucket->ForwardLink;
+  }
+
+  CoreReleaseDispatcherLock ();
+}
+
+
 /**
   This is the main Dispatcher for DXE and it exits when there are no more
   drivers to run. Drain the mScheduledQueue and load and start a PE
@@ -417,6 +646,11 @@ CoreDispatcher (
   EFI_CORE_DRIVER_ENTRY           *DriverEntry;
   BOOLEAN                         ReadyToRun;
   EFI_EVENT                       DxeDispatchEvent;
+  UINTN                           Wakeups;
+  UINTN                           Dispatched;
+  UINTN                           Evaluations;
+  UINTN                           Skipped;
+  UINT64                          WaitTime;
 
   PERF_FUNCTION_BEGIN ();
 
@@ -441,6 +675,9 @@ CoreDispatcher (
     return Status;
   }
 
+  Dispatched   = 0;
+  Evaluations  = 0;
+  Skipped      = 0;
   ReturnStatus = EFI_NOT_FOUND;
   do {
     //
@@ -511,6 +748,21 @@ CoreDispatcher (
 
       CoreReleaseDispatcherLock ();
 
+      //
+      // The system time only advances in timer ticks, and only once the Timer
+      // Architectural Protocol is installed; earlier waits are reported as 0.
+      //
+      WaitTime = CoreCurrentSystemTime () - DriverEntry->DiscoveredTime;
+      DEBUG ((
+        DEBUG_DISPATCH,
+        "Dispatch FFS(%g) waited %Lu us, %Lu DEPEX evaluations, %Lu wakeups\n",
+        &DriverEntry->FileName,
+        DivU64x32 (WaitTime, 10),
+        (UINT64) DriverEntry->DepexEvaluations,
+        (UINT64) DriverEntry->DepexWakeups
+        ));
+      Dispatched++;
+
 
       if (DriverEntry->IsFvImage) {
         //
@@ -563,9 +815,23 @@ CoreDispatcher (
       }
 
       if (DriverEntry->Dependent) {
+        if (!DriverEntry->DepexPending) {
+          //
+          // None of the GUIDs the DEPEX waits for has been installed since it
+          // evaluated to FALSE
+          //
+          Skipped++;
+          continue;
+        }
+
+        Wakeups = mDepexWakeups;
+        DriverEntry->DepexEvaluations++;
+        Evaluations++;
         if (CoreIsSchedulable (DriverEntry)) {
           CoreInsertOnScheduledQueueWhileProcessingBeforeAndAfter (DriverEntry);
           ReadyToRun = TRUE;
+        } else {
+          CoreDepexWait (DriverEntry, Wakeups);
         }
       } else {
         if (DriverEntry->Unrequested) {
@@ -577,6 +843,14 @@ CoreDispatcher (
     }
   } while (ReadyToRun);
 
+  DEBUG ((
+    DEBUG_DISPATCH,
+    "CoreDispatcher: %Lu drivers dispatched, %Lu DEPEX evaluations, %Lu skipped\n",
+    (UINT64) Dispatched,
+    (UINT64) Evaluations,
+    (UINT64) Skipped
+    ));
+
   //
   // Close DXE dispatch Event
   //
@@ -894,6 +1168,8 @@ CoreAddToDriverList (
 
   CoreGetDepexSectionAndPreProccess (DriverEntry);
 
+  DriverEntry->DiscoveredTime = CoreCurrentSystemTime ();
+
   CoreAcquireDispatcherLock ();
 
   InsertTailList (&mDiscoveredList, &DriverEntry->Link);
@@ -1455,8 +1731,15 @@ CoreInitializeDispatcher (
   VOID
   )
 {
+  UINTN  Index;
+
   PERF_FUNCTION_BEGIN ();
 
+  for (Index = 0; Index < DEPEX_WAIT_INDEX_BUCKETS; Index++) {
+    InitializeListHead (&mDepexWaitIndex[Index]);
+  }
+  mDepexWaitIndexReady = TRUE;
+
   mFwVolEvent = EfiCreateProtocolNotifyEvent (
                   &gEfiFirmwareVolume2ProtocolGuid,
                   TPL_CALLBACK,
@@ -1484,11 +1767,15 @@ CoreDisplayDiscoveredNotDispatched (
 {
   LIST_ENTRY                    *Link;
   EFI_CORE_DRIVER_ENTRY         *DriverEntry;
+  UINTN                         Index;
 
   for (Link = mDiscoveredList.ForwardLink;Link !=&mDiscoveredList; Link = Link->ForwardLink) {
     DriverEntry = CR(Link, EFI_CORE_DRIVER_ENTRY, Link, EFI_CORE_DRIVER_ENTRY_SIGNATURE);
     if (DriverEntry->Dependent) {
       DEBUG ((DEBUG_LOAD, "Driver %g was discovered but not loaded!!\n", &DriverEntry->FileName));
+      for (Index = 0; Index < DriverEntry->DepexWaitCount; Index++) {
+        DEBUG ((DEBUG_LOAD, "  waiting for %g\n", DriverEntry->DepexWait[Index].Guid));
+      }
     }
   }
 }
@@ -143,8 +143,19 @@ typedef struct {
 } KNOWN_HANDLE;
 
 
-#define EFI_CORE_DRIVER_ENTRY_SIGNATURE SIGNATURE_32('d','r','v','r')
+//
+// A GUID pushed by the DEPEX of a driver, not installed yet
+//
+#define EFI_CORE_DEPEX_WAIT_SIGNATURE SIGNATURE_32('d','p','w','t')
 typedef struct {
+  UINTN                           Signature;
+  LIST_ENTRY                      Link;             // mDepexWaitIndex
+  EFI_GUID                        *Guid;            // in the DEPEX
+  struct _EFI_CORE_DRIVER_ENTRY   *DriverEntry;
+} EFI_CORE_DEPEX_WAIT;
+
+#define EFI_CORE_DRIVER_ENTRY_SIGNATURE SIGNATURE_32('d','r','v','r')
+typedef struct _EFI_CORE_DRIVER_ENTRY {
   UINTN                           Signature;
   LIST_ENTRY                      Link;             // mDriverList
 
@@ -172,6 +183,18 @@ typedef struct {
   EFI_HANDLE                      ImageHandle;
   BOOLEAN                         IsFvImage;
 
+  //
+  // The DEPEX is only evaluated again once a GUID in DepexWait is installed
+  //
+  BOOLEAN                         DepexPending;
+  EFI_CORE_DEPEX_WAIT             *DepexWait;
+  UINTN                           DepexWaitCount;
+  UINTN                           DepexWaitMax;
+
+  UINT64                          DiscoveredTime;   // system time, in 100ns units
+  UINTN                           DepexEvaluations;
+  UINTN                           DepexWakeups;
+
 } EFI_CORE_DRIVER_ENTRY;
 
 //
@@ -310,6 +333,17 @@ CoreInitializePool (
   VOID
   );
 
+/**
+  Dumps the statistics of all the pools: the pages each one holds, and for
+  each block size the pages the blocks span, the blocks in use, on the free
+  list and kept for reuse, and how many allocations were served.
+
+**/
+VOID
+CoreDumpPoolStatistics (
+  VOID
+  );
+
 
 /**
   Called to initialize the memory map and add descriptors to
@@ -478,6 +512,18 @@ CoreTimerTick (
   );
 
 
+/**
+  Returns the current system time.
+
+  @return The current system time
+
+**/
+UINT64
+CoreCurrentSystemTime (
+  VOID
+  );
+
+
 /**
   Initialize the dispatcher. Initialize the notification function that runs when
   an FV2 protocol is added to the system.
@@ -2166,6 +2212,19 @@ CoreDisplayMissingArchProtocols (
   );
 
 
+/**
+  Make the dispatcher evaluate again the DEPEX of the drivers waiting for a
+  protocol, as it has just been installed.
+
+  @param  Protocol              The protocol installed.
+
+**/
+VOID
+CoreNotifyDepexWaiters (
+  IN EFI_GUID  *Protocol
+  );
+
+
 /**
   Traverse the discovered list for any drivers that were discovered but not loaded
   because the dependency experessions evaluated to false.
@@ -752,6 +752,10 @@ CoreExitBootServices (
   //
   gTimer->SetTimerPeriod (gTimer, 0);
 
+  DEBUG_CODE (
+    CoreDumpPoolStatistics ();
+  );
+
   //
   // Terminate memory services if the MapKey matches
   //
@@ -21,11 +21,21 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 // gHandleList           - A list of all the handles in the system
 // gProtocolDatabaseLock - Lock to protect the mProtocolDatabase
 // gHandleDatabaseKey    -  The Key to show that the handle has been created/modified
+// mHandleHashTable      - gHandleList hashed by handle value, for validation
+// mProtocolHashTable    - mProtocolDatabase hashed by protocol GUID
 //
 LIST_ENTRY      mProtocolDatabase     = INITIALIZE_LIST_HEAD_VARIABLE (mProtocolDatabase);
 LIST_ENTRY      gHandleList           = INITIALIZE_LIST_HEAD_VARIABLE (gHandleList);
 EFI_LOCK        gProtocolDatabaseLock = EFI_INITIALIZE_LOCK_VARIABLE (TPL_NOTIFY);
 UINT64          gHandleDatabaseKey    = 0;
+IHANDLE         *mHandleHashTable[HANDLE_HASH_BUCKETS];
+PROTOCOL_ENTRY  *mProtocolHashTable[PROTOCOL_HASH_BUCKETS];
+
+//
+// Handles are pool allocations, so the low bits carry no information.
+//
+#define HANDLE_HASH(Handle) \
+  ((((UINTN) (Handle) >> 3) ^ ((UINTN) (Handle) >> 12)) & (HANDLE_HASH_BUCKETS - 1))
 
 
 
@@ -57,9 +67,70 @@ CoreReleaseProtocolLock (
 
 
 
+/**
+  Add a new handle to gHandleList and to the handle hash table.
+  The gProtocolDatabaseLock must be owned
+
+  @param  Handle                 The handle to add
+
+**/
+STATIC
+VOID
+CoreInsertHandle (
+  IN IHANDLE        *Handle
+  )
+{
+  UINTN               Bucket;
+
+  ASSERT_LOCKED(&gProtocolDatabaseLock);
+
+  InsertTailList (&gHandleList, &Handle->AllHandles);
+
+  Bucket = HANDLE_HASH (Handle);
+  Handle->HashNext = mHandleHashTable[Bucket];
+  mHandleHashTable[Bucket] = Handle;
+}
+
+
+
+/**
+  Remove a handle from gHandleList and from the handle hash table.
+  The gProtocolDatabaseLock must be owned
+
+  @param  Handle                 The handle to remove
+
+**/
+STATIC
+VOID
+CoreRemoveHandle (
+  IN IHANDLE        *Handle
+  )
+{
+  IHANDLE             **Next;
+
+  ASSERT_LOCKED(&gProtocolDatabaseLock);
+
+  RemoveEntryList (&Handle->AllHandles);
+
+  for (Next = &mHandleHashTable[HANDLE_HASH (Handle)];
+       *Next != NULL;
+       Next = &(*Next)->HashNext) {
+    if (*Next == Handle) {
+      *Next = Handle->HashNext;
+      return;
+    }
+  }
+  ASSERT (FALSE);
+}
+
+
+
 /**
   Check whether a handle is a valid EFI_HANDLE
 
+  The handle is looked up by value in the handle hash table; it is never
+  dereferenced unless it is found there.
+
   @param  UserHandle             The handle to check
 
   @retval EFI_INVALID_PARAMETER  The handle is NULL or not a valid EFI_HANDLE.
@@ -72,15 +143,16 @@ CoreValidateHandle (
   )
 {
   IHANDLE             *Handle;
-  LIST_ENTRY          *Link;
 
   if (UserHandle == NULL) {
     return EFI_INVALID_PARAMETER;
   }
 
-  for (Link = gHandleList.BackLink; Link != &gHandleList; Link = Link->BackLink) {
-    Handle = CR (Link, IHANDLE, AllHandles, EFI_HANDLE_SIGNATURE);
+  for (Handle = mHandleHashTable[HANDLE_HASH (UserHandle)];
+       Handle != NULL;
+       Handle = Handle->HashNext) {
     if (Handle == (IHANDLE *) UserHandle) {
+      ASSERT_IS_HANDLE (Handle);
       return EFI_SUCCESS;
     }
   }
@@ -90,6 +162,33 @@ CoreValidateHandle (
 
 
 
+/**
+  Compute the protocol hash table bucket of a protocol GUID.
+
+  @param  Protocol               The ID of the protocol
+
+  @return Index into mProtocolHashTable
+
+**/
+STATIC
+UINTN
+CoreProtocolHash (
+  IN CONST EFI_GUID   *Protocol
+  )
+{
+  UINT32              Hash;
+
+  Hash = ReadUnaligned32 ((CONST UINT32 *) Protocol) ^
+         ReadUnaligned32 ((CONST UINT32 *) Protocol + 1) ^
+         ReadUnaligned32 ((CONST UINT32 *) Protocol + 2) ^
+         ReadUnaligned32 ((CONST UINT32 *) Protocol + 3);
+  Hash ^= Hash >> 16;
+  Hash ^= Hash >> 8;
+  return Hash & (PROTOCOL_HASH_BUCKETS - 1);
+}
+
+
+
 /**
   Finds the protocol entry for the requested protocol.
   The gProtocolDatabaseLock must be owned
@@ -106,9 +205,9 @@ CoreFindProtocolEntry (
   IN BOOLEAN    Create
   )
 {
-  LIST_ENTRY          *Link;
   PROTOCOL_ENTRY      *Item;
   PROTOCOL_ENTRY      *ProtEntry;
+  UINTN               Bucket;
 
   ASSERT_LOCKED(&gProtocolDatabaseLock);
 
@@ -117,11 +216,10 @@ CoreFindProtocolEntry (
   //
 
   ProtEntry = NULL;
-  for (Link = mProtocolDatabase.ForwardLink;
-       Link != &mProtocolDatabase;
-       Link = Link->ForwardLink) {
+  Bucket = CoreProtocolHash (Protocol);
+  for (Item = mProtocolHashTable[Bucket]; Item != NULL; Item = Item->HashNext) {
 
-    Item = CR(Link, PROTOCOL_ENTRY, AllEntries, PROTOCOL_ENTRY_SIGNATURE);
+    ASSERT (Item->Signature == PROTOCOL_ENTRY_SIGNATURE);
     if (CompareGuid (&Item->ProtocolID, Protocol)) {
 
       //
@@ -153,6 +251,8 @@ CoreFindProtocolEntry (
       // Add it to protocol database
       //
       InsertTailList (&mProtocolDatabase, &ProtEntry->AllEntries);
+      ProtEntry->HashNext = mProtocolHashTable[Bucket];
+      mProtocolHashTable[Bucket] = ProtEntry;
     }
   }
 
@@ -432,7 +532,7 @@ CoreInstallProtocolInterfaceNotify (
     // Add this handle to the list global list of all handles
     // in the system
     //
-    InsertTailList (&gHandleList, &Handle->AllHandles);
+    CoreInsertHandle (Handle);
   } else {
     Status = CoreValidateHandle (Handle);
     if (EFI_ERROR (Status)) {
@@ -472,6 +572,12 @@ CoreInstallProtocolInterfaceNotify (
   //
   InsertTailList (&ProtEntry->Protocols, &Prot->ByProtocol);
 
+  if (CompareGuid (&ProtEntry->ProtocolID, &gEfiDevicePathProtocolGuid)) {
+    CoreDevicePathIndexInsert (Prot);
+  }
+
+  CoreNotifyDepexWaiters (&ProtEntry->ProtocolID);
+
   //
   // Notify the notification list for this protocol
   //
@@ -793,8 +899,8 @@ CoreUninstallProtocolInterface (
   // If there are no more handlers for the handle, free the handle
   //
   if (IsListEmpty (&Handle->Protocols)) {
+    CoreRemoveHandle (Handle);
     Handle->Signature = 0;
-    RemoveEntryList (&Handle->AllHandles);
     CoreFreePool (Handle);
   }
 
@@ -18,10 +18,16 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 
 #define EFI_HANDLE_SIGNATURE            SIGNATURE_32('h','n','d','l')
 
+///
+/// Number of buckets in the handle and protocol hash tables; powers of two.
+///
+#define HANDLE_HASH_BUCKETS             512
+#define PROTOCOL_HASH_BUCKETS           128
+
 ///
 /// IHANDLE - contains a list of protocol handles
 ///
-typedef struct {
+typedef struct _IHANDLE {
   UINTN               Signature;
   /// All handles list of IHANDLE
   LIST_ENTRY          AllHandles;
@@ -30,6 +36,8 @@ typedef struct {
   UINTN               LocateRequest;
   /// The Handle Database Key value when this handle was last created or modified
   UINT64              Key;
+  /// Next handle in the same bucket of the handle hash table
+  struct _IHANDLE     *HashNext;
 } IHANDLE;
 
 #define ASSERT_IS_HANDLE(a)  ASSERT((a)->Signature == EFI_HANDLE_SIGNATURE)
@@ -41,7 +49,7 @@ typedef struct {
 /// database.  Each handler that supports this protocol is listed, along
 /// with a list of registered notifies.
 ///
-typedef struct {
+typedef struct _PROTOCOL_ENTRY {
   UINTN               Signature;
   /// Link Entry inserted to mProtocolDatabase
   LIST_ENTRY          AllEntries;
@@ -51,9 +59,41 @@ typedef struct {
   LIST_ENTRY          Protocols;
   /// Registerd notification handlers
   LIST_ENTRY          Notify;
+  /// Next entry in the same bucket of the protocol hash table
+  struct _PROTOCOL_ENTRY *HashNext;
 } PROTOCOL_ENTRY;
 
 
+#define DEVICE_PATH_INDEX_NODE_SIGNATURE  SIGNATURE_32('d','p','i','n')
+
+///
+/// Number of buckets in the device path index hash table; a power of two.
+///
+#define DEVICE_PATH_INDEX_HASH_BUCKETS  1024
+
+///
+/// DEVICE_PATH_INDEX_NODE - one node of the device path index, a trie of the
+/// device path protocol interfaces installed on handles. The path from the
+/// root to a node spells a device path; the device path protocol interfaces
+/// equal to that device path are listed on the node. The nodes are copies
+/// taken at install or reinstall time, not references to the interfaces.
+///
+typedef struct _DEVICE_PATH_INDEX_NODE {
+  UINTN                           Signature;
+  /// The node one device path node shorter; NULL for the root
+  struct _DEVICE_PATH_INDEX_NODE  *Parent;
+  /// Next node in the same bucket of the hash table, keyed by Parent and Node
+  struct _DEVICE_PATH_INDEX_NODE  *HashNext;
+  UINTN                           Hash;
+  /// Number of children, plus number of entries in Interfaces
+  UINTN                           References;
+  /// PROTOCOL_INTERFACE's whose device path ends at this node
+  LIST_ENTRY                      Interfaces;
+  /// Copy of the device path node, Node.Length bytes in size
+  EFI_DEVICE_PATH_PROTOCOL        Node;
+} DEVICE_PATH_INDEX_NODE;
+
+
 #define PROTOCOL_INTERFACE_SIGNATURE  SIGNATURE_32('p','i','f','c')
 
 ///
@@ -75,6 +115,11 @@ typedef struct {
   /// OPEN_PROTOCOL_DATA list
   LIST_ENTRY                  OpenList;
   UINTN                       OpenListCount;
+  /// Device path protocol only: the device path index node of Interface,
+  /// NULL if Interface is not indexed
+  DEVICE_PATH_INDEX_NODE      *IndexNode;
+  /// Link on DEVICE_PATH_INDEX_NODE.Interfaces
+  LIST_ENTRY                  IndexLink;
 
 } PROTOCOL_INTERFACE;
 
@@ -177,6 +222,33 @@ CoreRemoveInterfaceFromProtocol (
   );
 
 
+/**
+  Add a device path protocol interface to the device path index.
+  The gProtocolDatabaseLock must be owned
+
+  @param  Prot                   The device path protocol interface, installed
+                                 on its handle.
+
+**/
+VOID
+CoreDevicePathIndexInsert (
+  IN PROTOCOL_INTERFACE   *Prot
+  );
+
+
+/**
+  Remove a protocol interface from the device path index, if it is there.
+  The gProtocolDatabaseLock must be owned
+
+  @param  Prot                   The protocol interface.
+
+**/
+VOID
+CoreDevicePathIndexRemove (
+  IN PROTOCOL_INTERFACE   *Prot
+  );
+
+
 /**
   Connects a controller to a driver.
 
@@ -20,6 +20,32 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 //
 UINTN mEfiLocateHandleRequest = 0;
 
+//
+// mDevicePathIndexRoot       - Root of the device path index, the empty device path
+// mDevicePathIndexHash       - Non-root device path index nodes, hashed by parent and node
+// mDevicePathIndexIncomplete - An interface could not be indexed; stop using the index
+//
+// The index holds copies of the device path nodes, taken when the device path
+// protocol interface is installed or reinstalled. Every handle the index
+// yields is compared against its live device path interface, and
+// CoreLocateDevicePath() falls back to the linear scan if that comparison
+// fails, or if more than one handle matches at the same depth. A device path
+// changed in place, without ReinstallProtocolInterface(), so that it newly
+// matches a search is still missed; the UEFI specification does not allow
+// changing a device path protocol instance in place.
+//
+DEVICE_PATH_INDEX_NODE  mDevicePathIndexRoot = {
+  DEVICE_PATH_INDEX_NODE_SIGNATURE,
+  NULL,
+  NULL,
+  0,
+  0,
+  INITIALIZE_LIST_HEAD_VARIABLE (mDevicePathIndexRoot.Interfaces),
+  { END_DEVICE_PATH_TYPE, END_ENTIRE_DEVICE_PATH_SUBTYPE, { END_DEVICE_PATH_LENGTH, 0 } }
+};
+DEVICE_PATH_INDEX_NODE  *mDevicePathIndexHash[DEVICE_PATH_INDEX_HASH_BUCKETS];
+BOOLEAN                 mDevicePathIndexIncomplete = FALSE;
+
 //
 // Internal prototypes
 //
@@ -405,6 +431,347 @@ CoreGetNextLocateByProtocol (
 }
 
 
+/**
+  Compute the device path index hash of a device path node below a parent.
+
+  @param  Parent                 The parent index node.
+  @param  Node                   The device path node.
+
+  @return The hash value.
+
+**/
+STATIC
+UINTN
+CoreDevicePathIndexHash (
+  IN CONST DEVICE_PATH_INDEX_NODE    *Parent,
+  IN CONST EFI_DEVICE_PATH_PROTOCOL  *Node
+  )
+{
+  CONST UINT8   *Byte;
+  UINTN         Length;
+  UINT32        Hash;
+
+  //
+  // FNV-1a over the parent pointer and the node bytes.
+  //
+  Hash = 0x811c9dc5 ^ (UINT32) ((UINTN) Parent >> 3);
+  Byte = (CONST UINT8 *) Node;
+  for (Length = DevicePathNodeLength (Node); Length > 0; Length--) {
+    Hash = (Hash ^ *Byte++) * 0x01000193;
+  }
+  return Hash;
+}
+
+
+/**
+  Find the child of a device path index node for a device path node.
+  The gProtocolDatabaseLock must be owned
+
+  @param  Parent                 The parent index node.
+  @param  Node                   The device path node.
+  @param  Hash                   CoreDevicePathIndexHash (Parent, Node).
+
+  @return The child index node, or NULL if there is none.
+
+**/
+STATIC
+DEVICE_PATH_INDEX_NODE *
+CoreDevicePathIndexFindChild (
+  IN CONST DEVICE_PATH_INDEX_NODE    *Parent,
+  IN CONST EFI_DEVICE_PATH_PROTOCOL  *Node,
+  IN UINTN                           Hash
+  )
+{
+  DEVICE_PATH_INDEX_NODE  *Child;
+  UINTN                   Length;
+
+  Length = DevicePathNodeLength (Node);
+  for (Child = mDevicePathIndexHash[Hash & (DEVICE_PATH_INDEX_HASH_BUCKETS - 1)];
+       Child != NULL;
+       Child = Child->HashNext) {
+    if (Child->Hash == Hash &&
+        Child->Parent == Parent &&
+        DevicePathNodeLength (&Child->Node) == Length &&
+        CompareMem (&Child->Node, Node, Length) == 0) {
+      return Child;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+  Free the index nodes, from IndexNode towards the root, that are no longer
+  referenced.
+  The gProtocolDatabaseLock must be owned
+
+  @param  IndexNode              The index node to start with.
+
+**/
+STATIC
+VOID
+CoreDevicePathIndexPrune (
+  IN DEVICE_PATH_INDEX_NODE  *IndexNode
+  )
+{
+  DEVICE_PATH_INDEX_NODE  *Parent;
+  DEVICE_PATH_INDEX_NODE  **Next;
+
+  while (IndexNode != &mDevicePathIndexRoot && IndexNode->References == 0) {
+    ASSERT (IsListEmpty (&IndexNode->Interfaces));
+
+    for (Next = &mDevicePathIndexHash[IndexNode->Hash & (DEVICE_PATH_INDEX_HASH_BUCKETS - 1)];
+         *Next != IndexNode;
+         Next = &(*Next)->HashNext) {
+      ASSERT (*Next != NULL);
+    }
+    *Next = IndexNode->HashNext;
+
+    Parent = IndexNode->Parent;
+    ASSERT (Parent->References > 0);
+    Parent->References--;
+
+    IndexNode->Signature = 0;
+    CoreFreePool (IndexNode);
+    IndexNode = Parent;
+  }
+}
+
+
+/**
+  Add a device path protocol interface to the device path index.
+  The gProtocolDatabaseLock must be owned
+
+  The nodes of the device path are copied into the index, so later changes
+  to the interface in place are not seen until it is reinstalled.
+
+  @param  Prot                   The device path protocol interface, installed
+                                 on its handle.
+
+**/
+VOID
+CoreDevicePathIndexInsert (
+  IN PROTOCOL_INTERFACE   *Prot
+  )
+{
+  EFI_DEVICE_PATH_PROTOCOL  *DevicePath;
+  DEVICE_PATH_INDEX_NODE    *IndexNode;
+  DEVICE_PATH_INDEX_NODE    *Child;
+  UINTN                     Hash;
+  UINTN                     Length;
+
+  ASSERT_LOCKED (&gProtocolDatabaseLock);
+  ASSERT (Prot->IndexNode == NULL);
+
+  if (mDevicePathIndexIncomplete) {
+    return;
+  }
+
+  //
+  // CoreLocateDevicePath() never matched malformed device paths, so they
+  // need not be indexed.
+  //
+  DevicePath = Prot->Interface;
+  if (DevicePath == NULL || !IsDevicePathValid (DevicePath, 0)) {
+    return;
+  }
+
+  IndexNode = &mDevicePathIndexRoot;
+  for (; !IsDevicePathEnd (DevicePath); DevicePath = NextDevicePathNode (DevicePath)) {
+    Hash = CoreDevicePathIndexHash (IndexNode, DevicePath);
+    Child = CoreDevicePathIndexFindChild (IndexNode, DevicePath, Hash);
+    if (Child == NULL) {
+      Length = DevicePathNodeLength (DevicePath);
+      Child = AllocatePool (OFFSET_OF (DEVICE_PATH_INDEX_NODE, Node) + Length);
+      if (Child == NULL) {
+        DEBUG ((DEBUG_WARN, "%a: out of resources, no longer using the index\n",
+          __FUNCTION__));
+        mDevicePathIndexIncomplete = TRUE;
+        CoreDevicePathIndexPrune (IndexNode);
+        return;
+      }
+      Child->Signature  = DEVICE_PATH_INDEX_NODE_SIGNATURE;
+      Child->Parent     = IndexNode;
+      Child->Hash       = Hash;
+      Child->References = 0;
+      InitializeListHead (&Child->Interfaces);
+      CopyMem (&Child->Node, DevicePath, Length);
+
+      Child->HashNext = mDevicePathIndexHash[Hash & (DEVICE_PATH_INDEX_HASH_BUCKETS - 1)];
+      mDevicePathIndexHash[Hash & (DEVICE_PATH_INDEX_HASH_BUCKETS - 1)] = Child;
+      IndexNode->References++;
+    }
+    IndexNode = Child;
+  }
+
+  InsertTailList (&IndexNode->Interfaces, &Prot->IndexLink);
+  IndexNode->References++;
+  Prot->IndexNode = IndexNode;
+}
+
+
+/**
+  Remove a protocol interface from the device path index, if it is there.
+  The gProtocolDatabaseLock must be owned
+
+  @param  Prot                   The protocol interface.
+
+**/
+VOID
+CoreDevicePathIndexRemove (
+  IN PROTOCOL_INTERFACE   *Prot
+  )
+{
+  DEVICE_PATH_INDEX_NODE  *IndexNode;
+
+  ASSERT_LOCKED (&gProtocolDatabaseLock);
+
+  IndexNode = Prot->IndexNode;
+  if (IndexNode == NULL) {
+    return;
+  }
+
+  RemoveEntryList (&Prot->IndexLink);
+  Prot->IndexNode = NULL;
+
+  ASSERT (IndexNode->References > 0);
+  IndexNode->References--;
+  CoreDevicePathIndexPrune (IndexNode);
+}
+
+
+/**
+  Find the handle with the longest device path that is a prefix of
+  SourcePath and that supports Protocol, by walking the device path index
+  along SourcePath.
+
+  @param  Protocol               The protocol to search for.
+  @param  SourcePath             The device path to match.
+  @param  SourceSize             Size of the first instance of SourcePath,
+                                 without the end node.
+  @param  Device                 The matching handle.
+  @param  MatchSize              The size of the device path of Device,
+                                 without the end node.
+
+  @retval EFI_SUCCESS            A matching handle was found.
+  @retval EFI_NOT_FOUND          No handles match the search.
+  @retval EFI_UNSUPPORTED        The device path index cannot be used, a
+                                 handle's live device path no longer matches
+                                 the index, or several handles have the same
+                                 matching device path.
+
+**/
+STATIC
+EFI_STATUS
+CoreDevicePathIndexLookup (
+  IN  EFI_GUID                  *Protocol,
+  IN  EFI_DEVICE_PATH_PROTOCOL  *SourcePath,
+  IN  UINTN                     SourceSize,
+  OUT EFI_HANDLE                *Device,
+  OUT UINTN                     *MatchSize
+  )
+{
+  EFI_STATUS                Status;
+  PROTOCOL_ENTRY            *ProtEntry;
+  DEVICE_PATH_INDEX_NODE    *IndexNode;
+  EFI_DEVICE_PATH_PROTOCOL  *Node;
+  UINTN                     Offset;
+  LIST_ENTRY                *Link;
+  LIST_ENTRY                *ProtLink;
+  PROTOCOL_INTERFACE        *DevicePathProt;
+  PROTOCOL_INTERFACE        *Prot;
+  IHANDLE                   *Handle;
+  IHANDLE                   *Candidate;
+  UINTN                     Candidates;
+
+  CoreAcquireProtocolLock ();
+
+  if (mDevicePathIndexIncomplete) {
+    Status = EFI_UNSUPPORTED;
+    goto Done;
+  }
+
+  Status = EFI_NOT_FOUND;
+  ProtEntry = CoreFindProtocolEntry (Protocol, FALSE);
+  if (ProtEntry == NULL) {
+    goto Done;
+  }
+
+  IndexNode = &mDevicePathIndexRoot;
+  Node = SourcePath;
+  Offset = 0;
+  for (;;) {
+    //
+    // Which handles with this device path support the protocol?
+    //
+    Candidate = NULL;
+    Candidates = 0;
+    for (Link = IndexNode->Interfaces.ForwardLink;
+         Link != &IndexNode->Interfaces;
+         Link = Link->ForwardLink) {
+      DevicePathProt = CR (Link, PROTOCOL_INTERFACE, IndexLink, PROTOCOL_INTERFACE_SIGNATURE);
+      Handle = DevicePathProt->Handle;
+      for (ProtLink = Handle->Protocols.ForwardLink;
+           ProtLink != &Handle->Protocols;
+           ProtLink = ProtLink->ForwardLink) {
+        Prot = CR (ProtLink, PROTOCOL_INTERFACE, Link, PROTOCOL_INTERFACE_SIGNATURE);
+        if (Prot->Protocol == ProtEntry) {
+          break;
+        }
+      }
+      if (ProtLink == &Handle->Protocols) {
+        continue;
+      }
+
+      //
+      // The live interface must still be the device path that was indexed,
+      // otherwise the index is stale and the linear scan has to decide.
+      //
+      if (GetDevicePathSize (DevicePathProt->Interface) !=
+            Offset + END_DEVICE_PATH_LENGTH ||
+          CompareMem (DevicePathProt->Interface, SourcePath, Offset) != 0) {
+        Status = EFI_UNSUPPORTED;
+        goto Done;
+      }
+      Candidate = Handle;
+      Candidates++;
+    }
+
+    //
+    // Duplicate device paths are left to the linear scan, which asserts on
+    // them and breaks the tie by the order of the handles.
+    //
+    if (Candidates > 1) {
+      Status = EFI_UNSUPPORTED;
+      goto Done;
+    }
+    if (Candidates == 1) {
+      *Device = Candidate;
+      *MatchSize = Offset;
+      Status = EFI_SUCCESS;
+    }
+
+    if (Offset >= SourceSize) {
+      break;
+    }
+    IndexNode = CoreDevicePathIndexFindChild (
+                  IndexNode,
+                  Node,
+                  CoreDevicePathIndexHash (IndexNode, Node)
+                  );
+    if (IndexNode == NULL) {
+      break;
+    }
+    Offset += DevicePathNodeLength (Node);
+    Node = NextDevicePathNode (Node);
+  }
+
+Done:
+  CoreReleaseProtocolLock ();
+  return Status;
+}
+
+
 /**
   Locates the handle to a device on the device path that supports the specified protocol.
 
@@ -466,6 +833,26 @@ CoreLocateDevicePath (
 
   SourceSize = (UINTN) TmpDevicePath - (UINTN) SourcePath;
 
+  //
+  // Prefer the device path index, which costs O(SourcePath length) rather
+  // than O(number of handles). It finds the device paths as they were when
+  // they were installed or last reinstalled, and checks the handles it
+  // yields against their live device paths.
+  //
+  Status = CoreDevicePathIndexLookup (Protocol, SourcePath, (UINTN) SourceSize,
+             &BestDevice, &Index);
+  if (Status == EFI_NOT_FOUND) {
+    return EFI_NOT_FOUND;
+  }
+  if (!EFI_ERROR (Status)) {
+    if (Device == NULL) {
+      return  EFI_INVALID_PARAMETER;
+    }
+    *Device = BestDevice;
+    *DevicePath = (EFI_DEVICE_PATH_PROTOCOL *) (((UINT8 *) SourcePath) + Index);
+    return EFI_SUCCESS;
+  }
+
   //
   // Get a list of all handles that support the requested protocol
   //
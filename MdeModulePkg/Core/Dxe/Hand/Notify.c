@@ -85,6 +85,7 @@ CoreRemoveInterfaceFromProtocol (
     // Remove the protocol interface entry
     //
     RemoveEntryList (&Prot->ByProtocol);
+    CoreDevicePathIndexRemove (Prot);
   }
 
   return Prot;
@@ -256,6 +257,10 @@ CoreReinstallProtocolInterface (
   //
   InsertTailList (&ProtEntry->Protocols, &Prot->ByProtocol);
 
+  if (CompareGuid (&ProtEntry->ProtocolID, &gEfiDevicePathProtocolGuid)) {
+    CoreDevicePathIndexInsert (Prot);
+  }
+
   //
   // Update the Key to show that the handle has been created/modified
   //
@@ -36,7 +36,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 //
 
 #define MEMORY_MAP_SIGNATURE   SIGNATURE_32('m','m','a','p')
-typedef struct {
+typedef struct _MEMORY_MAP {
   UINTN           Signature;
   LIST_ENTRY      Link;
   BOOLEAN         FromPages;
@@ -47,6 +47,15 @@ typedef struct {
 
   UINT64          VirtualStart;
   UINT64          Attribute;
+
+  //
+  // Address index of gMemoryMap: a treap keyed by Start, where every node
+  // also records the largest free (EfiConventionalMemory) entry of its subtree
+  //
+  struct _MEMORY_MAP  *Left;
+  struct _MEMORY_MAP  *Right;
+  UINT32              Priority;
+  UINT64              MaxFreeBytes;
 } MEMORY_MAP;
 
 //
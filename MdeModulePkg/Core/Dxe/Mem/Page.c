@@ -50,6 +50,11 @@ UINTN         mFreeMapStack = 0;
 ///
 LIST_ENTRY   mFreeMemoryMapEntryList = INITIALIZE_LIST_HEAD_VARIABLE (mFreeMemoryMapEntryList);
 BOOLEAN      mMemoryTypeInformationInitialized = FALSE;
+///
+/// mMemoryMapIndex - root of the address index of all the entries in gMemoryMap
+///
+MEMORY_MAP   *mMemoryMapIndex = NULL;
+UINT32       mMemoryMapIndexSeed = 0x2545F491;
 
 EFI_MEMORY_TYPE_STATISTICS mMemoryTypeStatistics[EfiMaxMemoryType + 1] = {
   { 0, MAX_ADDRESS, 0, 0, EfiMaxMemoryType, TRUE,  FALSE },  // EfiReservedMemoryType
@@ -125,6 +130,380 @@ CoreReleaseMemoryLock (
 }
 
 
+/**
+  Internal function.  Returns the number of free bytes an entry contributes
+  to the memory map index.
+
+  @param  Entry                  The memory map entry
+
+  @return The size of Entry if it is EfiConventionalMemory, otherwise 0.
+
+**/
+STATIC
+UINT64
+MemoryMapIndexFreeBytes (
+  IN MEMORY_MAP  *Entry
+  )
+{
+  if (Entry->Type != EfiConventionalMemory) {
+    return 0;
+  }
+  return Entry->End - Entry->Start + 1;
+}
+
+/**
+  Internal function.  Recomputes MaxFreeBytes of an index node from the node
+  and its children.
+
+  @param  Entry                  The index node
+
+**/
+STATIC
+VOID
+UpdateMemoryMapIndexNode (
+  IN OUT MEMORY_MAP  *Entry
+  )
+{
+  UINT64  MaxFreeBytes;
+
+  MaxFreeBytes = MemoryMapIndexFreeBytes (Entry);
+  if (Entry->Left != NULL && Entry->Left->MaxFreeBytes > MaxFreeBytes) {
+    MaxFreeBytes = Entry->Left->MaxFreeBytes;
+  }
+  if (Entry->Right != NULL && Entry->Right->MaxFreeBytes > MaxFreeBytes) {
+    MaxFreeBytes = Entry->Right->MaxFreeBytes;
+  }
+  Entry->MaxFreeBytes = MaxFreeBytes;
+}
+
+/**
+  Internal function.  Inserts an entry into an index subtree.
+
+  @param  Root                   The root of the subtree, may be NULL
+  @param  Entry                  The entry to insert
+
+  @return The new root of the subtree.
+
+**/
+STATIC
+MEMORY_MAP *
+InsertMemoryMapIndexNode (
+  IN MEMORY_MAP  *Root,
+  IN MEMORY_MAP  *Entry
+  )
+{
+  MEMORY_MAP  *Pivot;
+
+  if (Root == NULL) {
+    return Entry;
+  }
+
+  if (Entry->Start < Root->Start) {
+    Root->Left = InsertMemoryMapIndexNode (Root->Left, Entry);
+    if (Root->Left->Priority > Root->Priority) {
+      Pivot       = Root->Left;
+      Root->Left  = Pivot->Right;
+      Pivot->Right = Root;
+      UpdateMemoryMapIndexNode (Root);
+      Root = Pivot;
+    }
+  } else {
+    ASSERT (Entry->Start > Root->Start);
+    Root->Right = InsertMemoryMapIndexNode (Root->Right, Entry);
+    if (Root->Right->Priority > Root->Priority) {
+      Pivot       = Root->Right;
+      Root->Right = Pivot->Left;
+      Pivot->Left = Root;
+      UpdateMemoryMapIndexNode (Root);
+      Root = Pivot;
+    }
+  }
+
+  UpdateMemoryMapIndexNode (Root);
+  return Root;
+}
+
+/**
+  Internal function.  Joins two index subtrees, all the entries of Left being
+  below all the entries of Right.
+
+  @param  Left                   The lower subtree, may be NULL
+  @param  Right                  The upper subtree, may be NULL
+
+  @return The root of the joined subtree.
+
+**/
+STATIC
+MEMORY_MAP *
+JoinMemoryMapIndexNodes (
+  IN MEMORY_MAP  *Left,
+  IN MEMORY_MAP  *Right
+  )
+{
+  if (Left == NULL) {
+    return Right;
+  }
+  if (Right == NULL) {
+    return Left;
+  }
+
+  if (Left->Priority > Right->Priority) {
+    Left->Right = JoinMemoryMapIndexNodes (Left->Right, Right);
+    UpdateMemoryMapIndexNode (Left);
+    return Left;
+  }
+
+  Right->Left = JoinMemoryMapIndexNodes (Left, Right->Left);
+  UpdateMemoryMapIndexNode (Right);
+  return Right;
+}
+
+/**
+  Internal function.  Removes an entry from an index subtree.
+
+  @param  Root                   The root of the subtree
+  @param  Entry                  The entry to remove, which must be in the
+                                 subtree
+
+  @return The new root of the subtree.
+
+**/
+STATIC
+MEMORY_MAP *
+RemoveMemoryMapIndexNode (
+  IN MEMORY_MAP  *Root,
+  IN MEMORY_MAP  *Entry
+  )
+{
+  ASSERT (Root != NULL);
+
+  if (Root == Entry) {
+    return JoinMemoryMapIndexNodes (Entry->Left, Entry->Right);
+  }
+
+  if (Entry->Start < Root->Start) {
+    Root->Left = RemoveMemoryMapIndexNode (Root->Left, Entry);
+  } else {
+    Root->Right = RemoveMemoryMapIndexNode (Root->Right, Entry);
+  }
+
+  UpdateMemoryMapIndexNode (Root);
+  return Root;
+}
+
+/**
+  Internal function.  Adds an entry of gMemoryMap to the address index.
+  The Start, End and Type of the entry must not change while it is indexed.
+
+  @param  Entry                  The entry to add
+
+**/
+STATIC
+VOID
+InsertMemoryMapIndex (
+  IN OUT MEMORY_MAP  *Entry
+  )
+{
+  //
+  // xorshift32, the priorities only have to look random to the treap
+  //
+  mMemoryMapIndexSeed ^= mMemoryMapIndexSeed << 13;
+  mMemoryMapIndexSeed ^= mMemoryMapIndexSeed >> 17;
+  mMemoryMapIndexSeed ^= mMemoryMapIndexSeed << 5;
+
+  Entry->Left     = NULL;
+  Entry->Right    = NULL;
+  Entry->Priority = mMemoryMapIndexSeed;
+  UpdateMemoryMapIndexNode (Entry);
+
+  mMemoryMapIndex = InsertMemoryMapIndexNode (mMemoryMapIndex, Entry);
+}
+
+/**
+  Internal function.  Removes an entry of gMemoryMap from the address index.
+
+  @param  Entry                  The entry to remove
+
+**/
+STATIC
+VOID
+RemoveMemoryMapIndex (
+  IN OUT MEMORY_MAP  *Entry
+  )
+{
+  mMemoryMapIndex = RemoveMemoryMapIndexNode (mMemoryMapIndex, Entry);
+  Entry->Left  = NULL;
+  Entry->Right = NULL;
+}
+
+/**
+  Internal function.  Finds the entry of gMemoryMap with the highest start
+  address not above Address.
+
+  @param  Address                The address to look up
+
+  @return The entry, which covers Address if its End is not below Address,
+          or NULL if all the entries start above Address.
+
+**/
+STATIC
+MEMORY_MAP *
+FindMemoryMapEntry (
+  IN UINT64  Address
+  )
+{
+  MEMORY_MAP  *Node;
+  MEMORY_MAP  *Floor;
+
+  Floor = NULL;
+  Node  = mMemoryMapIndex;
+  while (Node != NULL) {
+    if (Node->Start <= Address) {
+      Floor = Node;
+      Node  = Node->Right;
+    } else {
+      Node  = Node->Left;
+    }
+  }
+  return Floor;
+}
+
+/**
+  Internal function.  Finds the entry of gMemoryMap with the lowest start
+  address above Address.
+
+  @param  Address                The address to look up
+
+  @return The entry, or NULL if no entry starts above Address.
+
+**/
+STATIC
+MEMORY_MAP *
+FindNextMemoryMapEntry (
+  IN UINT64  Address
+  )
+{
+  MEMORY_MAP  *Node;
+  MEMORY_MAP  *Ceiling;
+
+  Ceiling = NULL;
+  Node    = mMemoryMapIndex;
+  while (Node != NULL) {
+    if (Node->Start > Address) {
+      Ceiling = Node;
+      Node    = Node->Left;
+    } else {
+      Node    = Node->Right;
+    }
+  }
+  return Ceiling;
+}
+
+/**
+  Internal function.  Checks an index subtree in address order.
+
+  @param  Node                   The root of the subtree, may be NULL
+  @param  Previous               The last entry checked so far, updated
+  @param  Count                  Number of entries checked so far, updated
+
+  @retval TRUE                   The subtree is consistent.
+  @retval FALSE                  The subtree is corrupted.
+
+**/
+STATIC
+BOOLEAN
+CheckMemoryMapIndexNode (
+  IN     MEMORY_MAP  *Node,
+  IN OUT MEMORY_MAP  **Previous,
+  IN OUT UINTN       *Count
+  )
+{
+  MEMORY_MAP  Expected;
+
+  if (Node == NULL) {
+    return TRUE;
+  }
+
+  if (!CheckMemoryMapIndexNode (Node->Left, Previous, Count)) {
+    return FALSE;
+  }
+
+  if (Node->Signature != MEMORY_MAP_SIGNATURE ||
+      (Node->Start & EFI_PAGE_MASK) != 0 ||
+      ((Node->End + 1) & EFI_PAGE_MASK) != 0 ||
+      Node->End < Node->Start) {
+    DEBUG ((DEBUG_ERROR, "MemoryMapIndex: bad entry %p %lx-%lx\n", Node, Node->Start, Node->End));
+    return FALSE;
+  }
+  if (*Previous != NULL && (*Previous)->End >= Node->Start) {
+    DEBUG ((DEBUG_ERROR, "MemoryMapIndex: %lx-%lx overlaps or is out of order with %lx-%lx\n",
+      Node->Start, Node->End, (*Previous)->Start, (*Previous)->End));
+    return FALSE;
+  }
+  if ((Node->Left != NULL && Node->Left->Priority > Node->Priority) ||
+      (Node->Right != NULL && Node->Right->Priority > Node->Priority)) {
+    DEBUG ((DEBUG_ERROR, "MemoryMapIndex: %lx-%lx breaks the heap order\n", Node->Start, Node->End));
+    return FALSE;
+  }
+  CopyMem (&Expected, Node, sizeof (Expected));
+  UpdateMemoryMapIndexNode (&Expected);
+  if (Expected.MaxFreeBytes != Node->MaxFreeBytes) {
+    DEBUG ((DEBUG_ERROR, "MemoryMapIndex: %lx-%lx has a stale free size %lx, expected %lx\n",
+      Node->Start, Node->End, Node->MaxFreeBytes, Expected.MaxFreeBytes));
+    return FALSE;
+  }
+
+  *Previous = Node;
+  *Count += 1;
+
+  return CheckMemoryMapIndexNode (Node->Right, Previous, Count);
+}
+
+/**
+  Internal function.  Checks that the address index holds exactly the entries
+  of gMemoryMap, that the entries do not overlap, and that the treap order and
+  the free sizes recorded in the index are right.
+
+  @retval TRUE                   The memory map and its index are consistent.
+  @retval FALSE                  The memory map or its index is corrupted.
+
+**/
+STATIC
+BOOLEAN
+CheckMemoryMapIndex (
+  VOID
+  )
+{
+  LIST_ENTRY  *Link;
+  MEMORY_MAP  *Entry;
+  MEMORY_MAP  *Previous;
+  UINTN       MapCount;
+  UINTN       IndexCount;
+
+  ASSERT_LOCKED (&gMemoryLock);
+
+  MapCount = 0;
+  for (Link = gMemoryMap.ForwardLink; Link != &gMemoryMap; Link = Link->ForwardLink) {
+    Entry = CR (Link, MEMORY_MAP, Link, MEMORY_MAP_SIGNATURE);
+    if (FindMemoryMapEntry (Entry->Start) != Entry) {
+      DEBUG ((DEBUG_ERROR, "MemoryMapIndex: %lx-%lx is not indexed\n", Entry->Start, Entry->End));
+      return FALSE;
+    }
+    MapCount++;
+  }
+
+  Previous   = NULL;
+  IndexCount = 0;
+  if (!CheckMemoryMapIndexNode (mMemoryMapIndex, &Previous, &IndexCount)) {
+    return FALSE;
+  }
+  if (IndexCount != MapCount) {
+    DEBUG ((DEBUG_ERROR, "MemoryMapIndex: %Lu entries indexed, %Lu in the map\n", (UINT64) IndexCount, (UINT64) MapCount));
+    return FALSE;
+  }
+
+  return TRUE;
+}
 
 
 /**
@@ -169,7 +548,6 @@ CoreAddRange (
   IN UINT64                   Attribute
   )
 {
-  LIST_ENTRY        *Link;
   MEMORY_MAP        *Entry;
 
   ASSERT ((Start & EFI_PAGE_MASK) == 0);
@@ -215,32 +593,26 @@ CoreAddRange (
   //
 
   // Two memory descriptors can only be merged if they have the same Type
-  // and the same Attribute
+  // and the same Attribute. As descriptors never overlap, only the ones
+  // right below and right above the range can be adjoining.
   //
 
-  Link = gMemoryMap.ForwardLink;
-  while (Link != &gMemoryMap) {
-    Entry = CR (Link, MEMORY_MAP, Link, MEMORY_MAP_SIGNATURE);
-    Link  = Link->ForwardLink;
-
-    if (Entry->Type != Type) {
-      continue;
-    }
-
-    if (Entry->Attribute != Attribute) {
-      continue;
-    }
-
-    if (Entry->End + 1 == Start) {
+  Entry = (Start == 0) ? NULL : FindMemoryMapEntry (Start - 1);
+  if (Entry != NULL && Entry->End + 1 == Start &&
+      Entry->Type == Type && Entry->Attribute == Attribute) {
 
-      Start = Entry->Start;
-      RemoveMemoryMapEntry (Entry);
+    Start = Entry->Start;
+    RemoveMemoryMapIndex (Entry);
+    RemoveMemoryMapEntry (Entry);
+  }
 
-    } else if (Entry->Start == End + 1) {
+  Entry = (End == MAX_UINT64) ? NULL : FindMemoryMapEntry (End + 1);
+  if (Entry != NULL && Entry->Start == End + 1 &&
+      Entry->Type == Type && Entry->Attribute == Attribute) {
 
-      End = Entry->End;
-      RemoveMemoryMapEntry (Entry);
-    }
+    End = Entry->End;
+    RemoveMemoryMapIndex (Entry);
+    RemoveMemoryMapEntry (Entry);
   }
 
   //
@@ -255,6 +627,7 @@ CoreAddRange (
   mMapStack[mMapDepth].VirtualStart  = 0;
   mMapStack[mMapDepth].Attribute     = Attribute;
   InsertTailList (&gMemoryMap, &mMapStack[mMapDepth].Link);
+  InsertMemoryMapIndex (&mMapStack[mMapDepth]);
 
   mMapDepth += 1;
   ASSERT (mMapDepth < MAX_MAP_DEPTH);
@@ -364,21 +737,23 @@ CoreFreeMemoryMapStack (
       //
       RemoveEntryList (&mMapStack[mMapDepth].Link);
       mMapStack[mMapDepth].Link.ForwardLink = NULL;
+      RemoveMemoryMapIndex (&mMapStack[mMapDepth]);
 
       CopyMem (Entry , &mMapStack[mMapDepth], sizeof (MEMORY_MAP));
       Entry->FromPages = TRUE;
 
       //
-      // Find insertion location
+      // Find insertion location: the entries from pages are kept in address
+      // order, so insert before the first of them above this one
       //
-      for (Link2 = gMemoryMap.ForwardLink; Link2 != &gMemoryMap; Link2 = Link2->ForwardLink) {
-        Entry2 = CR (Link2, MEMORY_MAP, Link, MEMORY_MAP_SIGNATURE);
-        if (Entry2->FromPages && Entry2->Start > Entry->Start) {
-          break;
-        }
+      Entry2 = FindNextMemoryMapEntry (Entry->Start);
+      while (Entry2 != NULL && !Entry2->FromPages) {
+        Entry2 = FindNextMemoryMapEntry (Entry2->Start);
       }
+      Link2 = (Entry2 == NULL) ? &gMemoryMap : &Entry2->Link;
 
       InsertTailList (Link2, &Entry->Link);
+      InsertMemoryMapIndex (Entry);
 
     } else {
       //
@@ -742,7 +1117,6 @@ CoreConvertPagesEx (
   UINT64          RangeEnd;
   UINT64          Attribute;
   EFI_MEMORY_TYPE MemType;
-  LIST_ENTRY      *Link;
   MEMORY_MAP      *Entry;
 
   Entry = NULL;
@@ -768,15 +1142,9 @@ CoreConvertPagesEx (
     //
     // Find the entry that the covers the range
     //
-    for (Link = gMemoryMap.ForwardLink; Link != &gMemoryMap; Link = Link->ForwardLink) {
-      Entry = CR (Link, MEMORY_MAP, Link, MEMORY_MAP_SIGNATURE);
+    Entry = FindMemoryMapEntry (Start);
 
-      if (Entry->Start <= Start && Entry->End > Start) {
-        break;
-      }
-    }
-
-    if (Link == &gMemoryMap) {
+    if (Entry == NULL || Entry->End <= Start) {
       DEBUG ((DEBUG_ERROR | DEBUG_PAGE, "ConvertPages: failed to find range %lx - %lx\n", Start, End));
       return EFI_NOT_FOUND;
     }
@@ -850,8 +1218,11 @@ CoreConvertPagesEx (
     }
 
     //
-    // Pull range out of descriptor
+    // Pull range out of descriptor. Its Start or End changes, so take it out
+    // of the index until it is final.
     //
+    RemoveMemoryMapIndex (Entry);
+
     if (Entry->Start == Start) {
 
       //
@@ -888,6 +1259,7 @@ CoreConvertPagesEx (
 
       Entry->End = Start - 1;
       ASSERT (Entry->Start < Entry->End);
+      InsertMemoryMapIndex (Entry);
 
       Entry = &mMapStack[mMapDepth];
       InsertTailList (&gMemoryMap, &Entry->Link);
@@ -914,6 +1286,8 @@ CoreConvertPagesEx (
     if (Entry->Start == Entry->End + 1) {
       RemoveMemoryMapEntry (Entry);
       Entry = NULL;
+    } else {
+      InsertMemoryMapIndex (Entry);
     }
 
     //
@@ -1014,6 +1388,157 @@ CoreUpdateMemoryAttributes (
 }
 
 
+/**
+  Internal function. Finds the highest free page range in one descriptor.
+
+  @param  Entry                  The memory map entry
+  @param  MaxAddress             The address that the range must be below,
+                                 the last byte of a page
+  @param  MinAddress             The address that the range must be above
+  @param  NumberOfBytes          Number of bytes needed
+  @param  Alignment              Bits to align with
+  @param  NeedGuard              Flag to indicate Guard page is needed or not
+
+  @return The last address of the range, or 0 if the range was not found
+
+**/
+STATIC
+UINT64
+CoreFindFreePagesInEntry (
+  IN MEMORY_MAP       *Entry,
+  IN UINT64           MaxAddress,
+  IN UINT64           MinAddress,
+  IN UINT64           NumberOfBytes,
+  IN UINTN            Alignment,
+  IN BOOLEAN          NeedGuard
+  )
+{
+  UINT64          DescStart;
+  UINT64          DescEnd;
+  UINT64          DescNumberOfBytes;
+
+  //
+  // If it's not a free entry, don't bother with it
+  //
+  if (Entry->Type != EfiConventionalMemory) {
+    return 0;
+  }
+
+  DescStart = Entry->Start;
+  DescEnd = Entry->End;
+
+  //
+  // If desc is past max allowed address or below min allowed address, skip it
+  //
+  if ((DescStart >= MaxAddress) || (DescEnd < MinAddress)) {
+    return 0;
+  }
+
+  //
+  // If desc ends past max allowed address, clip the end
+  //
+  if (DescEnd >= MaxAddress) {
+    DescEnd = MaxAddress;
+  }
+
+  DescEnd = ((DescEnd + 1) & (~(Alignment - 1))) - 1;
+
+  // Skip if DescEnd is less than DescStart after alignment clipping
+  if (DescEnd < DescStart) {
+    return 0;
+  }
+
+  //
+  // Compute the number of bytes we can used from this
+  // descriptor, and see it's enough to satisfy the request
+  //
+  DescNumberOfBytes = DescEnd - DescStart + 1;
+
+  if (DescNumberOfBytes < NumberOfBytes) {
+    return 0;
+  }
+
+  //
+  // If the start of the allocated range is below the min address allowed, skip it
+  //
+  if ((DescEnd - NumberOfBytes + 1) < MinAddress) {
+    return 0;
+  }
+
+  if (NeedGuard) {
+    DescEnd = AdjustMemoryS (
+                DescEnd + 1 - DescNumberOfBytes,
+                DescNumberOfBytes,
+                NumberOfBytes
+                );
+  }
+
+  return DescEnd;
+}
+
+
+/**
+  Internal function. Finds the highest free page range in an index subtree.
+
+  As descriptors do not overlap, the first descriptor that can hold the range
+  when walking down from MaxAddress also holds the highest possible range, so
+  the walk stops there. Subtrees without a large enough free descriptor, and
+  subtrees outside of [MinAddress, MaxAddress], are not visited.
+
+  @param  Node                   The root of the subtree, may be NULL
+  @param  MaxAddress             The address that the range must be below,
+                                 the last byte of a page
+  @param  MinAddress             The address that the range must be above
+  @param  NumberOfBytes          Number of bytes needed
+  @param  Alignment              Bits to align with
+  @param  NeedGuard              Flag to indicate Guard page is needed or not
+
+  @return The last address of the range, or 0 if the range was not found
+
+**/
+STATIC
+UINT64
+CoreFindFreePagesInIndex (
+  IN MEMORY_MAP       *Node,
+  IN UINT64           MaxAddress,
+  IN UINT64           MinAddress,
+  IN UINT64           NumberOfBytes,
+  IN UINTN            Alignment,
+  IN BOOLEAN          NeedGuard
+  )
+{
+  UINT64          Target;
+
+  if (Node == NULL || Node->MaxFreeBytes < NumberOfBytes) {
+    return 0;
+  }
+
+  if (Node->Start < MaxAddress) {
+    Target = CoreFindFreePagesInIndex (Node->Right, MaxAddress, MinAddress,
+               NumberOfBytes, Alignment, NeedGuard);
+    if (Target != 0) {
+      return Target;
+    }
+
+    Target = CoreFindFreePagesInEntry (Node, MaxAddress, MinAddress,
+               NumberOfBytes, Alignment, NeedGuard);
+    if (Target != 0) {
+      return Target;
+    }
+  }
+
+  //
+  // Everything in the left subtree ends below Node->Start
+  //
+  if (Node->Start <= MinAddress) {
+    return 0;
+  }
+
+  return CoreFindFreePagesInIndex (Node->Left, MaxAddress, MinAddress,
+           NumberOfBytes, Alignment, NeedGuard);
+}
+
+
 /**
   Internal function. Finds a consecutive free page range below
   the requested address.
@@ -1041,11 +1566,6 @@ CoreFindFreePagesI (
 {
   UINT64          NumberOfBytes;
   UINT64          Target;
-  UINT64          DescStart;
-  UINT64          DescEnd;
-  UINT64          DescNumberOfBytes;
-  LIST_ENTRY      *Link;
-  MEMORY_MAP      *Entry;
 
   if ((MaxAddress < EFI_PAGE_MASK) ||(NumberOfPages == 0)) {
     return 0;
@@ -1074,75 +1594,8 @@ CoreFindFreePagesI (
   }
 
   NumberOfBytes = LShiftU64 (NumberOfPages, EFI_PAGE_SHIFT);
-  Target = 0;
-
-  for (Link = gMemoryMap.ForwardLink; Link != &gMemoryMap; Link = Link->ForwardLink) {
-    Entry = CR (Link, MEMORY_MAP, Link, MEMORY_MAP_SIGNATURE);
-
-    //
-    // If it's not a free entry, don't bother with it
-    //
-    if (Entry->Type != EfiConventionalMemory) {
-      continue;
-    }
-
-    DescStart = Entry->Start;
-    DescEnd = Entry->End;
-
-    //
-    // If desc is past max allowed address or below min allowed address, skip it
-    //
-    if ((DescStart >= MaxAddress) || (DescEnd < MinAddress)) {
-      continue;
-    }
-
-    //
-    // If desc ends past max allowed address, clip the end
-    //
-    if (DescEnd >= MaxAddress) {
-      DescEnd = MaxAddress;
-    }
-
-    DescEnd = ((DescEnd + 1) & (~(Alignment - 1))) - 1;
-
-    // Skip if DescEnd is less than DescStart after alignment clipping
-    if (DescEnd < DescStart) {
-      continue;
-    }
-
-    //
-    // Compute the number of bytes we can used from this
-    // descriptor, and see it's enough to satisfy the request
-    //
-    DescNumberOfBytes = DescEnd - DescStart + 1;
-
-    if (DescNumberOfBytes >= NumberOfBytes) {
-      //
-      // If the start of the allocated range is below the min address allowed, skip it
-      //
-      if ((DescEnd - NumberOfBytes + 1) < MinAddress) {
-        continue;
-      }
-
-      //
-      // If this is the best match so far remember it
-      //
-      if (DescEnd > Target) {
-        if (NeedGuard) {
-          DescEnd = AdjustMemoryS (
-                      DescEnd + 1 - DescNumberOfBytes,
-                      DescNumberOfBytes,
-                      NumberOfBytes
-                      );
-          if (DescEnd == 0) {
-            continue;
-          }
-        }
-
-        Target = DescEnd;
-      }
-    }
-  }
+  Target = CoreFindFreePagesInIndex (mMemoryMapIndex, MaxAddress, MinAddress,
+             NumberOfBytes, Alignment, NeedGuard);
 
   //
   // If this is a grow down, adjust target to be the allocation base
@@ -1454,7 +1907,6 @@ CoreInternalFreePages (
   )
 {
   EFI_STATUS      Status;
-  LIST_ENTRY      *Link;
   MEMORY_MAP      *Entry;
   UINTN           Alignment;
   BOOLEAN         IsGuarded;
@@ -1468,14 +1920,8 @@ CoreInternalFreePages (
   // Find the entry that the covers the range
   //
   IsGuarded = FALSE;
-  Entry = NULL;
-  for (Link = gMemoryMap.ForwardLink; Link != &gMemoryMap; Link = Link->ForwardLink) {
-    Entry = CR(Link, MEMORY_MAP, Link, MEMORY_MAP_SIGNATURE);
-    if (Entry->Start <= Memory && Entry->End > Memory) {
-        break;
-    }
-  }
-  if (Link == &gMemoryMap) {
+  Entry = FindMemoryMapEntry (Memory);
+  if (Entry == NULL || Entry->End <= Memory) {
     Status = EFI_NOT_FOUND;
     goto Done;
   }
@@ -1733,6 +2179,10 @@ CoreGetMemoryMap (
 
   CoreAcquireMemoryLock ();
 
+  DEBUG_CODE (
+    ASSERT (CheckMemoryMapIndex ());
+  );
+
   //
   // Compute the buffer size needed to fit the entire map
   //
@@ -2032,6 +2482,10 @@ CoreTerminateMemoryMap (
 
   if (MapKey == mMemoryMapKey) {
 
+    DEBUG_CODE (
+      ASSERT (CheckMemoryMapIndex ());
+    );
+
     //
     // Make sure the memory map is following all the construction rules
     // This is the last chance we will be able to display any messages on
@@ -28,6 +28,7 @@ typedef struct {
 
 #define POOL_HEAD_SIGNATURE       SIGNATURE_32('p','h','d','0')
 #define POOLPAGE_HEAD_SIGNATURE   SIGNATURE_32('p','h','d','1')
+#define POOL_CACHED_SIGNATURE     SIGNATURE_32('p','m','g','0')
 typedef struct {
   UINT32          Signature;
   UINT32          Reserved;
@@ -66,17 +67,43 @@ STATIC CONST UINT16 mPoolSizeTable[] = {
 
 #define MAX_POOL_SIZE     (MAX_ADDRESS - POOL_OVERHEAD)
 
+//
+// All the pool sizes are multiples of POOL_SIZE_UNIT, so a size is mapped to
+// its list through the list of its number of units
+//
+#define POOL_SIZE_UNIT_SHIFT  7
+#define POOL_SIZE_UNIT        (1 << POOL_SIZE_UNIT_SHIFT)
+#define POOL_SIZE_UNITS       ((29824 >> POOL_SIZE_UNIT_SHIFT) + 1)
+
+//
+// Number of freed blocks of each list that a pool keeps to serve the next
+// allocations from, before they are returned to the free lists.
+//
+#define POOL_MAGAZINE_SIZE    8
+
 //
 // Globals
 //
 
+typedef struct {
+  UINTN            Allocations;
+  UINTN            MagazineHits;
+  UINTN            InUse;
+  UINTN            Free;
+} POOL_LIST_STATISTICS;
+
 #define POOL_SIGNATURE  SIGNATURE_32('p','l','s','t')
 typedef struct {
-    INTN             Signature;
-    UINTN            Used;
-    EFI_MEMORY_TYPE  MemoryType;
-    LIST_ENTRY       FreeList[MAX_POOL_LIST];
-    LIST_ENTRY       Link;
+    INTN                  Signature;
+    UINTN                 Used;
+    EFI_MEMORY_TYPE       MemoryType;
+    LIST_ENTRY            FreeList[MAX_POOL_LIST];
+    LIST_ENTRY            Link;
+    UINTN                 MagazineCount[MAX_POOL_LIST];
+    POOL_HEAD             *Magazine[MAX_POOL_LIST][POOL_MAGAZINE_SIZE];
+    UINTN                 Pages;
+    UINTN                 LargePages;
+    POOL_LIST_STATISTICS  Statistics[MAX_POOL_LIST];
 } POOL;
 
 //
@@ -85,9 +112,15 @@ typedef struct {
 POOL            mPoolHead[EfiMaxMemoryType];
 
 //
-// List of pool header to search for the appropriate memory type.
+// Lists of pool headers of the OS and OEM memory types, hashed by type.
 //
-LIST_ENTRY      mPoolHeadList = INITIALIZE_LIST_HEAD_VARIABLE (mPoolHeadList);
+#define POOL_HEAD_LIST_BUCKETS  16
+LIST_ENTRY      mPoolHeadList[POOL_HEAD_LIST_BUCKETS];
+
+//
+// Pool size table index of each number of pool size units.
+//
+UINT8           mPoolIndexFromUnits[POOL_SIZE_UNITS];
 
 /**
   Get pool size table index from the specified size.
@@ -103,14 +136,33 @@ GetPoolIndexFromSize (
   UINTN   Size
   )
 {
-  UINTN   Index;
+  if (Size > LIST_TO_SIZE (MAX_POOL_LIST - 1)) {
+    return MAX_POOL_LIST;
+  }
+  return mPoolIndexFromUnits[(Size + POOL_SIZE_UNIT - 1) >> POOL_SIZE_UNIT_SHIFT];
+}
 
-  for (Index = 0; Index < MAX_POOL_LIST; Index++) {
-    if (mPoolSizeTable [Index] >= Size) {
-      return Index;
-    }
+/**
+  Initialize a pool header.
+
+  @param  Pool                   The pool header
+  @param  MemoryType             Memory type of the pool
+
+**/
+STATIC
+VOID
+InitializePoolHead (
+  OUT POOL             *Pool,
+  IN  EFI_MEMORY_TYPE  MemoryType
+  )
+{
+  UINTN  Index;
+
+  ZeroMem (Pool, sizeof (*Pool));
+  Pool->MemoryType = MemoryType;
+  for (Index=0; Index < MAX_POOL_LIST; Index++) {
+    InitializeListHead (&Pool->FreeList[Index]);
   }
-  return MAX_POOL_LIST;
 }
 
 /**
@@ -124,14 +176,27 @@ CoreInitializePool (
 {
   UINTN  Type;
   UINTN  Index;
+  UINTN  Units;
 
   for (Type=0; Type < EfiMaxMemoryType; Type++) {
-    mPoolHead[Type].Signature  = 0;
-    mPoolHead[Type].Used       = 0;
-    mPoolHead[Type].MemoryType = (EFI_MEMORY_TYPE) Type;
-    for (Index=0; Index < MAX_POOL_LIST; Index++) {
-      InitializeListHead (&mPoolHead[Type].FreeList[Index]);
+    InitializePoolHead (&mPoolHead[Type], (EFI_MEMORY_TYPE) Type);
+  }
+
+  for (Index = 0; Index < POOL_HEAD_LIST_BUCKETS; Index++) {
+    InitializeListHead (&mPoolHeadList[Index]);
+  }
+
+  for (Index = 0; Index < MAX_POOL_LIST; Index++) {
+    ASSERT ((LIST_TO_SIZE (Index) & (POOL_SIZE_UNIT - 1)) == 0);
+  }
+  ASSERT ((LIST_TO_SIZE (MAX_POOL_LIST - 1) >> POOL_SIZE_UNIT_SHIFT) + 1 == POOL_SIZE_UNITS);
+
+  Index = 0;
+  for (Units = 0; Units < POOL_SIZE_UNITS; Units++) {
+    if ((Units << POOL_SIZE_UNIT_SHIFT) > LIST_TO_SIZE (Index)) {
+      Index++;
     }
+    mPoolIndexFromUnits[Units] = (UINT8) Index;
   }
 }
 
@@ -149,9 +214,9 @@ LookupPoolHead (
   IN EFI_MEMORY_TYPE  MemoryType
   )
 {
+  LIST_ENTRY      *Head;
   LIST_ENTRY      *Link;
   POOL            *Pool;
-  UINTN           Index;
 
   if ((UINT32)MemoryType < EfiMaxMemoryType) {
     return &mPoolHead[MemoryType];
@@ -164,7 +229,8 @@ LookupPoolHead (
   //
   if ((UINT32) MemoryType >= MEMORY_TYPE_OEM_RESERVED_MIN) {
 
-    for (Link = mPoolHeadList.ForwardLink; Link != &mPoolHeadList; Link = Link->ForwardLink) {
+    Head = &mPoolHeadList[(UINT32) MemoryType % POOL_HEAD_LIST_BUCKETS];
+    for (Link = Head->ForwardLink; Link != Head; Link = Link->ForwardLink) {
       Pool = CR(Link, POOL, Link, POOL_SIGNATURE);
       if (Pool->MemoryType == MemoryType) {
         return Pool;
@@ -176,14 +242,10 @@ LookupPoolHead (
       return NULL;
     }
 
+    InitializePoolHead (Pool, MemoryType);
     Pool->Signature = POOL_SIGNATURE;
-    Pool->Used      = 0;
-    Pool->MemoryType = MemoryType;
-    for (Index=0; Index < MAX_POOL_LIST; Index++) {
-      InitializeListHead (&Pool->FreeList[Index]);
-    }
 
-    InsertHeadList (&mPoolHeadList, &Pool->Link);
+    InsertHeadList (Head, &Pool->Link);
 
     return Pool;
   }
@@ -419,6 +481,23 @@ CoreAllocatePoolI (
     if (NeedGuard) {
       Head = AdjustPoolHeadA ((EFI_PHYSICAL_ADDRESS)(UINTN)Head, NoPages, Size);
     }
+    if (Head != NULL) {
+      Pool->LargePages += NoPages;
+    }
+    goto Done;
+  }
+
+  //
+  // Serve the allocation from the most recently freed block of the size,
+  // if the pool still holds on to it
+  //
+  if (Pool->MagazineCount[Index] > 0) {
+    Pool->MagazineCount[Index]--;
+    Head = Pool->Magazine[Index][Pool->MagazineCount[Index]];
+    ASSERT (Head->Signature == POOL_CACHED_SIGNATURE);
+    Pool->Statistics[Index].MagazineHits++;
+    Pool->Statistics[Index].Allocations++;
+    Pool->Statistics[Index].InUse++;
     goto Done;
   }
 
@@ -437,6 +516,7 @@ CoreAllocatePoolI (
       if (!IsListEmpty (&Pool->FreeList[Index])) {
         Free = CR (Pool->FreeList[Index].ForwardLink, POOL_FREE, Link, POOL_FREE_SIGNATURE);
         RemoveEntryList (&Free->Link);
+        Pool->Statistics[Index].Free--;
         NewPage = (VOID *) Free;
         MaxOffset = LIST_TO_SIZE (Index);
         goto Carve;
@@ -451,12 +531,15 @@ CoreAllocatePoolI (
     if (NewPage == NULL) {
       goto Done;
     }
+    Pool->Pages += EFI_SIZE_TO_PAGES (Granularity);
 
     //
     // Serve the allocation request from the head of the allocated block
     //
 Carve:
     Head = (POOL_HEAD *) NewPage;
+    Pool->Statistics[SIZE_TO_LIST (Size)].Allocations++;
+    Pool->Statistics[SIZE_TO_LIST (Size)].InUse++;
 
     //
     // Carve up remaining space into free pool blocks
@@ -471,6 +554,7 @@ Carve:
         Free->Signature = POOL_FREE_SIGNATURE;
         Free->Index     = (UINT32)Index;
         InsertHeadList (&Pool->FreeList[Index], &Free->Link);
+        Pool->Statistics[Index].Free++;
         Offset += FSize;
       }
       Index -= 1;
@@ -485,6 +569,9 @@ Carve:
   //
   Free = CR (Pool->FreeList[Index].ForwardLink, POOL_FREE, Link, POOL_FREE_SIGNATURE);
   RemoveEntryList (&Free->Link);
+  Pool->Statistics[Index].Free--;
+  Pool->Statistics[Index].Allocations++;
+  Pool->Statistics[Index].InUse++;
 
   Head = (POOL_HEAD *) Free;
 
@@ -659,6 +746,130 @@ CoreFreePoolPagesWithGuard (
   }
 }
 
+/**
+  Internal function.  Puts a free pool block onto its free list, and frees
+  the pages holding it if all the blocks in them are free.
+
+  @param  Pool                   The pool of the block
+  @param  Head                   The block
+  @param  Index                  The pool list of the block
+  @param  Granularity            The page allocation granularity of the pool
+
+**/
+STATIC
+VOID
+CoreReturnPoolBlock (
+  IN POOL               *Pool,
+  IN POOL_HEAD          *Head,
+  IN UINTN              Index,
+  IN UINTN              Granularity
+  )
+{
+  POOL_FREE   *Free;
+  CHAR8       *NewPage;
+  UINTN       Offset;
+  BOOLEAN     AllFree;
+
+  //
+  // Put the pool entry onto the free pool list
+  //
+  Free = (POOL_FREE *) Head;
+  ASSERT(Free != NULL);
+  Free->Signature = POOL_FREE_SIGNATURE;
+  Free->Index     = (UINT32)Index;
+  InsertHeadList (&Pool->FreeList[Index], &Free->Link);
+  Pool->Statistics[Index].Free++;
+
+  //
+  // See if all the pool entries in the same page as Free are freed pool
+  // entries
+  //
+  NewPage = (CHAR8 *)((UINTN)Free & ~(Granularity - 1));
+  Free = (POOL_FREE *) &NewPage[0];
+  ASSERT(Free != NULL);
+
+  if (Free->Signature == POOL_FREE_SIGNATURE) {
+
+    AllFree = TRUE;
+    Offset = 0;
+
+    while ((Offset < Granularity) && (AllFree)) {
+      Free = (POOL_FREE *) &NewPage[Offset];
+      ASSERT(Free != NULL);
+      if (Free->Signature != POOL_FREE_SIGNATURE) {
+        AllFree = FALSE;
+      }
+      Offset += LIST_TO_SIZE(Free->Index);
+    }
+
+    if (AllFree) {
+
+      //
+      // All of the pool entries in the same page as Free are free pool
+      // entries
+      // Remove all of these pool entries from the free loop lists.
+      //
+      Free = (POOL_FREE *) &NewPage[0];
+      ASSERT(Free != NULL);
+      Offset = 0;
+
+      while (Offset < Granularity) {
+        Free = (POOL_FREE *) &NewPage[Offset];
+        ASSERT(Free != NULL);
+        RemoveEntryList (&Free->Link);
+        Pool->Statistics[Free->Index].Free--;
+        Offset += LIST_TO_SIZE(Free->Index);
+      }
+
+      //
+      // Free the page
+      //
+      Pool->Pages -= EFI_SIZE_TO_PAGES (Granularity);
+      CoreFreePoolPagesI (Pool->MemoryType, (EFI_PHYSICAL_ADDRESS) (UINTN)NewPage,
+        EFI_SIZE_TO_PAGES (Granularity));
+    }
+  }
+}
+
+/**
+  Internal function.  Returns the oldest blocks kept in a pool magazine to
+  the free lists.
+
+  @param  Pool                   The pool of the magazine
+  @param  Index                  The pool list of the magazine
+  @param  Count                  The number of blocks to return
+
+**/
+STATIC
+VOID
+CoreFlushPoolMagazine (
+  IN POOL               *Pool,
+  IN UINTN              Index,
+  IN UINTN              Count
+  )
+{
+  UINTN       Slot;
+
+  ASSERT (Count <= Pool->MagazineCount[Index]);
+
+  for (Slot = 0; Slot < Count; Slot++) {
+    ASSERT (Pool->Magazine[Index][Slot]->Signature == POOL_CACHED_SIGNATURE);
+    CoreReturnPoolBlock (
+      Pool,
+      Pool->Magazine[Index][Slot],
+      Index,
+      DEFAULT_PAGE_ALLOCATION_GRANULARITY
+      );
+  }
+
+  Pool->MagazineCount[Index] -= Count;
+  CopyMem (
+    &Pool->Magazine[Index][0],
+    &Pool->Magazine[Index][Count],
+    Pool->MagazineCount[Index] * sizeof (Pool->Magazine[Index][0])
+    );
+}
+
 /**
   Internal function to free a pool entry.
   Caller must have the memory lock held
@@ -679,17 +890,14 @@ CoreFreePoolI (
   POOL        *Pool;
   POOL_HEAD   *Head;
   POOL_TAIL   *Tail;
-  POOL_FREE   *Free;
   UINTN       Index;
   UINTN       NoPages;
   UINTN       Size;
-  CHAR8       *NewPage;
-  UINTN       Offset;
-  BOOLEAN     AllFree;
   UINTN       Granularity;
   BOOLEAN     IsGuarded;
   BOOLEAN     HasPoolTail;
   BOOLEAN     PageAsPool;
+  BOOLEAN     UseMagazine;
 
   ASSERT(Buffer != NULL);
   //
@@ -743,14 +951,21 @@ CoreFreePoolI (
   Pool->Used -= Size;
   DEBUG ((DEBUG_POOL, "FreePool: %p (len %lx) %,ld\n", Head->Data, (UINT64)(Head->Size - POOL_OVERHEAD), (UINT64) Pool->Used));
 
+  //
+  // Pages of the runtime and ACPI types stay in the memory map that the OS
+  // sees, so their pools return freed blocks to the free lists right away
+  // rather than keeping them in the magazines.
+  //
   if  (Head->Type == EfiACPIReclaimMemory   ||
        Head->Type == EfiACPIMemoryNVS       ||
        Head->Type == EfiRuntimeServicesCode ||
        Head->Type == EfiRuntimeServicesData) {
 
     Granularity = RUNTIME_PAGE_ALLOCATION_GRANULARITY;
+    UseMagazine = FALSE;
   } else {
     Granularity = DEFAULT_PAGE_ALLOCATION_GRANULARITY;
+    UseMagazine = TRUE;
   }
 
   if (PoolType != NULL) {
@@ -773,6 +988,7 @@ CoreFreePoolI (
     //
     NoPages = EFI_SIZE_TO_PAGES (Size) + EFI_SIZE_TO_PAGES (Granularity) - 1;
     NoPages &= ~(UINTN)(EFI_SIZE_TO_PAGES (Granularity) - 1);
+    Pool->LargePages -= NoPages;
     if (IsGuarded) {
       Head = AdjustPoolHeadF ((EFI_PHYSICAL_ADDRESS)(UINTN)Head);
       CoreFreePoolPagesWithGuard (
@@ -790,61 +1006,22 @@ CoreFreePoolI (
 
   } else {
 
-    //
-    // Put the pool entry onto the free pool list
-    //
-    Free = (POOL_FREE *) Head;
-    ASSERT(Free != NULL);
-    Free->Signature = POOL_FREE_SIGNATURE;
-    Free->Index     = (UINT32)Index;
-    InsertHeadList (&Pool->FreeList[Index], &Free->Link);
-
-    //
-    // See if all the pool entries in the same page as Free are freed pool
-    // entries
-    //
-    NewPage = (CHAR8 *)((UINTN)Free & ~(Granularity - 1));
-    Free = (POOL_FREE *) &NewPage[0];
-    ASSERT(Free != NULL);
-
-    if (Free->Signature == POOL_FREE_SIGNATURE) {
+    Pool->Statistics[Index].InUse--;
 
-      AllFree = TRUE;
-      Offset = 0;
-
-      while ((Offset < Granularity) && (AllFree)) {
-        Free = (POOL_FREE *) &NewPage[Offset];
-        ASSERT(Free != NULL);
-        if (Free->Signature != POOL_FREE_SIGNATURE) {
-          AllFree = FALSE;
-        }
-        Offset += LIST_TO_SIZE(Free->Index);
-      }
-
-      if (AllFree) {
-
-        //
-        // All of the pool entries in the same page as Free are free pool
-        // entries
-        // Remove all of these pool entries from the free loop lists.
-        //
-        Free = (POOL_FREE *) &NewPage[0];
-        ASSERT(Free != NULL);
-        Offset = 0;
-
-        while (Offset < Granularity) {
-          Free = (POOL_FREE *) &NewPage[Offset];
-          ASSERT(Free != NULL);
-          RemoveEntryList (&Free->Link);
-          Offset += LIST_TO_SIZE(Free->Index);
-        }
-
-        //
-        // Free the page
-        //
-        CoreFreePoolPagesI (Pool->MemoryType, (EFI_PHYSICAL_ADDRESS) (UINTN)NewPage,
-          EFI_SIZE_TO_PAGES (Granularity));
+    if (UseMagazine) {
+      //
+      // Keep the block for the next allocation of the same size, and hand
+      // the oldest kept blocks back to the free lists in a batch when there
+      // are too many.
+      //
+      if (Pool->MagazineCount[Index] == POOL_MAGAZINE_SIZE) {
+        CoreFlushPoolMagazine (Pool, Index, POOL_MAGAZINE_SIZE / 2);
       }
+      Head->Signature = POOL_CACHED_SIGNATURE;
+      Pool->Magazine[Index][Pool->MagazineCount[Index]] = Head;
+      Pool->MagazineCount[Index]++;
+    } else {
+      CoreReturnPoolBlock (Pool, Head, Index, Granularity);
     }
   }
 
@@ -854,6 +1031,9 @@ CoreFreePoolI (
   // list entry for that memory type
   //
   if (((UINT32) Pool->MemoryType >= MEMORY_TYPE_OEM_RESERVED_MIN) && Pool->Used == 0) {
+    for (Index = 0; Index < MAX_POOL_LIST; Index++) {
+      CoreFlushPoolMagazine (Pool, Index, Pool->MagazineCount[Index]);
+    }
     RemoveEntryList (&Pool->Link);
     CoreFreePoolI (Pool, NULL);
   }
@@ -861,3 +1041,74 @@ CoreFreePoolI (
   return EFI_SUCCESS;
 }
 
+/**
+  Internal function.  Dumps the statistics of one pool.
+
+  @param  Pool                   The pool
+
+**/
+STATIC
+VOID
+CoreDumpPoolHeadStatistics (
+  IN POOL               *Pool
+  )
+{
+  UINTN                 Index;
+  UINTN                 Blocks;
+  POOL_LIST_STATISTICS  *Statistics;
+
+  if (Pool->Pages == 0 && Pool->LargePages == 0) {
+    return;
+  }
+
+  DEBUG ((DEBUG_POOL, "Pool type %x: used %ld bytes, %ld pages in blocks, %ld pages in large allocations\n",
+    Pool->MemoryType, (UINT64) Pool->Used, (UINT64) Pool->Pages, (UINT64) Pool->LargePages));
+
+  for (Index = 0; Index < MAX_POOL_LIST; Index++) {
+    Statistics = &Pool->Statistics[Index];
+    Blocks = Statistics->InUse + Statistics->Free + Pool->MagazineCount[Index];
+    if (Blocks == 0 && Statistics->Allocations == 0) {
+      continue;
+    }
+    DEBUG ((DEBUG_POOL, "  %5d: %ld pages, %ld in use, %ld free, %ld cached, %ld allocations, %ld from cache\n",
+      LIST_TO_SIZE (Index),
+      (UINT64) EFI_SIZE_TO_PAGES (Blocks * LIST_TO_SIZE (Index)),
+      (UINT64) Statistics->InUse,
+      (UINT64) Statistics->Free,
+      (UINT64) Pool->MagazineCount[Index],
+      (UINT64) Statistics->Allocations,
+      (UINT64) Statistics->MagazineHits
+      ));
+  }
+}
+
+/**
+  Dumps the statistics of all the pools: the pages each one holds, and for
+  each block size the pages the blocks span, the blocks in use, on the free
+  list and kept for reuse, and how many allocations were served.
+
+**/
+VOID
+CoreDumpPoolStatistics (
+  VOID
+  )
+{
+  UINTN       Type;
+  UINTN       Index;
+  LIST_ENTRY  *Link;
+
+  CoreAcquireLock (&mPoolMemoryLock);
+
+  for (Type = 0; Type < EfiMaxMemoryType; Type++) {
+    CoreDumpPoolHeadStatistics (&mPoolHead[Type]);
+  }
+  for (Index = 0; Index < POOL_HEAD_LIST_BUCKETS; Index++) {
+    for (Link = mPoolHeadList[Index].ForwardLink;
+         Link != &mPoolHeadList[Index];
+         Link = Link->ForwardLink) {
+      CoreDumpPoolHeadStatistics (CR (Link, POOL, Link, POOL_SIGNATURE));
+    }
+  }
+
+  CoreReleaseLock (&mPoolMemoryLock);
+}
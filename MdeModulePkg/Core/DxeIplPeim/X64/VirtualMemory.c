@@ -355,12 +355,25 @@ Split2MPageTo4K (
   UINTN                                 IndexOfPageTableEntries;
   PAGE_TABLE_4K_ENTRY                   *PageTableEntry;
   UINT64                                AddressEncMask;
+  EFI_PHYSICAL_ADDRESS                  GhcbPerCpuEnd;
+  UINT64                                GhcbPerCpuSize;
+  UINT64                                GhcbOffset;
 
   //
   // Make sure AddressEncMask is contained to smallest supported address field
   //
   AddressEncMask = PcdGet64 (PcdPteMemoryEncryptionAddressOrMask) & PAGING_1G_ADDRESS_MASK_64;
 
+  //
+  // The optional #VC scratch areas follow the per-CPU blocks.
+  //
+  GhcbPerCpuEnd  = GhcbBase + GhcbSize;
+  GhcbPerCpuSize = 0;
+  if (GhcbBase) {
+    GhcbPerCpuEnd -= PcdGet64 (PcdGhcbScratchSize);
+    GhcbPerCpuSize = PcdGet64 (PcdGhcbPerCpuSize);
+  }
+
   PageTableEntry = AllocatePageTableMemory (1);
   ASSERT (PageTableEntry != NULL);
 
@@ -375,9 +388,22 @@ Split2MPageTo4K (
     // Fill in the Page Table entries
     //
     PageTableEntry->Uint64 = (UINT64) PhysicalAddress4K;
+
+    //
+    // The GHCB area consists of per-CPU blocks, each starting with a GHCB
+    // page, and ends with the scratch areas. Only the GHCB pages and the
+    // scratch areas are mapped unencrypted.
+    //
+    GhcbOffset = 0;
+    if (GhcbPerCpuSize != 0
+        && (PhysicalAddress4K >= GhcbBase)
+        && (PhysicalAddress4K < GhcbPerCpuEnd)) {
+      DivU64x64Remainder (PhysicalAddress4K - GhcbBase, GhcbPerCpuSize, &GhcbOffset);
+    }
     if (!GhcbBase
         || (PhysicalAddress4K < GhcbBase)
-        || (PhysicalAddress4K >= GhcbBase + GhcbSize)) {
+        || (PhysicalAddress4K >= GhcbBase + GhcbSize)
+        || (GhcbOffset != 0)) {
       PageTableEntry->Uint64 |= AddressEncMask;
     }
     PageTableEntry->Bits.ReadWrite = 1;
@@ -20,7 +20,28 @@
 #include <Library/DebugLib.h>
 #include <Library/FrameBufferBltLib.h>
 
+//
+// Pixel conversion selected by FrameBufferBltConfigure ().
+//
+typedef enum {
+  //
+  // Convert pixels one at a time with PixelMasks, PixelShl and PixelShr.
+  //
+  FrameBufferKernelGeneric,
+  //
+  // 32bpp frame buffer with the EFI_GRAPHICS_OUTPUT_BLT_PIXEL layout; rows
+  // are copied without conversion.
+  //
+  FrameBufferKernelBgrx32,
+  //
+  // 32bpp frame buffer with red and blue swapped relative to
+  // EFI_GRAPHICS_OUTPUT_BLT_PIXEL.
+  //
+  FrameBufferKernelRgbx32
+} FRAME_BUFFER_KERNEL;
+
 struct FRAME_BUFFER_CONFIGURE {
+  FRAME_BUFFER_KERNEL             Kernel;
   UINT32                          PixelsPerScanLine;
   UINT32                          BytesPerPixel;
   UINT32                          Width;
@@ -41,6 +62,47 @@ CONST EFI_PIXEL_BITMASK mBgrPixelMasks = {
   0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000
 };
 
+/**
+  Convert pixels between EFI_GRAPHICS_OUTPUT_BLT_PIXEL and the 32bpp RGBX
+  layout, by swapping the red and blue bytes. The conversion is its own
+  inverse. The reserved byte is cleared, like the generic conversion does.
+
+  Two pixels are converted at a time when both buffers are suitably aligned.
+
+  @param[out] Destination  The converted pixels.
+  @param[in]  Source       The pixels to convert.
+  @param[in]  Count        The number of pixels.
+**/
+STATIC
+VOID
+FrameBufferBltLibSwapRedBlue (
+  OUT UINT32       *Destination,
+  IN  CONST UINT32 *Source,
+  IN  UINTN        Count
+  )
+{
+  UINT32           Uint32;
+  UINT64           Uint64;
+
+  if ((((UINTN) Destination | (UINTN) Source) & 7) == 0) {
+    for (; Count >= 2; Count -= 2) {
+      Uint64 = *(CONST UINT64 *) Source;
+      *(UINT64 *) Destination = ((Uint64 & 0x000000ff000000ffULL) << 16) |
+                                ((Uint64 >> 16) & 0x000000ff000000ffULL) |
+                                (Uint64 & 0x0000ff000000ff00ULL);
+      Source      += 2;
+      Destination += 2;
+    }
+  }
+
+  for (; Count > 0; Count--) {
+    Uint32 = *Source++;
+    *Destination++ = ((Uint32 & 0x000000ff) << 16) |
+                     ((Uint32 >> 16) & 0x000000ff) |
+                     (Uint32 & 0x0000ff00);
+  }
+}
+
 /**
   Initialize the bit mask in frame buffer configure.
 
@@ -171,6 +233,21 @@ FrameBufferBltConfigure (
   Configure->Height            = FrameBufferInfo->VerticalResolution;
   Configure->PixelsPerScanLine = FrameBufferInfo->PixelsPerScanLine;
 
+  //
+  // Pick the pixel conversion once, rather than on every Blt. A PixelBitMask
+  // mode whose masks match one of the 8 bits per color layouts is treated as
+  // that layout.
+  //
+  Configure->Kernel = FrameBufferKernelGeneric;
+  if (BytesPerPixel == sizeof (UINT32)) {
+    if (CompareMem (BitMask, &mBgrPixelMasks, 3 * sizeof (UINT32)) == 0) {
+      Configure->Kernel = FrameBufferKernelBgrx32;
+    } else if (CompareMem (BitMask, &mRgbPixelMasks, 3 * sizeof (UINT32)) == 0) {
+      Configure->Kernel = FrameBufferKernelRgbx32;
+    }
+  }
+  DEBUG ((DEBUG_VERBOSE, "FrameBufferBltConfigure: kernel %d\n", Configure->Kernel));
+
   return RETURN_SUCCESS;
 }
 
@@ -293,7 +370,12 @@ FrameBufferBltLibVideoFill (
       Offset = Configure->BytesPerPixel * Offset;
       Destination = Configure->FrameBuffer + Offset;
 
-      if (UseWideFill && (((UINTN) Destination & 7) == 0)) {
+      if (Configure->Kernel != FrameBufferKernelGeneric) {
+        //
+        // 32bpp pixels are always 4 byte aligned in the frame buffer.
+        //
+        SetMem32 (Destination, WidthInBytes, (UINT32) WideFill);
+      } else if (UseWideFill && (((UINTN) Destination & 7) == 0)) {
         DEBUG ((EFI_D_VERBOSE, "VideoFill (wide)\n"));
         SizeInBytes = WidthInBytes;
         if (SizeInBytes >= 8) {
@@ -393,6 +475,20 @@ FrameBufferBltLibVideoToBltBuffer (
 
   WidthInBytes = Width * Configure->BytesPerPixel;
 
+  if ((Configure->Kernel == FrameBufferKernelBgrx32) &&
+      (Width == Configure->PixelsPerScanLine) && (Delta == WidthInBytes)) {
+    //
+    // Both the frame buffer and BltBuffer rows are contiguous.
+    //
+    CopyMem (
+      (UINT8 *) BltBuffer + (DestinationY * Delta) +
+        (DestinationX * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL)),
+      Configure->FrameBuffer + SourceY * WidthInBytes,
+      Height * WidthInBytes
+      );
+    return RETURN_SUCCESS;
+  }
+
   //
   // Video to BltBuffer: Source is Video, destination is BltBuffer
   //
@@ -404,15 +500,25 @@ FrameBufferBltLibVideoToBltBuffer (
     Offset = Configure->BytesPerPixel * Offset;
     Source = Configure->FrameBuffer + Offset;
 
-    if (Configure->PixelFormat == PixelBlueGreenRedReserved8BitPerColor) {
+    if (Configure->Kernel == FrameBufferKernelBgrx32) {
       Destination = (UINT8 *) BltBuffer + (DstY * Delta) + (DestinationX * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
     } else {
       Destination = Configure->LineBuffer;
     }
 
+    //
+    // Read the frame buffer (typically uncached) with one bulk copy per row.
+    //
     CopyMem (Destination, Source, WidthInBytes);
 
-    if (Configure->PixelFormat != PixelBlueGreenRedReserved8BitPerColor) {
+    if (Configure->Kernel == FrameBufferKernelRgbx32) {
+      FrameBufferBltLibSwapRedBlue (
+        (UINT32 *) ((UINT8 *) BltBuffer + (DstY * Delta) +
+                    (DestinationX * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL))),
+        (UINT32 *) Configure->LineBuffer,
+        Width
+        );
+    } else if (Configure->Kernel == FrameBufferKernelGeneric) {
       for (IndexX = 0; IndexX < Width; IndexX++) {
         Blt = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *)
           ((UINT8 *) BltBuffer + (DstY * Delta) +
@@ -501,6 +607,20 @@ FrameBufferBltLibBufferToVideo (
 
   WidthInBytes = Width * Configure->BytesPerPixel;
 
+  if ((Configure->Kernel == FrameBufferKernelBgrx32) &&
+      (Width == Configure->PixelsPerScanLine) && (Delta == WidthInBytes)) {
+    //
+    // Both BltBuffer and the frame buffer rows are contiguous.
+    //
+    CopyMem (
+      Configure->FrameBuffer + DestinationY * WidthInBytes,
+      (UINT8 *) BltBuffer + (SourceY * Delta) +
+        (SourceX * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL)),
+      Height * WidthInBytes
+      );
+    return RETURN_SUCCESS;
+  }
+
   for (SrcY = SourceY, DstY = DestinationY;
        SrcY < (Height + SourceY);
        SrcY++, DstY++) {
@@ -509,8 +629,17 @@ FrameBufferBltLibBufferToVideo (
     Offset = Configure->BytesPerPixel * Offset;
     Destination = Configure->FrameBuffer + Offset;
 
-    if (Configure->PixelFormat == PixelBlueGreenRedReserved8BitPerColor) {
-      Source = (UINT8 *) BltBuffer + (SrcY * Delta);
+    if (Configure->Kernel == FrameBufferKernelBgrx32) {
+      Source = (UINT8 *) BltBuffer + (SrcY * Delta) +
+               (SourceX * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+    } else if (Configure->Kernel == FrameBufferKernelRgbx32) {
+      FrameBufferBltLibSwapRedBlue (
+        (UINT32 *) Configure->LineBuffer,
+        (UINT32 *) ((UINT8 *) BltBuffer + (SrcY * Delta) +
+                    (SourceX * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL))),
+        Width
+        );
+      Source = Configure->LineBuffer;
     } else {
       for (IndexX = 0; IndexX < Width; IndexX++) {
         Blt =
@@ -605,12 +734,20 @@ FrameBufferBltLibVideoToVideo (
   Destination = Configure->FrameBuffer + Offset;
 
   LineStride = Configure->BytesPerPixel * Configure->PixelsPerScanLine;
+  if (Width == Configure->PixelsPerScanLine) {
+    //
+    // Whole scan lines are contiguous; CopyMem () handles the overlap.
+    //
+    CopyMem (Destination, Source, Height * LineStride);
+    return RETURN_SUCCESS;
+  }
+
   if (Destination > Source) {
     //
     // Copy from last line to avoid source is corrupted by copying
     //
-    Source += Height * LineStride;
-    Destination += Height * LineStride;
+    Source += (Height - 1) * LineStride;
+    Destination += (Height - 1) * LineStride;
     LineStride = -LineStride;
   }
 
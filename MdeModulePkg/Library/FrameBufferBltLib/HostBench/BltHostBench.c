@@ -0,0 +1,273 @@
+/** @file
+  Host benchmark for FrameBufferBltLib.
+
+  For the 32bpp BGRX and RGBX pixel formats, and for a 16bpp PixelBitMask
+  format that takes the generic conversion, at 1080p and 4K, the benchmark
+  first checks that a full-screen buffer-to-video and video-to-buffer round
+  trip preserves the image, then reports the throughput of full-screen video
+  fill, video-to-buffer, buffer-to-video, and video-to-video (a 16-line
+  scroll) operations.
+
+  Usage: BltHostBench [iterations]
+
+**/
+
+#include <Base.h>
+#include <Protocol/GraphicsOutput.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/FrameBufferBltLib.h>
+#include "HostOs.h"
+
+#define SCROLL_LINES  16
+
+typedef struct {
+  CONST CHAR8                *Name;
+  EFI_GRAPHICS_PIXEL_FORMAT  PixelFormat;
+  EFI_PIXEL_BITMASK          PixelInformation;
+  UINT32                     BytesPerPixel;
+} BENCH_FORMAT;
+
+typedef struct {
+  CONST CHAR8  *Name;
+  UINT32       Width;
+  UINT32       Height;
+} BENCH_RESOLUTION;
+
+STATIC CONST BENCH_FORMAT  mFormats[] = {
+  { "BGRX 32bpp", PixelBlueGreenRedReserved8BitPerColor, { 0 }, 4 },
+  { "RGBX 32bpp", PixelRedGreenBlueReserved8BitPerColor, { 0 }, 4 },
+  { "RGB565 bitmask", PixelBitMask, { 0xF800, 0x07E0, 0x001F, 0 }, 2 }
+};
+
+STATIC CONST BENCH_RESOLUTION  mResolutions[] = {
+  { "1080p", 1920, 1080 },
+  { "4K",    3840, 2160 }
+};
+
+/**
+  Return the pixel that a round trip through Format is expected to yield.
+**/
+STATIC
+EFI_GRAPHICS_OUTPUT_BLT_PIXEL
+ExpectedPixel (
+  IN CONST BENCH_FORMAT            *Format,
+  IN EFI_GRAPHICS_OUTPUT_BLT_PIXEL Pixel
+  )
+{
+  if (Format->PixelFormat == PixelBitMask) {
+    Pixel.Red   &= 0xF8;
+    Pixel.Green &= 0xFC;
+    Pixel.Blue  &= 0xF8;
+  }
+  Pixel.Reserved = 0;
+  return Pixel;
+}
+
+/**
+  Check that a full-screen buffer-to-video and video-to-buffer round trip
+  preserves the image.
+
+  @retval TRUE  The image is preserved.
+**/
+STATIC
+BOOLEAN
+CheckRoundTrip (
+  IN FRAME_BUFFER_CONFIGURE         *Configure,
+  IN CONST BENCH_FORMAT             *Format,
+  IN UINT32                         Width,
+  IN UINT32                         Height,
+  IN EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *Source,
+  IN EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *Result
+  )
+{
+  UINTN                          Index;
+  EFI_GRAPHICS_OUTPUT_BLT_PIXEL  Expected;
+  RETURN_STATUS                  Status;
+
+  for (Index = 0; Index < (UINTN)Width * Height; Index++) {
+    Source[Index].Blue     = (UINT8)(Index * 7);
+    Source[Index].Green    = (UINT8)(Index >> 3);
+    Source[Index].Red      = (UINT8)(Index >> 11);
+    Source[Index].Reserved = 0;
+  }
+
+  Status = FrameBufferBlt (Configure, Source, EfiBltBufferToVideo,
+             0, 0, 0, 0, Width, Height, 0);
+  if (!RETURN_ERROR (Status)) {
+    Status = FrameBufferBlt (Configure, Result, EfiBltVideoToBltBuffer,
+               0, 0, 0, 0, Width, Height, 0);
+  }
+  if (RETURN_ERROR (Status)) {
+    HostPrint ("FrameBufferBlt() failed: 0x%lx\n", (unsigned long)Status);
+    return FALSE;
+  }
+
+  for (Index = 0; Index < (UINTN)Width * Height; Index++) {
+    Expected = ExpectedPixel (Format, Source[Index]);
+    if (CompareMem (&Result[Index], &Expected, sizeof Expected) != 0) {
+      HostPrint ("pixel %lu differs after the round trip\n",
+        (unsigned long)Index);
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/**
+  Run one operation Iterations times, and return the average time in
+  nanoseconds.
+**/
+STATIC
+UINT64
+BenchmarkOperation (
+  IN FRAME_BUFFER_CONFIGURE             *Configure,
+  IN EFI_GRAPHICS_OUTPUT_BLT_OPERATION  Operation,
+  IN UINT32                             Width,
+  IN UINT32                             Height,
+  IN EFI_GRAPHICS_OUTPUT_BLT_PIXEL      *BltBuffer,
+  IN UINTN                              Iterations
+  )
+{
+  UINT64                         Start;
+  UINTN                          Index;
+  EFI_GRAPHICS_OUTPUT_BLT_PIXEL  Color;
+
+  Color.Blue     = 0x40;
+  Color.Green    = 0x80;
+  Color.Red      = 0xC0;
+  Color.Reserved = 0;
+
+  Start = HostNanoseconds ();
+  for (Index = 0; Index < Iterations; Index++) {
+    switch (Operation) {
+    case EfiBltVideoFill:
+      FrameBufferBlt (Configure, &Color, Operation, 0, 0, 0, 0, Width, Height,
+        0);
+      break;
+    case EfiBltVideoToVideo:
+      FrameBufferBlt (Configure, NULL, Operation, 0, SCROLL_LINES, 0, 0, Width,
+        Height - SCROLL_LINES, 0);
+      break;
+    default:
+      FrameBufferBlt (Configure, BltBuffer, Operation, 0, 0, 0, 0, Width,
+        Height, 0);
+      break;
+    }
+  }
+  return (HostNanoseconds () - Start) / Iterations;
+}
+
+int
+main (
+  int   Argc,
+  char  **Argv
+  )
+{
+  UINTN                                 Iterations;
+  CHAR8                                 *Digit;
+  UINTN                                 FormatIndex;
+  UINTN                                 ResolutionIndex;
+  CONST BENCH_FORMAT                    *Format;
+  CONST BENCH_RESOLUTION                *Resolution;
+  EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  Info;
+  UINTN                                 Pixels;
+  VOID                                  *FrameBuffer;
+  EFI_GRAPHICS_OUTPUT_BLT_PIXEL         *Source;
+  EFI_GRAPHICS_OUTPUT_BLT_PIXEL         *Result;
+  FRAME_BUFFER_CONFIGURE                *Configure;
+  UINTN                                 ConfigureSize;
+  RETURN_STATUS                         Status;
+  UINT64                                Fill;
+  UINT64                                ToBuffer;
+  UINT64                                ToVideo;
+  UINT64                                Scroll;
+
+  Iterations = 20;
+  if (Argc > 1) {
+    Iterations = 0;
+    for (Digit = Argv[1]; *Digit >= '0' && *Digit <= '9'; Digit++) {
+      Iterations = Iterations * 10 + (*Digit - '0');
+    }
+    if (Iterations == 0) {
+      Iterations = 1;
+    }
+  }
+
+  HostPrint ("%-16s %-6s %12s %12s %12s %12s\n", "us per Blt", "", "fill",
+    "video->buf", "buf->video", "video->video");
+
+  for (ResolutionIndex = 0;
+       ResolutionIndex < ARRAY_SIZE (mResolutions);
+       ResolutionIndex++) {
+    Resolution = &mResolutions[ResolutionIndex];
+    Pixels     = (UINTN)Resolution->Width * Resolution->Height;
+    Source     = HostAllocatePages (EFI_SIZE_TO_PAGES (Pixels * sizeof *Source));
+    Result     = HostAllocatePages (EFI_SIZE_TO_PAGES (Pixels * sizeof *Result));
+    if (Source == NULL || Result == NULL) {
+      HostPrint ("out of memory\n");
+      return 1;
+    }
+
+    for (FormatIndex = 0; FormatIndex < ARRAY_SIZE (mFormats); FormatIndex++) {
+      Format = &mFormats[FormatIndex];
+
+      Info.Version              = 0;
+      Info.HorizontalResolution = Resolution->Width;
+      Info.VerticalResolution   = Resolution->Height;
+      Info.PixelFormat          = Format->PixelFormat;
+      Info.PixelInformation     = Format->PixelInformation;
+      Info.PixelsPerScanLine    = Resolution->Width;
+
+      FrameBuffer = HostAllocatePages (
+                      EFI_SIZE_TO_PAGES (Pixels * Format->BytesPerPixel));
+      ConfigureSize = 0;
+      Status = FrameBufferBltConfigure (FrameBuffer, &Info, NULL,
+                 &ConfigureSize);
+      if (Status != RETURN_BUFFER_TOO_SMALL || FrameBuffer == NULL) {
+        HostPrint ("%s: FrameBufferBltConfigure() failed: 0x%lx\n",
+          Format->Name, (unsigned long)Status);
+        return 1;
+      }
+      Configure = HostAllocatePages (EFI_SIZE_TO_PAGES (ConfigureSize));
+      if (Configure == NULL) {
+        HostPrint ("out of memory\n");
+        return 1;
+      }
+      Status = FrameBufferBltConfigure (FrameBuffer, &Info, Configure,
+                 &ConfigureSize);
+      if (RETURN_ERROR (Status)) {
+        HostPrint ("%s: FrameBufferBltConfigure() failed: 0x%lx\n",
+          Format->Name, (unsigned long)Status);
+        return 1;
+      }
+
+      if (!CheckRoundTrip (Configure, Format, Resolution->Width,
+             Resolution->Height, Source, Result)) {
+        HostPrint ("%s %s: round trip failed\n", Format->Name,
+          Resolution->Name);
+        return 1;
+      }
+
+      Fill     = BenchmarkOperation (Configure, EfiBltVideoFill,
+                   Resolution->Width, Resolution->Height, NULL, Iterations);
+      ToBuffer = BenchmarkOperation (Configure, EfiBltVideoToBltBuffer,
+                   Resolution->Width, Resolution->Height, Result, Iterations);
+      ToVideo  = BenchmarkOperation (Configure, EfiBltBufferToVideo,
+                   Resolution->Width, Resolution->Height, Source, Iterations);
+      Scroll   = BenchmarkOperation (Configure, EfiBltVideoToVideo,
+                   Resolution->Width, Resolution->Height, NULL, Iterations);
+
+      HostPrint ("%-16s %-6s %12lu %12lu %12lu %12lu\n", Format->Name,
+        Resolution->Name, (unsigned long)(Fill / 1000),
+        (unsigned long)(ToBuffer / 1000), (unsigned long)(ToVideo / 1000),
+        (unsigned long)(Scroll / 1000));
+    }
+  }
+
+  HostPrint ("\n%lu iterations; a full screen is %lu MB at 1080p, %lu MB at "
+    "4K in BLT pixels\n", (unsigned long)Iterations,
+    (unsigned long)(1920UL * 1080 * 4 >> 20),
+    (unsigned long)(3840UL * 2160 * 4 >> 20));
+  return 0;
+}
@@ -0,0 +1,131 @@
+/** @file
+  Host implementations of the BaseLib and BaseMemoryLib functions that
+  FrameBufferBltLib uses.
+
+  The copy and fill functions use the same string instructions as
+  BaseMemoryLibRepStr, the BaseMemoryLib instance of the OVMF platforms, so
+  that the benchmark measures what the firmware would do.
+
+**/
+
+#include <Base.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include "HostOs.h"
+
+VOID *
+EFIAPI
+CopyMem (
+  OUT VOID       *DestinationBuffer,
+  IN CONST VOID  *SourceBuffer,
+  IN UINTN       Length
+  )
+{
+  VOID        *Destination;
+  CONST VOID  *Source;
+  UINTN       Count;
+
+  if ((UINTN)DestinationBuffer > (UINTN)SourceBuffer &&
+      (UINTN)DestinationBuffer < (UINTN)SourceBuffer + Length) {
+    //
+    // Overlapping copy backward; not on the paths that are measured.
+    //
+    return __builtin_memmove (DestinationBuffer, SourceBuffer, Length);
+  }
+
+  Destination = DestinationBuffer;
+  Source      = SourceBuffer;
+  Count       = Length >> 3;
+  __asm__ __volatile__ (
+    "rep movsq"
+    : "+D" (Destination), "+S" (Source), "+c" (Count)
+    :
+    : "memory"
+    );
+  Count = Length & 7;
+  __asm__ __volatile__ (
+    "rep movsb"
+    : "+D" (Destination), "+S" (Source), "+c" (Count)
+    :
+    : "memory"
+    );
+  return DestinationBuffer;
+}
+
+VOID *
+EFIAPI
+SetMem (
+  OUT VOID  *Buffer,
+  IN UINTN  Length,
+  IN UINT8  Value
+  )
+{
+  return __builtin_memset (Buffer, Value, Length);
+}
+
+VOID *
+EFIAPI
+SetMem32 (
+  OUT VOID   *Buffer,
+  IN UINTN   Length,
+  IN UINT32  Value
+  )
+{
+  VOID   *Destination;
+  UINTN  Count;
+
+  Destination = Buffer;
+  Count       = Length / sizeof (UINT32);
+  __asm__ __volatile__ (
+    "rep stosl"
+    : "+D" (Destination), "+c" (Count)
+    : "a" (Value)
+    : "memory"
+    );
+  return Buffer;
+}
+
+VOID *
+EFIAPI
+SetMem64 (
+  OUT VOID   *Buffer,
+  IN UINTN   Length,
+  IN UINT64  Value
+  )
+{
+  VOID   *Destination;
+  UINTN  Count;
+
+  Destination = Buffer;
+  Count       = Length / sizeof (UINT64);
+  __asm__ __volatile__ (
+    "rep stosq"
+    : "+D" (Destination), "+c" (Count)
+    : "a" (Value)
+    : "memory"
+    );
+  return Buffer;
+}
+
+INTN
+EFIAPI
+CompareMem (
+  IN CONST VOID  *DestinationBuffer,
+  IN CONST VOID  *SourceBuffer,
+  IN UINTN       Length
+  )
+{
+  return __builtin_memcmp (DestinationBuffer, SourceBuffer, Length);
+}
+
+INTN
+EFIAPI
+HighBitSet32 (
+  IN UINT32  Operand
+  )
+{
+  if (Operand == 0) {
+    return -1;
+  }
+  return 31 - __builtin_clz (Operand);
+}
@@ -0,0 +1,80 @@
+/** @file
+  DebugLib instance for the edk2 host tests and benchmarks.
+
+  ASSERT()s are enabled, and report the failed condition before aborting the
+  program. DEBUG() messages are disabled, as the host C library does not
+  understand the edk2 format strings.
+
+**/
+
+#include <Base.h>
+#include <Library/DebugLib.h>
+#include "HostOs.h"
+
+VOID
+EFIAPI
+DebugAssert (
+  IN CONST CHAR8  *FileName,
+  IN UINTN        LineNumber,
+  IN CONST CHAR8  *Description
+  )
+{
+  HostPrint ("ASSERT %s(%u): %s\n", FileName, (unsigned)LineNumber,
+    Description);
+  HostAbort ();
+}
+
+VOID
+EFIAPI
+DebugPrint (
+  IN  UINTN        ErrorLevel,
+  IN  CONST CHAR8  *Format,
+  ...
+  )
+{
+}
+
+BOOLEAN
+EFIAPI
+DebugAssertEnabled (
+  VOID
+  )
+{
+  return TRUE;
+}
+
+BOOLEAN
+EFIAPI
+DebugPrintEnabled (
+  VOID
+  )
+{
+  return FALSE;
+}
+
+BOOLEAN
+EFIAPI
+DebugCodeEnabled (
+  VOID
+  )
+{
+  return FALSE;
+}
+
+BOOLEAN
+EFIAPI
+DebugClearMemoryEnabled (
+  VOID
+  )
+{
+  return FALSE;
+}
+
+BOOLEAN
+EFIAPI
+DebugPrintLevelEnabled (
+  IN  CONST UINTN  ErrorLevel
+  )
+{
+  return FALSE;
+}
@@ -0,0 +1,167 @@
+/** @file
+  Host operating system services for the edk2 host tests and benchmarks, on
+  top of the C library.
+
+**/
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "HostOs.h"
+
+void
+HostPrint (
+  const char  *Format,
+  ...
+  )
+{
+  va_list  Marker;
+
+  va_start (Marker, Format);
+  vprintf (Format, Marker);
+  va_end (Marker);
+  fflush (stdout);
+}
+
+void
+HostAbort (
+  void
+  )
+{
+  abort ();
+}
+
+unsigned long long
+HostNanoseconds (
+  void
+  )
+{
+  struct timespec  Now;
+
+  clock_gettime (CLOCK_MONOTONIC, &Now);
+  return (unsigned long long)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+void *
+HostAllocatePages (
+  unsigned long  Pages
+  )
+{
+  void  *Buffer;
+
+  if (posix_memalign (&Buffer, 4096, Pages * 4096) != 0) {
+    return NULL;
+  }
+  memset (Buffer, 0, Pages * 4096);
+  return Buffer;
+}
+
+void *
+HostAllocate (
+  unsigned long  Size
+  )
+{
+  return malloc (Size);
+}
+
+void
+HostFree (
+  void  *Buffer
+  )
+{
+  free (Buffer);
+}
+
+void *
+HostAllocateLowPages (
+  unsigned long  Pages
+  )
+{
+  void  *Buffer;
+
+  Buffer = mmap (NULL, Pages * 4096, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+  if (Buffer == MAP_FAILED) {
+    return NULL;
+  }
+  return Buffer;
+}
+
+void *
+HostReadFile (
+  const char     *Name,
+  unsigned long  *Size
+  )
+{
+  FILE  *File;
+  long  Length;
+  void  *Buffer;
+
+  File = fopen (Name, "rb");
+  if (File == NULL) {
+    return NULL;
+  }
+  Buffer = NULL;
+  if (fseek (File, 0, SEEK_END) == 0 && (Length = ftell (File)) >= 0 &&
+      fseek (File, 0, SEEK_SET) == 0) {
+    Buffer = malloc (Length + 1);
+    if (Buffer != NULL && fread (Buffer, 1, Length, File) != (size_t)Length) {
+      free (Buffer);
+      Buffer = NULL;
+    }
+    *Size = Length;
+  }
+  fclose (File);
+  return Buffer;
+}
+
+typedef struct {
+  void  (*Procedure) (void *Context);
+  void  *Context;
+} HOST_THREAD_START;
+
+static void *
+HostThread (
+  void  *Start
+  )
+{
+  HOST_THREAD_START  *ThreadStart;
+
+  ThreadStart = Start;
+  ThreadStart->Procedure (ThreadStart->Context);
+  return NULL;
+}
+
+int
+HostRunParallel (
+  unsigned long  Count,
+  void           (*Procedure) (void *Context),
+  void           *Context
+  )
+{
+  HOST_THREAD_START  Start;
+  pthread_t          *Threads;
+  unsigned long      Index;
+  unsigned long      Started;
+
+  Threads = malloc (Count * sizeof *Threads);
+  if (Threads == NULL) {
+    return 0;
+  }
+  Start.Procedure = Procedure;
+  Start.Context   = Context;
+  for (Started = 0; Started < Count; Started++) {
+    if (pthread_create (&Threads[Started], NULL, HostThread, &Start) != 0) {
+      break;
+    }
+  }
+  for (Index = 0; Index < Started; Index++) {
+    pthread_join (Threads[Index], NULL);
+  }
+  free (Threads);
+  return Started == Count;
+}
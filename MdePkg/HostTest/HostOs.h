@@ -0,0 +1,77 @@
+/** @file
+  Host operating system services for the edk2 host tests and benchmarks.
+
+  This header is shared by the files that include the edk2 headers and the
+  file that includes the C library headers, so it only uses plain C types.
+
+**/
+
+#ifndef _HOST_OS_H_
+#define _HOST_OS_H_
+
+void
+HostPrint (
+  const char  *Format,
+  ...
+  );
+
+void
+HostAbort (
+  void
+  );
+
+unsigned long long
+HostNanoseconds (
+  void
+  );
+
+void *
+HostAllocatePages (
+  unsigned long  Pages
+  );
+
+//
+// Allocate from the C library heap, and free memory allocated with
+// HostAllocate() or HostAllocatePages().
+//
+void *
+HostAllocate (
+  unsigned long  Size
+  );
+
+void
+HostFree (
+  void  *Buffer
+  );
+
+//
+// Allocate zeroed pages below 4GB, like the memory that firmware typically
+// places its data structures in.
+//
+void *
+HostAllocateLowPages (
+  unsigned long  Pages
+  );
+
+//
+// Read a whole file into memory allocated with HostAllocate(). Return NULL
+// if the file cannot be read.
+//
+void *
+HostReadFile (
+  const char     *Name,
+  unsigned long  *Size
+  );
+
+//
+// Run Procedure (Context) on Count threads at the same time, and return when
+// all of them have returned. Return 0 if the threads could not be started.
+//
+int
+HostRunParallel (
+  unsigned long  Count,
+  void           (*Procedure) (void *Context),
+  void           *Context
+  );
+
+#endif
@@ -0,0 +1,68 @@
+## @file
+#  Common GNU/Linux makefile rules for the edk2 host tests and benchmarks.
+#
+#  A host test builds edk2 sources as an x86_64 Linux program. Its GNUmakefile
+#  sets WORKSPACE and the following variables, then includes this file:
+#
+#    PROGRAM        The name of the program.
+#    EDK2_SOURCES   The edk2 sources of the program. They are built
+#                   freestanding, against the edk2 headers.
+#    EDK2_INCLUDES  Additional include options for EDK2_SOURCES (optional).
+#    EDK2_DEPS      The headers that EDK2_SOURCES depend on (optional).
+#    RUN_ARGS       The arguments of the program for "make run" (optional).
+#
+#  HostDebugLib.c, and HostOs.c, which is the only file built against the C
+#  library, are added to the program. Objects and the program are written to
+#  BUILD_DIR, outside of the source tree:
+#
+#    make -C <directory of the GNUmakefile> run
+#    make -C <directory of the GNUmakefile> clean
+#
+
+HOST_TEST_DIR := $(WORKSPACE)/MdePkg/HostTest
+BUILD_DIR     ?= $(WORKSPACE)/Build/HostTest/$(PROGRAM)
+
+CC      ?= gcc
+CFLAGS  ?= -O2 -g
+CFLAGS  += -Wall -Wno-unused-variable -Wno-unused-function -fshort-wchar \
+           -fno-strict-aliasing
+
+#
+# EFIAPI is empty here, so the edk2 sources use the host calling convention,
+# and their variable argument lists must too.
+#
+EDK2_CFLAGS = $(CFLAGS) -DNO_MSABI_VA_FUNCS -ffreestanding -nostdinc \
+              -include Uefi.h \
+              -I$(WORKSPACE)/MdePkg/Include -I$(WORKSPACE)/MdePkg/Include/X64 \
+              -I$(HOST_TEST_DIR) $(EDK2_INCLUDES)
+
+EDK2_SOURCES += $(HOST_TEST_DIR)/HostDebugLib.c
+EDK2_OBJECTS  = $(addprefix $(BUILD_DIR)/,$(notdir $(EDK2_SOURCES:.c=.o)))
+
+all: $(BUILD_DIR)/$(PROGRAM)
+
+$(BUILD_DIR)/$(PROGRAM): $(EDK2_OBJECTS) $(BUILD_DIR)/HostOs.o
+	$(CC) $(CFLAGS) -o $@ $^ -pthread
+
+$(BUILD_DIR)/HostOs.o: $(HOST_TEST_DIR)/HostOs.c $(HOST_TEST_DIR)/HostOs.h | $(BUILD_DIR)
+	$(CC) $(CFLAGS) -pthread -c -o $@ $<
+
+#
+# One rule per source, as the sources may come from several directories.
+#
+define EDK2_OBJECT_RULE
+$(BUILD_DIR)/$(notdir $(1:.c=.o)): $(1) $(EDK2_DEPS) $(HOST_TEST_DIR)/HostOs.h | $(BUILD_DIR)
+	$$(CC) $$(EDK2_CFLAGS) -c -o $$@ $$<
+endef
+$(foreach Source,$(EDK2_SOURCES),$(eval $(call EDK2_OBJECT_RULE,$(Source))))
+
+$(BUILD_DIR):
+	mkdir -p $@
+
+run: $(BUILD_DIR)/$(PROGRAM)
+	$(BUILD_DIR)/$(PROGRAM) $(RUN_ARGS)
+
+clean:
+	rm -rf $(BUILD_DIR)
+
+.PHONY: all run clean
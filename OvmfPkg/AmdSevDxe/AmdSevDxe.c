@@ -16,6 +16,7 @@
 
 **/
 
+#include <Guid/EventGroup.h>
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
@@ -23,6 +24,62 @@
 #include <Library/MemEncryptSevLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Register/Amd/Ghcb.h>
+
+/**
+  Report the CPUID and MMIO decode cache statistics of the SEV-ES #VC handler,
+  and the string I/O exits saved by its scratch areas, summed over the per-CPU
+  data pages that follow each CPU's GHCB.
+
+  @param[in] Event    Event whose notification function is being invoked.
+  @param[in] Context  Unused.
+**/
+STATIC
+VOID
+EFIAPI
+AmdSevEsExitBootServices (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  UINT8                *GhcbBase;
+  UINTN                GhcbSize;
+  UINTN                Offset;
+  SEV_ES_PER_CPU_DATA  *PerCpuData;
+  UINT64               Hits;
+  UINT64               Misses;
+  UINT64               MmioHits;
+  UINT64               MmioMisses;
+  UINT64               ExitsAvoided;
+
+  GhcbBase     = (UINT8 *)(UINTN) PcdGet64 (PcdGhcbBase);
+  GhcbSize     = (UINTN) (PcdGet64 (PcdGhcbSize) -
+                          PcdGet64 (PcdGhcbScratchSize));
+  Hits         = 0;
+  Misses       = 0;
+  MmioHits     = 0;
+  MmioMisses   = 0;
+  ExitsAvoided = 0;
+
+  for (Offset = 0;
+       Offset < GhcbSize;
+       Offset += EFI_PAGES_TO_SIZE (GHCB_PER_CPU_PAGES)) {
+    PerCpuData = GhcbGetPerCpuData ((GHCB *)(GhcbBase + Offset));
+    Hits         += PerCpuData->CpuidCacheHits;
+    Misses       += PerCpuData->CpuidCacheMisses;
+    MmioHits     += PerCpuData->MmioCacheHits;
+    MmioMisses   += PerCpuData->MmioCacheMisses;
+    ExitsAvoided += PerCpuData->ScratchExitsAvoided;
+  }
+
+  DEBUG ((DEBUG_INFO, "SEV-ES: #VC CPUID cache: Hits=%Lu Misses=%Lu\n",
+    Hits, Misses));
+  DEBUG ((DEBUG_INFO, "SEV-ES: #VC MMIO cache: Hits=%Lu Misses=%Lu\n",
+    MmioHits, MmioMisses));
+  DEBUG ((DEBUG_INFO, "SEV-ES: #VC scratch area: string I/O exits avoided=%Lu\n",
+    ExitsAvoided));
+}
 
 EFI_STATUS
 EFIAPI
@@ -35,6 +92,9 @@ AmdSevDxeEntryPoint (
   EFI_GCD_MEMORY_SPACE_DESCRIPTOR  *AllDescMap;
   UINTN                            NumEntries;
   UINTN                            Index;
+  MEM_ENCRYPT_SEV_RANGE            *Ranges;
+  UINTN                            NumRanges;
+  EFI_EVENT                        ExitBootEvent;
 
   //
   // Do nothing when SEV is not enabled
@@ -50,24 +110,52 @@ AmdSevDxeEntryPoint (
   // NonExistent memory space can gurantee that current and furture MMIO adds
   // will have C-bit cleared.
   //
+  // The GCD map is sorted by base address; collect the ranges and update them
+  // in one go, so that adjacent ranges are coalesced and the TLB is flushed
+  // only once. If the array of ranges cannot be allocated, update the ranges
+  // one by one instead.
+  //
   Status = gDS->GetMemorySpaceMap (&NumEntries, &AllDescMap);
   if (!EFI_ERROR (Status)) {
+    Ranges = AllocatePool (NumEntries * sizeof *Ranges);
+    NumRanges = 0;
+
     for (Index = 0; Index < NumEntries; Index++) {
       CONST EFI_GCD_MEMORY_SPACE_DESCRIPTOR *Desc;
 
       Desc = &AllDescMap[Index];
       if (Desc->GcdMemoryType == EfiGcdMemoryTypeMemoryMappedIo ||
           Desc->GcdMemoryType == EfiGcdMemoryTypeNonExistent) {
-        Status = MemEncryptSevClearPageEncMask (
-                   0,
-                   Desc->BaseAddress,
-                   EFI_SIZE_TO_PAGES (Desc->Length),
-                   FALSE
-                   );
-        ASSERT_EFI_ERROR (Status);
+        if (Ranges != NULL) {
+          Ranges[NumRanges].BaseAddress = Desc->BaseAddress;
+          Ranges[NumRanges].NumPages    = EFI_SIZE_TO_PAGES (Desc->Length);
+          NumRanges++;
+        } else {
+          Status = MemEncryptSevClearPageEncMask (
+                     0,
+                     Desc->BaseAddress,
+                     EFI_SIZE_TO_PAGES (Desc->Length),
+                     FALSE
+                     );
+          ASSERT_EFI_ERROR (Status);
+        }
       }
     }
 
+    if (NumRanges > 0) {
+      Status = MemEncryptSevUpdatePageEncMaskRanges (
+                 0,
+                 Ranges,
+                 NumRanges,
+                 MemEncryptSevDecrypt,
+                 FALSE
+                 );
+      ASSERT_EFI_ERROR (Status);
+    }
+
+    if (Ranges != NULL) {
+      FreePool (Ranges);
+    }
     FreePool (AllDescMap);
   }
 
@@ -121,5 +209,17 @@ AmdSevDxeEntryPoint (
     }
   }
 
+  if (MemEncryptSevEsIsEnabled () && PcdGet64 (PcdGhcbSize) != 0) {
+    Status = gBS->CreateEventEx (
+                    EVT_NOTIFY_SIGNAL,
+                    TPL_CALLBACK,
+                    AmdSevEsExitBootServices,
+                    NULL,
+                    &gEfiEventExitBootServicesGuid,
+                    &ExitBootEvent
+                    );
+    ASSERT_EFI_ERROR (Status);
+  }
+
   return EFI_SUCCESS;
 }
@@ -0,0 +1,219 @@
+/** @file
+  Decode the data of a chunked LZMA GUIDed section on several processors.
+
+  This program and the accompanying materials are licensed and made available
+  under the terms and conditions of the BSD License which accompanies this
+  distribution. The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS, WITHOUT
+  WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <Pi/PiFirmwareFile.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/SynchronizationLib.h>
+
+#include "ChunkedLzma.h"
+
+//
+// The smallest LZMA stream: the properties and the decoded size.
+//
+#define CHUNKED_LZMA_MIN_STREAM_SIZE  13
+
+/**
+  Return the decoded size of a chunk.
+**/
+STATIC
+UINT32
+ChunkedLzmaChunkSize (
+  IN CONST CHUNKED_LZMA_HEADER  *Header,
+  IN UINT32                     Index
+  )
+{
+  return MIN (Header->ChunkSize, Header->OriginalSize - Index * Header->ChunkSize);
+}
+
+/**
+  Validate the data of a chunked LZMA GUIDed section, and initialize the
+  fields of a context that describe it.
+
+  @param[out] Context       The context to initialize; the fields that the
+                            caller sets are zeroed.
+  @param[in]  Data          The section data, starting with the
+                            CHUNKED_LZMA_HEADER.
+  @param[in]  DataSize      The size of the section data.
+  @param[in]  GetInfo       The get info handler of the LZMA custom decompress
+                            GUID.
+  @param[out] OriginalSize  The size of the decoded data.
+  @param[out] ScratchSize   The size of the scratch buffer that decoding one
+                            chunk needs.
+
+  @retval RETURN_SUCCESS            The data is valid.
+  @retval RETURN_INVALID_PARAMETER  The data is not valid chunked LZMA data.
+**/
+RETURN_STATUS
+ChunkedLzmaGetInfo (
+  OUT CHUNKED_LZMA_CONTEXT                     *Context,
+  IN  CONST VOID                               *Data,
+  IN  UINT32                                   DataSize,
+  IN  EXTRACT_GUIDED_SECTION_GET_INFO_HANDLER  GetInfo,
+  OUT UINT32                                   *OriginalSize,
+  OUT UINT32                                   *ScratchSize
+  )
+{
+  CONST CHUNKED_LZMA_HEADER        *Header;
+  CONST UINT32                     *ChunkOffset;
+  UINT32                           TableEnd;
+  UINT32                           Index;
+  CONST EFI_COMMON_SECTION_HEADER  *Section;
+  UINT32                           SectionSize;
+  UINT16                           DataOffset;
+  UINT32                           ChunkOutputSize;
+  UINT32                           ChunkScratchSize;
+  UINT16                           Attributes;
+  RETURN_STATUS                    Status;
+
+  ZeroMem (Context, sizeof *Context);
+  if (DataSize < sizeof *Header) {
+    return RETURN_INVALID_PARAMETER;
+  }
+
+  Header = Data;
+  if (Header->Signature != CHUNKED_LZMA_SIGNATURE ||
+      Header->ChunkSize == 0 ||
+      Header->OriginalSize == 0 ||
+      Header->ChunkCount != (Header->OriginalSize - 1) / Header->ChunkSize + 1 ||
+      Header->ChunkCount > (DataSize - sizeof *Header) / sizeof *ChunkOffset) {
+    return RETURN_INVALID_PARAMETER;
+  }
+  ChunkOffset = (CONST UINT32 *)(Header + 1);
+  TableEnd    = sizeof *Header + Header->ChunkCount * sizeof *ChunkOffset;
+
+  *ScratchSize = 0;
+  for (Index = 0; Index < Header->ChunkCount; Index++) {
+    //
+    // Each chunk is an aligned LZMA GUIDed section with a 24-bit size, within
+    // the data, after the offset table.
+    //
+    if (ChunkOffset[Index] < TableEnd ||
+        ChunkOffset[Index] % sizeof (UINT32) != 0 ||
+        ChunkOffset[Index] > DataSize - sizeof (EFI_GUID_DEFINED_SECTION)) {
+      return RETURN_INVALID_PARAMETER;
+    }
+    Section     = (CONST EFI_COMMON_SECTION_HEADER *)
+                    ((CONST UINT8 *)Data + ChunkOffset[Index]);
+    SectionSize = SECTION_SIZE (Section);
+    DataOffset  = ((CONST EFI_GUID_DEFINED_SECTION *)Section)->DataOffset;
+    if (Section->Type != EFI_SECTION_GUID_DEFINED ||
+        IS_SECTION2 (Section) ||
+        SectionSize > DataSize - ChunkOffset[Index] ||
+        DataOffset < sizeof (EFI_GUID_DEFINED_SECTION) ||
+        SectionSize < DataOffset + CHUNKED_LZMA_MIN_STREAM_SIZE) {
+      return RETURN_INVALID_PARAMETER;
+    }
+
+    Status = GetInfo (Section, &ChunkOutputSize, &ChunkScratchSize, &Attributes);
+    if (RETURN_ERROR (Status) ||
+        ChunkOutputSize != ChunkedLzmaChunkSize (Header, Index)) {
+      return RETURN_INVALID_PARAMETER;
+    }
+    *ScratchSize = MAX (*ScratchSize, ChunkScratchSize);
+  }
+
+  Context->Data        = Data;
+  Context->Header      = Header;
+  Context->ChunkOffset = ChunkOffset;
+  *OriginalSize = Header->OriginalSize;
+  return RETURN_SUCCESS;
+}
+
+/**
+  Decode chunks until no chunk is left.
+
+  The function runs on any processor, and only uses the decode handler and
+  the synchronization primitives.
+
+  @param[in,out] Context  The CHUNKED_LZMA_CONTEXT of the section.
+**/
+VOID
+EFIAPI
+ChunkedLzmaWorker (
+  IN OUT VOID  *Context
+  )
+{
+  CHUNKED_LZMA_CONTEXT  *Chunked;
+  UINT32                ScratchIndex;
+  VOID                  *Scratch;
+  UINT32                Index;
+  UINT8                 *Output;
+  VOID                  *Decoded;
+  UINT32                AuthenticationStatus;
+  RETURN_STATUS         Status;
+
+  Chunked = Context;
+  ScratchIndex = InterlockedIncrement (&Chunked->NextScratch) - 1;
+  if (ScratchIndex >= Chunked->ScratchCount) {
+    return;
+  }
+  Scratch = Chunked->Scratch + ScratchIndex * Chunked->ScratchSize;
+
+  for (;;) {
+    Index = InterlockedIncrement (&Chunked->NextChunk) - 1;
+    if (Index >= Chunked->Header->ChunkCount) {
+      return;
+    }
+
+    if (Index == 0) {
+      Output = Chunked->Bounce;
+    } else {
+      Output = Chunked->Destination +
+               Index * Chunked->Header->ChunkSize - Chunked->Skip;
+    }
+    Decoded = Output;
+    Status = Chunked->Decode (
+                        Chunked->Data + Chunked->ChunkOffset[Index],
+                        &Decoded,
+                        Scratch,
+                        &AuthenticationStatus
+                        );
+    if (RETURN_ERROR (Status) || Decoded != Output) {
+      InterlockedIncrement (&Chunked->Failures);
+      continue;
+    }
+
+    if (Index == 0) {
+      CopyMem (
+        Chunked->Destination,
+        Chunked->Bounce + Chunked->Skip,
+        ChunkedLzmaChunkSize (Chunked->Header, 0) - Chunked->Skip
+        );
+    }
+  }
+}
+
+/**
+  Report the result of the workers, after all of them have returned.
+
+  @param[in] Context  The CHUNKED_LZMA_CONTEXT of the section.
+
+  @retval RETURN_SUCCESS            All chunks have been decoded.
+  @retval RETURN_INVALID_PARAMETER  A chunk could not be decoded.
+  @retval RETURN_NOT_READY          Chunks are left; no worker had a scratch
+                                    buffer for them.
+**/
+RETURN_STATUS
+ChunkedLzmaGetStatus (
+  IN CONST CHUNKED_LZMA_CONTEXT  *Context
+  )
+{
+  if (Context->Failures != 0) {
+    return RETURN_INVALID_PARAMETER;
+  }
+  if (Context->NextChunk < Context->Header->ChunkCount) {
+    return RETURN_NOT_READY;
+  }
+  return RETURN_SUCCESS;
+}
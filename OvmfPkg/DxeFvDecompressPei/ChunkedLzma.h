@@ -0,0 +1,113 @@
+/** @file
+  Decode the data of a chunked LZMA GUIDed section on several processors.
+
+  ChunkedLzmaGetInfo() validates the section data on one processor. Then
+  ChunkedLzmaWorker() is run on any number of processors, up to the number of
+  scratch buffers, with the same CHUNKED_LZMA_CONTEXT; each call claims chunks
+  until none is left, and decodes them through the LZMA decode handler only.
+  When all calls have returned, ChunkedLzmaGetStatus() reports the result.
+
+  This program and the accompanying materials are licensed and made available
+  under the terms and conditions of the BSD License which accompanies this
+  distribution. The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS, WITHOUT
+  WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef _CHUNKED_LZMA_H_
+#define _CHUNKED_LZMA_H_
+
+#include <Guid/ChunkedLzmaSection.h>
+#include <Library/ExtractGuidedSectionLib.h>
+
+typedef struct {
+  //
+  // Set by ChunkedLzmaGetInfo().
+  //
+  CONST UINT8                            *Data;
+  CONST CHUNKED_LZMA_HEADER              *Header;
+  CONST UINT32                           *ChunkOffset;
+  //
+  // Set by the caller before the workers start.
+  //
+  // Decoded byte Skip of the data is written to Destination; the bytes before
+  // it are not written anywhere else than to Bounce, where chunk 0 is decoded
+  // in full. Skip is below the size of chunk 0, and Bounce has room for
+  // chunk 0. The scratch buffers are ScratchSize bytes each.
+  //
+  EXTRACT_GUIDED_SECTION_DECODE_HANDLER  Decode;
+  UINT8                                  *Destination;
+  UINT32                                 Skip;
+  UINT8                                  *Bounce;
+  UINT8                                  *Scratch;
+  UINT32                                 ScratchSize;
+  UINT32                                 ScratchCount;
+  //
+  // Updated by the workers.
+  //
+  volatile UINT32                        NextScratch;
+  volatile UINT32                        NextChunk;
+  volatile UINT32                        Failures;
+} CHUNKED_LZMA_CONTEXT;
+
+/**
+  Validate the data of a chunked LZMA GUIDed section, and initialize the
+  fields of a context that describe it.
+
+  @param[out] Context       The context to initialize; the fields that the
+                            caller sets are zeroed.
+  @param[in]  Data          The section data, starting with the
+                            CHUNKED_LZMA_HEADER.
+  @param[in]  DataSize      The size of the section data.
+  @param[in]  GetInfo       The get info handler of the LZMA custom decompress
+                            GUID.
+  @param[out] OriginalSize  The size of the decoded data.
+  @param[out] ScratchSize   The size of the scratch buffer that decoding one
+                            chunk needs.
+
+  @retval RETURN_SUCCESS            The data is valid.
+  @retval RETURN_INVALID_PARAMETER  The data is not valid chunked LZMA data.
+**/
+RETURN_STATUS
+ChunkedLzmaGetInfo (
+  OUT CHUNKED_LZMA_CONTEXT                     *Context,
+  IN  CONST VOID                               *Data,
+  IN  UINT32                                   DataSize,
+  IN  EXTRACT_GUIDED_SECTION_GET_INFO_HANDLER  GetInfo,
+  OUT UINT32                                   *OriginalSize,
+  OUT UINT32                                   *ScratchSize
+  );
+
+/**
+  Decode chunks until no chunk is left.
+
+  The function runs on any processor, and only uses the decode handler and
+  the synchronization primitives.
+
+  @param[in,out] Context  The CHUNKED_LZMA_CONTEXT of the section.
+**/
+VOID
+EFIAPI
+ChunkedLzmaWorker (
+  IN OUT VOID  *Context
+  );
+
+/**
+  Report the result of the workers, after all of them have returned.
+
+  @param[in] Context  The CHUNKED_LZMA_CONTEXT of the section.
+
+  @retval RETURN_SUCCESS            All chunks have been decoded.
+  @retval RETURN_INVALID_PARAMETER  A chunk could not be decoded.
+  @retval RETURN_NOT_READY          Chunks are left; no worker had a scratch
+                                    buffer for them.
+**/
+RETURN_STATUS
+ChunkedLzmaGetStatus (
+  IN CONST CHUNKED_LZMA_CONTEXT  *Context
+  );
+
+#endif
@@ -0,0 +1,384 @@
+/** @file
+  Decompress DXEFV in PEI, on all processors.
+
+  SEC only decompresses PEIFV. The FDF stores DXEFV in FVMAIN_COMPACT as a
+  chunked LZMA GUIDed section (see Guid/ChunkedLzmaSection.h), whose chunks
+  this PEIM decodes into PcdOvmfDxeMemFvBase on the APs, through the PEI MP
+  services, and then on the BSP, which the blocking StartupAllAPs() keeps
+  idle until the APs are done. Finally it publishes DXEFV to PEI and DXE.
+
+  If FVMAIN_COMPACT has no chunked LZMA section, SEC has decompressed DXEFV
+  together with PEIFV, and this PEIM only publishes it.
+
+  On S3 resume, DXEFV is not needed, and the PEIM does nothing.
+
+  This program and the accompanying materials are licensed and made available
+  under the terms and conditions of the BSD License which accompanies this
+  distribution. The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS, WITHOUT
+  WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <PiPei.h>
+#include <Guid/LzmaDecompress.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/HobLib.h>
+#include <Library/PcdLib.h>
+#include <Library/PeiServicesLib.h>
+#include <Library/PerformanceLib.h>
+#include <Ppi/MpServices.h>
+
+#include "ChunkedLzma.h"
+
+/**
+  Find the chunked LZMA GUIDed section in an FV_IMAGE file of FVMAIN_COMPACT.
+
+  @param[out] Data      The data of the section.
+  @param[out] DataSize  The size of the data.
+
+  @retval EFI_SUCCESS           The section has been found.
+  @retval EFI_NOT_FOUND         FVMAIN_COMPACT has no such section.
+  @retval EFI_VOLUME_CORRUPTED  FVMAIN_COMPACT is corrupted.
+**/
+STATIC
+EFI_STATUS
+FindChunkedLzmaSection (
+  OUT CONST VOID  **Data,
+  OUT UINT32      *DataSize
+  )
+{
+  EFI_FIRMWARE_VOLUME_HEADER  *Fv;
+  UINTN                       FvEnd;
+  UINTN                       FileAddress;
+  EFI_FFS_FILE_HEADER         *File;
+  UINTN                       FileEnd;
+  UINTN                       SectionAddress;
+  EFI_COMMON_SECTION_HEADER   *Section;
+  UINT32                      SectionSize;
+  UINT32                      HeaderSize;
+  EFI_GUID                    *SectionGuid;
+  UINT16                      DataOffset;
+
+  Fv = (EFI_FIRMWARE_VOLUME_HEADER *)(UINTN) PcdGet32 (PcdOvmfFvMainCompactBase);
+  if (Fv->Signature != EFI_FVH_SIGNATURE ||
+      Fv->FvLength > PcdGet32 (PcdOvmfFvMainCompactSize) ||
+      Fv->HeaderLength > Fv->FvLength) {
+    DEBUG ((DEBUG_ERROR, "%a: no FV header at %p\n", __FUNCTION__, Fv));
+    return EFI_VOLUME_CORRUPTED;
+  }
+  FvEnd = (UINTN)Fv + (UINTN)Fv->FvLength;
+
+  //
+  // Loop through the FFS files, up to the free space.
+  //
+  for (FileEnd = (UINTN)Fv + Fv->HeaderLength; ; ) {
+    FileAddress = ALIGN_VALUE (FileEnd, 8);
+    if (FileAddress + sizeof (EFI_FFS_FILE_HEADER) > FvEnd) {
+      return EFI_NOT_FOUND;
+    }
+    File = (EFI_FFS_FILE_HEADER *)FileAddress;
+    if (IS_FFS_FILE2 (File)) {
+      //
+      // FVMAIN_COMPACT has no large files.
+      //
+      return EFI_NOT_FOUND;
+    }
+    if (FFS_FILE_SIZE (File) == 0xFFFFFF) {
+      return EFI_NOT_FOUND;
+    }
+    if (FFS_FILE_SIZE (File) < sizeof (EFI_FFS_FILE_HEADER) ||
+        FFS_FILE_SIZE (File) > FvEnd - FileAddress) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+    FileEnd = FileAddress + FFS_FILE_SIZE (File);
+
+    if (File->Type != EFI_FV_FILETYPE_FIRMWARE_VOLUME_IMAGE) {
+      continue;
+    }
+
+    //
+    // Loop through the sections of the file.
+    //
+    for (SectionAddress = (UINTN)(File + 1);
+         SectionAddress + sizeof (EFI_COMMON_SECTION_HEADER2) <= FileEnd;
+         SectionAddress = ALIGN_VALUE (SectionAddress + SectionSize, 4)) {
+      Section = (EFI_COMMON_SECTION_HEADER *)SectionAddress;
+      if (IS_SECTION2 (Section)) {
+        SectionSize = SECTION2_SIZE (Section);
+        HeaderSize  = sizeof (EFI_GUID_DEFINED_SECTION2);
+      } else {
+        SectionSize = SECTION_SIZE (Section);
+        HeaderSize  = sizeof (EFI_GUID_DEFINED_SECTION);
+      }
+      if (SectionSize < sizeof (EFI_COMMON_SECTION_HEADER) ||
+          SectionSize > FileEnd - SectionAddress) {
+        return EFI_VOLUME_CORRUPTED;
+      }
+      if (Section->Type != EFI_SECTION_GUID_DEFINED ||
+          SectionSize < HeaderSize) {
+        continue;
+      }
+
+      if (IS_SECTION2 (Section)) {
+        SectionGuid = &((EFI_GUID_DEFINED_SECTION2 *)Section)->SectionDefinitionGuid;
+        DataOffset  = ((EFI_GUID_DEFINED_SECTION2 *)Section)->DataOffset;
+      } else {
+        SectionGuid = &((EFI_GUID_DEFINED_SECTION *)Section)->SectionDefinitionGuid;
+        DataOffset  = ((EFI_GUID_DEFINED_SECTION *)Section)->DataOffset;
+      }
+      if (!CompareGuid (SectionGuid, &gChunkedLzmaSectionGuid)) {
+        continue;
+      }
+      if (DataOffset < HeaderSize || DataOffset > SectionSize) {
+        return EFI_VOLUME_CORRUPTED;
+      }
+      *Data     = (UINT8 *)Section + DataOffset;
+      *DataSize = SectionSize - DataOffset;
+      return EFI_SUCCESS;
+    }
+  }
+}
+
+/**
+  Check that the decoded data is a sequence of sections that ends with the
+  FV_IMAGE section of DXEFV.
+
+  @param[in] Sections      The start of the decoded data.
+  @param[in] FvOffset      The offset of DXEFV in the decoded data; the
+                           sections before it are at Sections.
+  @param[in] OriginalSize  The size of the decoded data.
+
+  @retval TRUE  The FV at FvOffset is the data of the last section, an
+                FV_IMAGE section.
+**/
+STATIC
+BOOLEAN
+IsDxeFvSection (
+  IN CONST UINT8  *Sections,
+  IN UINT32       FvOffset,
+  IN UINT32       OriginalSize
+  )
+{
+  UINT32                           Offset;
+  CONST EFI_COMMON_SECTION_HEADER  *Section;
+  UINT32                           SectionSize;
+  UINT32                           HeaderSize;
+
+  for (Offset = 0;
+       Offset + sizeof (EFI_COMMON_SECTION_HEADER) <= FvOffset;
+       Offset = ALIGN_VALUE (Offset + SectionSize, 4)) {
+    Section = (CONST EFI_COMMON_SECTION_HEADER *)(Sections + Offset);
+    if (IS_SECTION2 (Section)) {
+      SectionSize = SECTION2_SIZE (Section);
+      HeaderSize  = sizeof (EFI_COMMON_SECTION_HEADER2);
+    } else {
+      SectionSize = SECTION_SIZE (Section);
+      HeaderSize  = sizeof (EFI_COMMON_SECTION_HEADER);
+    }
+    if (SectionSize < HeaderSize || SectionSize > OriginalSize - Offset) {
+      return FALSE;
+    }
+    if (Section->Type == EFI_SECTION_FIRMWARE_VOLUME_IMAGE) {
+      return Offset + HeaderSize == FvOffset &&
+             Offset + SectionSize == OriginalSize;
+    }
+  }
+  return FALSE;
+}
+
+/**
+  Decode the chunked LZMA section of DXEFV into PcdOvmfDxeMemFvBase.
+
+  @param[in] PeiServices  The PEI services table.
+  @param[in] Data         The data of the chunked LZMA section.
+  @param[in] DataSize     The size of the data.
+
+  @retval EFI_SUCCESS           DXEFV has been decoded.
+  @retval EFI_VOLUME_CORRUPTED  The section does not hold DXEFV, or it could
+                                not be decoded.
+  @return                       Error returned by a PEI service.
+**/
+STATIC
+EFI_STATUS
+DecompressDxeFv (
+  IN CONST EFI_PEI_SERVICES  **PeiServices,
+  IN CONST VOID              *Data,
+  IN UINT32                  DataSize
+  )
+{
+  EXTRACT_GUIDED_SECTION_GET_INFO_HANDLER  GetInfo;
+  EXTRACT_GUIDED_SECTION_DECODE_HANDLER    Decode;
+  CHUNKED_LZMA_CONTEXT                     Context;
+  UINT32                                   OriginalSize;
+  UINT32                                   ScratchSize;
+  UINT32                                   DxeMemFvSize;
+  UINT32                                   BounceSize;
+  EFI_PEI_MP_SERVICES_PPI                  *MpServices;
+  UINTN                                    ProcessorCount;
+  UINTN                                    EnabledProcessorCount;
+  UINTN                                    Pages;
+  EFI_PHYSICAL_ADDRESS                     Buffer;
+  EFI_STATUS                               Status;
+
+  Status = ExtractGuidedSectionGetHandlers (
+             &gLzmaCustomDecompressGuid,
+             &GetInfo,
+             &Decode
+             );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: no LZMA handlers: %r\n", __FUNCTION__, Status));
+    return Status;
+  }
+
+  Status = ChunkedLzmaGetInfo (&Context, Data, DataSize, GetInfo,
+             &OriginalSize, &ScratchSize);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: invalid chunked LZMA data\n", __FUNCTION__));
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  //
+  // The decoded data ends with the FV_IMAGE section of DXEFV, after padding
+  // sections that align the FV. Only the FV goes to PcdOvmfDxeMemFvBase; the
+  // sections before it land in the bounce buffer of chunk 0, and would
+  // precede PcdOvmfDxeMemFvBase otherwise.
+  //
+  DxeMemFvSize = PcdGet32 (PcdOvmfDxeMemFvSize);
+  BounceSize   = MIN (Context.Header->ChunkSize, OriginalSize);
+  if (OriginalSize <= DxeMemFvSize ||
+      OriginalSize - DxeMemFvSize >= BounceSize) {
+    DEBUG ((DEBUG_ERROR, "%a: decoded size 0x%x does not match DXEFV\n",
+      __FUNCTION__, OriginalSize));
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  Status = PeiServicesLocatePpi (&gEfiPeiMpServicesPpiGuid, 0, NULL,
+             (VOID **)&MpServices);
+  ASSERT_EFI_ERROR (Status);
+  Status = MpServices->GetNumberOfProcessors (PeiServices, MpServices,
+                         &ProcessorCount, &EnabledProcessorCount);
+  if (EFI_ERROR (Status)) {
+    EnabledProcessorCount = 1;
+  }
+
+  //
+  // One scratch buffer per processor, and the bounce buffer of chunk 0.
+  //
+  ScratchSize = ALIGN_VALUE (ScratchSize, EFI_PAGE_SIZE);
+  Pages = EFI_SIZE_TO_PAGES (BounceSize) +
+          EnabledProcessorCount * EFI_SIZE_TO_PAGES (ScratchSize);
+  Status = PeiServicesAllocatePages (EfiBootServicesData, Pages, &Buffer);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Context.Decode       = Decode;
+  Context.Destination  = (UINT8 *)(UINTN) PcdGet32 (PcdOvmfDxeMemFvBase);
+  Context.Skip         = OriginalSize - DxeMemFvSize;
+  Context.Bounce       = (UINT8 *)(UINTN)Buffer;
+  Context.Scratch      = Context.Bounce + EFI_PAGES_TO_SIZE (EFI_SIZE_TO_PAGES (BounceSize));
+  Context.ScratchSize  = ScratchSize;
+  Context.ScratchCount = (UINT32)EnabledProcessorCount;
+
+  DEBUG ((DEBUG_INFO, "%a: %u chunks of %u KB, %u processor(s)\n",
+    __FUNCTION__, Context.Header->ChunkCount, Context.Header->ChunkSize >> 10,
+    Context.ScratchCount));
+
+  PERF_START (NULL, "DxeFvDecompress", "DxeFvDecompressPei", 0);
+  Status = MpServices->StartupAllAPs (PeiServices, MpServices,
+                         ChunkedLzmaWorker, FALSE, 0, &Context);
+  if (EFI_ERROR (Status) && Status != EFI_NOT_STARTED) {
+    DEBUG ((DEBUG_WARN, "%a: StartupAllAPs(): %r\n", __FUNCTION__, Status));
+  }
+  //
+  // The BSP decodes whatever the APs have left, all of DXEFV without APs.
+  //
+  ChunkedLzmaWorker (&Context);
+  PERF_END (NULL, "DxeFvDecompress", "DxeFvDecompressPei", 0);
+
+  Status = ChunkedLzmaGetStatus (&Context);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: decoding failed: %r\n", __FUNCTION__, Status));
+    Status = EFI_VOLUME_CORRUPTED;
+  } else if (!IsDxeFvSection (Context.Bounce, Context.Skip, OriginalSize)) {
+    DEBUG ((DEBUG_ERROR, "%a: no DXEFV section\n", __FUNCTION__));
+    Status = EFI_VOLUME_CORRUPTED;
+  }
+
+  PeiServicesFreePages (Buffer, Pages);
+  return Status;
+}
+
+/**
+  Entry point of the PEIM.
+
+  @param[in] FileHandle   Handle of the file being invoked.
+  @param[in] PeiServices  Describes the list of possible PEI Services.
+
+  @retval EFI_SUCCESS  DXEFV has been published, or the boot is an S3 resume.
+  @return              DXEFV could not be decompressed.
+**/
+EFI_STATUS
+EFIAPI
+DxeFvDecompressPeiEntryPoint (
+  IN       EFI_PEI_FILE_HANDLE  FileHandle,
+  IN CONST EFI_PEI_SERVICES     **PeiServices
+  )
+{
+  EFI_BOOT_MODE               BootMode;
+  CONST VOID                  *Data;
+  UINT32                      DataSize;
+  EFI_FIRMWARE_VOLUME_HEADER  *DxeMemFv;
+  EFI_STATUS                  Status;
+
+  Status = PeiServicesGetBootMode (&BootMode);
+  ASSERT_EFI_ERROR (Status);
+  if (BootMode == BOOT_ON_S3_RESUME) {
+    return EFI_SUCCESS;
+  }
+
+  Status = FindChunkedLzmaSection (&Data, &DataSize);
+  if (Status == EFI_NOT_FOUND) {
+    DEBUG ((DEBUG_INFO, "%a: SEC has decompressed DXEFV\n", __FUNCTION__));
+  } else if (!EFI_ERROR (Status)) {
+    Status = DecompressDxeFv (PeiServices, Data, DataSize);
+    if (EFI_ERROR (Status)) {
+      ASSERT_EFI_ERROR (Status);
+      return Status;
+    }
+  } else {
+    ASSERT_EFI_ERROR (Status);
+    return Status;
+  }
+
+  DxeMemFv = (EFI_FIRMWARE_VOLUME_HEADER *)(UINTN) PcdGet32 (PcdOvmfDxeMemFvBase);
+  if (DxeMemFv->Signature != EFI_FVH_SIGNATURE) {
+    DEBUG ((DEBUG_ERROR, "%a: DXEFV at %p has no FV header signature\n",
+      __FUNCTION__, DxeMemFv));
+    ASSERT (FALSE);
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  //
+  // Let DXE know about the DXE FV
+  //
+  BuildFvHob ((UINTN)DxeMemFv, PcdGet32 (PcdOvmfDxeMemFvSize));
+
+  //
+  // Let PEI know about the DXE FV so it can find the DXE Core
+  //
+  PeiServicesInstallFvInfoPpi (
+    NULL,
+    DxeMemFv,
+    PcdGet32 (PcdOvmfDxeMemFvSize),
+    NULL,
+    NULL
+    );
+
+  return EFI_SUCCESS;
+}
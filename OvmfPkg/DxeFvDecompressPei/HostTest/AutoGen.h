@@ -0,0 +1,17 @@
+/** @file
+  Host replacement for the AutoGen.h file of DxeFvDecompressPei.
+
+**/
+
+#ifndef _DXE_FV_HOST_AUTOGEN_H_
+#define _DXE_FV_HOST_AUTOGEN_H_
+
+extern CHAR8  *gEfiCallerBaseName;
+
+RETURN_STATUS
+EFIAPI
+LzmaDecompressLibConstructor (
+  VOID
+  );
+
+#endif
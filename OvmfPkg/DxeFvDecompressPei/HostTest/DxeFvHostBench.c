@@ -0,0 +1,413 @@
+/** @file
+  Host test and benchmark of the chunked LZMA decoding of DxeFvDecompressPei.
+
+  The benchmark decodes the same data compressed as one LZMA stream, which is
+  how SEC decompresses PEIFV and DXEFV together, and as chunked LZMA data,
+  which is how DxeFvDecompressPei decompresses DXEFV:
+
+  - it times the one stream, and each chunk on its own;
+  - from the chunk times, it models the decoding time in PEI for a number of
+    VCPUs: the BSP is idle in StartupAllAPs() while the APs claim the chunks
+    in order, so the chunks are scheduled on (VCPUs - 1) workers;
+  - it runs ChunkedLzmaWorker() on threads, checks the decoded data, and
+    reports the time, which only shows a speedup on a host with as many free
+    CPUs as threads.
+
+  It also checks that ChunkedLzmaGetInfo() rejects damaged data, and that
+  ChunkedLzmaWorker() only uses as many processors as there are scratch
+  buffers.
+
+  Usage: DxeFvHostBench <original> <LZMA stream> <chunked LZMA data> [skip]
+
+  Skip is the number of leading decoded bytes that are not written to the
+  destination, like the section headers before DXEFV.
+
+**/
+
+#include <Base.h>
+#include <Pi/PiFirmwareFile.h>
+#include <Guid/LzmaDecompress.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include "ChunkedLzma.h"
+#include "HostOs.h"
+
+#define FAIL(Args)  do { HostPrint Args; mFailures++; } while (FALSE)
+
+STATIC CONST UINTN  mVcpuCounts[]   = { 1, 2, 4, 8, 16 };
+STATIC CONST UINTN  mThreadCounts[] = { 1, 2, 4 };
+
+STATIC UINTN                                    mFailures;
+STATIC EXTRACT_GUIDED_SECTION_GET_INFO_HANDLER  mGetInfo;
+STATIC EXTRACT_GUIDED_SECTION_DECODE_HANDLER    mDecode;
+
+STATIC
+UINTN
+ParseNumber (
+  IN CONST CHAR8  *String
+  )
+{
+  UINTN  Value;
+
+  for (Value = 0; *String >= '0' && *String <= '9'; String++) {
+    Value = Value * 10 + (*String - '0');
+  }
+  return Value;
+}
+
+/**
+  Decode one LZMA GUIDed section, and return the time in nanoseconds, or 0 if
+  it cannot be decoded.
+**/
+STATIC
+UINT64
+DecodeSection (
+  IN CONST VOID  *Section,
+  IN VOID        *Output,
+  IN VOID        *Scratch
+  )
+{
+  UINT64         Start;
+  UINT64         Elapsed;
+  VOID           *Decoded;
+  UINT32         AuthenticationStatus;
+  RETURN_STATUS  Status;
+
+  Decoded = Output;
+  Start   = HostNanoseconds ();
+  Status  = mDecode (Section, &Decoded, Scratch, &AuthenticationStatus);
+  Elapsed = HostNanoseconds () - Start;
+  if (RETURN_ERROR (Status) || Decoded != Output) {
+    return 0;
+  }
+  return MAX (Elapsed, 1);
+}
+
+/**
+  Return the time of the chunks on Workers processors, which claim the
+  chunks in order, each one when it is done with its previous chunk.
+**/
+STATIC
+UINT64
+ModelChunkedTime (
+  IN CONST UINT64  *ChunkTimes,
+  IN UINT32        ChunkCount,
+  IN UINTN         Workers
+  )
+{
+  UINT64  Busy[16];
+  UINT32  Index;
+  UINTN   Worker;
+  UINTN   First;
+  UINT64  End;
+
+  ZeroMem (Busy, sizeof Busy);
+  for (Index = 0; Index < ChunkCount; Index++) {
+    First = 0;
+    for (Worker = 1; Worker < Workers; Worker++) {
+      if (Busy[Worker] < Busy[First]) {
+        First = Worker;
+      }
+    }
+    Busy[First] += ChunkTimes[Index];
+  }
+
+  End = 0;
+  for (Worker = 0; Worker < Workers; Worker++) {
+    End = MAX (End, Busy[Worker]);
+  }
+  return End;
+}
+
+/**
+  Run ChunkedLzmaWorker() on Threads threads with ScratchCount scratch
+  buffers, and check the decoded data.
+
+  @return  The time in nanoseconds, or 0 if decoding failed.
+**/
+STATIC
+UINT64
+RunChunked (
+  IN CONST CHUNKED_LZMA_CONTEXT  *Info,
+  IN CONST UINT8                 *Original,
+  IN UINT32                      OriginalSize,
+  IN UINT32                      Skip,
+  IN UINT32                      ScratchSize,
+  IN UINTN                       Threads,
+  IN UINTN                       ScratchCount,
+  IN UINT8                       *Destination,
+  IN UINT8                       *Bounce,
+  IN UINT8                       *Scratch
+  )
+{
+  CHUNKED_LZMA_CONTEXT  Context;
+  UINT64                Start;
+  UINT64                Elapsed;
+  RETURN_STATUS         Status;
+
+  ZeroMem (Destination, OriginalSize - Skip);
+  ZeroMem (Bounce, Info->Header->ChunkSize);
+
+  CopyMem (&Context, Info, sizeof Context);
+  Context.Decode       = mDecode;
+  Context.Destination  = Destination;
+  Context.Skip         = Skip;
+  Context.Bounce       = Bounce;
+  Context.Scratch      = Scratch;
+  Context.ScratchSize  = ScratchSize;
+  Context.ScratchCount = (UINT32)ScratchCount;
+
+  Start = HostNanoseconds ();
+  if (!HostRunParallel (Threads, ChunkedLzmaWorker, &Context)) {
+    FAIL (("%lu threads could not be started\n", (unsigned long)Threads));
+    return 0;
+  }
+  Elapsed = HostNanoseconds () - Start;
+
+  Status = ChunkedLzmaGetStatus (&Context);
+  if (RETURN_ERROR (Status)) {
+    FAIL (("%lu threads, %lu scratch buffers: status 0x%lx\n",
+      (unsigned long)Threads, (unsigned long)ScratchCount,
+      (unsigned long)Status));
+    return 0;
+  }
+  if (CompareMem (Destination, Original + Skip, OriginalSize - Skip) != 0 ||
+      CompareMem (Bounce, Original, Skip) != 0) {
+    FAIL (("%lu threads: wrong data\n", (unsigned long)Threads));
+    return 0;
+  }
+  return MAX (Elapsed, 1);
+}
+
+/**
+  Check that ChunkedLzmaGetInfo() rejects a damaged copy of the data.
+**/
+STATIC
+VOID
+CheckDamaged (
+  IN CONST CHAR8  *Name,
+  IN CONST UINT8  *Chunked,
+  IN UINT32       ChunkedSize,
+  IN UINT32       Offset,
+  IN UINT8        Xor,
+  IN UINT32       Truncate
+  )
+{
+  UINT8                 *Copy;
+  CHUNKED_LZMA_CONTEXT  Context;
+  UINT32                OriginalSize;
+  UINT32                ScratchSize;
+  RETURN_STATUS         Status;
+
+  Copy = HostAllocate (ChunkedSize);
+  if (Copy == NULL) {
+    FAIL (("out of memory\n"));
+    return;
+  }
+  CopyMem (Copy, Chunked, ChunkedSize);
+  Copy[Offset] ^= Xor;
+  Status = ChunkedLzmaGetInfo (&Context, Copy, ChunkedSize - Truncate,
+             mGetInfo, &OriginalSize, &ScratchSize);
+  if (Status != RETURN_INVALID_PARAMETER) {
+    FAIL (("%s: status 0x%lx\n", Name, (unsigned long)Status));
+  }
+  HostFree (Copy);
+}
+
+int
+main (
+  int   Argc,
+  char  **Argv
+  )
+{
+  UINT8                      *Original;
+  UINT8                      *Stream;
+  UINT8                      *Chunked;
+  unsigned long              OriginalSize;
+  unsigned long              StreamSize;
+  unsigned long              ChunkedSize;
+  UINT32                     Skip;
+  EFI_GUID_DEFINED_SECTION   *Section;
+  UINT32                     SectionSize;
+  UINT32                     DecodedSize;
+  UINT32                     ScratchSize;
+  UINT16                     Attributes;
+  UINT8                      *Output;
+  UINT8                      *Scratch;
+  UINT8                      *Bounce;
+  UINT64                     StreamTime;
+  UINT64                     Elapsed;
+  UINT64                     Sum;
+  UINT64                     *ChunkTimes;
+  CHUNKED_LZMA_CONTEXT       Info;
+  CHUNKED_LZMA_CONTEXT       Context;
+  CONST CHUNKED_LZMA_HEADER  *Header;
+  UINT32                     Index;
+  UINTN                      Count;
+  UINTN                      Workers;
+  RETURN_STATUS              Status;
+
+  if (Argc < 4) {
+    HostPrint ("usage: %s <original> <LZMA stream> <chunked LZMA data> "
+      "[skip]\n", Argv[0]);
+    return 1;
+  }
+  Original = HostReadFile (Argv[1], &OriginalSize);
+  Stream   = HostReadFile (Argv[2], &StreamSize);
+  Chunked  = HostReadFile (Argv[3], &ChunkedSize);
+  Skip     = (Argc > 4) ? (UINT32)ParseNumber (Argv[4]) : 0;
+  if (Original == NULL || Stream == NULL || Chunked == NULL) {
+    HostPrint ("cannot read the input files\n");
+    return 1;
+  }
+
+  LzmaDecompressLibConstructor ();
+  Status = ExtractGuidedSectionGetHandlers (&gLzmaCustomDecompressGuid,
+             &mGetInfo, &mDecode);
+  if (RETURN_ERROR (Status)) {
+    HostPrint ("no LZMA handlers\n");
+    return 1;
+  }
+
+  //
+  // The one stream, in an LZMA GUIDed section, as in FVMAIN_COMPACT.
+  //
+  SectionSize = (UINT32)(sizeof *Section + StreamSize);
+  Section = HostAllocate (SectionSize);
+  Output  = HostAllocatePages (EFI_SIZE_TO_PAGES (OriginalSize));
+  if (Section == NULL || Output == NULL || SectionSize >= 0xFFFFFF) {
+    HostPrint ("out of memory, or the LZMA stream is too large\n");
+    return 1;
+  }
+  Section->CommonHeader.Size[0]  = (UINT8)SectionSize;
+  Section->CommonHeader.Size[1]  = (UINT8)(SectionSize >> 8);
+  Section->CommonHeader.Size[2]  = (UINT8)(SectionSize >> 16);
+  Section->CommonHeader.Type     = EFI_SECTION_GUID_DEFINED;
+  Section->SectionDefinitionGuid = gLzmaCustomDecompressGuid;
+  Section->DataOffset            = sizeof *Section;
+  Section->Attributes            = EFI_GUIDED_SECTION_PROCESSING_REQUIRED;
+  CopyMem (Section + 1, Stream, StreamSize);
+
+  Status = mGetInfo (Section, &DecodedSize, &ScratchSize, &Attributes);
+  if (RETURN_ERROR (Status) || DecodedSize != OriginalSize) {
+    HostPrint ("the LZMA stream does not hold the original data\n");
+    return 1;
+  }
+  Scratch = HostAllocatePages (EFI_SIZE_TO_PAGES (ScratchSize) * 16);
+  if (Scratch == NULL) {
+    HostPrint ("out of memory\n");
+    return 1;
+  }
+  StreamTime = DecodeSection (Section, Output, Scratch);
+  if (StreamTime == 0 || CompareMem (Output, Original, OriginalSize) != 0) {
+    FAIL (("the LZMA stream decodes to wrong data\n"));
+  }
+
+  //
+  // The chunked data, each chunk on its own.
+  //
+  Status = ChunkedLzmaGetInfo (&Info, Chunked, (UINT32)ChunkedSize, mGetInfo,
+             &DecodedSize, &ScratchSize);
+  if (RETURN_ERROR (Status) || DecodedSize != OriginalSize) {
+    HostPrint ("the chunked LZMA data does not hold the original data\n");
+    return 1;
+  }
+  Header = Info.Header;
+  if (Skip >= MIN (Header->ChunkSize, OriginalSize)) {
+    HostPrint ("skip must be below the size of chunk 0\n");
+    return 1;
+  }
+  ScratchSize = ALIGN_VALUE (ScratchSize, EFI_PAGE_SIZE);
+  ChunkTimes  = HostAllocate (Header->ChunkCount * sizeof *ChunkTimes);
+  Bounce      = HostAllocatePages (EFI_SIZE_TO_PAGES (Header->ChunkSize));
+  if (ChunkTimes == NULL || Bounce == NULL) {
+    HostPrint ("out of memory\n");
+    return 1;
+  }
+  Sum = 0;
+  for (Index = 0; Index < Header->ChunkCount; Index++) {
+    ChunkTimes[Index] = DecodeSection (Chunked + Info.ChunkOffset[Index],
+                          Output + Index * Header->ChunkSize, Scratch);
+    if (ChunkTimes[Index] == 0) {
+      FAIL (("chunk %u cannot be decoded\n", (unsigned)Index));
+    }
+    Sum += ChunkTimes[Index];
+  }
+  if (CompareMem (Output, Original, OriginalSize) != 0) {
+    FAIL (("the chunks decode to wrong data\n"));
+  }
+
+  HostPrint ("%lu bytes: LZMA stream %lu bytes, %lu chunks of %lu KB %lu "
+    "bytes (+%lu.%lu%%)\n", OriginalSize, StreamSize,
+    (unsigned long)Header->ChunkCount, (unsigned long)Header->ChunkSize >> 10,
+    ChunkedSize, (ChunkedSize - StreamSize) * 100 / StreamSize,
+    (ChunkedSize - StreamSize) * 1000 / StreamSize % 10);
+  HostPrint ("decoding: LZMA stream %lu ms, chunks one by one %lu ms\n",
+    (unsigned long)(StreamTime / 1000000), (unsigned long)(Sum / 1000000));
+
+  HostPrint ("\nmodeled in PEI, from the chunk times:\n%6s %8s %8s %8s\n",
+    "VCPUs", "workers", "ms", "speedup");
+  for (Count = 0; Count < ARRAY_SIZE (mVcpuCounts); Count++) {
+    Workers = MAX (mVcpuCounts[Count] - 1, 1);
+    Elapsed = ModelChunkedTime (ChunkTimes, Header->ChunkCount, Workers);
+    HostPrint ("%6lu %8lu %8lu %6lu.%lux\n",
+      (unsigned long)mVcpuCounts[Count], (unsigned long)Workers,
+      (unsigned long)(Elapsed / 1000000),
+      (unsigned long)(StreamTime / Elapsed),
+      (unsigned long)(StreamTime * 10 / Elapsed % 10));
+  }
+
+  HostPrint ("\nmeasured on host threads:\n%6s %8s %8s\n", "threads", "ms",
+    "speedup");
+  for (Count = 0; Count < ARRAY_SIZE (mThreadCounts); Count++) {
+    Elapsed = RunChunked (&Info, Original, (UINT32)OriginalSize, Skip,
+                ScratchSize, mThreadCounts[Count], mThreadCounts[Count],
+                Output, Bounce, Scratch);
+    if (Elapsed != 0) {
+      HostPrint ("%6lu %8lu %6lu.%lux\n",
+        (unsigned long)mThreadCounts[Count],
+        (unsigned long)(Elapsed / 1000000),
+        (unsigned long)(StreamTime / Elapsed),
+        (unsigned long)(StreamTime * 10 / Elapsed % 10));
+    }
+  }
+
+  //
+  // More threads than scratch buffers: the extra threads return at once.
+  // No scratch buffer: no chunk is decoded.
+  //
+  RunChunked (&Info, Original, (UINT32)OriginalSize, Skip, ScratchSize, 4, 2,
+    Output, Bounce, Scratch);
+  CopyMem (&Context, &Info, sizeof Context);
+  Context.Decode = mDecode;
+  ChunkedLzmaWorker (&Context);
+  if (ChunkedLzmaGetStatus (&Context) != RETURN_NOT_READY) {
+    FAIL (("no scratch buffer: chunks were decoded\n"));
+  }
+
+  //
+  // Damaged data.
+  //
+  CheckDamaged ("signature", Chunked, (UINT32)ChunkedSize, 0, 0x01, 0);
+  CheckDamaged ("chunk count", Chunked, (UINT32)ChunkedSize,
+    OFFSET_OF (CHUNKED_LZMA_HEADER, ChunkCount), 0x01, 0);
+  CheckDamaged ("chunk size", Chunked, (UINT32)ChunkedSize,
+    OFFSET_OF (CHUNKED_LZMA_HEADER, ChunkSize), 0x01, 0);
+  CheckDamaged ("unaligned chunk offset", Chunked, (UINT32)ChunkedSize,
+    sizeof (CHUNKED_LZMA_HEADER), 0x01, 0);
+  CheckDamaged ("chunk section type", Chunked, (UINT32)ChunkedSize,
+    Info.ChunkOffset[0] + OFFSET_OF (EFI_COMMON_SECTION_HEADER, Type), 0x01, 0);
+  CheckDamaged ("chunk section GUID", Chunked, (UINT32)ChunkedSize,
+    Info.ChunkOffset[0] +
+    OFFSET_OF (EFI_GUID_DEFINED_SECTION, SectionDefinitionGuid), 0x01, 0);
+  CheckDamaged ("chunk decoded size", Chunked, (UINT32)ChunkedSize,
+    Info.ChunkOffset[0] + sizeof (EFI_GUID_DEFINED_SECTION) + 5, 0x01, 0);
+  CheckDamaged ("truncated data", Chunked, (UINT32)ChunkedSize, 0, 0, 8);
+
+  if (mFailures != 0) {
+    HostPrint ("FAILED\n");
+    return 1;
+  }
+  HostPrint ("\nAll tests passed\n");
+  return 0;
+}
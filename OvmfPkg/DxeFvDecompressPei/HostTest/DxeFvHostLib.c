@@ -0,0 +1,120 @@
+/** @file
+  Host implementations of the BaseLib, BaseMemoryLib, SynchronizationLib and
+  ExtractGuidedSectionLib functions that ChunkedLzma.c, the LZMA decompress
+  library and the benchmark use.
+
+  The handler table of ExtractGuidedSectionLib holds one GUID, which is
+  enough for the LZMA decompress library.
+
+**/
+
+#include <Base.h>
+#include <Guid/LzmaDecompress.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/ExtractGuidedSectionLib.h>
+#include <Library/SynchronizationLib.h>
+#include "HostOs.h"
+
+EFI_GUID  gLzmaCustomDecompressGuid = LZMA_CUSTOM_DECOMPRESS_GUID;
+
+CHAR8  *gEfiCallerBaseName = "DxeFvHostBench";
+
+STATIC GUID                                     mHostHandlerGuid;
+STATIC EXTRACT_GUIDED_SECTION_GET_INFO_HANDLER  mHostGetInfo;
+STATIC EXTRACT_GUIDED_SECTION_DECODE_HANDLER    mHostDecode;
+
+VOID *
+EFIAPI
+CopyMem (
+  OUT VOID       *DestinationBuffer,
+  IN CONST VOID  *SourceBuffer,
+  IN UINTN       Length
+  )
+{
+  return __builtin_memmove (DestinationBuffer, SourceBuffer, Length);
+}
+
+VOID *
+EFIAPI
+ZeroMem (
+  OUT VOID  *Buffer,
+  IN UINTN  Length
+  )
+{
+  return __builtin_memset (Buffer, 0, Length);
+}
+
+INTN
+EFIAPI
+CompareMem (
+  IN CONST VOID  *DestinationBuffer,
+  IN CONST VOID  *SourceBuffer,
+  IN UINTN       Length
+  )
+{
+  return __builtin_memcmp (DestinationBuffer, SourceBuffer, Length);
+}
+
+BOOLEAN
+EFIAPI
+CompareGuid (
+  IN CONST GUID  *Guid1,
+  IN CONST GUID  *Guid2
+  )
+{
+  return __builtin_memcmp (Guid1, Guid2, sizeof (GUID)) == 0;
+}
+
+UINT64
+EFIAPI
+LShiftU64 (
+  IN UINT64  Operand,
+  IN UINTN   Count
+  )
+{
+  return Operand << Count;
+}
+
+UINT32
+EFIAPI
+InterlockedIncrement (
+  IN volatile UINT32  *Value
+  )
+{
+  return __atomic_add_fetch (Value, 1, __ATOMIC_SEQ_CST);
+}
+
+RETURN_STATUS
+EFIAPI
+ExtractGuidedSectionRegisterHandlers (
+  IN CONST GUID                               *SectionGuid,
+  IN EXTRACT_GUIDED_SECTION_GET_INFO_HANDLER  GetInfoHandler,
+  IN EXTRACT_GUIDED_SECTION_DECODE_HANDLER    DecodeHandler
+  )
+{
+  mHostHandlerGuid = *SectionGuid;
+  mHostGetInfo     = GetInfoHandler;
+  mHostDecode      = DecodeHandler;
+  return RETURN_SUCCESS;
+}
+
+RETURN_STATUS
+EFIAPI
+ExtractGuidedSectionGetHandlers (
+  IN CONST GUID                                *SectionGuid,
+  OUT EXTRACT_GUIDED_SECTION_GET_INFO_HANDLER  *GetInfoHandler,  OPTIONAL
+  OUT EXTRACT_GUIDED_SECTION_DECODE_HANDLER    *DecodeHandler    OPTIONAL
+  )
+{
+  if (mHostGetInfo == NULL || !CompareGuid (SectionGuid, &mHostHandlerGuid)) {
+    return RETURN_NOT_FOUND;
+  }
+  if (GetInfoHandler != NULL) {
+    *GetInfoHandler = mHostGetInfo;
+  }
+  if (DecodeHandler != NULL) {
+    *DecodeHandler = mHostDecode;
+  }
+  return RETURN_SUCCESS;
+}
@@ -0,0 +1,42 @@
+/** @file
+  GUID and data format of GUIDed sections that hold independently LZMA
+  compressed chunks, as produced by BaseTools' ChunkedLzmaCompress.
+
+  The section data starts with a CHUNKED_LZMA_HEADER, followed by ChunkCount
+  UINT32 offsets of the chunks, relative to the start of the header. Each
+  chunk is a complete, 4 byte aligned EFI_GUID_DEFINED_SECTION of the LZMA
+  custom decompress GUID. Decoded, chunk N covers bytes [N * ChunkSize,
+  MIN ((N + 1) * ChunkSize, OriginalSize)) of the original data, so the chunks
+  can be decoded in any order, in parallel.
+
+  This program and the accompanying materials are licensed and made available
+  under the terms and conditions of the BSD License that accompanies this
+  distribution. The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php.
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS, WITHOUT
+  WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef __CHUNKED_LZMA_SECTION_H__
+#define __CHUNKED_LZMA_SECTION_H__
+
+#define CHUNKED_LZMA_SECTION_GUID \
+{0x5d5ce104, 0xeffe, 0x44a3, {0xa2, 0xca, 0x7a, 0x18, 0x55, 0x31, 0x9d, 0xea}}
+
+#define CHUNKED_LZMA_SIGNATURE  SIGNATURE_32 ('C', 'L', 'Z', 'M')
+
+#pragma pack (1)
+typedef struct {
+  UINT32 Signature;
+  UINT32 ChunkCount;
+  UINT32 ChunkSize;
+  UINT32 OriginalSize;
+//UINT32 ChunkOffset[ChunkCount];
+} CHUNKED_LZMA_HEADER;
+#pragma pack ()
+
+extern EFI_GUID gChunkedLzmaSectionGuid;
+
+#endif
@@ -0,0 +1,57 @@
+/** @file
+  GUIDs with which the QemuFwCfgLib instances share one SEV DMA window per
+  boot phase.
+
+  When SEV is active, fw_cfg DMA transfers are bounced through a window of
+  shared (unencrypted) memory. In PEI, the first module that needs the window
+  sets it up and describes it in a GUID HOB carrying a
+  QEMU_FW_CFG_SEV_DMA_WINDOW structure; the window is released at the end of
+  PEI. In DXE, the first module that needs the window maps it with the IOMMU
+  protocol and installs the structure as a protocol interface on a new handle;
+  the window is unmapped by the IOMMU driver at ExitBootServices().
+
+  Copyright (C) 2017, Advanced Micro Devices. All rights reserved.<BR>
+
+  This program and the accompanying materials are licensed and made available
+  under the terms and conditions of the BSD License which accompanies this
+  distribution.  The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS, WITHOUT
+  WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+**/
+
+#ifndef _QEMU_FW_CFG_SEV_DMA_WINDOW_H_
+#define _QEMU_FW_CFG_SEV_DMA_WINDOW_H_
+
+#define QEMU_FW_CFG_SEV_DMA_WINDOW_HOB_GUID             \
+  { 0xeb3fabbd,                                         \
+    0x7884,                                             \
+    0x4b2a,                                             \
+    { 0x92, 0x1d, 0xc1, 0xd5, 0x17, 0x15, 0xce, 0x2f }, \
+  }
+
+#define QEMU_FW_CFG_SEV_DMA_WINDOW_PROTOCOL_GUID        \
+  { 0xaedb2566,                                         \
+    0xd02e,                                             \
+    0x4cf4,                                             \
+    { 0x88, 0x3c, 0x38, 0xf8, 0xee, 0x14, 0x55, 0x2b }, \
+  }
+
+typedef struct {
+  //
+  // Base address of the window. The window is mapped for DMA at its own
+  // address, and is FW_CFG_SEV_DMA_WINDOW_SIZE bytes in size.
+  //
+  EFI_PHYSICAL_ADDRESS Base;
+  //
+  // Set when the window has been released; from then on, the window must not
+  // be used.
+  //
+  BOOLEAN              Released;
+} QEMU_FW_CFG_SEV_DMA_WINDOW;
+
+extern EFI_GUID gQemuFwCfgSevDmaWindowHobGuid;
+extern EFI_GUID gQemuFwCfgSevDmaWindowProtocolGuid;
+
+#endif
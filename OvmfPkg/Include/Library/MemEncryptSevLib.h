@@ -19,6 +19,23 @@
 
 #include <Base.h>
 
+//
+// Direction of a memory encryption attribute update, for
+// MemEncryptSevUpdatePageEncMaskRanges().
+//
+typedef enum {
+  MemEncryptSevDecrypt,
+  MemEncryptSevEncrypt
+} MEM_ENCRYPT_SEV_MODE;
+
+//
+// A page-aligned memory range, for MemEncryptSevUpdatePageEncMaskRanges().
+//
+typedef struct {
+  PHYSICAL_ADDRESS  BaseAddress;
+  UINTN             NumPages;
+} MEM_ENCRYPT_SEV_RANGE;
+
 /**
   Returns a boolean to indicate whether SEV-ES is enabled
 
@@ -99,6 +116,43 @@ MemEncryptSevSetPageEncMask (
   IN BOOLEAN                  Flush
   );
 
+/**
+  This function sets or clears the memory encryption bit for all memory regions
+  in the Ranges array, from the current page table context.
+
+  Adjacent elements of Ranges that describe contiguous memory are coalesced.
+  The caches are flushed (if requested), and the TLB is flushed, only once for
+  the whole array. Callers that need to update many memory regions should
+  therefore prefer this function to repeated MemEncryptSevClearPageEncMask() /
+  MemEncryptSevSetPageEncMask() calls, and should pass the regions sorted by
+  base address.
+
+  @param[in]  Cr3BaseAddress          Cr3 Base Address (if zero then use
+                                      current CR3)
+  @param[in]  Ranges                  The memory regions to update.
+  @param[in]  RangeCount              The number of elements in Ranges.
+  @param[in]  Mode                    Whether to set (MemEncryptSevEncrypt) or
+                                      to clear (MemEncryptSevDecrypt) the
+                                      memory encryption bit.
+  @param[in]  Flush                   Flush the caches before updating the bit
+                                      (mostly TRUE except MMIO addresses)
+
+  @retval RETURN_SUCCESS              The attributes were updated for all
+                                      memory regions.
+  @retval RETURN_INVALID_PARAMETER    RangeCount is zero, or the number of
+                                      pages is zero in an element of Ranges.
+  @retval RETURN_UNSUPPORTED          Updating the memory encryption attribute
+                                      is not supported
+**/
+RETURN_STATUS
+EFIAPI
+MemEncryptSevUpdatePageEncMaskRanges (
+  IN PHYSICAL_ADDRESS             Cr3BaseAddress,
+  IN CONST MEM_ENCRYPT_SEV_RANGE  *Ranges,
+  IN UINTN                        RangeCount,
+  IN MEM_ENCRYPT_SEV_MODE         Mode,
+  IN BOOLEAN                      Flush
+  );
 
 /**
   Locate the page range that covers the initial (pre-SMBASE-relocation) SMRAM
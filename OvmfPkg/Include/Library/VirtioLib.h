@@ -116,6 +116,24 @@ typedef struct {
 } DESC_INDICES;
 
 
+//
+// Completion wait statistics of a virtio device, accumulated by
+// VirtioWaitUsed() and VirtioFlush().
+//
+// Buckets[0] counts the waits that ended in the spin phase, without
+// stalling. Buckets[N], for N >= 1, counts the waits that stalled for a total
+// of [2^(N-1), 2^N) microseconds; the last bucket is open-ended.
+//
+#define VIRTIO_LATENCY_BUCKETS 16
+
+typedef struct {
+  UINT64 Waits;
+  UINT64 SpinIterations;
+  UINT64 StallUsecs;
+  UINT64 Buckets[VIRTIO_LATENCY_BUCKETS];
+} VIRTIO_LATENCY_HISTOGRAM;
+
+
 /**
 
   Turn off interrupt notifications from the host, and prepare for appending
@@ -207,6 +225,9 @@ VirtioAppendDesc (
                           from device-specific request structures linked by the
                           descriptor chain.
 
+  @param[in,out] Latency  Completion wait statistics of the device, updated by
+                          VirtioWaitUsed(). May be NULL.
+
   @return              Error code from VirtIo->SetQueueNotify() if it fails.
 
   @retval EFI_SUCCESS  Otherwise, the host processed all descriptors.
@@ -215,11 +236,128 @@ VirtioAppendDesc (
 EFI_STATUS
 EFIAPI
 VirtioFlush (
-  IN     VIRTIO_DEVICE_PROTOCOL *VirtIo,
-  IN     UINT16                 VirtQueueId,
-  IN OUT VRING                  *Ring,
-  IN     DESC_INDICES           *Indices,
-  OUT    UINT32                 *UsedLen    OPTIONAL
+  IN     VIRTIO_DEVICE_PROTOCOL   *VirtIo,
+  IN     UINT16                   VirtQueueId,
+  IN OUT VRING                    *Ring,
+  IN     DESC_INDICES             *Indices,
+  OUT    UINT32                   *UsedLen    OPTIONAL,
+  IN OUT VIRTIO_LATENCY_HISTOGRAM *Latency    OPTIONAL
+  );
+
+
+/**
+
+  Wait until the host places an element on the used ring beyond LastUsedIdx.
+
+  The wait proceeds in three phases, so that short completions are noticed
+  quickly without accessing the timer hardware, while long ones don't keep
+  the processor busy:
+  - spinning on the used index, with CpuPause(), for
+    PcdVirtioPollSpinIterations iterations,
+  - stalling for exponentially increasing periods, starting at 1 us,
+  - stalling repeatedly for slightly above 1 ms.
+
+  @param[in] Ring         The virtio ring to wait on.
+
+  @param[in] LastUsedIdx  The free-running index of the first used ring
+                          element that the caller has not consumed yet.
+
+  @param[in,out] Latency  Completion wait statistics to update. May be NULL.
+
+**/
+VOID
+EFIAPI
+VirtioWaitUsed (
+  IN     VRING                    *Ring,
+  IN     UINT16                   LastUsedIdx,
+  IN OUT VIRTIO_LATENCY_HISTOGRAM *Latency     OPTIONAL
+  );
+
+
+/**
+
+  Log the completion wait statistics of a virtio device on the debug console.
+
+  @param[in] Name     A short description of the device, printed as a prefix.
+
+  @param[in] Latency  The statistics to log.
+
+**/
+VOID
+EFIAPI
+VirtioLogLatency (
+  IN CONST CHAR8                    *Name,
+  IN CONST VIRTIO_LATENCY_HISTOGRAM *Latency
+  );
+
+
+/**
+
+  Make a descriptor chain just built available to the host, without notifying
+  the host and without waiting for the host to process it.
+
+  This function implements the following sections from virtio-0.9.5:
+  - 2.4.1.2 Updating the Available Ring
+  - 2.4.1.3 Updating the Index Field
+
+  Unlike VirtioFlush(), this function does not rely on lock-step progress;
+  any number of descriptor chains may be in flight. The caller is responsible
+  for building the chains in disjoint ranges of the descriptor table (by
+  setting Indices->HeadDescIdx and Indices->NextDescIdx itself, rather than
+  calling VirtioPrepare()), for notifying the host with
+  VirtIo->SetQueueNotify() after one or more chains have been made available,
+  and for collecting the completions with VirtioFetchUsed().
+
+  @param[in,out] Ring  The virtio ring with descriptors to submit.
+
+  @param[in] Indices   Indices->NextDescIdx is not accessed.
+                       Indices->HeadDescIdx identifies the head descriptor of
+                       the descriptor chain.
+
+**/
+VOID
+EFIAPI
+VirtioAppendAvail (
+  IN OUT VRING        *Ring,
+  IN     DESC_INDICES *Indices
+  );
+
+
+/**
+
+  Retrieve the next element that the host has placed on the used ring, if
+  any, without waiting.
+
+  This function implements the following section from virtio-0.9.5:
+  - 2.4.2 Receiving Used Buffers From the Device
+
+  @param[in] Ring            The virtio ring to check.
+
+  @param[in,out] LastUsedIdx  On input, the free-running index of the first
+                              used ring element that the caller has not
+                              consumed yet. On output, incremented by one,
+                              modulo 2^16, if an element has been retrieved.
+
+  @param[out] HeadDescIdx     The head descriptor index of the descriptor
+                              chain that the host has processed.
+
+  @param[out] UsedLen         The total number of bytes that the host wrote
+                              to the buffers linked by the descriptor chain.
+                              May be NULL if the caller doesn't care.
+
+  @retval TRUE   An element has been retrieved.
+
+  @retval FALSE  The host has not placed any element on the used ring beyond
+                 LastUsedIdx.
+
+**/
+BOOLEAN
+EFIAPI
+VirtioFetchUsed (
+  IN     VRING  *Ring,
+  IN OUT UINT16 *LastUsedIdx,
+  OUT    UINT16 *HeadDescIdx,
+  OUT    UINT32 *UsedLen      OPTIONAL
   );
 
 
@@ -5,6 +5,14 @@
   must be performed on unencrypted buffer hence we use a bounce buffer to map
   the guest buffer into an unencrypted DMA buffer.
 
+  Map() and Unmap() may be called at or below TPL_NOTIFY; this lets bus master
+  drivers map and unmap buffers from timer and completion notification
+  functions. Both functions raise the TPL to TPL_NOTIFY while they update the
+  list of mappings, the bounce buffer pool and the page tables, so that a call
+  from a notification function cannot interrupt another call half-way.
+  AllocateBuffer() and FreeBuffer() follow the TPL restrictions of
+  gBS->AllocatePages() and gBS->FreePages().
+
   Copyright (c) 2017, AMD Inc. All rights reserved.<BR>
   Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
 
@@ -30,6 +38,16 @@ typedef struct {
   UINTN                                     NumberOfPages;
   EFI_PHYSICAL_ADDRESS                      CryptedAddress;
   EFI_PHYSICAL_ADDRESS                      PlainTextAddress;
+  //
+  // Size class of the bounce buffer at PlainTextAddress, if the bounce buffer
+  // belongs to the bounce buffer pool; BOUNCE_CLASS_NONE otherwise.
+  //
+  UINTN                                     BounceClass;
+  //
+  // The pool (BOUNCE_POOL_BELOW_4GB or BOUNCE_POOL_ANY) that the bounce buffer
+  // belongs to, if BounceClass is not BOUNCE_CLASS_NONE.
+  //
+  UINTN                                     BouncePool;
 } MAP_INFO;
 
 //
@@ -39,6 +57,60 @@ typedef struct {
 //
 STATIC LIST_ENTRY mMapInfos = INITIALIZE_LIST_HEAD_VARIABLE (mMapInfos);
 
+//
+// List of the MAP_INFO structures that are not in use. MAP_INFO structures are
+// carved from slabs of MAP_INFO_SLAB_COUNT elements; once allocated, they are
+// never released, only recycled through this list.
+//
+STATIC LIST_ENTRY mFreeMapInfos = INITIALIZE_LIST_HEAD_VARIABLE (mFreeMapInfos);
+
+#define MAP_INFO_SLAB_COUNT 32
+
+//
+// The bounce buffer pool.
+//
+// BusMasterRead[64] and BusMasterWrite[64] operations need a plaintext bounce
+// buffer. Allocating such a buffer, clearing the C-bit on it, and then setting
+// the C-bit and releasing it in Unmap() costs page table manipulation and a TLB
+// flush on each mapping. Instead, bounce buffers of power-of-two page counts
+// (up to BOUNCE_CLASS_PAGES (BOUNCE_CLASS_COUNT - 1)) are kept decrypted, and
+// recycled across Map() / Unmap().
+//
+// There are two pools. Bounce buffers for BusMasterRead and BusMasterWrite
+// are allocated under 4GB, and are recycled through BOUNCE_POOL_BELOW_4GB.
+// Bounce buffers for BusMasterRead64 and BusMasterWrite64 may reside anywhere,
+// and are recycled through BOUNCE_POOL_ANY; this way the 64-bit operations do
+// not consume memory under 4GB.
+//
+// Each pool is indexed by size class, and every class is a stack of at most
+// BOUNCE_CLASS_DEPTH free bounce buffers. The stacks themselves live in
+// (encrypted) driver data. Bounce buffers exceeding the largest size class, or
+// not fitting in their full stack, take the original allocate / decrypt /
+// encrypt / free path.
+//
+#define BOUNCE_POOL_BELOW_4GB     0
+#define BOUNCE_POOL_ANY           1
+#define BOUNCE_POOL_COUNT         2
+#define BOUNCE_CLASS_COUNT        7
+#define BOUNCE_CLASS_DEPTH        8
+#define BOUNCE_CLASS_NONE         MAX_UINTN
+#define BOUNCE_CLASS_PAGES(Class) ((UINTN)1 << (Class))
+
+STATIC EFI_PHYSICAL_ADDRESS
+       mBouncePool[BOUNCE_POOL_COUNT][BOUNCE_CLASS_COUNT][BOUNCE_CLASS_DEPTH];
+STATIC UINTN mBouncePoolCount[BOUNCE_POOL_COUNT][BOUNCE_CLASS_COUNT];
+
+//
+// Bounce buffer pool statistics, logged at ExitBootServices(), for sizing the
+// pools. "Hits" counts mappings that recycled a pooled bounce buffer. "Misses"
+// counts mappings that had to decrypt a new bounce buffer for their (empty)
+// size class. "Bypasses" counts mappings that were too large for the pools, or
+// whose pooled bounce buffer could not be allocated.
+//
+STATIC UINT64 mBouncePoolHits;
+STATIC UINT64 mBouncePoolMisses;
+STATIC UINT64 mBouncePoolBypasses;
+
 #define COMMON_BUFFER_SIG SIGNATURE_64 ('C', 'M', 'N', 'B', 'U', 'F', 'F', 'R')
 
 //
@@ -78,6 +150,231 @@ typedef struct {
 } COMMON_BUFFER_HEADER;
 #pragma pack ()
 
+/**
+  Take a MAP_INFO structure from the free list, refilling the free list with a
+  new slab of MAP_INFO structures if necessary.
+
+  @return  The MAP_INFO structure, or NULL if the free list was empty and a
+           new slab could not be allocated.
+**/
+STATIC
+MAP_INFO *
+AllocateMapInfo (
+  VOID
+  )
+{
+  MAP_INFO   *Slab;
+  UINTN      Index;
+  LIST_ENTRY *Node;
+
+  if (IsListEmpty (&mFreeMapInfos)) {
+    Slab = AllocatePool (MAP_INFO_SLAB_COUNT * sizeof (MAP_INFO));
+    if (Slab == NULL) {
+      return NULL;
+    }
+    for (Index = 0; Index < MAP_INFO_SLAB_COUNT; Index++) {
+      Slab[Index].Signature = MAP_INFO_SIG;
+      InsertTailList (&mFreeMapInfos, &Slab[Index].Link);
+    }
+  }
+
+  Node = GetFirstNode (&mFreeMapInfos);
+  RemoveEntryList (Node);
+  return CR (Node, MAP_INFO, Link, MAP_INFO_SIG);
+}
+
+/**
+  Return a MAP_INFO structure to the free list. This function never releases
+  memory, hence it is safe to call while the UEFI memory map is locked.
+
+  @param[in] MapInfo  The MAP_INFO structure to recycle. MapInfo must not be
+                      linked into any list.
+**/
+STATIC
+VOID
+FreeMapInfo (
+  IN MAP_INFO *MapInfo
+  )
+{
+  InsertHeadList (&mFreeMapInfos, &MapInfo->Link);
+}
+
+/**
+  Map a page count to the smallest bounce buffer pool size class that can
+  accommodate it.
+
+  @param[in] NumberOfPages  The number of pages to accommodate.
+
+  @return  The size class, or BOUNCE_CLASS_NONE if NumberOfPages exceeds the
+           largest size class.
+**/
+STATIC
+UINTN
+GetBounceClass (
+  IN UINTN NumberOfPages
+  )
+{
+  UINTN Class;
+
+  for (Class = 0; Class < BOUNCE_CLASS_COUNT; Class++) {
+    if (NumberOfPages <= BOUNCE_CLASS_PAGES (Class)) {
+      return Class;
+    }
+  }
+  return BOUNCE_CLASS_NONE;
+}
+
+/**
+  Set up the plaintext bounce buffer for a BusMasterRead[64] or
+  BusMasterWrite[64] operation.
+
+  The bounce buffer is taken from the bounce buffer pool that matches the
+  highest acceptable address, if possible. Otherwise a new bounce buffer is
+  allocated and decrypted; it is entered into that pool (by size class) if it
+  is small enough.
+
+  A recycled bounce buffer still holds the data of an earlier mapping. For
+  BusMasterWrite[64] operations, the part that Unmap() copies back is zeroed,
+  so that the caller cannot receive stale data where the bus master writes
+  less than NumberOfBytes.
+
+  The caller is responsible for raising the TPL to TPL_NOTIFY.
+
+  @param[in,out] MapInfo  On input, Operation and NumberOfBytes describe the
+                          mapping, NumberOfPages specifies the required size,
+                          and PlainTextAddress specifies the highest acceptable
+                          address, for the bounce buffer. On output,
+                          PlainTextAddress, NumberOfPages, BounceClass and
+                          BouncePool describe the decrypted bounce buffer.
+
+  @retval EFI_SUCCESS           The bounce buffer has been set up.
+  @return                       Error codes from gBS->AllocatePages().
+**/
+STATIC
+EFI_STATUS
+AcquireBounceBuffer (
+  IN OUT MAP_INFO *MapInfo
+  )
+{
+  EFI_STATUS           Status;
+  UINTN                Pool;
+  UINTN                Class;
+  UINTN                *Count;
+  EFI_PHYSICAL_ADDRESS Address;
+  EFI_ALLOCATE_TYPE    AllocateType;
+
+  AllocateType = (MapInfo->PlainTextAddress == MAX_ADDRESS) ?
+                 AllocateAnyPages :
+                 AllocateMaxAddress;
+  Pool = (MapInfo->PlainTextAddress == MAX_ADDRESS) ?
+         BOUNCE_POOL_ANY :
+         BOUNCE_POOL_BELOW_4GB;
+
+  Class = GetBounceClass (MapInfo->NumberOfPages);
+  if (Class != BOUNCE_CLASS_NONE) {
+    Count = &mBouncePoolCount[Pool][Class];
+    if (*Count > 0) {
+      //
+      // Pool hit: the bounce buffer is already decrypted.
+      //
+      mBouncePoolHits++;
+      (*Count)--;
+      MapInfo->PlainTextAddress = mBouncePool[Pool][Class][*Count];
+      MapInfo->NumberOfPages    = BOUNCE_CLASS_PAGES (Class);
+      MapInfo->BounceClass      = Class;
+      MapInfo->BouncePool       = Pool;
+      if (MapInfo->Operation == EdkiiIoMmuOperationBusMasterWrite ||
+          MapInfo->Operation == EdkiiIoMmuOperationBusMasterWrite64) {
+        ZeroMem (
+          (VOID *)(UINTN)MapInfo->PlainTextAddress,
+          MapInfo->NumberOfBytes
+          );
+      }
+      return EFI_SUCCESS;
+    }
+
+    Address = MapInfo->PlainTextAddress;
+    Status = gBS->AllocatePages (
+                    AllocateType,
+                    EfiBootServicesData,
+                    BOUNCE_CLASS_PAGES (Class),
+                    &Address
+                    );
+    if (!EFI_ERROR (Status)) {
+      mBouncePoolMisses++;
+      MapInfo->PlainTextAddress = Address;
+      MapInfo->NumberOfPages    = BOUNCE_CLASS_PAGES (Class);
+      MapInfo->BounceClass      = Class;
+      MapInfo->BouncePool       = Pool;
+      goto Decrypt;
+    }
+  }
+
+  //
+  // Allocate a bounce buffer of the exact size, outside of the pools.
+  //
+  mBouncePoolBypasses++;
+  Status = gBS->AllocatePages (
+                  AllocateType,
+                  EfiBootServicesData,
+                  MapInfo->NumberOfPages,
+                  &MapInfo->PlainTextAddress
+                  );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+  MapInfo->BounceClass = BOUNCE_CLASS_NONE;
+
+Decrypt:
+  Status = MemEncryptSevClearPageEncMask (
+             0,
+             MapInfo->PlainTextAddress,
+             MapInfo->NumberOfPages,
+             TRUE
+             );
+  ASSERT_EFI_ERROR (Status);
+  if (EFI_ERROR (Status)) {
+    CpuDeadLoop ();
+  }
+  return EFI_SUCCESS;
+}
+
+/**
+  Re-encrypt a plaintext bounce buffer, zeroing it first, and release it unless
+  the UEFI memory map is locked.
+
+  @param[in] Address          The base address of the bounce buffer.
+  @param[in] NumberOfPages    The size of the bounce buffer in pages.
+  @param[in] MemoryMapLocked  The function is executing on the stack of
+                              gBS->ExitBootServices(); changes to the UEFI
+                              memory map are forbidden.
+**/
+STATIC
+VOID
+ReleaseBounceBuffer (
+  IN EFI_PHYSICAL_ADDRESS Address,
+  IN UINTN                NumberOfPages,
+  IN BOOLEAN              MemoryMapLocked
+  )
+{
+  EFI_STATUS Status;
+
+  //
+  // Fill the late bounce buffer (which existed as plaintext at some point)
+  // with zeros, then restore the memory encryption mask on it.
+  //
+  ZeroMem ((VOID *)(UINTN)Address, EFI_PAGES_TO_SIZE (NumberOfPages));
+  Status = MemEncryptSevSetPageEncMask (0, Address, NumberOfPages, TRUE);
+  ASSERT_EFI_ERROR (Status);
+  if (EFI_ERROR (Status)) {
+    CpuDeadLoop ();
+  }
+
+  if (!MemoryMapLocked) {
+    gBS->FreePages (Address, NumberOfPages);
+  }
+}
+
 /**
   Provides the controller-specific addresses required to access system memory
   from a DMA bus master. On SEV guest, the DMA operations must be performed on
@@ -121,9 +418,9 @@ IoMmuMap (
 {
   EFI_STATUS                                        Status;
   MAP_INFO                                          *MapInfo;
-  EFI_ALLOCATE_TYPE                                 AllocateType;
   COMMON_BUFFER_HEADER                              *CommonBufferHeader;
   VOID                                              *DecryptionSource;
+  EFI_TPL                                           OldTpl;
 
   DEBUG ((
     DEBUG_VERBOSE,
@@ -142,11 +439,13 @@ IoMmuMap (
     return EFI_INVALID_PARAMETER;
   }
 
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
   //
   // Allocate a MAP_INFO structure to remember the mapping when Unmap() is
   // called later.
   //
-  MapInfo = AllocatePool (sizeof (MAP_INFO));
+  MapInfo = AllocateMapInfo ();
   if (MapInfo == NULL) {
     Status = EFI_OUT_OF_RESOURCES;
     goto Failed;
@@ -161,13 +460,14 @@ IoMmuMap (
   MapInfo->NumberOfBytes     = *NumberOfBytes;
   MapInfo->NumberOfPages     = EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes);
   MapInfo->CryptedAddress    = (UINTN)HostAddress;
+  MapInfo->BounceClass       = BOUNCE_CLASS_NONE;
+  MapInfo->BouncePool        = BOUNCE_POOL_BELOW_4GB;
 
   //
   // In the switch statement below, we point "MapInfo->PlainTextAddress" to the
   // plaintext buffer, according to Operation. We also set "DecryptionSource".
   //
   MapInfo->PlainTextAddress = MAX_ADDRESS;
-  AllocateType = AllocateAnyPages;
   DecryptionSource = (VOID *)(UINTN)MapInfo->CryptedAddress;
   switch (Operation) {
   //
@@ -179,21 +479,15 @@ IoMmuMap (
   case EdkiiIoMmuOperationBusMasterRead:
   case EdkiiIoMmuOperationBusMasterWrite:
     MapInfo->PlainTextAddress = BASE_4GB - 1;
-    AllocateType = AllocateMaxAddress;
     //
     // fall through
     //
   case EdkiiIoMmuOperationBusMasterRead64:
   case EdkiiIoMmuOperationBusMasterWrite64:
     //
-    // Allocate the implicit plaintext bounce buffer.
+    // Set up the implicit plaintext bounce buffer, preferably from the pool.
     //
-    Status = gBS->AllocatePages (
-                    AllocateType,
-                    EfiBootServicesData,
-                    MapInfo->NumberOfPages,
-                    &MapInfo->PlainTextAddress
-                    );
+    Status = AcquireBounceBuffer (MapInfo);
     if (EFI_ERROR (Status)) {
       goto FreeMapInfo;
     }
@@ -242,6 +536,20 @@ IoMmuMap (
     // it to the original location, after the switch statement.
     //
     DecryptionSource = CommonBufferHeader->StashBuffer;
+
+    //
+    // Clear the memory encryption mask on the plaintext buffer.
+    //
+    Status = MemEncryptSevClearPageEncMask (
+               0,
+               MapInfo->PlainTextAddress,
+               MapInfo->NumberOfPages,
+               TRUE
+               );
+    ASSERT_EFI_ERROR (Status);
+    if (EFI_ERROR (Status)) {
+      CpuDeadLoop ();
+    }
     break;
 
   default:
@@ -252,20 +560,6 @@ IoMmuMap (
     goto FreeMapInfo;
   }
 
-  //
-  // Clear the memory encryption mask on the plaintext buffer.
-  //
-  Status = MemEncryptSevClearPageEncMask (
-             0,
-             MapInfo->PlainTextAddress,
-             MapInfo->NumberOfPages,
-             TRUE
-             );
-  ASSERT_EFI_ERROR (Status);
-  if (EFI_ERROR (Status)) {
-    CpuDeadLoop ();
-  }
-
   //
   // If this is a read operation from the Bus Master's point of view,
   // then copy the contents of the real buffer into the mapped buffer
@@ -305,12 +599,14 @@ IoMmuMap (
     (UINT64)MapInfo->NumberOfPages
     ));
 
+  gBS->RestoreTPL (OldTpl);
   return EFI_SUCCESS;
 
 FreeMapInfo:
-  FreePool (MapInfo);
+  FreeMapInfo (MapInfo);
 
 Failed:
+  gBS->RestoreTPL (OldTpl);
   *NumberOfBytes = 0;
   return Status;
 }
@@ -346,6 +642,8 @@ IoMmuUnmapWorker (
   EFI_STATUS               Status;
   COMMON_BUFFER_HEADER     *CommonBufferHeader;
   VOID                     *EncryptionTarget;
+  UINTN                    *Count;
+  EFI_TPL                  OldTpl;
 
   DEBUG ((
     DEBUG_VERBOSE,
@@ -361,6 +659,8 @@ IoMmuUnmapWorker (
 
   MapInfo = (MAP_INFO *)Mapping;
 
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
   //
   // set CommonBufferHeader to suppress incorrect compiler/analyzer warnings
   //
@@ -406,55 +706,64 @@ IoMmuUnmapWorker (
     break;
   }
 
-  //
-  // Restore the memory encryption mask on the area we used to hold the
-  // plaintext.
-  //
-  Status = MemEncryptSevSetPageEncMask (
-             0,
-             MapInfo->PlainTextAddress,
-             MapInfo->NumberOfPages,
-             TRUE
-             );
-  ASSERT_EFI_ERROR (Status);
-  if (EFI_ERROR (Status)) {
-    CpuDeadLoop ();
-  }
-
-  //
-  // For BusMasterCommonBuffer[64] operations, copy the stashed data to the
-  // original (now encrypted) location.
-  //
-  // For all other operations, fill the late bounce buffer (which existed as
-  // plaintext at some point) with zeros, and then release it (unless the UEFI
-  // memory map is locked).
-  //
   if (MapInfo->Operation == EdkiiIoMmuOperationBusMasterCommonBuffer ||
       MapInfo->Operation == EdkiiIoMmuOperationBusMasterCommonBuffer64) {
+    //
+    // Restore the memory encryption mask on the area we used to hold the
+    // plaintext.
+    //
+    Status = MemEncryptSevSetPageEncMask (
+               0,
+               MapInfo->PlainTextAddress,
+               MapInfo->NumberOfPages,
+               TRUE
+               );
+    ASSERT_EFI_ERROR (Status);
+    if (EFI_ERROR (Status)) {
+      CpuDeadLoop ();
+    }
+
+    //
+    // Copy the stashed data to the original (now encrypted) location.
+    //
     CopyMem (
       (VOID *)(UINTN)MapInfo->CryptedAddress,
       CommonBufferHeader->StashBuffer,
       MapInfo->NumberOfBytes
       );
+  } else if (!MemoryMapLocked &&
+             MapInfo->BounceClass != BOUNCE_CLASS_NONE &&
+             mBouncePoolCount[MapInfo->BouncePool][MapInfo->BounceClass] <
+             BOUNCE_CLASS_DEPTH) {
+    //
+    // Return the bounce buffer to its pool, keeping it decrypted. Its contents
+    // have been exposed to the hypervisor already, so there's no point in
+    // zeroing it here; AcquireBounceBuffer() zeroes it for the next
+    // BusMasterWrite[64] operation.
+    //
+    Count = &mBouncePoolCount[MapInfo->BouncePool][MapInfo->BounceClass];
+    mBouncePool[MapInfo->BouncePool][MapInfo->BounceClass][*Count] =
+      MapInfo->PlainTextAddress;
+    (*Count)++;
   } else {
-    ZeroMem (
-      (VOID *)(UINTN)MapInfo->PlainTextAddress,
-      EFI_PAGES_TO_SIZE (MapInfo->NumberOfPages)
+    //
+    // Encrypt and release the bounce buffer (the latter unless the UEFI memory
+    // map is locked).
+    //
+    ReleaseBounceBuffer (
+      MapInfo->PlainTextAddress,
+      MapInfo->NumberOfPages,
+      MemoryMapLocked
       );
-    if (!MemoryMapLocked) {
-      gBS->FreePages (MapInfo->PlainTextAddress, MapInfo->NumberOfPages);
-    }
   }
 
   //
-  // Forget the MAP_INFO structure, then free it (unless the UEFI memory map is
-  // locked).
+  // Forget the MAP_INFO structure, then recycle it.
   //
   RemoveEntryList (&MapInfo->Link);
-  if (!MemoryMapLocked) {
-    FreePool (MapInfo);
-  }
+  FreeMapInfo (MapInfo);
 
+  gBS->RestoreTPL (OldTpl);
   return EFI_SUCCESS;
 }
 
@@ -828,12 +1137,22 @@ AmdSevUnmapAllMappings (
   IN VOID      *Context
   )
 {
-  LIST_ENTRY *Node;
-  LIST_ENTRY *NextNode;
-  MAP_INFO   *MapInfo;
+  LIST_ENTRY            *Node;
+  LIST_ENTRY            *NextNode;
+  MAP_INFO              *MapInfo;
+  UINTN                 Pool;
+  UINTN                 Class;
+  UINTN                 Index;
+  UINTN                 NumRanges;
+  MEM_ENCRYPT_SEV_RANGE Ranges[BOUNCE_POOL_COUNT * BOUNCE_CLASS_COUNT *
+                               BOUNCE_CLASS_DEPTH];
+  EFI_STATUS            Status;
+  EFI_TPL               OldTpl;
 
   DEBUG ((DEBUG_VERBOSE, "%a\n", __FUNCTION__));
 
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
   //
   // All drivers that had set up IOMMU mappings have halted their respective
   // controllers by now; tear down the mappings.
@@ -847,6 +1166,50 @@ AmdSevUnmapAllMappings (
       TRUE      // MemoryMapLocked
       );
   }
+
+  //
+  // The OS expects all memory to be encrypted; zero and re-encrypt the bounce
+  // buffers that are held in the pool, in a single batch.
+  //
+  NumRanges = 0;
+  for (Pool = 0; Pool < BOUNCE_POOL_COUNT; Pool++) {
+    for (Class = 0; Class < BOUNCE_CLASS_COUNT; Class++) {
+      for (Index = 0; Index < mBouncePoolCount[Pool][Class]; Index++) {
+        Ranges[NumRanges].BaseAddress = mBouncePool[Pool][Class][Index];
+        Ranges[NumRanges].NumPages    = BOUNCE_CLASS_PAGES (Class);
+        ZeroMem (
+          (VOID *)(UINTN)Ranges[NumRanges].BaseAddress,
+          EFI_PAGES_TO_SIZE (Ranges[NumRanges].NumPages)
+          );
+        NumRanges++;
+      }
+      mBouncePoolCount[Pool][Class] = 0;
+    }
+  }
+  if (NumRanges > 0) {
+    Status = MemEncryptSevUpdatePageEncMaskRanges (
+               0,
+               Ranges,
+               NumRanges,
+               MemEncryptSevEncrypt,
+               TRUE
+               );
+    ASSERT_EFI_ERROR (Status);
+    if (EFI_ERROR (Status)) {
+      CpuDeadLoop ();
+    }
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: bounce buffer pool: Hits=%Lu Misses=%Lu Bypasses=%Lu\n",
+    __FUNCTION__,
+    mBouncePoolHits,
+    mBouncePoolMisses,
+    mBouncePoolBypasses
+    ));
+
+  gBS->RestoreTPL (OldTpl);
 }
 
 /**
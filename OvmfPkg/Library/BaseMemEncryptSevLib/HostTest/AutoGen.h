@@ -0,0 +1,11 @@
+/** @file
+  Host replacement for the AutoGen.h file of a BaseMemEncryptSevLib module.
+
+**/
+
+#ifndef _SEV_HOST_AUTOGEN_H_
+#define _SEV_HOST_AUTOGEN_H_
+
+extern CHAR8  *gEfiCallerBaseName;
+
+#endif
@@ -0,0 +1,203 @@
+/** @file
+  Host implementations of the BaseLib, BaseMemoryLib, CpuLib,
+  CacheMaintenanceLib and MemoryAllocationLib functions that the X64 page
+  table code of BaseMemEncryptSevLib and the test use.
+
+  CPUID reports the C-bit at position 47 and 1GB page support. CR0 reports
+  that write protection is disabled, so the page table pool is never made
+  read-only. The TLB and cache flushes only count how often they are called.
+
+  Page table memory is allocated below 4GB, as in a guest. The page table
+  code computes table addresses from 40-bit wide bit-fields, and GCC
+  truncates that arithmetic to 40 bits, so tables above 1TB (where the host
+  heap usually is) would not be found.
+
+**/
+
+#include <Base.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/CacheMaintenanceLib.h>
+#include <Library/CpuLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Register/Amd/Cpuid.h>
+#include <Register/Cpuid.h>
+#include "HostOs.h"
+#include "SevHostTest.h"
+
+CHAR8  *gEfiCallerBaseName = "SevHostTest";
+
+UINTN  mHostTlbFlushes;
+UINTN  mHostCacheFlushes;
+
+VOID *
+EFIAPI
+CopyMem (
+  OUT VOID       *DestinationBuffer,
+  IN CONST VOID  *SourceBuffer,
+  IN UINTN       Length
+  )
+{
+  return __builtin_memmove (DestinationBuffer, SourceBuffer, Length);
+}
+
+VOID *
+EFIAPI
+ZeroMem (
+  OUT VOID  *Buffer,
+  IN UINTN  Length
+  )
+{
+  return __builtin_memset (Buffer, 0, Length);
+}
+
+UINT64
+EFIAPI
+LShiftU64 (
+  IN UINT64  Operand,
+  IN UINTN   Count
+  )
+{
+  return Operand << Count;
+}
+
+UINT64
+EFIAPI
+RShiftU64 (
+  IN UINT64  Operand,
+  IN UINTN   Count
+  )
+{
+  return Operand >> Count;
+}
+
+UINT64
+EFIAPI
+MultU64x32 (
+  IN UINT64  Multiplicand,
+  IN UINT32  Multiplier
+  )
+{
+  return Multiplicand * Multiplier;
+}
+
+UINT32
+EFIAPI
+AsmCpuid (
+  IN  UINT32  Index,
+  OUT UINT32  *RegisterEax,  OPTIONAL
+  OUT UINT32  *RegisterEbx,  OPTIONAL
+  OUT UINT32  *RegisterEcx,  OPTIONAL
+  OUT UINT32  *RegisterEdx   OPTIONAL
+  )
+{
+  UINT32  Eax;
+  UINT32  Ebx;
+  UINT32  Edx;
+
+  Eax = 0;
+  Ebx = 0;
+  Edx = 0;
+  switch (Index) {
+  case CPUID_EXTENDED_FUNCTION:
+    Eax = CPUID_MEMORY_ENCRYPTION_INFO;
+    break;
+  case CPUID_EXTENDED_CPU_SIG:
+    Edx = BIT26;
+    break;
+  case CPUID_MEMORY_ENCRYPTION_INFO:
+    Eax = BIT1;
+    Ebx = 47;
+    break;
+  default:
+    break;
+  }
+
+  if (RegisterEax != NULL) {
+    *RegisterEax = Eax;
+  }
+  if (RegisterEbx != NULL) {
+    *RegisterEbx = Ebx;
+  }
+  if (RegisterEcx != NULL) {
+    *RegisterEcx = 0;
+  }
+  if (RegisterEdx != NULL) {
+    *RegisterEdx = Edx;
+  }
+  return Index;
+}
+
+UINTN
+EFIAPI
+AsmReadCr0 (
+  VOID
+  )
+{
+  return 0;
+}
+
+UINTN
+EFIAPI
+AsmWriteCr0 (
+  UINTN  Cr0
+  )
+{
+  return Cr0;
+}
+
+UINTN
+EFIAPI
+AsmReadCr3 (
+  VOID
+  )
+{
+  HostPrint ("AsmReadCr3() reached on the host\n");
+  HostAbort ();
+  return 0;
+}
+
+VOID
+EFIAPI
+CpuFlushTlb (
+  VOID
+  )
+{
+  mHostTlbFlushes++;
+}
+
+VOID
+EFIAPI
+WriteBackInvalidateDataCache (
+  VOID
+  )
+{
+  mHostCacheFlushes++;
+}
+
+VOID *
+EFIAPI
+WriteBackInvalidateDataCacheRange (
+  IN VOID   *Address,
+  IN UINTN  Length
+  )
+{
+  mHostCacheFlushes++;
+  return Address;
+}
+
+VOID *
+EFIAPI
+AllocateAlignedPages (
+  IN UINTN  Pages,
+  IN UINTN  Alignment
+  )
+{
+  UINTN  Buffer;
+
+  Buffer = (UINTN)HostAllocateLowPages (Pages + EFI_SIZE_TO_PAGES (Alignment));
+  if (Buffer == 0) {
+    return NULL;
+  }
+  return (VOID *)ALIGN_VALUE (Buffer, Alignment);
+}
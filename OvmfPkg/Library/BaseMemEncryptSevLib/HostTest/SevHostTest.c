@@ -0,0 +1,492 @@
+/** @file
+  Host test for the batched memory encryption bit API of BaseMemEncryptSevLib.
+
+  Two identical identity-mapped page tables are built for the first 8GB of
+  the address space, either with 2MB or with 1GB pages, all encrypted. One
+  page table is updated with MemEncryptSevClearPageEncMask() and
+  MemEncryptSevSetPageEncMask(), one call per range; the other one with
+  MemEncryptSevUpdatePageEncMaskRanges(), one call for all ranges. After each
+  step, the test checks for every 4KB page that
+
+  - the two page tables translate it to the same address, with the same
+    attributes, and the same memory encryption bit;
+  - the memory encryption bit is clear exactly for the decrypted ranges;
+
+  and that the two page tables hold the same number of 4KB, 2MB and 1GB
+  mappings. The steps are: decrypt all ranges, re-encrypt every other range,
+  and re-encrypt the remaining ranges. After the last step, all split pages
+  must have been merged again: no 4KB mappings may remain, nor 2MB mappings
+  if the page tables started out with 1GB pages. (Starting out with 2MB
+  pages, the merge may also produce 1GB pages.)
+
+  The ranges are a fixed set that resembles the MMIO and NonExistent entries
+  of the GCD memory space map, and sets of random ranges, some of them
+  adjacent.
+
+  Usage: SevHostTest [number of random range sets]
+
+**/
+
+#include <Base.h>
+#include <Library/BaseLib.h>
+#include <Library/MemEncryptSevLib.h>
+#include "VirtualMemory.h"
+#include "HostOs.h"
+#include "SevHostTest.h"
+
+#define TEST_MEMORY_SIZE  SIZE_8GB
+#define TEST_MEMORY_PAGES (TEST_MEMORY_SIZE / SIZE_4KB)
+#define TEST_MAX_RANGES   128
+
+#define TEST_C_BIT        BIT47
+#define TEST_ATTRIBUTES   (IA32_PG_P | IA32_PG_RW | IA32_PG_U | IA32_PG_NX | \
+                           TEST_C_BIT)
+
+typedef struct {
+  UINTN  Count4K;
+  UINTN  Count2M;
+  UINTN  Count1G;
+} MAPPING_COUNTS;
+
+STATIC CONST MEM_ENCRYPT_SEV_RANGE  mGcdRanges[] = {
+  { 0x000A0000,  0x20 },        // legacy VGA window
+  { 0x80000000,  0x7EC00 },     // PCI MMIO aperture, up to the IO-APIC
+  { 0xFEC00000,  0x1 },         // IO-APIC
+  { 0xFEC01000,  0xFF },        // NonExistent, adjacent to the IO-APIC
+  { 0xFED00000,  0x1 },         // HPET
+  { 0xFEE00000,  0x100 },       // local APIC
+  { 0xFF000000,  0x1000 },      // flash
+  { 0x100000000, 0x80000 },     // 64-bit PCI MMIO aperture, 1GB aligned
+  { 0x180000000, 0x40000 }      // NonExistent, adjacent to the aperture
+};
+
+STATIC MEM_ENCRYPT_SEV_RANGE  mRanges[TEST_MAX_RANGES];
+STATIC UINTN                  mRangeCount;
+STATIC UINT8                  mExpectedDecrypted[TEST_MEMORY_PAGES];
+STATIC UINT64                 mSeed;
+
+/**
+  Return the next number of the pseudo-random sequence (xorshift64).
+
+  @param[in] Limit  The upper bound of the result, exclusive; not zero.
+**/
+STATIC
+UINT64
+TestRandom (
+  IN UINT64  Limit
+  )
+{
+  mSeed ^= mSeed << 13;
+  mSeed ^= mSeed >> 7;
+  mSeed ^= mSeed << 17;
+  return mSeed % Limit;
+}
+
+/**
+  Build an identity-mapped, encrypted page table for TEST_MEMORY_SIZE bytes.
+
+  @param[in] Use1G  Map the memory with 1GB pages rather than 2MB pages.
+
+  @return  The page table base address, as it would be found in CR3.
+**/
+STATIC
+UINT64
+BuildPageTable (
+  IN BOOLEAN  Use1G
+  )
+{
+  UINT64  *Pml4;
+  UINT64  *Pdpt;
+  UINT64  *Pd;
+  UINTN   PdptIndex;
+  UINTN   PdIndex;
+  UINT64  Address;
+
+  Pml4 = HostAllocateLowPages (1);
+  Pdpt = HostAllocateLowPages (1);
+  if (Pml4 == NULL || Pdpt == NULL) {
+    HostPrint ("out of memory\n");
+    HostAbort ();
+  }
+  Pml4[0] = (UINT64)(UINTN)Pdpt | TEST_C_BIT | IA32_PG_P | IA32_PG_RW;
+
+  for (PdptIndex = 0; PdptIndex < TEST_MEMORY_SIZE / SIZE_1GB; PdptIndex++) {
+    Address = (UINT64)PdptIndex * SIZE_1GB;
+    if (Use1G) {
+      Pdpt[PdptIndex] = Address | TEST_C_BIT | IA32_PG_PS | IA32_PG_P |
+                        IA32_PG_RW;
+      continue;
+    }
+    Pd = HostAllocateLowPages (1);
+    if (Pd == NULL) {
+      HostPrint ("out of memory\n");
+      HostAbort ();
+    }
+    Pdpt[PdptIndex] = (UINT64)(UINTN)Pd | TEST_C_BIT | IA32_PG_P | IA32_PG_RW;
+    for (PdIndex = 0; PdIndex < 512; PdIndex++) {
+      Pd[PdIndex] = (Address + PdIndex * SIZE_2MB) | TEST_C_BIT | IA32_PG_PS |
+                    IA32_PG_P | IA32_PG_RW;
+    }
+  }
+  return (UINT64)(UINTN)Pml4;
+}
+
+/**
+  Look up the leaf entry that maps Address.
+
+  @param[in]  Cr3       The page table base address.
+  @param[in]  Address   The address to look up.
+  @param[out] LeafSize  The size of the page that the entry maps.
+
+  @return  The leaf entry, or zero if Address is not mapped.
+**/
+STATIC
+UINT64
+LookUpLeaf (
+  IN  UINT64  Cr3,
+  IN  UINT64  Address,
+  OUT UINT64  *LeafSize
+  )
+{
+  UINT64  *Table;
+  UINT64  Entry;
+  UINTN   Level;
+
+  Table = (UINT64 *)(UINTN)Cr3;
+  for (Level = 4; Level > 0; Level--) {
+    Entry = Table[(Address >> (12 + 9 * (Level - 1))) & 0x1FF];
+    if ((Entry & IA32_PG_P) == 0) {
+      return 0;
+    }
+    *LeafSize = LShiftU64 (SIZE_4KB, 9 * (Level - 1));
+    if (Level == 1 || (Entry & IA32_PG_PS) != 0) {
+      return Entry;
+    }
+    Table = (UINT64 *)(UINTN)(Entry & ~TEST_C_BIT & PAGING_4K_ADDRESS_MASK_64);
+  }
+  return 0;
+}
+
+/**
+  Return the translation of the 4KB page at Address: the physical address,
+  combined with the present, read/write, user, no-execute and memory
+  encryption bits.
+**/
+STATIC
+UINT64
+Translate (
+  IN UINT64  Cr3,
+  IN UINT64  Address
+  )
+{
+  UINT64  Entry;
+  UINT64  LeafSize;
+
+  Entry = LookUpLeaf (Cr3, Address, &LeafSize);
+  if (Entry == 0) {
+    return 0;
+  }
+  return ((Entry & ~TEST_C_BIT & PAGING_4K_ADDRESS_MASK_64 &
+           ~(LeafSize - 1)) +
+          (Address & (LeafSize - 1))) |
+         (Entry & TEST_ATTRIBUTES);
+}
+
+/**
+  Count the 4KB, 2MB and 1GB mappings of a page table.
+**/
+STATIC
+VOID
+CountMappings (
+  IN  UINT64          Cr3,
+  OUT MAPPING_COUNTS  *Counts
+  )
+{
+  UINT64  Address;
+  UINT64  LeafSize;
+
+  Counts->Count4K = 0;
+  Counts->Count2M = 0;
+  Counts->Count1G = 0;
+  for (Address = 0; Address < TEST_MEMORY_SIZE; Address += LeafSize) {
+    if (LookUpLeaf (Cr3, Address, &LeafSize) == 0) {
+      HostPrint ("0x%llx is not mapped\n", (unsigned long long)Address);
+      HostAbort ();
+    }
+    if (LeafSize == SIZE_4KB) {
+      Counts->Count4K++;
+    } else if (LeafSize == SIZE_2MB) {
+      Counts->Count2M++;
+    } else {
+      Counts->Count1G++;
+    }
+  }
+}
+
+/**
+  Check the per-range and the batched page tables against each other, and
+  against mExpectedDecrypted.
+
+  @retval TRUE  The page tables are as expected.
+**/
+STATIC
+BOOLEAN
+CheckPageTables (
+  IN CONST CHAR8  *Step,
+  IN UINT64       PerRangeCr3,
+  IN UINT64       BatchedCr3
+  )
+{
+  UINT64          Address;
+  UINT64          PerRange;
+  UINT64          Batched;
+  MAPPING_COUNTS  PerRangeCounts;
+  MAPPING_COUNTS  BatchedCounts;
+
+  for (Address = 0; Address < TEST_MEMORY_SIZE; Address += SIZE_4KB) {
+    PerRange = Translate (PerRangeCr3, Address);
+    Batched  = Translate (BatchedCr3, Address);
+    if (PerRange != Batched) {
+      HostPrint ("%s: 0x%llx: per-range 0x%llx, batched 0x%llx\n", Step,
+        (unsigned long long)Address, (unsigned long long)PerRange,
+        (unsigned long long)Batched);
+      return FALSE;
+    }
+    if (PerRange != (Address | IA32_PG_P | IA32_PG_RW |
+                     (mExpectedDecrypted[Address / SIZE_4KB] ?
+                      0 : TEST_C_BIT))) {
+      HostPrint ("%s: 0x%llx: unexpected translation 0x%llx\n", Step,
+        (unsigned long long)Address, (unsigned long long)PerRange);
+      return FALSE;
+    }
+  }
+
+  CountMappings (PerRangeCr3, &PerRangeCounts);
+  CountMappings (BatchedCr3, &BatchedCounts);
+  if (PerRangeCounts.Count4K != BatchedCounts.Count4K ||
+      PerRangeCounts.Count2M != BatchedCounts.Count2M ||
+      PerRangeCounts.Count1G != BatchedCounts.Count1G) {
+    HostPrint ("%s: per-range 4KB=%lu 2MB=%lu 1GB=%lu, "
+      "batched 4KB=%lu 2MB=%lu 1GB=%lu\n", Step,
+      (unsigned long)PerRangeCounts.Count4K,
+      (unsigned long)PerRangeCounts.Count2M,
+      (unsigned long)PerRangeCounts.Count1G,
+      (unsigned long)BatchedCounts.Count4K,
+      (unsigned long)BatchedCounts.Count2M,
+      (unsigned long)BatchedCounts.Count1G);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/**
+  Update the memory encryption bit on the ranges First, First + Stride, ...
+  of mRanges, in both page tables, and in mExpectedDecrypted.
+
+  @retval TRUE  The updates have succeeded, and the page tables are as
+                expected.
+**/
+STATIC
+BOOLEAN
+UpdateRanges (
+  IN CONST CHAR8           *Step,
+  IN UINT64                PerRangeCr3,
+  IN UINT64                BatchedCr3,
+  IN UINTN                 First,
+  IN UINTN                 Stride,
+  IN MEM_ENCRYPT_SEV_MODE  Mode
+  )
+{
+  MEM_ENCRYPT_SEV_RANGE  Batch[TEST_MAX_RANGES];
+  UINTN                  BatchCount;
+  UINTN                  Index;
+  UINTN                  Page;
+  RETURN_STATUS          Status;
+  UINTN                  PerRangeFlushes;
+
+  BatchCount = 0;
+  mHostTlbFlushes = 0;
+  for (Index = First; Index < mRangeCount; Index += Stride) {
+    if (Mode == MemEncryptSevDecrypt) {
+      Status = MemEncryptSevClearPageEncMask (PerRangeCr3,
+                 mRanges[Index].BaseAddress, mRanges[Index].NumPages, TRUE);
+    } else {
+      Status = MemEncryptSevSetPageEncMask (PerRangeCr3,
+                 mRanges[Index].BaseAddress, mRanges[Index].NumPages, TRUE);
+    }
+    if (RETURN_ERROR (Status)) {
+      HostPrint ("%s: per-range update of 0x%llx failed: 0x%lx\n", Step,
+        (unsigned long long)mRanges[Index].BaseAddress,
+        (unsigned long)Status);
+      return FALSE;
+    }
+    for (Page = 0; Page < mRanges[Index].NumPages; Page++) {
+      mExpectedDecrypted[mRanges[Index].BaseAddress / SIZE_4KB + Page] =
+        (Mode == MemEncryptSevDecrypt);
+    }
+    Batch[BatchCount++] = mRanges[Index];
+  }
+  PerRangeFlushes = mHostTlbFlushes;
+
+  mHostTlbFlushes = 0;
+  Status = MemEncryptSevUpdatePageEncMaskRanges (BatchedCr3, Batch,
+             BatchCount, Mode, TRUE);
+  if (RETURN_ERROR (Status)) {
+    HostPrint ("%s: batched update failed: 0x%lx\n", Step,
+      (unsigned long)Status);
+    return FALSE;
+  }
+  if (mHostTlbFlushes != 1 || PerRangeFlushes != BatchCount) {
+    HostPrint ("%s: %lu TLB flushes per-range, %lu batched\n", Step,
+      (unsigned long)PerRangeFlushes, (unsigned long)mHostTlbFlushes);
+    return FALSE;
+  }
+
+  return CheckPageTables (Step, PerRangeCr3, BatchedCr3);
+}
+
+/**
+  Run the three steps of the test on mRanges, for both initial page table
+  layouts.
+
+  @param[in] Seed  The seed that mRanges have been generated from, or zero
+                   for mGcdRanges.
+
+  @retval TRUE  The test has passed.
+**/
+STATIC
+BOOLEAN
+RunTest (
+  IN UINTN  Seed
+  )
+{
+  UINTN           Layout;
+  UINT64          PerRangeCr3;
+  UINT64          BatchedCr3;
+  MAPPING_COUNTS  Decrypted;
+  MAPPING_COUNTS  Final;
+
+  for (Layout = 0; Layout < 2; Layout++) {
+    PerRangeCr3 = BuildPageTable (Layout == 1);
+    BatchedCr3  = BuildPageTable (Layout == 1);
+    ZeroMem (mExpectedDecrypted, sizeof mExpectedDecrypted);
+
+    if (!UpdateRanges ("decrypt all", PerRangeCr3, BatchedCr3, 0, 1,
+           MemEncryptSevDecrypt)) {
+      return FALSE;
+    }
+    CountMappings (BatchedCr3, &Decrypted);
+    if (!UpdateRanges ("encrypt even", PerRangeCr3, BatchedCr3, 0, 2,
+           MemEncryptSevEncrypt) ||
+        !UpdateRanges ("encrypt odd", PerRangeCr3, BatchedCr3, 1, 2,
+           MemEncryptSevEncrypt)) {
+      return FALSE;
+    }
+    CountMappings (BatchedCr3, &Final);
+    if (Final.Count4K != 0 || (Layout == 1 && Final.Count2M != 0)) {
+      HostPrint ("split pages have not been merged: 4KB=%lu 2MB=%lu 1GB=%lu\n",
+        (unsigned long)Final.Count4K, (unsigned long)Final.Count2M,
+        (unsigned long)Final.Count1G);
+      return FALSE;
+    }
+
+    if (Seed == 0) {
+      HostPrint ("%-8s", "GCD map");
+    } else {
+      HostPrint ("seed %3lu", (unsigned long)Seed);
+    }
+    HostPrint (" %s pages, %3lu ranges: decrypted 4KB=%lu 2MB=%lu 1GB=%lu\n",
+      (Layout == 1) ? "1GB" : "2MB",
+      (unsigned long)mRangeCount, (unsigned long)Decrypted.Count4K,
+      (unsigned long)Decrypted.Count2M, (unsigned long)Decrypted.Count1G);
+  }
+  return TRUE;
+}
+
+/**
+  Fill mRanges with random, sorted, non-overlapping ranges.
+**/
+STATIC
+VOID
+GenerateRanges (
+  VOID
+  )
+{
+  UINT64  Page;
+  UINT64  Pages;
+
+  mRangeCount = 0;
+  Page = TestRandom (1024);
+  while (mRangeCount < TEST_MAX_RANGES) {
+    switch (TestRandom (4)) {
+    case 0:
+      Pages = 1 + TestRandom (16);
+      break;
+    case 1:
+      Pages = 1 + TestRandom (2048);
+      break;
+    case 2:
+      //
+      // 2MB aligned and sized.
+      //
+      Page  = ALIGN_VALUE (Page, 512);
+      Pages = 512 * (1 + TestRandom (8));
+      break;
+    default:
+      Pages = 1 + TestRandom (SIZE_1GB / SIZE_4KB);
+      break;
+    }
+    if (Page + Pages > TEST_MEMORY_PAGES) {
+      break;
+    }
+    mRanges[mRangeCount].BaseAddress = Page * SIZE_4KB;
+    mRanges[mRangeCount].NumPages    = (UINTN)Pages;
+    mRangeCount++;
+
+    //
+    // One range in four is adjacent to the next one.
+    //
+    Page += Pages;
+    if (TestRandom (4) != 0) {
+      Page += 1 + TestRandom (4096);
+    }
+  }
+}
+
+int
+main (
+  int   Argc,
+  char  **Argv
+  )
+{
+  UINTN   Seeds;
+  UINTN   Seed;
+  CHAR8   *Digit;
+
+  Seeds = 16;
+  if (Argc > 1) {
+    Seeds = 0;
+    for (Digit = Argv[1]; *Digit >= '0' && *Digit <= '9'; Digit++) {
+      Seeds = Seeds * 10 + (*Digit - '0');
+    }
+  }
+
+  CopyMem (mRanges, mGcdRanges, sizeof mGcdRanges);
+  mRangeCount = ARRAY_SIZE (mGcdRanges);
+  if (!RunTest (0)) {
+    HostPrint ("FAILED\n");
+    return 1;
+  }
+
+  for (Seed = 1; Seed <= Seeds; Seed++) {
+    mSeed = 0x9E3779B97F4A7C15ull * Seed;
+    GenerateRanges ();
+    if (!RunTest (Seed)) {
+      HostPrint ("FAILED\n");
+      return 1;
+    }
+  }
+
+  HostPrint ("All tests passed\n");
+  return 0;
+}
@@ -0,0 +1,15 @@
+/** @file
+  Counters shared by the BaseMemEncryptSevLib host test and its host library.
+
+**/
+
+#ifndef _SEV_HOST_TEST_H_
+#define _SEV_HOST_TEST_H_
+
+//
+// The number of CpuFlushTlb() calls, and of data cache flush calls.
+//
+extern UINTN  mHostTlbFlushes;
+extern UINTN  mHostCacheFlushes;
+
+#endif
@@ -94,3 +94,47 @@ MemEncryptSevSetPageEncMask (
            Flush
            );
 }
+
+/**
+  This function sets or clears the memory encryption bit for all memory regions
+  in the Ranges array, from the current page table context.
+
+  Adjacent elements of Ranges that describe contiguous memory are coalesced.
+  The caches are flushed (if requested), and the TLB is flushed, only once for
+  the whole array.
+
+  @param[in]  Cr3BaseAddress          Cr3 Base Address (if zero then use
+                                      current CR3)
+  @param[in]  Ranges                  The memory regions to update.
+  @param[in]  RangeCount              The number of elements in Ranges.
+  @param[in]  Mode                    Whether to set (MemEncryptSevEncrypt) or
+                                      to clear (MemEncryptSevDecrypt) the
+                                      memory encryption bit.
+  @param[in]  Flush                   Flush the caches before updating the bit
+                                      (mostly TRUE except MMIO addresses)
+
+  @retval RETURN_SUCCESS              The attributes were updated for all
+                                      memory regions.
+  @retval RETURN_INVALID_PARAMETER    RangeCount is zero, or the number of
+                                      pages is zero in an element of Ranges.
+  @retval RETURN_UNSUPPORTED          Updating the memory encryption attribute
+                                      is not supported
+**/
+RETURN_STATUS
+EFIAPI
+MemEncryptSevUpdatePageEncMaskRanges (
+  IN PHYSICAL_ADDRESS             Cr3BaseAddress,
+  IN CONST MEM_ENCRYPT_SEV_RANGE  *Ranges,
+  IN UINTN                        RangeCount,
+  IN MEM_ENCRYPT_SEV_MODE         Mode,
+  IN BOOLEAN                      Flush
+  )
+{
+  return InternalMemEncryptSevUpdateMemoryRanges (
+           Cr3BaseAddress,
+           Ranges,
+           RangeCount,
+           Mode,
+           Flush
+           );
+}
@@ -27,6 +27,30 @@ STATIC BOOLEAN mAddressEncMaskChecked = FALSE;
 STATIC UINT64  mAddressEncMask;
 STATIC PAGE_TABLE_POOL   *mPageTablePool = NULL;
 
+//
+// Singly linked list of page table pages that have been released into the
+// page table pool by merging split pages. The first UINT64 of each such page
+// points to the next page.
+//
+STATIC VOID    *mPageTableFreeList = NULL;
+
+//
+// Singly linked list of page table pages that have been released during the
+// current SetMemoryEncDecRanges() call. The paging-structure caches may still
+// reference them, so they are moved to mPageTableFreeList only after the TLB
+// has been flushed.
+//
+STATIC VOID    *mPageTablePendingList = NULL;
+
+//
+// The number of large pages split during the current SetMemoryEncDecRanges()
+// call.
+//
+STATIC UINTN   mSplitPages = 0;
+
+STATIC BOOLEAN mPage1GSupportChecked = FALSE;
+STATIC BOOLEAN mPage1GSupport;
+
 typedef enum {
    SetCBit,
    ClearCBit
@@ -63,6 +87,36 @@ GetMemEncryptionAddressMask (
   return mAddressEncMask;
 }
 
+/**
+  Check whether the processor supports 1GB pages.
+
+  @retval TRUE   1GB pages are supported.
+  @retval FALSE  1GB pages are not supported.
+**/
+STATIC
+BOOLEAN
+IsPage1GSupported (
+  VOID
+  )
+{
+  UINT32                          MaxExtendedFunction;
+  CPUID_EXTENDED_CPU_SIG_EDX      Edx;
+
+  if (mPage1GSupportChecked) {
+    return mPage1GSupport;
+  }
+
+  mPage1GSupport = FALSE;
+  AsmCpuid (CPUID_EXTENDED_FUNCTION, &MaxExtendedFunction, NULL, NULL, NULL);
+  if (MaxExtendedFunction >= CPUID_EXTENDED_CPU_SIG) {
+    AsmCpuid (CPUID_EXTENDED_CPU_SIG, NULL, NULL, NULL, &Edx.Uint32);
+    mPage1GSupport = (BOOLEAN)(Edx.Bits.Page1GB != 0);
+  }
+  mPage1GSupportChecked = TRUE;
+
+  return mPage1GSupport;
+}
+
 /**
   Initialize a buffer pool for page table use only.
 
@@ -153,6 +207,15 @@ AllocatePageTableMemory (
     return NULL;
   }
 
+  //
+  // Prefer single pages that have been released by merging split pages.
+  //
+  if (Pages == 1 && mPageTableFreeList != NULL) {
+    Buffer = mPageTableFreeList;
+    mPageTableFreeList = *(VOID **)Buffer;
+    return Buffer;
+  }
+
   //
   // Renew the pool if necessary.
   //
@@ -180,10 +243,75 @@ AllocatePageTableMemory (
   return Buffer;
 }
 
+/**
+  Release a page, allocated earlier with AllocatePageTableMemory (1), for
+  reuse as page table memory.
+
+  Pages that don't belong to the page table pool (for example, page tables
+  built before this library took over) are not reused, just abandoned.
+
+  The page is only queued; ReusePendingPageTableMemory() makes it available to
+  AllocatePageTableMemory() once the TLB has been flushed. The caller is
+  responsible for making the page writeable.
+
+  @param[in] Buffer   The page to release.
+**/
+STATIC
+VOID
+FreePageTableMemory (
+  IN VOID   *Buffer
+  )
+{
+  PAGE_TABLE_POOL   *Pool;
+  UINTN             PoolEnd;
+
+  if (mPageTablePool == NULL) {
+    return;
+  }
+
+  Pool = mPageTablePool;
+  do {
+    PoolEnd = (UINTN)Pool + Pool->Offset;
+    if ((UINTN)Buffer >= (UINTN)Pool + EFI_PAGE_SIZE &&
+        (UINTN)Buffer < PoolEnd) {
+      *(VOID **)Buffer = mPageTablePendingList;
+      mPageTablePendingList = Buffer;
+      return;
+    }
+    Pool = Pool->NextPool;
+  } while (Pool != mPageTablePool);
+}
+
+/**
+  Make the pages queued by FreePageTableMemory() available for reuse as page
+  table memory.
+
+  The caller is responsible for making the pages writeable, and for flushing
+  the TLB first.
+**/
+STATIC
+VOID
+ReusePendingPageTableMemory (
+  VOID
+  )
+{
+  VOID              *Buffer;
+
+  while (mPageTablePendingList != NULL) {
+    Buffer = mPageTablePendingList;
+    mPageTablePendingList = *(VOID **)Buffer;
+    *(VOID **)Buffer = mPageTableFreeList;
+    mPageTableFreeList = Buffer;
+  }
+}
+
 
 /**
   Split 2M page to 4K.
 
+  The 4K pages inherit the memory encryption bit of the 2M page, except that
+  the GHCB page area is always mapped unencrypted.
+
   @param[in]      PhysicalAddress       Start physical address the 2M page
                                         covered.
   @param[in, out] PageEntry2M           Pointer to 2M page entry.
@@ -208,15 +336,17 @@ Split2MPageTo4K (
   UINTN                             IndexOfPageTableEntries;
   PAGE_TABLE_4K_ENTRY               *PageTableEntry, *PageTableEntry1;
   UINT64                            AddressEncMask;
+  UINT64                            PageEncMask;
 
   PageTableEntry = AllocatePageTableMemory(1);
+  mSplitPages++;
 
   PageTableEntry1 = PageTableEntry;
 
   AddressEncMask = GetMemEncryptionAddressMask ();
+  PageEncMask = *PageEntry2M & AddressEncMask;
 
   ASSERT (PageTableEntry != NULL);
-  ASSERT (*PageEntry2M & AddressEncMask);
 
   PhysicalAddress4K = PhysicalAddress;
   for (IndexOfPageTableEntries = 0;
@@ -231,7 +361,7 @@ Split2MPageTo4K (
     if (!GhcbBase
         || (PhysicalAddress4K < GhcbBase)
         || (PhysicalAddress4K >= GhcbBase + GhcbSize)) {
-      PageTableEntry->Uint64 |= AddressEncMask;
+      PageTableEntry->Uint64 |= PageEncMask;
     }
     PageTableEntry->Bits.ReadWrite = 1;
     PageTableEntry->Bits.Present = 1;
@@ -427,6 +557,8 @@ EnablePageTableProtection (
 /**
   Split 1G page to 2M.
 
+  The 2M pages inherit the memory encryption bit of the 1G page.
+
   @param[in]      PhysicalAddress       Start physical address the 1G page
                                         covered.
   @param[in, out] PageEntry1G           Pointer to 1G page entry.
@@ -451,12 +583,14 @@ Split1GPageTo2M (
   UINTN                             IndexOfPageDirectoryEntries;
   PAGE_TABLE_ENTRY                  *PageDirectoryEntry;
   UINT64                            AddressEncMask;
+  UINT64                            PageEncMask;
 
   PageDirectoryEntry = AllocatePageTableMemory(1);
+  mSplitPages++;
 
   AddressEncMask = GetMemEncryptionAddressMask ();
+  PageEncMask = *PageEntry1G & AddressEncMask;
   ASSERT (PageDirectoryEntry != NULL);
-  ASSERT (*PageEntry1G & GetMemEncryptionAddressMask ());
   //
   // Fill in 1G page entry.
   //
@@ -476,6 +610,7 @@ Split1GPageTo2M (
       //
       // Need to split this 2M page that covers stack range.
       //
+      PageDirectoryEntry->Uint64 = PageEncMask;
       Split2MPageTo4K (
         PhysicalAddress2M,
         (UINT64 *)PageDirectoryEntry,
@@ -488,7 +623,7 @@ Split1GPageTo2M (
       //
       // Fill in the Page Directory entries
       //
-      PageDirectoryEntry->Uint64 = (UINT64) PhysicalAddress2M | AddressEncMask;
+      PageDirectoryEntry->Uint64 = (UINT64) PhysicalAddress2M | PageEncMask;
       PageDirectoryEntry->Bits.ReadWrite = 1;
       PageDirectoryEntry->Bits.Present = 1;
       PageDirectoryEntry->Bits.MustBe1 = 1;
@@ -563,10 +698,301 @@ EnableReadOnlyPageWriteProtect (
 }
 
 
+/**
+  Collapse a page table (or page directory) whose entries map a naturally
+  aligned, contiguous physical range with identical attributes, into a single
+  large page entry in the parent table. This reverses the effect of
+  Split2MPageTo4K() (or Split1GPageTo2M()) once all the small pages have the
+  same memory encryption bit again.
+
+  The Accessed and Dirty bits of the small pages are combined into the large
+  page entry. Small pages with the PAT bit set are never merged.
+
+  @param[in, out] ParentEntry   The page directory entry (or page directory
+                                pointer table entry) that references the table
+                                to collapse.
+  @param[in]      LeafSize      The size of the pages mapped by the table;
+                                SIZE_4KB or SIZE_2MB.
+
+  @retval TRUE    The table has been collapsed, and its page has been released
+                  with FreePageTableMemory().
+  @retval FALSE   The table cannot be collapsed; nothing has been changed.
+**/
+STATIC
+BOOLEAN
+MergePageTable (
+  IN OUT UINT64   *ParentEntry,
+  IN     UINT64   LeafSize
+  )
+{
+  UINT64    AddressEncMask;
+  UINT64    AddressMask;
+  UINT64    PatBit;
+  UINT64    *Table;
+  UINT64    Base;
+  UINT64    Attributes;
+  UINT64    AccessedDirty;
+  UINTN     Index;
+
+  if ((*ParentEntry & IA32_PG_P) == 0 || (*ParentEntry & IA32_PG_PS) != 0) {
+    return FALSE;
+  }
+  //
+  // The permissions in the parent entry must not restrict the permissions in
+  // the table entries, as the parent entry becomes the only entry.
+  //
+  if ((*ParentEntry & IA32_PG_RW) == 0 || (*ParentEntry & IA32_PG_NX) != 0) {
+    return FALSE;
+  }
+
+  AddressEncMask = GetMemEncryptionAddressMask ();
+  if (LeafSize == SIZE_4KB) {
+    AddressMask = PAGING_4K_ADDRESS_MASK_64 & ~AddressEncMask;
+    PatBit      = IA32_PG_PAT_4K;
+  } else {
+    ASSERT (LeafSize == SIZE_2MB);
+    AddressMask = PAGING_2M_ADDRESS_MASK_64 & ~AddressEncMask;
+    PatBit      = IA32_PG_PAT_2M;
+  }
+
+  Table = (UINT64 *)(UINTN)(*ParentEntry & ~AddressEncMask &
+                            PAGING_4K_ADDRESS_MASK_64);
+
+  Base       = Table[0] & AddressMask;
+  Attributes = Table[0] & ~AddressMask & ~(UINT64)(IA32_PG_A | IA32_PG_D);
+  if ((Attributes & IA32_PG_P) == 0 || (Attributes & PatBit) != 0) {
+    return FALSE;
+  }
+  if (LeafSize == SIZE_2MB && (Attributes & IA32_PG_PS) == 0) {
+    return FALSE;
+  }
+  if ((Base & (MultU64x32 (LeafSize, 512) - 1)) != 0) {
+    return FALSE;
+  }
+  if ((*ParentEntry & IA32_PG_U) == 0 && (Attributes & IA32_PG_U) != 0) {
+    return FALSE;
+  }
+
+  AccessedDirty = 0;
+  for (Index = 0; Index < 512; Index++) {
+    if ((Table[Index] & AddressMask) != Base) {
+      return FALSE;
+    }
+    if ((Table[Index] & ~AddressMask & ~(UINT64)(IA32_PG_A | IA32_PG_D)) !=
+        Attributes) {
+      return FALSE;
+    }
+    AccessedDirty |= Table[Index] & (IA32_PG_A | IA32_PG_D);
+    Base += LeafSize;
+  }
+  Base -= MultU64x32 (LeafSize, 512);
+
+  *ParentEntry = Base | Attributes | AccessedDirty | IA32_PG_PS;
+  FreePageTableMemory (Table);
+  return TRUE;
+}
+
+/**
+  Opportunistically collapse the split pages that cover the memory region
+  specified by PhysicalAddress and Length back into 2MB and 1GB pages.
+
+  The caller is responsible for making the page table writeable, and for
+  flushing the TLB.
+
+  @param[in]  Cr3BaseAddress          Cr3 Base Address (must not be zero)
+  @param[in]  PhysicalAddress         The physical address that is the start
+                                      address of a memory region.
+  @param[in]  Length                  The length of memory region
+
+  @return  The number of page table pages released.
+**/
+STATIC
+UINTN
+MergePagesInRange (
+  IN  PHYSICAL_ADDRESS        Cr3BaseAddress,
+  IN  PHYSICAL_ADDRESS        PhysicalAddress,
+  IN  UINTN                   Length
+  )
+{
+  UINT64            PgTableMask;
+  UINT64            *Pml4;
+  UINT64            *Pdpt;
+  UINT64            *Pd;
+  PHYSICAL_ADDRESS  Address;
+  PHYSICAL_ADDRESS  End;
+  UINTN             Released;
+
+  PgTableMask = GetMemEncryptionAddressMask () | EFI_PAGE_MASK;
+  Pml4 = (UINT64 *)(UINTN)(Cr3BaseAddress & ~PgTableMask);
+  End = PhysicalAddress + Length;
+  Released = 0;
+
+  //
+  // First merge 4KB pages into 2MB pages, then 2MB pages into 1GB pages.
+  // Unmapped ranges and 1GB pages have no page directory to look at, so they
+  // are skipped as a whole.
+  //
+  Address = PhysicalAddress & ~(UINT64)(SIZE_2MB - 1);
+  while (Address < End) {
+    if ((Pml4[PML4_OFFSET (Address)] & IA32_PG_P) == 0) {
+      Address = (Address & ~(UINT64)(SIZE_512GB - 1)) + SIZE_512GB;
+      continue;
+    }
+    Pdpt = (UINT64 *)(UINTN)(Pml4[PML4_OFFSET (Address)] & ~PgTableMask &
+                             PAGING_4K_ADDRESS_MASK_64);
+    if ((Pdpt[PDP_OFFSET (Address)] & IA32_PG_P) == 0 ||
+        (Pdpt[PDP_OFFSET (Address)] & IA32_PG_PS) != 0) {
+      Address = (Address & ~(UINT64)(SIZE_1GB - 1)) + SIZE_1GB;
+      continue;
+    }
+    Pd = (UINT64 *)(UINTN)(Pdpt[PDP_OFFSET (Address)] & ~PgTableMask &
+                           PAGING_4K_ADDRESS_MASK_64);
+    if (MergePageTable (&Pd[PDE_OFFSET (Address)], SIZE_4KB)) {
+      Released++;
+    }
+    Address += SIZE_2MB;
+  }
+
+  if (!IsPage1GSupported ()) {
+    return Released;
+  }
+
+  Address = PhysicalAddress & ~(UINT64)(SIZE_1GB - 1);
+  while (Address < End) {
+    if ((Pml4[PML4_OFFSET (Address)] & IA32_PG_P) == 0) {
+      Address = (Address & ~(UINT64)(SIZE_512GB - 1)) + SIZE_512GB;
+      continue;
+    }
+    Pdpt = (UINT64 *)(UINTN)(Pml4[PML4_OFFSET (Address)] & ~PgTableMask &
+                             PAGING_4K_ADDRESS_MASK_64);
+    if (MergePageTable (&Pdpt[PDP_OFFSET (Address)], SIZE_2MB)) {
+      Released++;
+    }
+    Address += SIZE_1GB;
+  }
+
+  return Released;
+}
+
+/**
+  Count the 4KB, 2MB and 1GB mappings in the page table rooted at
+  Cr3BaseAddress, for debug logging.
+
+  @param[in]  Cr3BaseAddress          Cr3 Base Address (must not be zero)
+  @param[out] Count4K                 The number of 4KB mappings.
+  @param[out] Count2M                 The number of 2MB mappings.
+  @param[out] Count1G                 The number of 1GB mappings.
+**/
+STATIC
+VOID
+CountPageTableMappings (
+  IN  PHYSICAL_ADDRESS        Cr3BaseAddress,
+  OUT UINTN                   *Count4K,
+  OUT UINTN                   *Count2M,
+  OUT UINTN                   *Count1G
+  )
+{
+  UINT64            PgTableMask;
+  UINT64            *Pml4;
+  UINT64            *Pdpt;
+  UINT64            *Pd;
+  UINT64            *Pt;
+  UINTN             Pml4Index;
+  UINTN             PdptIndex;
+  UINTN             PdIndex;
+  UINTN             PtIndex;
+
+  PgTableMask = GetMemEncryptionAddressMask () | EFI_PAGE_MASK;
+  Pml4 = (UINT64 *)(UINTN)(Cr3BaseAddress & ~PgTableMask);
+  *Count4K = 0;
+  *Count2M = 0;
+  *Count1G = 0;
+
+  for (Pml4Index = 0; Pml4Index < 512; Pml4Index++) {
+    if ((Pml4[Pml4Index] & IA32_PG_P) == 0) {
+      continue;
+    }
+    Pdpt = (UINT64 *)(UINTN)(Pml4[Pml4Index] & ~PgTableMask &
+                             PAGING_4K_ADDRESS_MASK_64);
+    for (PdptIndex = 0; PdptIndex < 512; PdptIndex++) {
+      if ((Pdpt[PdptIndex] & IA32_PG_P) == 0) {
+        continue;
+      }
+      if ((Pdpt[PdptIndex] & IA32_PG_PS) != 0) {
+        (*Count1G)++;
+        continue;
+      }
+      Pd = (UINT64 *)(UINTN)(Pdpt[PdptIndex] & ~PgTableMask &
+                             PAGING_4K_ADDRESS_MASK_64);
+      for (PdIndex = 0; PdIndex < 512; PdIndex++) {
+        if ((Pd[PdIndex] & IA32_PG_P) == 0) {
+          continue;
+        }
+        if ((Pd[PdIndex] & IA32_PG_PS) != 0) {
+          (*Count2M)++;
+          continue;
+        }
+        Pt = (UINT64 *)(UINTN)(Pd[PdIndex] & ~PgTableMask &
+                               PAGING_4K_ADDRESS_MASK_64);
+        for (PtIndex = 0; PtIndex < 512; PtIndex++) {
+          if ((Pt[PtIndex] & IA32_PG_P) != 0) {
+            (*Count4K)++;
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+  Log how many large pages a batch of updates has split, how many page table
+  pages it has released by merging, and the resulting number of 4KB, 2MB and
+  1GB mappings in the page table rooted at Cr3BaseAddress, if DEBUG_VERBOSE
+  messages are enabled.
+
+  Counting the mappings walks the whole page table, so this is done once per
+  batch, and only if the batch has changed the layout of the page table.
+
+  @param[in]  Cr3BaseAddress          Cr3 Base Address (must not be zero)
+  @param[in]  SplitPages              The number of large pages split.
+  @param[in]  ReleasedPages           The number of page table pages released.
+**/
+STATIC
+VOID
+DumpPageTableStatistics (
+  IN  PHYSICAL_ADDRESS        Cr3BaseAddress,
+  IN  UINTN                   SplitPages,
+  IN  UINTN                   ReleasedPages
+  )
+{
+  UINTN   Count4K;
+  UINTN   Count2M;
+  UINTN   Count1G;
+
+  if (!DebugPrintLevelEnabled (DEBUG_VERBOSE) ||
+      (SplitPages == 0 && ReleasedPages == 0)) {
+    return;
+  }
+
+  CountPageTableMappings (Cr3BaseAddress, &Count4K, &Count2M, &Count1G);
+  DEBUG ((
+    DEBUG_VERBOSE,
+    "%a:%a: split %Lu large pages, released %Lu page table pages: "
+    "4KB=%Lu 2MB=%Lu 1GB=%Lu\n",
+    gEfiCallerBaseName,
+    __FUNCTION__,
+    (UINT64)SplitPages,
+    (UINT64)ReleasedPages,
+    (UINT64)Count4K,
+    (UINT64)Count2M,
+    (UINT64)Count1G
+    ));
+}
+
 /**
   This function either sets or clears memory encryption bit for the memory
-  region specified by PhysicalAddress and Length from the current page table
-  context.
+  region specified by PhysicalAddress and Length in the page table rooted at
+  Cr3BaseAddress.
 
   The function iterates through the PhysicalAddress one page at a time, and set
   or clears the memory encryption mask in the page table. If it encounters
@@ -575,31 +1001,31 @@ EnableReadOnlyPageWriteProtect (
   large pages into smaller (e.g 2M page into 4K pages) and then try to set or
   clear the encryption bit on the smallest page size.
 
-  @param[in]  Cr3BaseAddress          Cr3 Base Address (if zero then use
+  The caller is responsible for flushing the caches, for making the page table
+  writeable, and for flushing the TLB.
+
+  @param[in]      Cr3BaseAddress      Cr3 Base Address (if zero then use
                                       current CR3)
-  @param[in]  PhysicalAddress         The physical address that is the start
+  @param[in]      PhysicalAddress     The physical address that is the start
                                       address of a memory region.
-  @param[in]  Length                  The length of memory region
-  @param[in]  Mode                    Set or Clear mode
-  @param[in]  CacheFlush              Flush the caches before applying the
-                                      encryption mask
+  @param[in]      Length              The length of memory region
+  @param[in]      Mode                Set or Clear mode
+  @param[in, out] PageMapLevel4EntryPtr  On output, the last PML4 entry that
+                                         the function looked up.
 
-  @retval RETURN_SUCCESS              The attributes were cleared for the
-                                      memory region.
-  @retval RETURN_INVALID_PARAMETER    Number of pages is zero.
-  @retval RETURN_UNSUPPORTED          Setting the memory encyrption attribute
-                                      is not supported
+  @retval RETURN_SUCCESS              The attribute was updated for the memory
+                                      region.
+  @retval RETURN_NO_MAPPING           A part of the memory region is not
+                                      mapped.
 **/
-
 STATIC
 RETURN_STATUS
-EFIAPI
-SetMemoryEncDec (
-  IN    PHYSICAL_ADDRESS         Cr3BaseAddress,
-  IN    PHYSICAL_ADDRESS         PhysicalAddress,
-  IN    UINTN                    Length,
-  IN    MAP_RANGE_MODE           Mode,
-  IN    BOOLEAN                  CacheFlush
+SetMemoryEncDecInRange (
+  IN     PHYSICAL_ADDRESS                Cr3BaseAddress,
+  IN     PHYSICAL_ADDRESS                PhysicalAddress,
+  IN     UINTN                           Length,
+  IN     MAP_RANGE_MODE                  Mode,
+  IN OUT PAGE_MAP_AND_DIRECTORY_POINTER  **PageMapLevel4EntryPtr
   )
 {
   PAGE_MAP_AND_DIRECTORY_POINTER *PageMapLevel4Entry;
@@ -609,59 +1035,11 @@ SetMemoryEncDec (
   PAGE_TABLE_ENTRY               *PageDirectory2MEntry;
   PAGE_TABLE_4K_ENTRY            *PageTableEntry;
   UINT64                         PgTableMask;
-  UINT64                         AddressEncMask;
-  BOOLEAN                        IsWpEnabled;
   RETURN_STATUS                  Status;
 
-  //
-  // Set PageMapLevel4Entry to suppress incorrect compiler/analyzer warnings.
-  //
-  PageMapLevel4Entry = NULL;
-
-  DEBUG ((
-    DEBUG_VERBOSE,
-    "%a:%a: Cr3Base=0x%Lx Physical=0x%Lx Length=0x%Lx Mode=%a CacheFlush=%u\n",
-    gEfiCallerBaseName,
-    __FUNCTION__,
-    Cr3BaseAddress,
-    PhysicalAddress,
-    (UINT64)Length,
-    (Mode == SetCBit) ? "Encrypt" : "Decrypt",
-    (UINT32)CacheFlush
-    ));
-
-  //
-  // Check if we have a valid memory encryption mask
-  //
-  AddressEncMask = GetMemEncryptionAddressMask ();
-  if (!AddressEncMask) {
-    return RETURN_ACCESS_DENIED;
-  }
-
-  PgTableMask = AddressEncMask | EFI_PAGE_MASK;
-
-  if (Length == 0) {
-    return RETURN_INVALID_PARAMETER;
-  }
-
-  //
-  // We are going to change the memory encryption attribute from C=0 -> C=1 or
-  // vice versa Flush the caches to ensure that data is written into memory
-  // with correct C-bit
-  //
-  if (CacheFlush) {
-    WriteBackInvalidateDataCacheRange((VOID*) (UINTN)PhysicalAddress, Length);
-  }
-
-  //
-  // Make sure that the page table is changeable.
-  //
-  IsWpEnabled = IsReadOnlyPageWriteProtected ();
-  if (IsWpEnabled) {
-    DisableReadOnlyPageWriteProtect ();
-  }
-
-  Status = EFI_SUCCESS;
+  PgTableMask = GetMemEncryptionAddressMask () | EFI_PAGE_MASK;
+  PageMapLevel4Entry = *PageMapLevel4EntryPtr;
+  Status = RETURN_SUCCESS;
 
   while (Length)
   {
@@ -826,6 +1204,170 @@ SetMemoryEncDec (
     }
   }
 
+Done:
+  *PageMapLevel4EntryPtr = PageMapLevel4Entry;
+  return Status;
+}
+
+/**
+  This function either sets or clears memory encryption bit for the memory
+  regions in the Ranges array, from the current page table context.
+
+  Elements of Ranges that describe contiguous memory are coalesced into a
+  single SetMemoryEncDecInRange() call. The caches are flushed (if requested),
+  the page table protection is re-applied, and the TLB is flushed, once for
+  the whole array.
+
+  @param[in]  Cr3BaseAddress          Cr3 Base Address (if zero then use
+                                      current CR3)
+  @param[in]  Ranges                  The memory regions to update.
+  @param[in]  RangeCount              The number of elements in Ranges.
+  @param[in]  Mode                    Set or Clear mode
+  @param[in]  CacheFlush              Flush the caches before applying the
+                                      encryption mask
+
+  @retval RETURN_SUCCESS              The attributes were updated for all
+                                      memory regions.
+  @retval RETURN_INVALID_PARAMETER    RangeCount is zero, or the number of
+                                      pages is zero in an element of Ranges.
+  @retval RETURN_UNSUPPORTED          Setting the memory encyrption attribute
+                                      is not supported
+**/
+STATIC
+RETURN_STATUS
+EFIAPI
+SetMemoryEncDecRanges (
+  IN    PHYSICAL_ADDRESS             Cr3BaseAddress,
+  IN    CONST MEM_ENCRYPT_SEV_RANGE  *Ranges,
+  IN    UINTN                        RangeCount,
+  IN    MAP_RANGE_MODE               Mode,
+  IN    BOOLEAN                      CacheFlush
+  )
+{
+  PAGE_MAP_AND_DIRECTORY_POINTER *PageMapLevel4Entry;
+  UINT64                         AddressEncMask;
+  BOOLEAN                        IsWpEnabled;
+  RETURN_STATUS                  Status;
+  UINTN                          Index;
+  UINT64                         TotalLength;
+  PHYSICAL_ADDRESS               PhysicalAddress;
+  UINTN                          Length;
+  UINTN                          ReleasedPages;
+
+  //
+  // Set PageMapLevel4Entry to suppress incorrect compiler/analyzer warnings.
+  //
+  PageMapLevel4Entry = NULL;
+
+  DEBUG ((
+    DEBUG_VERBOSE,
+    "%a:%a: Cr3Base=0x%Lx Ranges=%Lu Mode=%a CacheFlush=%u\n",
+    gEfiCallerBaseName,
+    __FUNCTION__,
+    Cr3BaseAddress,
+    (UINT64)RangeCount,
+    (Mode == SetCBit) ? "Encrypt" : "Decrypt",
+    (UINT32)CacheFlush
+    ));
+
+  //
+  // Check if we have a valid memory encryption mask
+  //
+  AddressEncMask = GetMemEncryptionAddressMask ();
+  if (!AddressEncMask) {
+    return RETURN_ACCESS_DENIED;
+  }
+
+  if (Ranges == NULL || RangeCount == 0) {
+    return RETURN_INVALID_PARAMETER;
+  }
+  TotalLength = 0;
+  for (Index = 0; Index < RangeCount; Index++) {
+    if (Ranges[Index].NumPages == 0) {
+      return RETURN_INVALID_PARAMETER;
+    }
+    TotalLength += EFI_PAGES_TO_SIZE ((UINT64)Ranges[Index].NumPages);
+  }
+
+  //
+  // We are going to change the memory encryption attribute from C=0 -> C=1 or
+  // vice versa Flush the caches to ensure that data is written into memory
+  // with correct C-bit. Flushing a large amount of memory line by line is
+  // slower than flushing the entire data cache.
+  //
+  if (CacheFlush) {
+    if (TotalLength >= CACHE_FLUSH_ALL_THRESHOLD) {
+      WriteBackInvalidateDataCache ();
+    } else {
+      for (Index = 0; Index < RangeCount; Index++) {
+        WriteBackInvalidateDataCacheRange (
+          (VOID *)(UINTN)Ranges[Index].BaseAddress,
+          EFI_PAGES_TO_SIZE (Ranges[Index].NumPages)
+          );
+      }
+    }
+  }
+
+  //
+  // Make sure that the page table is changeable.
+  //
+  IsWpEnabled = IsReadOnlyPageWriteProtected ();
+  if (IsWpEnabled) {
+    DisableReadOnlyPageWriteProtect ();
+  }
+
+  //
+  // If Cr3BaseAddress is not specified then read the current CR3
+  //
+  if (Cr3BaseAddress == 0) {
+    Cr3BaseAddress = AsmReadCr3();
+  }
+
+  Status = RETURN_SUCCESS;
+  ReleasedPages = 0;
+  mSplitPages = 0;
+
+  Index = 0;
+  while (Index < RangeCount) {
+    //
+    // Coalesce the current element with the subsequent elements that describe
+    // contiguous memory.
+    //
+    PhysicalAddress = Ranges[Index].BaseAddress;
+    Length          = EFI_PAGES_TO_SIZE (Ranges[Index].NumPages);
+    for (Index++;
+         Index < RangeCount &&
+         Ranges[Index].BaseAddress == PhysicalAddress + Length;
+         Index++) {
+      Length += EFI_PAGES_TO_SIZE (Ranges[Index].NumPages);
+    }
+
+    Status = SetMemoryEncDecInRange (
+               Cr3BaseAddress,
+               PhysicalAddress,
+               Length,
+               Mode,
+               &PageMapLevel4Entry
+               );
+    if (RETURN_ERROR (Status)) {
+      goto Done;
+    }
+
+    //
+    // Splitting large pages in SetMemoryEncDecInRange() may have left behind
+    // page tables whose entries agree again (for example, when an earlier
+    // call changed a sub-range, and this call changed it back). Collapse such
+    // page tables, to keep TLB pressure low.
+    //
+    ReleasedPages += MergePagesInRange (
+                       Cr3BaseAddress,
+                       PhysicalAddress,
+                       Length
+                       );
+  }
+
+  DumpPageTableStatistics (Cr3BaseAddress, mSplitPages, ReleasedPages);
+
   //
   // Protect the page table by marking the memory used for page table to be
   // read-only.
@@ -840,6 +1382,17 @@ SetMemoryEncDec (
   CpuFlushTlb();
 
 Done:
+  //
+  // The page table pages released by merging may be reused only now that the
+  // TLB (including the paging-structure caches) no longer references them.
+  //
+  if (mPageTablePendingList != NULL) {
+    if (RETURN_ERROR (Status)) {
+      CpuFlushTlb ();
+    }
+    ReusePendingPageTableMemory ();
+  }
+
   //
   // Restore page table write protection, if any.
   //
@@ -850,6 +1403,45 @@ Done:
   return Status;
 }
 
+/**
+  This function either sets or clears memory encryption bit for the memory
+  region specified by PhysicalAddress and Length from the current page table
+  context.
+
+  @param[in]  Cr3BaseAddress          Cr3 Base Address (if zero then use
+                                      current CR3)
+  @param[in]  PhysicalAddress         The physical address that is the start
+                                      address of a memory region.
+  @param[in]  Length                  The length of memory region
+  @param[in]  Mode                    Set or Clear mode
+  @param[in]  CacheFlush              Flush the caches before applying the
+                                      encryption mask
+
+  @retval RETURN_SUCCESS              The attributes were cleared for the
+                                      memory region.
+  @retval RETURN_INVALID_PARAMETER    Number of pages is zero.
+  @retval RETURN_UNSUPPORTED          Setting the memory encyrption attribute
+                                      is not supported
+**/
+STATIC
+RETURN_STATUS
+EFIAPI
+SetMemoryEncDec (
+  IN    PHYSICAL_ADDRESS         Cr3BaseAddress,
+  IN    PHYSICAL_ADDRESS         PhysicalAddress,
+  IN    UINTN                    Length,
+  IN    MAP_RANGE_MODE           Mode,
+  IN    BOOLEAN                  CacheFlush
+  )
+{
+  MEM_ENCRYPT_SEV_RANGE          Range;
+
+  Range.BaseAddress = PhysicalAddress;
+  Range.NumPages    = EFI_SIZE_TO_PAGES (Length);
+
+  return SetMemoryEncDecRanges (Cr3BaseAddress, &Range, 1, Mode, CacheFlush);
+}
+
 /**
   This function clears memory encryption bit for the memory region specified by
   PhysicalAddress and Length from the current page table context.
@@ -922,3 +1514,41 @@ InternalMemEncryptSevSetMemoryEncrypted (
            Flush
            );
 }
+
+/**
+  This function sets or clears the memory encryption bit for all memory regions
+  in the Ranges array, from the current page table context.
+
+  @param[in]  Cr3BaseAddress          Cr3 Base Address (if zero then use
+                                      current CR3)
+  @param[in]  Ranges                  The memory regions to update.
+  @param[in]  RangeCount              The number of elements in Ranges.
+  @param[in]  Mode                    Set or clear the memory encryption bit.
+  @param[in]  Flush                   Flush the caches before applying the
+                                      encryption mask
+
+  @retval RETURN_SUCCESS              The attributes were updated for all
+                                      memory regions.
+  @retval RETURN_INVALID_PARAMETER    RangeCount is zero, or the number of
+                                      pages is zero in an element of Ranges.
+  @retval RETURN_UNSUPPORTED          Updating the memory encyrption attribute
+                                      is not supported
+**/
+RETURN_STATUS
+EFIAPI
+InternalMemEncryptSevUpdateMemoryRanges (
+  IN  PHYSICAL_ADDRESS             Cr3BaseAddress,
+  IN  CONST MEM_ENCRYPT_SEV_RANGE  *Ranges,
+  IN  UINTN                        RangeCount,
+  IN  MEM_ENCRYPT_SEV_MODE         Mode,
+  IN  BOOLEAN                      Flush
+  )
+{
+  return SetMemoryEncDecRanges (
+           Cr3BaseAddress,
+           Ranges,
+           RangeCount,
+           (Mode == MemEncryptSevEncrypt) ? SetCBit : ClearCBit,
+           Flush
+           );
+}
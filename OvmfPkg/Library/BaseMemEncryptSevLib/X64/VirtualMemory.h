@@ -24,6 +24,7 @@
 #include <Library/BaseMemoryLib.h>
 #include <Library/CacheMaintenanceLib.h>
 #include <Library/DebugLib.h>
+#include <Library/MemEncryptSevLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Uefi.h>
 
@@ -149,7 +150,13 @@ typedef union {
 
 #define IA32_PG_P                   BIT0
 #define IA32_PG_RW                  BIT1
+#define IA32_PG_U                   BIT2
+#define IA32_PG_A                   BIT5
+#define IA32_PG_D                   BIT6
 #define IA32_PG_PS                  BIT7
+#define IA32_PG_PAT_4K              BIT7
+#define IA32_PG_PAT_2M              BIT12
+#define IA32_PG_NX                  BIT63
 
 #define PAGING_PAE_INDEX_MASK       0x1FF
 
@@ -184,6 +191,13 @@ typedef struct {
   UINTN           FreePages;
 } PAGE_TABLE_POOL;
 
+//
+// When the total length of the memory regions to flush from the caches
+// reaches this threshold, flush the entire data cache instead of flushing the
+// regions line by line.
+//
+#define CACHE_FLUSH_ALL_THRESHOLD   SIZE_2MB
+
 
 
 /**
@@ -240,4 +254,33 @@ InternalMemEncryptSevSetMemoryEncrypted (
   IN  BOOLEAN                 Flush
   );
 
+/**
+  This function sets or clears the memory encryption bit for all memory regions
+  in the Ranges array, from the current page table context.
+
+  @param[in]  Cr3BaseAddress          Cr3 Base Address (if zero then use
+                                      current CR3)
+  @param[in]  Ranges                  The memory regions to update.
+  @param[in]  RangeCount              The number of elements in Ranges.
+  @param[in]  Mode                    Set or clear the memory encryption bit.
+  @param[in]  Flush                   Flush the caches before applying the
+                                      encryption mask
+
+  @retval RETURN_SUCCESS              The attributes were updated for all
+                                      memory regions.
+  @retval RETURN_INVALID_PARAMETER    RangeCount is zero, or the number of
+                                      pages is zero in an element of Ranges.
+  @retval RETURN_UNSUPPORTED          Updating the memory encyrption attribute
+                                      is not supported
+**/
+RETURN_STATUS
+EFIAPI
+InternalMemEncryptSevUpdateMemoryRanges (
+  IN  PHYSICAL_ADDRESS             Cr3BaseAddress,
+  IN  CONST MEM_ENCRYPT_SEV_RANGE  *Ranges,
+  IN  UINTN                        RangeCount,
+  IN  MEM_ENCRYPT_SEV_MODE         Mode,
+  IN  BOOLEAN                      Flush
+  );
+
 #endif
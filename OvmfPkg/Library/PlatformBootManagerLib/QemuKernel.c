@@ -13,15 +13,148 @@
 
 #include <Uefi.h>
 
+#include <Library/BaseCryptLib.h>
 #include <Library/BaseLib.h>
 #include <Library/DebugLib.h>
 #include <Library/LoadLinuxLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/PerformanceLib.h>
 #include <Library/QemuFwCfgLib.h>
 #include <Library/ReportStatusCodeLib.h>
+#include <Library/TpmMeasurementLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 
+//
+// With PcdQemuKernelMeasure, the blobs are read from fw_cfg in chunks of this
+// size, and each chunk is hashed while it is still in the cache.
+//
+#define QEMU_KERNEL_CHUNK_SIZE  SIZE_256KB
+
+//
+// EV_IPL from the TCG PC Client Specific Implementation Specification. The
+// blobs are measured like a boot loader would measure them: the kernel and
+// the initrd into PCR 9, the command line into PCR 8.
+//
+#define QEMU_KERNEL_EV_IPL              0x0000000D
+#define QEMU_KERNEL_BLOB_PCR            9
+#define QEMU_KERNEL_COMMAND_LINE_PCR    8
+
+/**
+  Read a blob from fw_cfg directly into its final location. With
+  PcdQemuKernelMeasure, compute the SHA-256 digest of the blob in the same
+  pass.
+
+  The read is recorded as a performance measurement, with Name as token.
+
+  @param[in]  Name      Name of the blob, for logging.
+  @param[in]  DataItem  The fw_cfg item to read.
+  @param[in]  Size      The size of the blob.
+  @param[out] Buffer    The final location of the blob.
+  @param[out] Digest    The SHA-256 digest of the blob. Only set with
+                        PcdQemuKernelMeasure.
+
+  @retval EFI_SUCCESS           The blob has been read.
+  @retval EFI_OUT_OF_RESOURCES  The hash context could not be allocated.
+  @retval EFI_ABORTED           Hashing failed.
+**/
+STATIC
+EFI_STATUS
+QemuKernelFetchBlob (
+  IN  CONST CHAR8          *Name,
+  IN  FIRMWARE_CONFIG_ITEM DataItem,
+  IN  UINTN                Size,
+  OUT VOID                 *Buffer,
+  OUT UINT8                *Digest
+  )
+{
+  VOID    *HashContext;
+  BOOLEAN Hashed;
+  UINTN   ChunkSize;
+  UINT8   *Cursor;
+
+  HashContext = NULL;
+  Hashed = TRUE;
+  if (FeaturePcdGet (PcdQemuKernelMeasure)) {
+    HashContext = AllocatePool (Sha256GetContextSize ());
+    if (HashContext == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+    Hashed = Sha256Init (HashContext);
+  }
+
+  DEBUG ((EFI_D_INFO, "%a size: 0x%x\n", Name, (UINT32) Size));
+  DEBUG ((EFI_D_INFO, "Reading %a image ...", Name));
+  PERF_START (NULL, Name, "QemuKernel", 0);
+  QemuFwCfgSelectItem (DataItem);
+
+  Cursor = Buffer;
+  while (Size > 0) {
+    ChunkSize = (HashContext == NULL) ? Size
+                                      : MIN (Size, QEMU_KERNEL_CHUNK_SIZE);
+    QemuFwCfgReadBytes (ChunkSize, Cursor);
+    if (HashContext != NULL && Hashed) {
+      Hashed = Sha256Update (HashContext, Cursor, ChunkSize);
+    }
+    Cursor += ChunkSize;
+    Size -= ChunkSize;
+  }
+
+  if (HashContext != NULL) {
+    if (Hashed) {
+      Hashed = Sha256Final (HashContext, Digest);
+    }
+    FreePool (HashContext);
+  }
+  PERF_END (NULL, Name, "QemuKernel", 0);
+  DEBUG ((EFI_D_INFO, " [done]\n"));
+
+  if (!Hashed) {
+    DEBUG ((EFI_D_ERROR, "%a: hashing %a failed\n", __FUNCTION__, Name));
+    return EFI_ABORTED;
+  }
+  return EFI_SUCCESS;
+}
+
+/**
+  Measure a blob into the TPM, if there is one, with PcdQemuKernelMeasure.
+
+  The blob has been hashed by QemuKernelFetchBlob() while it was read, so the
+  event data is its SHA-256 digest rather than the blob itself; the PCR is
+  extended with the digest of that digest in each active bank.
+
+  @param[in] Name      Description of the blob, logged with the measurement.
+  @param[in] PcrIndex  The PCR to extend.
+  @param[in] Digest    The SHA-256 digest of the blob.
+**/
+STATIC
+VOID
+QemuKernelMeasureBlob (
+  IN CONST CHAR8  *Name,
+  IN UINT32       PcrIndex,
+  IN UINT8        *Digest
+  )
+{
+  EFI_STATUS Status;
+
+  if (!FeaturePcdGet (PcdQemuKernelMeasure)) {
+    return;
+  }
+
+  Status = TpmMeasureAndLogData (
+             PcrIndex,
+             QEMU_KERNEL_EV_IPL,
+             (VOID *) Name,
+             (UINT32) AsciiStrSize (Name),
+             Digest,
+             SHA256_DIGEST_SIZE
+             );
+  if (EFI_ERROR (Status) && Status != EFI_UNSUPPORTED) {
+    DEBUG ((EFI_D_ERROR, "%a: measuring %a: %r\n", __FUNCTION__, Name,
+      Status));
+  }
+}
 
 EFI_STATUS
 TryRunningQemuKernel (
@@ -38,6 +171,7 @@ TryRunningQemuKernel (
   CHAR8                     *CommandLine;
   UINTN                     InitrdSize;
   VOID*                     InitrdData;
+  UINT8                     Digest[SHA256_DIGEST_SIZE];
 
   SetupBuf = NULL;
   SetupSize = 0;
@@ -69,16 +203,22 @@ TryRunningQemuKernel (
     return EFI_OUT_OF_RESOURCES;
   }
 
-  DEBUG ((EFI_D_INFO, "Setup size: 0x%x\n", (UINT32) SetupSize));
-  DEBUG ((EFI_D_INFO, "Reading kernel setup image ..."));
-  QemuFwCfgSelectItem (QemuFwCfgItemKernelSetupData);
-  QemuFwCfgReadBytes (SetupSize, SetupBuf);
-  DEBUG ((EFI_D_INFO, " [done]\n"));
+  //
+  // The setup image is hashed as it is read, before
+  // LoadLinuxInitializeKernelSetup() clears all but the setup header, so that
+  // the measurement covers the image as provided by QEMU.
+  //
+  Status = QemuKernelFetchBlob ("kernel setup", QemuFwCfgItemKernelSetupData,
+             SetupSize, SetupBuf, Digest);
+  if (EFI_ERROR (Status)) {
+    goto FreeAndReturn;
+  }
 
   Status = LoadLinuxCheckKernelSetup (SetupBuf, SetupSize);
   if (EFI_ERROR (Status)) {
     goto FreeAndReturn;
   }
+  QemuKernelMeasureBlob ("qemu -kernel setup", QEMU_KERNEL_BLOB_PCR, Digest);
 
   Status = LoadLinuxInitializeKernelSetup (SetupBuf);
   if (EFI_ERROR (Status)) {
@@ -91,6 +231,11 @@ TryRunningQemuKernel (
     goto FreeAndReturn;
   }
 
+  //
+  // The kernel, the command line and the initrd are read straight into the
+  // pages LoadLinux() hands to the kernel; nothing is copied or relocated
+  // afterwards.
+  //
   KernelBuf = LoadLinuxAllocateKernelPages (
                 SetupBuf,
                 EFI_SIZE_TO_PAGES (KernelInitialSize));
@@ -100,11 +245,12 @@ TryRunningQemuKernel (
     goto FreeAndReturn;
   }
 
-  DEBUG ((EFI_D_INFO, "Kernel size: 0x%x\n", (UINT32) KernelSize));
-  DEBUG ((EFI_D_INFO, "Reading kernel image ..."));
-  QemuFwCfgSelectItem (QemuFwCfgItemKernelData);
-  QemuFwCfgReadBytes (KernelSize, KernelBuf);
-  DEBUG ((EFI_D_INFO, " [done]\n"));
+  Status = QemuKernelFetchBlob ("kernel", QemuFwCfgItemKernelData,
+             KernelSize, KernelBuf, Digest);
+  if (EFI_ERROR (Status)) {
+    goto FreeAndReturn;
+  }
+  QemuKernelMeasureBlob ("qemu -kernel", QEMU_KERNEL_BLOB_PCR, Digest);
 
   QemuFwCfgSelectItem (QemuFwCfgItemCommandLineSize);
   CommandLineSize = (UINTN) QemuFwCfgRead64 ();
@@ -112,8 +258,19 @@ TryRunningQemuKernel (
   if (CommandLineSize > 0) {
     CommandLine = LoadLinuxAllocateCommandLinePages (
                     EFI_SIZE_TO_PAGES (CommandLineSize));
-    QemuFwCfgSelectItem (QemuFwCfgItemCommandLineData);
-    QemuFwCfgReadBytes (CommandLineSize, CommandLine);
+    if (CommandLine == NULL) {
+      DEBUG ((EFI_D_ERROR, "Unable to allocate memory for command line!\n"));
+      Status = EFI_OUT_OF_RESOURCES;
+      goto FreeAndReturn;
+    }
+    Status = QemuKernelFetchBlob ("command line",
+               QemuFwCfgItemCommandLineData, CommandLineSize, CommandLine,
+               Digest);
+    if (EFI_ERROR (Status)) {
+      goto FreeAndReturn;
+    }
+    QemuKernelMeasureBlob ("qemu -append", QEMU_KERNEL_COMMAND_LINE_PCR,
+      Digest);
   } else {
     CommandLine = NULL;
   }
@@ -131,11 +288,17 @@ TryRunningQemuKernel (
                    SetupBuf,
                    EFI_SIZE_TO_PAGES (InitrdSize)
                    );
-    DEBUG ((EFI_D_INFO, "Initrd size: 0x%x\n", (UINT32) InitrdSize));
-    DEBUG ((EFI_D_INFO, "Reading initrd image ..."));
-    QemuFwCfgSelectItem (QemuFwCfgItemInitrdData);
-    QemuFwCfgReadBytes (InitrdSize, InitrdData);
-    DEBUG ((EFI_D_INFO, " [done]\n"));
+    if (InitrdData == NULL) {
+      DEBUG ((EFI_D_ERROR, "Unable to allocate memory for initrd!\n"));
+      Status = EFI_OUT_OF_RESOURCES;
+      goto FreeAndReturn;
+    }
+    Status = QemuKernelFetchBlob ("initrd", QemuFwCfgItemInitrdData,
+               InitrdSize, InitrdData, Digest);
+    if (EFI_ERROR (Status)) {
+      goto FreeAndReturn;
+    }
+    QemuKernelMeasureBlob ("qemu -initrd", QEMU_KERNEL_BLOB_PCR, Digest);
   } else {
     InitrdData = NULL;
   }
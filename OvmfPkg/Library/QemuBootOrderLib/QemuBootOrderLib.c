@@ -24,6 +24,7 @@
 #include <Library/DevicePathLib.h>
 #include <Library/QemuBootOrderLib.h>
 #include <Library/BaseMemoryLib.h>
+#include <Library/PerformanceLib.h>
 #include <Guid/GlobalVariable.h>
 #include <Guid/VirtioMmioTransport.h>
 
@@ -257,6 +258,10 @@ typedef struct {
                                                   //   ownership
   BOOLEAN                            Appended;    // has been added to a
                                                   //   BOOT_ORDER?
+  CHAR16                             *Converted;  // text form of the
+                                                  //   (expanded) device path,
+                                                  //   owned; NULL if it could
+                                                  //   not be converted
 } ACTIVE_OPTION;
 
 
@@ -359,6 +364,7 @@ CollectActiveOptions (
         if (ScanMode == 1) {
           (*ActiveOption)[*Count].BootOption = &BootOptions[Index];
           (*ActiveOption)[*Count].Appended   = FALSE;
+          (*ActiveOption)[*Count].Converted  = NULL;
         }
         ++*Count;
       }
@@ -1606,36 +1612,24 @@ FreeFwCfg:
 /**
 
   Convert the UEFI DevicePath to full text representation with DevPathToText,
-  then match the UEFI device path fragment in Translated against it.
+  for matching UEFI device path fragments against it. Short-form device paths
+  are expanded to absolute device paths first.
 
-  @param[in] Translated        UEFI device path fragment, translated from
-                               OpenFirmware format, to search for.
+  @param[in] DevicePath  Boot option device path to convert.
 
-  @param[in] TranslatedLength  The length of Translated in CHAR16's.
 
-  @param[in] DevicePath        Boot option device path whose textual rendering
-                               to search in.
-
-  @param[in] DevPathToText  Binary-to-text conversion protocol for DevicePath.
-
-
-  @retval TRUE   If Translated was found at the beginning of DevicePath after
-                 converting the latter to text.
-
-  @retval FALSE  If DevicePath was NULL, or it could not be converted, or there
-                 was no match.
+  @return  The textual rendering of DevicePath, to be released with FreePool()
+           by the caller. NULL if DevicePath could not be converted or
+           expanded.
 
 **/
 STATIC
-BOOLEAN
-Match (
-  IN  CONST CHAR16                           *Translated,
-  IN  UINTN                                  TranslatedLength,
+CHAR16 *
+ConvertBootOptionToText (
   IN  EFI_DEVICE_PATH_PROTOCOL               *DevicePath
   )
 {
   CHAR16                   *Converted;
-  BOOLEAN                  Result;
   VOID                     *FileBuffer;
   UINTN                    FileSize;
   EFI_DEVICE_PATH_PROTOCOL *AbsDevicePath;
@@ -1649,10 +1643,9 @@ Match (
                 FALSE  // AllowShortcuts
                 );
   if (Converted == NULL) {
-    return FALSE;
+    return NULL;
   }
 
-  Result = FALSE;
   Shortform = FALSE;
   //
   // Expand the short-form device path to full device path
@@ -1698,13 +1691,13 @@ Match (
                    DevicePath, &AbsDevicePath, &FileSize
                    );
     if (FileBuffer == NULL) {
-      goto Exit;
+      goto Error;
     }
     FreePool (FileBuffer);
     AbsConverted = ConvertDevicePathToText (AbsDevicePath, FALSE, FALSE);
     FreePool (AbsDevicePath);
     if (AbsConverted == NULL) {
-      goto Exit;
+      goto Error;
     }
     DEBUG ((DEBUG_VERBOSE,
       "%a: expanded relative device path \"%s\" for prefix matching\n",
@@ -1713,20 +1706,170 @@ Match (
     Converted = AbsConverted;
   }
 
-  //
-  // Is Translated a prefix of Converted?
-  //
-  Result = (BOOLEAN)(StrnCmp (Converted, Translated, TranslatedLength) == 0);
-  DEBUG ((
-    DEBUG_VERBOSE,
-    "%a: against \"%s\": %a\n",
-    __FUNCTION__,
-    Converted,
-    Result ? "match" : "no match"
-    ));
-Exit:
+  return Converted;
+
+Error:
   FreePool (Converted);
-  return Result;
+  return NULL;
+}
+
+
+/**
+
+  Build a prefix index of the active boot options: convert the device path of
+  each active boot option to text exactly once, and sort the options by their
+  textual renderings.
+
+  The boot options whose textual rendering starts with a given UEFI device
+  path fragment then form one contiguous range of the index, which
+  FindPrefixRange() locates with binary search.
+
+  @param[in,out] ActiveOption  The array of active boot options to index. The
+                               Converted field of each element is set.
+
+  @param[in]     ActiveCount   Number of elements in ActiveOption.
+
+  @param[out]    Index         Indices into ActiveOption of the boot options
+                               that could be converted, sorted by Converted.
+                               The caller is responsible for freeing the
+                               array with FreePool() after use.
+
+  @param[out]    IndexCount    Number of elements in Index.
+
+
+  @retval RETURN_SUCCESS           The index has been created.
+
+  @retval RETURN_OUT_OF_RESOURCES  Memory allocation failed.
+
+**/
+STATIC
+RETURN_STATUS
+CreatePrefixIndex (
+  IN OUT  ACTIVE_OPTION *ActiveOption,
+  IN      UINTN         ActiveCount,
+  OUT     UINTN         **Index,
+  OUT     UINTN         *IndexCount
+  )
+{
+  UINTN  Idx;
+  UINTN  Left;
+  UINTN  Right;
+  UINTN  Middle;
+  CHAR16 *Converted;
+
+  *Index = AllocatePool (ActiveCount * sizeof **Index);
+  if (*Index == NULL) {
+    return RETURN_OUT_OF_RESOURCES;
+  }
+
+  *IndexCount = 0;
+  for (Idx = 0; Idx < ActiveCount; ++Idx) {
+    Converted = ConvertBootOptionToText (ActiveOption[Idx].BootOption->FilePath);
+    ActiveOption[Idx].Converted = Converted;
+    if (Converted == NULL) {
+      continue;
+    }
+
+    //
+    // Binary insertion; equal renderings stay in boot option order.
+    //
+    Left = 0;
+    Right = *IndexCount;
+    while (Left < Right) {
+      Middle = Left + (Right - Left) / 2;
+      if (StrCmp (ActiveOption[(*Index)[Middle]].Converted, Converted) <= 0) {
+        Left = Middle + 1;
+      } else {
+        Right = Middle;
+      }
+    }
+    CopyMem (&(*Index)[Left + 1], &(*Index)[Left],
+      (*IndexCount - Left) * sizeof **Index);
+    (*Index)[Left] = Idx;
+    ++*IndexCount;
+  }
+  return RETURN_SUCCESS;
+}
+
+
+/**
+
+  Find the first element of the prefix index whose textual rendering does not
+  compare below the UEFI device path fragment in Translated (when comparing
+  Translated's length only), or above it, if Above is TRUE.
+
+**/
+STATIC
+UINTN
+PrefixIndexBound (
+  IN  CONST ACTIVE_OPTION *ActiveOption,
+  IN  CONST UINTN         *Index,
+  IN  UINTN               IndexCount,
+  IN  CONST CHAR16        *Translated,
+  IN  UINTN               TranslatedLength,
+  IN  BOOLEAN             Above
+  )
+{
+  UINTN  Left;
+  UINTN  Right;
+  UINTN  Middle;
+  INTN   Cmp;
+
+  Left = 0;
+  Right = IndexCount;
+  while (Left < Right) {
+    Middle = Left + (Right - Left) / 2;
+    Cmp = StrnCmp (ActiveOption[Index[Middle]].Converted, Translated,
+            TranslatedLength);
+    if (Cmp < 0 || (Above && Cmp == 0)) {
+      Left = Middle + 1;
+    } else {
+      Right = Middle;
+    }
+  }
+  return Left;
+}
+
+
+/**
+
+  Look up the active boot options whose textual rendering starts with the
+  UEFI device path fragment in Translated.
+
+  @param[in]  ActiveOption      The array of active boot options.
+
+  @param[in]  Index             The prefix index created by
+                                CreatePrefixIndex().
+
+  @param[in]  IndexCount        Number of elements in Index.
+
+  @param[in]  Translated        UEFI device path fragment, translated from
+                                OpenFirmware format, to search for.
+
+  @param[in]  TranslatedLength  The length of Translated in CHAR16's.
+
+  @param[out] First             The first matching element of Index.
+
+  @param[out] Last              One past the last matching element of Index.
+                                Equal to First if there was no match.
+
+**/
+STATIC
+VOID
+FindPrefixRange (
+  IN  CONST ACTIVE_OPTION *ActiveOption,
+  IN  CONST UINTN         *Index,
+  IN  UINTN               IndexCount,
+  IN  CONST CHAR16        *Translated,
+  IN  UINTN               TranslatedLength,
+  OUT UINTN               *First,
+  OUT UINTN               *Last
+  )
+{
+  *First = PrefixIndexBound (ActiveOption, Index, IndexCount, Translated,
+             TranslatedLength, FALSE);
+  *Last = *First + PrefixIndexBound (ActiveOption, Index + *First,
+                     IndexCount - *First, Translated, TranslatedLength, TRUE);
 }
 
 
@@ -1935,6 +2078,12 @@ SetBootOrderFromQemu (
   EFI_BOOT_MANAGER_LOAD_OPTION     *BootOptions;
   UINTN                            BootOptionCount;
 
+  UINTN                            *PrefixIndex;
+  UINTN                            PrefixIndexCount;
+  UINTN                            *Matches;
+  UINTN                            Idx;
+  UINTN                            NumPaths;
+
   Status = QemuFwCfgFindFile ("bootorder", &FwCfgItem, &FwCfgSize);
   if (Status != RETURN_SUCCESS) {
     return Status;
@@ -1995,9 +2144,33 @@ SetBootOrderFromQemu (
     ExtraPciRoots = NULL;
   }
 
+  //
+  // Convert each active boot option to text once, rather than once per
+  // OpenFirmware path.
+  //
+  // The indexing and the matching below are timed with PerformanceLib; the
+  // "BootOrderIndex" and "BootOrderMatch" records show up in the boot
+  // performance data when the platform collects it.
+  //
+  PERF_START (NULL, "BootOrderIndex", "QemuBootOrder", 0);
+  Status = CreatePrefixIndex (ActiveOption, ActiveCount, &PrefixIndex,
+             &PrefixIndexCount);
+  PERF_END (NULL, "BootOrderIndex", "QemuBootOrder", 0);
+  if (RETURN_ERROR (Status)) {
+    goto ErrorFreeExtraPciRoots;
+  }
+
+  Matches = AllocatePool (ActiveCount * sizeof *Matches);
+  if (Matches == NULL) {
+    Status = RETURN_OUT_OF_RESOURCES;
+    goto ErrorFreePrefixIndex;
+  }
+
   //
   // translate each OpenFirmware path
   //
+  PERF_START (NULL, "BootOrderMatch", "QemuBootOrder", 0);
+  NumPaths = 0;
   TranslatedSize = ARRAY_SIZE (Translated);
   Status = TranslateOfwPath (&FwCfgPtr, ExtraPciRoots, Translated,
              &TranslatedSize);
@@ -2006,34 +2179,65 @@ SetBootOrderFromQemu (
          Status == RETURN_PROTOCOL_ERROR ||
          Status == RETURN_BUFFER_TOO_SMALL) {
     if (Status == RETURN_SUCCESS) {
-      UINTN Idx;
+      UINTN First;
+      UINTN Last;
+      UINTN MatchCount;
+      UINTN Pos;
 
       //
-      // match translated OpenFirmware path against all active boot options
+      // look up the active boot options that the translated OpenFirmware
+      // path is a prefix of
       //
-      for (Idx = 0; Idx < ActiveCount; ++Idx) {
-        if (!ActiveOption[Idx].Appended &&
-            Match (
-              Translated,
-              TranslatedSize, // contains length, not size, in CHAR16's here
-              ActiveOption[Idx].BootOption->FilePath
-              )
-            ) {
+      FindPrefixRange (
+        ActiveOption,
+        PrefixIndex,
+        PrefixIndexCount,
+        Translated,
+        TranslatedSize, // contains length, not size, in CHAR16's here
+        &First,
+        &Last
+        );
+      ++NumPaths;
+
+      //
+      // Append the matches in boot option order, like a linear scan of the
+      // active boot options would.
+      //
+      MatchCount = 0;
+      for (Idx = First; Idx < Last; ++Idx) {
+        for (Pos = MatchCount;
+             Pos > 0 && Matches[Pos - 1] > PrefixIndex[Idx];
+             --Pos) {
+          Matches[Pos] = Matches[Pos - 1];
+        }
+        Matches[Pos] = PrefixIndex[Idx];
+        ++MatchCount;
+      }
+
+      for (Pos = 0; Pos < MatchCount; ++Pos) {
+        if (!ActiveOption[Matches[Pos]].Appended) {
+          DEBUG ((DEBUG_VERBOSE, "%a: \"%s\" matches \"%s\"\n", __FUNCTION__,
+            Translated, ActiveOption[Matches[Pos]].Converted));
           //
           // match found, store ID and continue with next OpenFirmware path
           //
-          Status = BootOrderAppend (&BootOrder, &ActiveOption[Idx]);
+          Status = BootOrderAppend (&BootOrder, &ActiveOption[Matches[Pos]]);
           if (Status != RETURN_SUCCESS) {
-            goto ErrorFreeExtraPciRoots;
+            goto ErrorFreeMatches;
           }
         }
-      } // scanned all active boot options
+      } // appended all matching active boot options
     }   // translation successful
 
     TranslatedSize = ARRAY_SIZE (Translated);
     Status = TranslateOfwPath (&FwCfgPtr, ExtraPciRoots, Translated,
                &TranslatedSize);
   } // scanning of OpenFirmware paths done
+  PERF_END (NULL, "BootOrderMatch", "QemuBootOrder", 0);
+
+  DEBUG ((DEBUG_INFO, "%a: indexed %Lu of %Lu boot option(s), matched %Lu "
+    "OpenFirmware device path(s)\n", __FUNCTION__,
+    (UINT64)PrefixIndexCount, (UINT64)ActiveCount, (UINT64)NumPaths));
 
   if (Status == RETURN_NOT_FOUND && BootOrder.Produced > 0) {
     //
@@ -2043,7 +2247,7 @@ SetBootOrderFromQemu (
     //
     Status = BootOrderComplete (&BootOrder, ActiveOption, ActiveCount);
     if (RETURN_ERROR (Status)) {
-      goto ErrorFreeExtraPciRoots;
+      goto ErrorFreeMatches;
     }
 
     //
@@ -2062,19 +2266,30 @@ SetBootOrderFromQemu (
     if (EFI_ERROR (Status)) {
       DEBUG ((DEBUG_ERROR, "%a: setting BootOrder: %r\n", __FUNCTION__,
         Status));
-      goto ErrorFreeExtraPciRoots;
+      goto ErrorFreeMatches;
     }
 
     DEBUG ((DEBUG_INFO, "%a: setting BootOrder: success\n", __FUNCTION__));
     PruneBootVariables (ActiveOption, ActiveCount);
   }
 
+ErrorFreeMatches:
+  FreePool (Matches);
+
+ErrorFreePrefixIndex:
+  FreePool (PrefixIndex);
+
 ErrorFreeExtraPciRoots:
   if (ExtraPciRoots != NULL) {
     DestroyExtraRootBusMap (ExtraPciRoots);
   }
 
 ErrorFreeActiveOption:
+  for (Idx = 0; Idx < ActiveCount; ++Idx) {
+    if (ActiveOption[Idx].Converted != NULL) {
+      FreePool (ActiveOption[Idx].Converted);
+    }
+  }
   FreePool (ActiveOption);
 
 ErrorFreeBootOptions:
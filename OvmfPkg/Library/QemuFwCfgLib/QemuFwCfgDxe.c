@@ -17,6 +17,8 @@
 
 #include <Uefi.h>
 
+#include <Guid/QemuFwCfgSevDmaWindow.h>
+
 #include <Protocol/IoMmu.h>
 
 #include <Library/BaseLib.h>
@@ -26,6 +28,7 @@
 #include <Library/QemuFwCfgLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/MemEncryptSevLib.h>
+#include <Library/MemoryAllocationLib.h>
 
 #include "QemuFwCfgLibInternal.h"
 
@@ -34,6 +37,42 @@ STATIC BOOLEAN mQemuFwCfgDmaSupported;
 
 STATIC EDKII_IOMMU_PROTOCOL        *mIoMmuProtocol;
 
+//
+// The shared DMA window, as found or set up by this module, and whether
+// ExitBootServices() has been signaled.
+//
+STATIC QEMU_FW_CFG_SEV_DMA_WINDOW  *mFwCfgDmaWindow;
+STATIC BOOLEAN                     mFwCfgExitBootServices;
+
+/**
+  Notification function for ExitBootServices(). From here on, this module
+  stops using the shared DMA window and falls back to per-transfer bounce
+  buffers.
+
+  The notification is queued at TPL_NOTIFY, which makes it run before the
+  IOMMU driver unmaps (and so re-encrypts) the window; that happens only after
+  the notification functions of all events in the
+  EFI_EVENT_GROUP_EXIT_BOOT_SERVICES group have been invoked.
+
+  @param[in] Event    Event whose notification function is being invoked.
+
+  @param[in] Context  Ignored.
+**/
+STATIC
+VOID
+EFIAPI
+QemuFwCfgExitBoot (
+  IN EFI_EVENT Event,
+  IN VOID      *Context
+  )
+{
+  mFwCfgExitBootServices = TRUE;
+  if (mFwCfgDmaWindow != NULL) {
+    mFwCfgDmaWindow->Released = TRUE;
+    mFwCfgDmaWindow = NULL;
+  }
+}
+
 /**
   Returns a boolean indicating if the firmware configuration interface
   is available or not.
@@ -93,6 +132,7 @@ QemuFwCfgInitialize (
 
   if (mQemuFwCfgDmaSupported && MemEncryptSevIsEnabled ()) {
     EFI_STATUS   Status;
+    EFI_EVENT    ExitBootEvent;
 
     //
     // IoMmuDxe driver must have installed the IOMMU protocol. If we are not
@@ -107,6 +147,16 @@ QemuFwCfgInitialize (
       ASSERT (FALSE);
       CpuDeadLoop ();
     }
+
+    Status = gBS->CreateEvent (EVT_SIGNAL_EXIT_BOOT_SERVICES, TPL_NOTIFY,
+                    QemuFwCfgExitBoot, NULL, &ExitBootEvent);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR,
+        "QemuFwCfgSevDma %a:%a Failed to create ExitBootServices event.\n",
+        gEfiCallerBaseName, __FUNCTION__));
+      ASSERT (FALSE);
+      CpuDeadLoop ();
+    }
   }
 
   return RETURN_SUCCESS;
@@ -335,6 +385,167 @@ UnmapFwCfgDmaDataBuffer (
   }
 }
 
+/**
+  Allocate the shared window through which DMA transfers are bounced when SEV
+  is enabled, map it with BusMasterCommonBuffer64, and publish it for the
+  other modules of the phase.
+
+  The mapping is never torn down by the QemuFwCfgLib instances: the IOMMU
+  driver unmaps it, and so re-encrypts the window, at ExitBootServices().
+
+  @return  The published window.
+**/
+STATIC
+QEMU_FW_CFG_SEV_DMA_WINDOW *
+AllocFwCfgDmaWindow (
+  VOID
+  )
+{
+  UINTN                      Size;
+  UINTN                      NumPages;
+  EFI_STATUS                 Status;
+  VOID                       *HostAddress;
+  EFI_PHYSICAL_ADDRESS       DmaAddress;
+  VOID                       *Mapping;
+  QEMU_FW_CFG_SEV_DMA_WINDOW *Window;
+  EFI_HANDLE                 Handle;
+
+  Size = FW_CFG_SEV_DMA_WINDOW_SIZE;
+  NumPages = EFI_SIZE_TO_PAGES (Size);
+
+  //
+  // The window descriptor must outlive this module, which may be an unloadable
+  // driver or an application.
+  //
+  Window = AllocatePool (sizeof *Window);
+  if (Window == NULL) {
+    DEBUG ((DEBUG_ERROR,
+      "%a:%a failed to allocate the DMA window descriptor\n",
+      gEfiCallerBaseName, __FUNCTION__));
+    ASSERT (FALSE);
+    CpuDeadLoop ();
+  }
+
+  //
+  // As per UEFI spec, in order to map a host address with
+  // BusMasterCommomBuffer64, the buffer must be allocated using the IOMMU
+  // AllocateBuffer()
+  //
+  Status = mIoMmuProtocol->AllocateBuffer (
+                             mIoMmuProtocol,
+                             AllocateAnyPages,
+                             EfiBootServicesData,
+                             NumPages,
+                             &HostAddress,
+                             EDKII_IOMMU_ATTRIBUTE_DUAL_ADDRESS_CYCLE
+                             );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR,
+      "%a:%a failed to allocate the DMA window\n", gEfiCallerBaseName,
+      __FUNCTION__));
+    ASSERT (FALSE);
+    CpuDeadLoop ();
+  }
+
+  //
+  // Avoid exposing stale data even temporarily: zero the area before mapping
+  // it.
+  //
+  ZeroMem (HostAddress, Size);
+
+  //
+  // Map the host buffer with BusMasterCommonBuffer64
+  //
+  Status = mIoMmuProtocol->Map (
+                             mIoMmuProtocol,
+                             EdkiiIoMmuOperationBusMasterCommonBuffer64,
+                             HostAddress,
+                             &Size,
+                             &DmaAddress,
+                             &Mapping
+                             );
+  if (EFI_ERROR (Status)) {
+    mIoMmuProtocol->FreeBuffer (mIoMmuProtocol, NumPages, HostAddress);
+    DEBUG ((DEBUG_ERROR,
+      "%a:%a failed to Map() the DMA window\n", gEfiCallerBaseName,
+      __FUNCTION__));
+    ASSERT (FALSE);
+    CpuDeadLoop ();
+  }
+
+  //
+  // The fw_cfg DMA interface takes host addresses, which is what the SEV
+  // IOMMU hands out for common buffers.
+  //
+  if (Size < FW_CFG_SEV_DMA_WINDOW_SIZE ||
+      DmaAddress != (EFI_PHYSICAL_ADDRESS)(UINTN)HostAddress) {
+    mIoMmuProtocol->Unmap (mIoMmuProtocol, Mapping);
+    mIoMmuProtocol->FreeBuffer (mIoMmuProtocol, NumPages, HostAddress);
+    DEBUG ((DEBUG_ERROR,
+      "%a:%a failed to Map() - requested 0x%Lx got 0x%Lx at 0x%Lx\n",
+      gEfiCallerBaseName, __FUNCTION__, (UINT64)FW_CFG_SEV_DMA_WINDOW_SIZE,
+      (UINT64)Size, DmaAddress));
+    ASSERT (FALSE);
+    CpuDeadLoop ();
+  }
+
+  Window->Base     = DmaAddress;
+  Window->Released = FALSE;
+
+  Handle = NULL;
+  Status = gBS->InstallProtocolInterface (
+                  &Handle,
+                  &gQemuFwCfgSevDmaWindowProtocolGuid,
+                  EFI_NATIVE_INTERFACE,
+                  Window
+                  );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR,
+      "%a:%a failed to publish the DMA window: %r\n", gEfiCallerBaseName,
+      __FUNCTION__, Status));
+    ASSERT (FALSE);
+    CpuDeadLoop ();
+  }
+
+  DEBUG ((DEBUG_INFO, "SEV: QemuFwCfg DMA window at 0x%Lx, owned by %a.\n",
+    Window->Base, gEfiCallerBaseName));
+  return Window;
+}
+
+/**
+  Return the shared DMA window of the phase, setting it up if no module has
+  done so yet.
+
+  @retval NULL    ExitBootServices() has been signaled; the window must not be
+                  used any longer.
+  @return         The base address of the window otherwise.
+**/
+STATIC
+VOID *
+GetFwCfgDmaWindow (
+  VOID
+  )
+{
+  EFI_STATUS  Status;
+
+  if (mFwCfgExitBootServices) {
+    return NULL;
+  }
+
+  if (mFwCfgDmaWindow == NULL) {
+    Status = gBS->LocateProtocol (&gQemuFwCfgSevDmaWindowProtocolGuid, NULL,
+                    (VOID **)&mFwCfgDmaWindow);
+    if (EFI_ERROR (Status)) {
+      mFwCfgDmaWindow = AllocFwCfgDmaWindow ();
+    }
+  }
+
+  if (mFwCfgDmaWindow->Released) {
+    return NULL;
+  }
+  return (VOID *)(UINTN)mFwCfgDmaWindow->Base;
+}
+
 /**
   Transfer an array of bytes, or skip a number of bytes, using the DMA
   interface.
@@ -363,6 +574,7 @@ InternalQemuFwCfgDmaBytes (
   UINT32                     Status;
   VOID                       *AccessMapping, *DataMapping;
   VOID                       *DataBuffer;
+  VOID                       *Window;
 
   ASSERT (Control == FW_CFG_DMA_CTL_WRITE || Control == FW_CFG_DMA_CTL_READ ||
     Control == FW_CFG_DMA_CTL_SKIP);
@@ -371,6 +583,19 @@ InternalQemuFwCfgDmaBytes (
     return;
   }
 
+  //
+  // When SEV is enabled, stream the transfer through the shared window, as
+  // long as that exists. Otherwise, bounce the access structure and Buffer
+  // through mappings that are set up for this transfer only.
+  //
+  if (MemEncryptSevIsEnabled ()) {
+    Window = GetFwCfgDmaWindow ();
+    if (Window != NULL) {
+      InternalQemuFwCfgDmaBytesThroughWindow (Size, Buffer, Control, Window);
+      return;
+    }
+  }
+
   Access = &LocalAccess;
   AccessMapping = NULL;
   DataMapping = NULL;
@@ -296,3 +296,123 @@ QemuFwCfgFindFile (
 
   return RETURN_NOT_FOUND;
 }
+
+/**
+  Run a single DMA transfer described by Access, and wait for it to complete.
+
+  @param[in,out] Access   The FW_CFG_DMA_ACCESS structure, mapped for DMA at its
+                          own address.
+  @param[in]     Size     Size in bytes to transfer or skip.
+  @param[in]     Address  DMA address of the data.
+  @param[in]     Control  The FW_CFG_DMA_CTL_* operation.
+**/
+STATIC
+VOID
+QemuFwCfgDmaRun (
+  IN OUT volatile FW_CFG_DMA_ACCESS  *Access,
+  IN     UINT32                      Size,
+  IN     UINT64                      Address,
+  IN     UINT32                      Control
+  )
+{
+  UINT32 AccessHigh, AccessLow;
+  UINT32 Status;
+
+  Access->Control = SwapBytes32 (Control);
+  Access->Length  = SwapBytes32 (Size);
+  Access->Address = SwapBytes64 (Address);
+
+  //
+  // Delimit the transfer from modifications to Access and to the data.
+  //
+  MemoryFence ();
+
+  AccessHigh = (UINT32)RShiftU64 ((UINTN)Access, 32);
+  AccessLow  = (UINT32)(UINTN)Access;
+  IoWrite32 (FW_CFG_IO_DMA_ADDRESS,     SwapBytes32 (AccessHigh));
+  IoWrite32 (FW_CFG_IO_DMA_ADDRESS + 4, SwapBytes32 (AccessLow));
+
+  //
+  // Don't look at Access.Control before starting the transfer.
+  //
+  MemoryFence ();
+
+  do {
+    Status = SwapBytes32 (Access->Control);
+    ASSERT ((Status & FW_CFG_DMA_CTL_ERROR) == 0);
+  } while (Status != 0);
+
+  //
+  // After a read, the caller will want to use the data.
+  //
+  MemoryFence ();
+}
+
+/**
+  Transfer an array of bytes, or skip a number of bytes, using the DMA
+  interface, bouncing the data through a window of shared memory.
+
+  The window must be mapped for DMA at its own address, and must be
+  FW_CFG_SEV_DMA_WINDOW_SIZE bytes in size.
+
+  @param[in]     Size     Size in bytes to transfer or skip.
+
+  @param[in,out] Buffer   Buffer to read data into or write data from. Ignored,
+                          and may be NULL, if Size is zero, or Control is
+                          FW_CFG_DMA_CTL_SKIP.
+
+  @param[in]     Control  One of the following:
+                          FW_CFG_DMA_CTL_WRITE - write to fw_cfg from Buffer.
+                          FW_CFG_DMA_CTL_READ  - read from fw_cfg into Buffer.
+                          FW_CFG_DMA_CTL_SKIP  - skip bytes in fw_cfg.
+
+  @param[in]     Window   The shared window.
+**/
+VOID
+InternalQemuFwCfgDmaBytesThroughWindow (
+  IN     UINT32   Size,
+  IN OUT VOID     *Buffer OPTIONAL,
+  IN     UINT32   Control,
+  IN     VOID     *Window
+  )
+{
+  volatile FW_CFG_DMA_ACCESS *Access;
+  UINT8                      *Data;
+  UINT8                      *Cursor;
+  UINT32                     ChunkSize;
+
+  ASSERT (Control == FW_CFG_DMA_CTL_WRITE || Control == FW_CFG_DMA_CTL_READ ||
+    Control == FW_CFG_DMA_CTL_SKIP);
+
+  Access = Window;
+  Data   = (UINT8 *)Window + FW_CFG_SEV_DMA_DATA_OFFSET;
+
+  //
+  // A skip transfers no data, so it needs no bouncing.
+  //
+  if (Control == FW_CFG_DMA_CTL_SKIP) {
+    if (Size > 0) {
+      QemuFwCfgDmaRun (Access, Size, 0, Control);
+    }
+    return;
+  }
+
+  Cursor = Buffer;
+  while (Size > 0) {
+    ChunkSize = MIN (Size,
+                  FW_CFG_SEV_DMA_WINDOW_SIZE - FW_CFG_SEV_DMA_DATA_OFFSET);
+
+    if (Control == FW_CFG_DMA_CTL_WRITE) {
+      CopyMem (Data, Cursor, ChunkSize);
+    }
+
+    QemuFwCfgDmaRun (Access, ChunkSize, (UINTN)Data, Control);
+
+    if (Control == FW_CFG_DMA_CTL_READ) {
+      CopyMem (Cursor, Data, ChunkSize);
+    }
+
+    Cursor += ChunkSize;
+    Size   -= ChunkSize;
+  }
+}
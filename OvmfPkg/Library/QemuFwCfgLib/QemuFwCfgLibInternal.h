@@ -17,6 +17,20 @@
 #ifndef __QEMU_FW_CFG_LIB_INTERNAL_H__
 #define __QEMU_FW_CFG_LIB_INTERNAL_H__
 
+//
+// When SEV is active, the hypervisor cannot access guest private memory. DMA
+// transfers are then bounced through one window of shared memory per phase,
+// which the first module that needs it allocates and decrypts, and which all
+// the other modules of the phase share (see <Guid/QemuFwCfgSevDmaWindow.h>).
+// The window is re-encrypted at the end of PEI, and at ExitBootServices(),
+// respectively; DXE falls back to per-transfer bounce buffers after that. The
+// window starts with the FW_CFG_DMA_ACCESS structure; the rest of it is the
+// data area, through which large items (kernel, initrd, ACPI tables) are
+// streamed in chunks.
+//
+#define FW_CFG_SEV_DMA_WINDOW_SIZE  SIZE_1MB
+#define FW_CFG_SEV_DMA_DATA_OFFSET  EFI_PAGE_SIZE
+
 /**
   Returns a boolean indicating if the firmware configuration interface is
   available for library-internal purposes.
@@ -66,4 +80,32 @@ InternalQemuFwCfgDmaBytes (
   IN     UINT32   Control
   );
 
+/**
+  Transfer an array of bytes, or skip a number of bytes, using the DMA
+  interface, bouncing the data through a window of shared memory.
+
+  The window must be mapped for DMA at its own address, and must be
+  FW_CFG_SEV_DMA_WINDOW_SIZE bytes in size.
+
+  @param[in]     Size     Size in bytes to transfer or skip.
+
+  @param[in,out] Buffer   Buffer to read data into or write data from. Ignored,
+                          and may be NULL, if Size is zero, or Control is
+                          FW_CFG_DMA_CTL_SKIP.
+
+  @param[in]     Control  One of the following:
+                          FW_CFG_DMA_CTL_WRITE - write to fw_cfg from Buffer.
+                          FW_CFG_DMA_CTL_READ  - read from fw_cfg into Buffer.
+                          FW_CFG_DMA_CTL_SKIP  - skip bytes in fw_cfg.
+
+  @param[in]     Window   The shared window.
+**/
+VOID
+InternalQemuFwCfgDmaBytesThroughWindow (
+  IN     UINT32   Size,
+  IN OUT VOID     *Buffer OPTIONAL,
+  IN     UINT32   Control,
+  IN     VOID     *Window
+  );
+
 #endif
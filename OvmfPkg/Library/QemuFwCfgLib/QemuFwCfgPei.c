@@ -15,17 +15,44 @@
   WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 **/
 
+#include <PiPei.h>
+
+#include <Guid/QemuFwCfgSevDmaWindow.h>
+
+#include <Ppi/EndOfPeiPhase.h>
+#include <Ppi/MemoryDiscovered.h>
+
 #include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Library/IoLib.h>
 #include <Library/DebugLib.h>
+#include <Library/HobLib.h>
 #include <Library/QemuFwCfgLib.h>
 #include <Library/MemEncryptSevLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PeiServicesLib.h>
 
 #include "QemuFwCfgLibInternal.h"
 
 STATIC BOOLEAN mQemuFwCfgSupported = FALSE;
 STATIC BOOLEAN mQemuFwCfgDmaSupported;
 
+STATIC
+EFI_STATUS
+EFIAPI
+QemuFwCfgSevDmaWindowRelease (
+  IN EFI_PEI_SERVICES           **PeiServices,
+  IN EFI_PEI_NOTIFY_DESCRIPTOR  *NotifyDescriptor,
+  IN VOID                       *Ppi
+  );
+
+STATIC CONST EFI_PEI_NOTIFY_DESCRIPTOR mEndOfPeiNotify = {
+  (EFI_PEI_PPI_DESCRIPTOR_NOTIFY_CALLBACK |
+   EFI_PEI_PPI_DESCRIPTOR_TERMINATE_LIST),
+  &gEfiEndOfPeiSignalPpiGuid,
+  QemuFwCfgSevDmaWindowRelease
+};
+
 
 /**
   Returns a boolean indicating if the firmware configuration interface
@@ -80,23 +107,169 @@ QemuFwCfgInitialize (
   if ((Revision & FW_CFG_F_DMA) == 0) {
     DEBUG ((DEBUG_INFO, "QemuFwCfg interface (IO Port) is supported.\n"));
   } else {
+    mQemuFwCfgDmaSupported = TRUE;
+    DEBUG ((DEBUG_INFO, "QemuFwCfg interface (DMA) is supported.\n"));
+
     //
-    // If SEV is enabled then we do not support DMA operations in PEI phase.
-    // This is mainly because DMA in SEV guest requires using bounce buffer
-    // (which need to allocate dynamic memory and allocating a PAGE size'd
-    // buffer can be challenge in PEI phase)
+    // DMA in an SEV guest needs a shared bounce buffer, which can only be
+    // allocated once permanent memory has been installed. Until then the IO
+    // Port interface is used.
     //
     if (MemEncryptSevIsEnabled ()) {
-      DEBUG ((DEBUG_INFO, "SEV: QemuFwCfg fallback to IO Port interface.\n"));
-    } else {
-      mQemuFwCfgDmaSupported = TRUE;
-      DEBUG ((DEBUG_INFO, "QemuFwCfg interface (DMA) is supported.\n"));
+      DEBUG ((DEBUG_INFO, "SEV: QemuFwCfg DMA deferred to permanent memory.\n"));
     }
   }
   return RETURN_SUCCESS;
 }
 
 
+/**
+  Re-encrypt and free the shared DMA window at the end of PEI.
+
+  The window is released before DXE builds its own page tables, so no
+  plaintext mapping of it, and no cache line written through such a mapping,
+  outlives the phase. DMA transfers that are requested after this point use
+  the IO Port interface.
+
+  @param[in] PeiServices       Indirect reference to the PEI Services Table.
+  @param[in] NotifyDescriptor  Address of the notification descriptor.
+  @param[in] Ppi               Address of the End of PEI PPI.
+
+  @retval EFI_SUCCESS  The window has been released, or it could not be
+                       re-encrypted and has been leaked.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+QemuFwCfgSevDmaWindowRelease (
+  IN EFI_PEI_SERVICES           **PeiServices,
+  IN EFI_PEI_NOTIFY_DESCRIPTOR  *NotifyDescriptor,
+  IN VOID                       *Ppi
+  )
+{
+  EFI_HOB_GUID_TYPE           *GuidHob;
+  QEMU_FW_CFG_SEV_DMA_WINDOW  *Window;
+  UINTN                       NumPages;
+  EFI_STATUS                  Status;
+
+  GuidHob = GetFirstGuidHob (&gQemuFwCfgSevDmaWindowHobGuid);
+  if (GuidHob == NULL) {
+    return EFI_SUCCESS;
+  }
+  Window = GET_GUID_HOB_DATA (GuidHob);
+  if (Window->Released) {
+    return EFI_SUCCESS;
+  }
+  Window->Released = TRUE;
+
+  NumPages = EFI_SIZE_TO_PAGES (FW_CFG_SEV_DMA_WINDOW_SIZE);
+  Status = MemEncryptSevSetPageEncMask (
+             0,                             // Cr3BaseAddress -- use current CR3
+             Window->Base,
+             NumPages,
+             TRUE                           // Flush
+             );
+  if (EFI_ERROR (Status)) {
+    //
+    // Don't hand shared memory back to the allocator.
+    //
+    DEBUG ((DEBUG_ERROR, "%a: MemEncryptSevSetPageEncMask(): %r\n",
+      __FUNCTION__, Status));
+    ASSERT_EFI_ERROR (Status);
+    return EFI_SUCCESS;
+  }
+
+  FreePages ((VOID *)(UINTN)Window->Base, NumPages);
+  DEBUG ((DEBUG_INFO, "SEV: QemuFwCfg DMA window at 0x%Lx released.\n",
+    Window->Base));
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Return the shared window through which DMA transfers are bounced when SEV is
+  enabled, setting it up if that's possible in the current PEI state.
+
+  The first module that needs the window after permanent memory has been
+  installed allocates it, clears its encryption bit, and describes it in a GUID
+  HOB for the other modules of the phase. The window is released at the end of
+  PEI.
+
+  @retval NULL  The window could not be set up (yet), or it has been released
+                already.
+  @return       The base address of the window otherwise.
+**/
+STATIC
+VOID *
+QemuFwCfgSevDmaWindow (
+  VOID
+  )
+{
+  EFI_STATUS                  Status;
+  EFI_HOB_GUID_TYPE           *GuidHob;
+  QEMU_FW_CFG_SEV_DMA_WINDOW  *WindowHob;
+  VOID                        *MemoryDiscovered;
+  VOID                        *Window;
+  UINTN                       NumPages;
+
+  GuidHob = GetFirstGuidHob (&gQemuFwCfgSevDmaWindowHobGuid);
+  if (GuidHob != NULL) {
+    WindowHob = GET_GUID_HOB_DATA (GuidHob);
+    if (WindowHob->Released) {
+      return NULL;
+    }
+    return (VOID *)(UINTN)WindowHob->Base;
+  }
+
+  Status = PeiServicesLocatePpi (
+             &gEfiPeiMemoryDiscoveredPpiGuid,
+             0,
+             NULL,
+             &MemoryDiscovered
+             );
+  if (EFI_ERROR (Status)) {
+    return NULL;
+  }
+
+  NumPages = EFI_SIZE_TO_PAGES (FW_CFG_SEV_DMA_WINDOW_SIZE);
+  Window = AllocatePages (NumPages);
+  if (Window == NULL) {
+    return NULL;
+  }
+
+  Status = MemEncryptSevClearPageEncMask (
+             0,                             // Cr3BaseAddress -- use current CR3
+             (PHYSICAL_ADDRESS)(UINTN)Window,
+             NumPages,
+             TRUE                           // Flush
+             );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: MemEncryptSevClearPageEncMask(): %r\n",
+      __FUNCTION__, Status));
+    FreePages (Window, NumPages);
+    return NULL;
+  }
+
+  Status = PeiServicesNotifyPpi (&mEndOfPeiNotify);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: PeiServicesNotifyPpi(): %r\n", __FUNCTION__,
+      Status));
+    MemEncryptSevSetPageEncMask (0, (PHYSICAL_ADDRESS)(UINTN)Window, NumPages,
+      TRUE);
+    FreePages (Window, NumPages);
+    return NULL;
+  }
+
+  ZeroMem (Window, FW_CFG_SEV_DMA_WINDOW_SIZE);
+  WindowHob = BuildGuidHob (&gQemuFwCfgSevDmaWindowHobGuid,
+                sizeof *WindowHob);
+  WindowHob->Base     = (EFI_PHYSICAL_ADDRESS)(UINTN)Window;
+  WindowHob->Released = FALSE;
+  DEBUG ((DEBUG_INFO, "SEV: QemuFwCfg DMA window at 0x%p.\n", Window));
+  return Window;
+}
+
+
 /**
   Returns a boolean indicating if the firmware configuration interface is
   available for library-internal purposes.
@@ -126,7 +299,15 @@ InternalQemuFwCfgDmaIsAvailable (
   VOID
   )
 {
-  return mQemuFwCfgDmaSupported;
+  if (!mQemuFwCfgDmaSupported) {
+    return FALSE;
+  }
+
+  if (MemEncryptSevIsEnabled ()) {
+    return (BOOLEAN)(QemuFwCfgSevDmaWindow () != NULL);
+  }
+
+  return TRUE;
 }
 
 /**
@@ -154,6 +335,7 @@ InternalQemuFwCfgDmaBytes (
   volatile FW_CFG_DMA_ACCESS Access;
   UINT32                     AccessHigh, AccessLow;
   UINT32                     Status;
+  VOID                       *Window;
 
   ASSERT (Control == FW_CFG_DMA_CTL_WRITE || Control == FW_CFG_DMA_CTL_READ ||
     Control == FW_CFG_DMA_CTL_SKIP);
@@ -163,10 +345,14 @@ InternalQemuFwCfgDmaBytes (
   }
 
   //
-  // SEV does not support DMA operations in PEI stage, we should
-  // not have reached here.
+  // With SEV, InternalQemuFwCfgDmaIsAvailable() has set up the shared window.
   //
-  ASSERT (!MemEncryptSevIsEnabled ());
+  if (MemEncryptSevIsEnabled ()) {
+    Window = QemuFwCfgSevDmaWindow ();
+    ASSERT (Window != NULL);
+    InternalQemuFwCfgDmaBytesThroughWindow (Size, Buffer, Control, Window);
+    return;
+  }
 
   Access.Control = SwapBytes32 (Control);
   Access.Length  = SwapBytes32 (Size);
@@ -19,6 +19,7 @@
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 
 #include <Library/VirtioLib.h>
@@ -269,6 +270,9 @@ VirtioAppendDesc (
                           from device-specific request structures linked by the
                           descriptor chain.
 
+  @param[in,out] Latency  Completion wait statistics of the device, updated by
+                          VirtioWaitUsed(). May be NULL.
+
   @return              Error code from VirtIo->SetQueueNotify() if it fails.
 
   @retval EFI_SUCCESS  Otherwise, the host processed all descriptors.
@@ -277,17 +281,17 @@ VirtioAppendDesc (
 EFI_STATUS
 EFIAPI
 VirtioFlush (
-  IN     VIRTIO_DEVICE_PROTOCOL *VirtIo,
-  IN     UINT16                 VirtQueueId,
-  IN OUT VRING                  *Ring,
-  IN     DESC_INDICES           *Indices,
-  OUT    UINT32                 *UsedLen    OPTIONAL
+  IN     VIRTIO_DEVICE_PROTOCOL   *VirtIo,
+  IN     UINT16                   VirtQueueId,
+  IN OUT VRING                    *Ring,
+  IN     DESC_INDICES             *Indices,
+  OUT    UINT32                   *UsedLen    OPTIONAL,
+  IN OUT VIRTIO_LATENCY_HISTOGRAM *Latency    OPTIONAL
   )
 {
   UINT16     NextAvailIdx;
   UINT16     LastUsedIdx;
   EFI_STATUS Status;
-  UINTN      PollPeriodUsecs;
 
   //
   // virtio-0.9.5, 2.4.1.2 Updating the Available Ring
@@ -325,14 +329,186 @@ VirtioFlush (
   // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device
   // Wait until the host processes and acknowledges our descriptor chain. The
   // condition we use for polling is greatly simplified and relies on the
-  // synchronous, lock-step progress.
+  // synchronous, lock-step progress: the used index can only move past
+  // LastUsedIdx by reaching NextAvailIdx.
+  //
+  VirtioWaitUsed (Ring, LastUsedIdx, Latency);
+  ASSERT (*Ring->Used.Idx == NextAvailIdx);
+
+  MemoryFence();
+
+  if (UsedLen != NULL) {
+    volatile CONST VRING_USED_ELEM *UsedElem;
+
+    UsedElem = &Ring->Used.UsedElem[LastUsedIdx % Ring->QueueSize];
+    ASSERT (UsedElem->Id == Indices->HeadDescIdx);
+    *UsedLen = UsedElem->Len;
+  }
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+
+  Make a descriptor chain just built available to the host, without notifying
+  the host and without waiting for the host to process it.
+
+  This function implements the following sections from virtio-0.9.5:
+  - 2.4.1.2 Updating the Available Ring
+  - 2.4.1.3 Updating the Index Field
+
+  Unlike VirtioFlush(), this function does not rely on lock-step progress;
+  any number of descriptor chains may be in flight. The caller is responsible
+  for building the chains in disjoint ranges of the descriptor table (by
+  setting Indices->HeadDescIdx and Indices->NextDescIdx itself, rather than
+  calling VirtioPrepare()), for notifying the host with
+  VirtIo->SetQueueNotify() after one or more chains have been made available,
+  and for collecting the completions with VirtioFetchUsed().
+
+  @param[in,out] Ring  The virtio ring with descriptors to submit.
+
+  @param[in] Indices   Indices->NextDescIdx is not accessed.
+                       Indices->HeadDescIdx identifies the head descriptor of
+                       the descriptor chain.
+
+**/
+VOID
+EFIAPI
+VirtioAppendAvail (
+  IN OUT VRING        *Ring,
+  IN     DESC_INDICES *Indices
+  )
+{
+  UINT16 NextAvailIdx;
+
+  NextAvailIdx = *Ring->Avail.Idx;
+  Ring->Avail.Ring[NextAvailIdx++ % Ring->QueueSize] =
+    Indices->HeadDescIdx % Ring->QueueSize;
+
+  //
+  // The descriptor chain and the available ring entry must be visible to the
+  // host before the index that publishes them.
+  //
+  MemoryFence();
+  *Ring->Avail.Idx = NextAvailIdx;
+  MemoryFence();
+}
+
+
+/**
+
+  Retrieve the next element that the host has placed on the used ring, if
+  any, without waiting.
+
+  This function implements the following section from virtio-0.9.5:
+  - 2.4.2 Receiving Used Buffers From the Device
+
+  @param[in] Ring            The virtio ring to check.
+
+  @param[in,out] LastUsedIdx  On input, the free-running index of the first
+                              used ring element that the caller has not
+                              consumed yet. On output, incremented by one,
+                              modulo 2^16, if an element has been retrieved.
+
+  @param[out] HeadDescIdx     The head descriptor index of the descriptor
+                              chain that the host has processed.
+
+  @param[out] UsedLen         The total number of bytes that the host wrote
+                              to the buffers linked by the descriptor chain.
+                              May be NULL if the caller doesn't care.
+
+  @retval TRUE   An element has been retrieved.
+
+  @retval FALSE  The host has not placed any element on the used ring beyond
+                 LastUsedIdx.
+
+**/
+BOOLEAN
+EFIAPI
+VirtioFetchUsed (
+  IN     VRING  *Ring,
+  IN OUT UINT16 *LastUsedIdx,
+  OUT    UINT16 *HeadDescIdx,
+  OUT    UINT32 *UsedLen      OPTIONAL
+  )
+{
+  volatile CONST VRING_USED_ELEM *UsedElem;
+
+  MemoryFence();
+  if (*Ring->Used.Idx == *LastUsedIdx) {
+    return FALSE;
+  }
+
+  //
+  // The used element must not be read before the index that published it.
+  //
+  MemoryFence();
+  UsedElem = &Ring->Used.UsedElem[*LastUsedIdx % Ring->QueueSize];
+  *HeadDescIdx = (UINT16)UsedElem->Id;
+  if (UsedLen != NULL) {
+    *UsedLen = UsedElem->Len;
+  }
+  ++*LastUsedIdx;
+  return TRUE;
+}
+
+
+/**
+
+  Wait until the host places an element on the used ring beyond LastUsedIdx.
+
+  The wait proceeds in three phases, so that short completions are noticed
+  quickly without accessing the timer hardware, while long ones don't keep
+  the processor busy:
+  - spinning on the used index, with CpuPause(), for
+    PcdVirtioPollSpinIterations iterations,
+  - stalling for exponentially increasing periods, starting at 1 us,
+  - stalling repeatedly for slightly above 1 ms.
+
+  @param[in] Ring         The virtio ring to wait on.
+
+  @param[in] LastUsedIdx  The free-running index of the first used ring
+                          element that the caller has not consumed yet.
+
+  @param[in,out] Latency  Completion wait statistics to update. May be NULL.
+
+**/
+VOID
+EFIAPI
+VirtioWaitUsed (
+  IN     VRING                    *Ring,
+  IN     UINT16                   LastUsedIdx,
+  IN OUT VIRTIO_LATENCY_HISTOGRAM *Latency     OPTIONAL
+  )
+{
+  UINT32 SpinIterations;
+  UINT32 SpinLimit;
+  UINTN  PollPeriodUsecs;
+  UINT64 StallUsecs;
+  UINTN  Bucket;
+
+  //
+  // Spinning is cheap on the host side, and under SEV-ES it doesn't cause
+  // #VC exceptions, unlike the timer port accesses in Stall().
+  //
+  SpinLimit = PcdGet32 (PcdVirtioPollSpinIterations);
+  SpinIterations = 0;
+  MemoryFence();
+  while (*Ring->Used.Idx == LastUsedIdx && SpinIterations < SpinLimit) {
+    CpuPause ();
+    ++SpinIterations;
+    MemoryFence();
+  }
+
   //
   // Keep slowing down until we reach a poll period of slightly above 1 ms.
   //
   PollPeriodUsecs = 1;
-  MemoryFence();
-  while (*Ring->Used.Idx != NextAvailIdx) {
+  StallUsecs = 0;
+  while (*Ring->Used.Idx == LastUsedIdx) {
     gBS->Stall (PollPeriodUsecs); // calls AcpiTimerLib::MicroSecondDelay
+    StallUsecs += PollPeriodUsecs;
 
     if (PollPeriodUsecs < 1024) {
       PollPeriodUsecs *= 2;
@@ -340,17 +516,55 @@ VirtioFlush (
     MemoryFence();
   }
 
-  MemoryFence();
-
-  if (UsedLen != NULL) {
-    volatile CONST VRING_USED_ELEM *UsedElem;
+  if (Latency == NULL) {
+    return;
+  }
 
-    UsedElem = &Ring->Used.UsedElem[LastUsedIdx % Ring->QueueSize];
-    ASSERT (UsedElem->Id == Indices->HeadDescIdx);
-    *UsedLen = UsedElem->Len;
+  if (StallUsecs == 0) {
+    Bucket = 0;
+  } else {
+    Bucket = MIN ((UINTN)HighBitSet64 (StallUsecs) + 1,
+               VIRTIO_LATENCY_BUCKETS - 1);
   }
+  Latency->Waits++;
+  Latency->SpinIterations += SpinIterations;
+  Latency->StallUsecs     += StallUsecs;
+  Latency->Buckets[Bucket]++;
+}
 
-  return EFI_SUCCESS;
+
+/**
+
+  Log the completion wait statistics of a virtio device on the debug console.
+
+  @param[in] Name     A short description of the device, printed as a prefix.
+
+  @param[in] Latency  The statistics to log.
+
+**/
+VOID
+EFIAPI
+VirtioLogLatency (
+  IN CONST CHAR8                    *Name,
+  IN CONST VIRTIO_LATENCY_HISTOGRAM *Latency
+  )
+{
+  UINTN Bucket;
+
+  DEBUG ((DEBUG_INFO, "%a: Waits=%Lu SpinIterations=%Lu StallUsecs=%Lu\n",
+    Name, Latency->Waits, Latency->SpinIterations, Latency->StallUsecs));
+  for (Bucket = 0; Bucket < VIRTIO_LATENCY_BUCKETS; ++Bucket) {
+    if (Latency->Buckets[Bucket] == 0) {
+      continue;
+    }
+    if (Bucket == 0) {
+      DEBUG ((DEBUG_INFO, "%a:   spin only: %Lu\n", Name,
+        Latency->Buckets[Bucket]));
+    } else {
+      DEBUG ((DEBUG_INFO, "%a:   stalled <%Lu us: %Lu\n", Name,
+        LShiftU64 (1, Bucket), Latency->Buckets[Bucket]));
+    }
+  }
 }
 
 
@@ -25,6 +25,7 @@
 #include <Register/Amd/Msr.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Register/Amd/Ghcb.h>
 
 #include "Platform.h"
 
@@ -40,6 +41,15 @@ AmdSevEsInitialize (
   )
 {
   EFI_PHYSICAL_ADDRESS              GhcbBase;
+  UINTN                             GhcbPageCount;
+  UINTN                             ScratchPages;
+  EFI_PHYSICAL_ADDRESS              ScratchBase;
+  MEM_ENCRYPT_SEV_RANGE             *GhcbRanges;
+  UINTN                             RangeCount;
+  UINTN                             Index;
+  GHCB                              *Ghcb;
+  SEV_ES_PER_CPU_DATA               *PerCpuData;
+  SEV_ES_PER_CPU_DATA               *SecPerCpuData;
   RETURN_STATUS                     DecryptStatus, PcdStatus;
   IA32_DESCRIPTOR                   Gdtr;
   VOID                              *Gdt;
@@ -49,36 +59,92 @@ AmdSevEsInitialize (
   }
 
   //
-  // Allocate GHCB pages.
+  // Allocate GHCB and per-CPU data pages. Each CPU gets a GHCB page, which
+  // is shared with the hypervisor, followed by an encrypted page used by the
+  // #VC handler (e.g. for its CPUID cache). The optional per-CPU scratch
+  // areas for string I/O, also shared, come after all of those.
   //
-  GhcbBase = (EFI_PHYSICAL_ADDRESS)AllocatePages (mMaxCpuCount);
+  ScratchPages = FixedPcdGet32 (PcdOvmfSevEsScratchPages);
+  GhcbPageCount = mMaxCpuCount * (GHCB_PER_CPU_PAGES + ScratchPages);
+  GhcbBase = (EFI_PHYSICAL_ADDRESS)AllocatePages (GhcbPageCount);
   ASSERT (GhcbBase);
+  ScratchBase = GhcbBase +
+                EFI_PAGES_TO_SIZE (mMaxCpuCount * GHCB_PER_CPU_PAGES);
 
-  DecryptStatus = MemEncryptSevClearPageEncMask (
+  //
+  // Clear the encryption bit of the GHCB pages and the scratch areas only,
+  // in a single page table update.
+  //
+  GhcbRanges = AllocatePool ((mMaxCpuCount + 1) * sizeof *GhcbRanges);
+  ASSERT (GhcbRanges != NULL);
+  for (Index = 0; Index < mMaxCpuCount; Index++) {
+    GhcbRanges[Index].BaseAddress =
+      GhcbBase + EFI_PAGES_TO_SIZE (Index * GHCB_PER_CPU_PAGES);
+    GhcbRanges[Index].NumPages = 1;
+  }
+  RangeCount = mMaxCpuCount;
+  if (ScratchPages != 0) {
+    GhcbRanges[RangeCount].BaseAddress = ScratchBase;
+    GhcbRanges[RangeCount].NumPages = mMaxCpuCount * ScratchPages;
+    RangeCount++;
+  }
+
+  DecryptStatus = MemEncryptSevUpdatePageEncMaskRanges (
     0,
-    GhcbBase,
-    mMaxCpuCount,
+    GhcbRanges,
+    RangeCount,
+    MemEncryptSevDecrypt,
     TRUE
     );
   ASSERT_RETURN_ERROR (DecryptStatus);
+  FreePool (GhcbRanges);
 
   BuildMemoryAllocationHob (
     GhcbBase,
-    EFI_PAGES_TO_SIZE (mMaxCpuCount),
+    EFI_PAGES_TO_SIZE (GhcbPageCount),
     EfiReservedMemoryType
     );
 
-  SetMem ((VOID *) GhcbBase, mMaxCpuCount * SIZE_4KB, 0);
+  SetMem ((VOID *) GhcbBase, EFI_PAGES_TO_SIZE (GhcbPageCount), 0);
+
+  if (ScratchPages != 0) {
+    for (Index = 0; Index < mMaxCpuCount; Index++) {
+      Ghcb = (GHCB *)(UINTN)(GhcbBase +
+                             EFI_PAGES_TO_SIZE (Index * GHCB_PER_CPU_PAGES));
+      PerCpuData = GhcbGetPerCpuData (Ghcb);
+      PerCpuData->ScratchBase = ScratchBase +
+                                EFI_PAGES_TO_SIZE (Index * ScratchPages);
+      PerCpuData->ScratchSize = EFI_PAGES_TO_SIZE (ScratchPages);
+    }
+  }
 
   PcdStatus = PcdSet64S (PcdGhcbBase, (UINT64)GhcbBase);
   ASSERT_RETURN_ERROR (PcdStatus);
-  PcdStatus = PcdSet64S (PcdGhcbSize, (UINT64)EFI_PAGES_TO_SIZE (mMaxCpuCount));
+  PcdStatus = PcdSet64S (PcdGhcbSize, (UINT64)EFI_PAGES_TO_SIZE (GhcbPageCount));
+  ASSERT_RETURN_ERROR (PcdStatus);
+  PcdStatus = PcdSet64S (PcdGhcbScratchSize,
+                (UINT64)EFI_PAGES_TO_SIZE (mMaxCpuCount * ScratchPages));
+  ASSERT_RETURN_ERROR (PcdStatus);
+  PcdStatus = PcdSet64S (PcdGhcbPerCpuSize,
+                (UINT64)EFI_PAGES_TO_SIZE (GHCB_PER_CPU_PAGES));
   ASSERT_RETURN_ERROR (PcdStatus);
   PcdStatus = PcdSet32S (PcdCpuSevEsActive, 1);
   ASSERT_RETURN_ERROR (PcdStatus);
 
   DEBUG ((EFI_D_INFO, "SEV-ES is enabled, %u GHCB pages allocated starting at 0x%lx\n", mMaxCpuCount, GhcbBase));
 
+  //
+  // Report the cache statistics of the SEC / early PEI #VC handler, whose
+  // per-CPU data follows the SEC GHCB, before switching away from it.
+  //
+  SecPerCpuData = GhcbGetPerCpuData (
+                    (GHCB *)(UINTN) PcdGet32 (PcdOvmfSecGhcbBase)
+                    );
+  DEBUG ((DEBUG_INFO, "SEV-ES: SEC #VC CPUID cache: Hits=%Lu Misses=%Lu\n",
+    SecPerCpuData->CpuidCacheHits, SecPerCpuData->CpuidCacheMisses));
+  DEBUG ((DEBUG_INFO, "SEV-ES: SEC #VC MMIO cache: Hits=%Lu Misses=%Lu\n",
+    SecPerCpuData->MmioCacheHits, SecPerCpuData->MmioCacheMisses));
+
   AsmWriteMsr64 (MSR_SEV_ES_GHCB, GhcbBase);
 
   //
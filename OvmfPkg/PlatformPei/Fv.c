@@ -16,7 +16,6 @@
 #include "Platform.h"
 #include <Library/DebugLib.h>
 #include <Library/HobLib.h>
-#include <Library/PeiServicesLib.h>
 #include <Library/PcdLib.h>
 
 
@@ -24,6 +23,9 @@
   Publish PEI & DXE (Decompressed) Memory based FVs to let PEI
   and DXE know about them.
 
+  DXEFV itself is published by DxeFvDecompressPei, once it is decompressed;
+  here it is only kept away from other allocations.
+
   @retval EFI_SUCCESS   Platform PEI FVs were initialized successfully.
 
 **/
@@ -47,20 +49,15 @@ PeiFvInitialization (
     mS3Supported ? EfiACPIMemoryNVS : EfiBootServicesData
     );
 
-  //
-  // Let DXE know about the DXE FV
-  //
-  BuildFvHob (PcdGet32 (PcdOvmfDxeMemFvBase), PcdGet32 (PcdOvmfDxeMemFvSize));
-
   SecureS3Needed = mS3Supported && FeaturePcdGet (PcdSmmSmramRequire);
 
   //
   // Create a memory allocation HOB for the DXE FV.
   //
-  // If "secure" S3 is needed, then SEC will decompress both PEI and DXE
-  // firmware volumes at S3 resume too, hence we need to keep away the OS from
-  // DXEFV as well. Otherwise we only need to keep away DXE itself from the
-  // DXEFV area.
+  // If "secure" S3 is needed, then SEC will decompress PEIFV at S3 resume too,
+  // using temporary memory in the DXEFV area (and DXEFV itself, if it is not
+  // in a chunked section), hence we need to keep away the OS from DXEFV as
+  // well. Otherwise we only need to keep away DXE itself from the DXEFV area.
   //
   BuildMemoryAllocationHob (
     PcdGet32 (PcdOvmfDxeMemFvBase),
@@ -69,7 +66,7 @@ PeiFvInitialization (
     );
 
   //
-  // Additionally, said decompression will use temporary memory above the end
+  // Additionally, said decompression may use temporary memory above the end
   // of DXEFV, so let's keep away the OS from there too.
   //
   if (SecureS3Needed) {
@@ -77,24 +74,15 @@ PeiFvInitialization (
 
     DxeMemFvEnd = PcdGet32 (PcdOvmfDxeMemFvBase) +
                   PcdGet32 (PcdOvmfDxeMemFvSize);
-    BuildMemoryAllocationHob (
-      DxeMemFvEnd,
-      PcdGet32 (PcdOvmfDecompressionScratchEnd) - DxeMemFvEnd,
-      EfiACPIMemoryNVS
-      );
+    if (PcdGet32 (PcdOvmfDecompressionScratchEnd) > DxeMemFvEnd) {
+      BuildMemoryAllocationHob (
+        DxeMemFvEnd,
+        PcdGet32 (PcdOvmfDecompressionScratchEnd) - DxeMemFvEnd,
+        EfiACPIMemoryNVS
+        );
+    }
   }
 
-  //
-  // Let PEI know about the DXE FV so it can find the DXE Core
-  //
-  PeiServicesInstallFvInfoPpi (
-    NULL,
-    (VOID *)(UINTN) PcdGet32 (PcdOvmfDxeMemFvBase),
-    PcdGet32 (PcdOvmfDxeMemFvSize),
-    NULL,
-    NULL
-    );
-
   return EFI_SUCCESS;
 }
 
@@ -562,11 +562,13 @@ PublishPeiMemory (
     // their lifetimes don't overlap. However, PeiFvInitialization() will cover
     // RAM up to PcdOvmfDecompressionScratchEnd with an EfiACPIMemoryNVS memory
     // allocation HOB, and other allocations served from the permanent PEI RAM
-    // shouldn't overlap with that HOB.
+    // shouldn't overlap with that HOB. When DXEFV is decompressed in PEI, the
+    // scratch buffer ends within DXEFV.
     //
-    MemoryBase = mS3Supported && FeaturePcdGet (PcdSmmSmramRequire) ?
-      PcdGet32 (PcdOvmfDecompressionScratchEnd) :
-      PcdGet32 (PcdOvmfDxeMemFvBase) + PcdGet32 (PcdOvmfDxeMemFvSize);
+    MemoryBase = PcdGet32 (PcdOvmfDxeMemFvBase) + PcdGet32 (PcdOvmfDxeMemFvSize);
+    if (mS3Supported && FeaturePcdGet (PcdSmmSmramRequire)) {
+      MemoryBase = MAX (MemoryBase, PcdGet32 (PcdOvmfDecompressionScratchEnd));
+    }
     MemorySize = LowerMemorySize - MemoryBase;
     if (MemorySize > PeiMemoryCap) {
       MemoryBase = LowerMemorySize - PeiMemoryCap;
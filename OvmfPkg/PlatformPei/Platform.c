@@ -26,6 +26,7 @@
 #include <Library/DebugLib.h>
 #include <Library/HobLib.h>
 #include <Library/IoLib.h>
+#include <Library/MemEncryptSevLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/PcdLib.h>
 #include <Library/PciLib.h>
@@ -38,6 +39,7 @@
 #include <Ppi/MasterBootMode.h>
 #include <IndustryStandard/Pci22.h>
 #include <OvmfPlatforms.h>
+#include <Register/Cpuid.h>
 
 #include "Platform.h"
 #include "Cmos.h"
@@ -609,6 +611,57 @@ MaxCpuCountInitialization (
 }
 
 
+/**
+  Select the loop in which APs wait for MP services requests, and expose it to
+  UefiCpuPkg modules.
+
+  If the VCPUs advertise MONITOR/MWAIT (QEMU: "-overcommit cpu-pm=on"), APs
+  sleep in MWAIT on their start-up signals, so that MP services calls after
+  the initial enumeration only write those signals, rather than sending
+  INIT-SIPI-SIPI to every AP.
+
+  Otherwise (the QEMU default) APs stay in the HLT loop, unless PcdApRunLoop
+  is set, for example with
+  "-fw_cfg name=opt/ovmf/PcdApRunLoop,string=y". Then they spin on their
+  start-up signals in the PAUSE-based run loop, which costs host CPU time
+  until ExitBootServices(), where MpInitLib moves the APs to the HLT loop.
+
+  Under SEV-ES, APs can only be restarted from the AP reset hold of the HLT
+  loop, so that loop is kept, and MP services calls keep sending
+  INIT-SIPI-SIPI.
+**/
+VOID
+ApLoopModeInitialization (
+  VOID
+  )
+{
+  CPUID_VERSION_INFO_ECX VersionInfoEcx;
+  UINT8                  ApLoopMode;
+  RETURN_STATUS          PcdStatus;
+
+  //
+  // PcdCpuApLoopMode: 1 = HLT loop, 2 = MWAIT loop, 3 = run loop.
+  //
+  if (MemEncryptSevEsIsEnabled ()) {
+    ApLoopMode = 1;
+  } else {
+    UPDATE_BOOLEAN_PCD_FROM_FW_CFG (PcdApRunLoop);
+    AsmCpuid (CPUID_VERSION_INFO, NULL, NULL, &VersionInfoEcx.Uint32, NULL);
+    if (VersionInfoEcx.Bits.MONITOR == 1) {
+      ApLoopMode = 2;
+    } else if (PcdGetBool (PcdApRunLoop)) {
+      ApLoopMode = 3;
+    } else {
+      ApLoopMode = 1;
+    }
+  }
+
+  PcdStatus = PcdSet8S (PcdCpuApLoopMode, ApLoopMode);
+  ASSERT_RETURN_ERROR (PcdStatus);
+  DEBUG ((DEBUG_INFO, "%a: AP loop mode %d\n", __FUNCTION__, ApLoopMode));
+}
+
+
 /**
   Perform Platform PEI initialization.
 
@@ -644,6 +697,7 @@ InitializePlatform (
   BootModeInitialization ();
   AddressWidthInitialization ();
   MaxCpuCountInitialization ();
+  ApLoopModeInitialization ();
 
   //
   // Query Host Bridge DID
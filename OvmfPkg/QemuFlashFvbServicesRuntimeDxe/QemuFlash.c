@@ -24,17 +24,47 @@
 #define CLEAR_STATUS_CMD         0x50
 #define READ_STATUS_CMD          0x70
 #define READ_DEVID_CMD           0x90
+#define READ_CFI_QUERY_CMD       0x98
 #define BLOCK_ERASE_CONFIRM_CMD  0xd0
+#define WRITE_BUFFER_CONFIRM_CMD 0xd0
+#define WRITE_BUFFER_CMD         0xe8
 #define READ_ARRAY_CMD           0xff
 
 #define CLEARED_ARRAY_STATUS  0x00
 
+//
+// Status register bits: device ready, and the erase, program, VPP and block
+// lock errors.
+//
+#define STATUS_READY          BIT7
+#define STATUS_ERROR_MASK     (BIT5 | BIT4 | BIT3 | BIT1)
+
+//
+// CFI query table offsets, for a byte-wide device.
+//
+#define CFI_QUERY_STRING_OFFSET      0x10
+#define CFI_MAX_WRITE_BUFFER_OFFSET  0x2a
+
+//
+// The word count of the write-to-buffer command is written as a single byte
+// on a byte-wide device, which caps the buffer at 256 bytes regardless of the
+// size reported by the CFI query.
+//
+#define MAX_WRITE_BUFFER_SIZE  256
+
 
 UINT8 *mFlashBase;
 
 STATIC UINTN       mFdBlockSize = 0;
 STATIC UINTN       mFdBlockCount = 0;
 
+//
+// Number of bytes that one write-to-buffer command may program, or zero if
+// the device doesn't support the command and bytes must be programmed one by
+// one. Always a power of two.
+//
+STATIC UINTN       mWriteBufferSize = 0;
+
 STATIC
 volatile UINT8*
 QemuFlashPtr (
@@ -114,6 +144,94 @@ QemuFlashDetected (
 }
 
 
+/**
+  Determine the size of the write buffer from the CFI query table of the
+  detected flash device, and store it in mWriteBufferSize.
+
+  The device must be in read array mode on entry, and it is left in that mode
+  on return.
+**/
+STATIC
+VOID
+QemuFlashProbeWriteBuffer (
+  VOID
+  )
+{
+  volatile UINT8  *Ptr;
+  UINT8           Shift;
+
+  Ptr = QemuFlashPtr (0, 0);
+  *Ptr = READ_CFI_QUERY_CMD;
+  if (Ptr[CFI_QUERY_STRING_OFFSET] == 'Q' &&
+      Ptr[CFI_QUERY_STRING_OFFSET + 1] == 'R' &&
+      Ptr[CFI_QUERY_STRING_OFFSET + 2] == 'Y') {
+    Shift = Ptr[CFI_MAX_WRITE_BUFFER_OFFSET];
+  } else {
+    Shift = 0;
+  }
+  *Ptr = READ_ARRAY_CMD;
+
+  if (Shift == 0 || Shift >= sizeof (UINTN) * 8) {
+    mWriteBufferSize = 0;
+  } else {
+    mWriteBufferSize = MIN ((UINTN)1 << Shift, MAX_WRITE_BUFFER_SIZE);
+  }
+
+  DEBUG ((EFI_D_INFO, "QEMU Flash: write buffer size %Lu\n",
+    (UINT64)mWriteBufferSize));
+}
+
+
+/**
+  Program up to mWriteBufferSize bytes with a single write-to-buffer command.
+
+  The range must not cross a write buffer boundary: the device commits the
+  aligned window of mWriteBufferSize bytes that contains the last byte
+  written.
+
+  @param[in] Ptr      Flash address to start programming at.
+  @param[in] Buffer   Pointer to the data to write.
+  @param[in] Count    Number of bytes to program, between 1 and
+                      mWriteBufferSize, inclusive.
+
+  @retval EFI_SUCCESS       The bytes have been programmed.
+  @retval EFI_DEVICE_ERROR  The device rejected the command, or reported an
+                            error in its status register.
+**/
+STATIC
+EFI_STATUS
+QemuFlashWriteBuffer (
+  IN volatile UINT8  *Ptr,
+  IN CONST UINT8     *Buffer,
+  IN UINTN           Count
+  )
+{
+  UINTN Loop;
+  UINT8 Status;
+
+  ASSERT (Count > 0);
+  ASSERT (Count <= mWriteBufferSize);
+
+  *Ptr = WRITE_BUFFER_CMD;
+  if ((*Ptr & STATUS_READY) == 0) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  *Ptr = (UINT8)(Count - 1);
+  for (Loop = 0; Loop < Count; Loop++) {
+    Ptr[Loop] = Buffer[Loop];
+  }
+  *Ptr = WRITE_BUFFER_CONFIRM_CMD;
+
+  Status = *Ptr;
+  if ((Status & (STATUS_READY | STATUS_ERROR_MASK)) != STATUS_READY) {
+    *Ptr = CLEAR_STATUS_CMD;
+    return EFI_DEVICE_ERROR;
+  }
+  return EFI_SUCCESS;
+}
+
+
 /**
   Read from QEMU Flash
 
@@ -173,6 +291,8 @@ QemuFlashWrite (
 {
   volatile UINT8  *Ptr;
   UINTN           Loop;
+  UINTN           End;
+  EFI_STATUS      Status;
 
   //
   // Only write to the first 64k. We don't bother saving the FTW Spare
@@ -183,20 +303,60 @@ QemuFlashWrite (
   }
 
   //
-  // Program flash
+  // Program flash. Every command and data byte written traps to QEMU, and
+  // every completed program operation is written through to the backing
+  // file, hence:
   //
-  Ptr = QemuFlashPtr (Lba, Offset);
-  for (Loop = 0; Loop < *NumBytes; Loop++) {
-    *Ptr = WRITE_BYTE_CMD;
-    *Ptr = Buffer[Loop];
-    Ptr++;
-  }
-
+  // - bytes that already hold the requested value (typically erased space,
+  //   or data that a variable store reclaim copies over unchanged) are
+  //   skipped; the array is in read mode while we compare, so those reads
+  //   don't trap,
   //
-  // Restore flash to read mode
+  // - runs of bytes that differ are programmed with write-to-buffer commands
+  //   where the device supports them, rather than byte by byte.
   //
-  if (*NumBytes > 0) {
-    *(Ptr - 1) = READ_ARRAY_CMD;
+  Ptr = QemuFlashPtr (Lba, Offset);
+  Loop = 0;
+  while (Loop < *NumBytes) {
+    if (Ptr[Loop] == Buffer[Loop]) {
+      Loop++;
+      continue;
+    }
+
+    if (mWriteBufferSize == 0) {
+      for (End = Loop; End < *NumBytes && Ptr[End] != Buffer[End]; End++) {
+      }
+      for (; Loop < End; Loop++) {
+        Ptr[Loop] = WRITE_BYTE_CMD;
+        Ptr[Loop] = Buffer[Loop];
+      }
+      Status = EFI_SUCCESS;
+    } else {
+      //
+      // Extend the run up to the end of the write buffer window, then trim
+      // the unchanged bytes from its tail. (Unchanged bytes inside the run
+      // are cheaper to rewrite than to start another command for.)
+      //
+      End = Loop + mWriteBufferSize -
+            ((UINTN)(Ptr + Loop - mFlashBase) & (mWriteBufferSize - 1));
+      End = MIN (End, *NumBytes);
+      while (Ptr[End - 1] == Buffer[End - 1]) {
+        End--;
+      }
+      Status = QemuFlashWriteBuffer (Ptr + Loop, Buffer + Loop, End - Loop);
+      if (EFI_ERROR (Status)) {
+        *NumBytes = Loop;
+      }
+      Loop = End;
+    }
+
+    //
+    // Restore flash to read mode
+    //
+    Ptr[Loop - 1] = READ_ARRAY_CMD;
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
   }
 
   return EFI_SUCCESS;
@@ -258,6 +418,7 @@ QemuFlashInitialize (
     return EFI_WRITE_PROTECTED;
   }
 
+  QemuFlashProbeWriteBuffer ();
   return EFI_SUCCESS;
 }
 
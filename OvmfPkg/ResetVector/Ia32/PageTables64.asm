@@ -173,7 +173,8 @@ pageTableEntriesLoop:
     ; and needs to be un-encrypted.  This requires the 2MB page
     ; (index 4 in the first 1GB page) for this range be broken down
     ; into 512 4KB pages.  All will be marked as encrypted, except
-    ; for the GHCB.
+    ; for the GHCB.  The page following the GHCB (0x808000) holds the
+    ; #VC handler per-CPU data and stays encrypted.
     ;
     mov     ecx, 4
     mov     eax, PT_ADDR (0x6000) + PAGE_PDP_ATTR
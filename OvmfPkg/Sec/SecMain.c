@@ -313,6 +313,10 @@ FindFfsFileAndSection (
 /**
   Locates the compressed main firmware volume and decompresses it.
 
+  The LZMA compressed section holds PEIFV, and optionally DXEFV. Otherwise
+  DXEFV is stored in its own chunked LZMA section, which
+  OvmfPkg/DxeFvDecompressPei decompresses on all processors.
+
   @param[in,out]  Fv            On input, the firmware volume to search
                                 On output, the decompressed BOOT/PEI FV
 
@@ -417,6 +421,11 @@ DecompressMemFvs (
              1,
              &FvSection
              );
+  if (Status == EFI_NOT_FOUND) {
+    DEBUG ((EFI_D_INFO, "DXE FV is decompressed in PEI\n"));
+    *Fv = PeiMemFv;
+    return EFI_SUCCESS;
+  }
   if (EFI_ERROR (Status)) {
     DEBUG ((EFI_D_ERROR, "Unable to find DXE FV section\n"));
     return Status;
@@ -0,0 +1,24 @@
+/** @file
+  Host replacement for the AutoGen.h file of VirtioBlkDxe.
+
+**/
+
+#ifndef _VBLK_HOST_AUTOGEN_H_
+#define _VBLK_HOST_AUTOGEN_H_
+
+extern CHAR8  *gEfiCallerBaseName;
+
+//
+// Spin briefly before stalling, so that the device also makes progress
+// while the driver stalls.
+//
+#define _PCD_GET_MODE_32_PcdVirtioPollSpinIterations  16
+
+EFI_STATUS
+EFIAPI
+VirtioBlkEntryPoint (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  );
+
+#endif
@@ -0,0 +1,660 @@
+/** @file
+  Host implementations of the boot services and of the BaseLib,
+  BaseMemoryLib, MemoryAllocationLib and UefiLib functions that VirtioBlkDxe,
+  VirtioLib and the test use.
+
+  The boot services model the TPL and event rules of the DXE core:
+  - RaiseTPL() and RestoreTPL() check that the TPL only goes up, and comes
+    back down, respectively. Lowering the TPL runs the notification
+    functions of the signaled events that it unmasks, highest TPL first.
+  - SignalEvent() runs the notification function at once if the current TPL
+    does not mask it, and defers it otherwise.
+  - Timer events fire when the test calls HostTimerTick(), which it does
+    from Stall(), as a timer interrupt would.
+
+  The protocol database holds one entry per handle and protocol.
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+#include "HostOs.h"
+#include "VblkHostTest.h"
+
+#define HOST_MAX_EVENTS     32
+#define HOST_MAX_PROTOCOLS  16
+
+typedef struct {
+  UINT32            Type;
+  EFI_TPL           NotifyTpl;
+  EFI_EVENT_NOTIFY  NotifyFunction;
+  VOID              *NotifyContext;
+  BOOLEAN           Signaled;
+  BOOLEAN           TimerArmed;
+} HOST_EVENT;
+
+typedef struct {
+  EFI_HANDLE  Handle;
+  EFI_GUID    *Protocol;
+  VOID        *Interface;
+  BOOLEAN     OpenedByDriver;
+} HOST_PROTOCOL;
+
+EFI_GUID  gVirtioDeviceProtocolGuid = {
+  0xfa920010, 0x6785, 0x4941, { 0xb6, 0xec, 0x49, 0x8c, 0x57, 0x9f, 0x16, 0x0a }
+};
+EFI_GUID  gEfiBlockIoProtocolGuid   = EFI_BLOCK_IO_PROTOCOL_GUID;
+EFI_GUID  gEfiBlockIo2ProtocolGuid  = EFI_BLOCK_IO2_PROTOCOL_GUID;
+
+CHAR8                        *gEfiCallerBaseName = "VblkHostTest";
+EFI_TPL                      mHostTpl = TPL_APPLICATION;
+EFI_DRIVER_BINDING_PROTOCOL  *mHostDriverBinding;
+UINTN                        mHostPoolAllocations;
+
+STATIC HOST_EVENT     *mHostEvents[HOST_MAX_EVENTS];
+STATIC HOST_PROTOCOL  mHostProtocols[HOST_MAX_PROTOCOLS];
+
+//
+// BaseLib and BaseMemoryLib
+//
+
+LIST_ENTRY *
+EFIAPI
+InitializeListHead (
+  IN OUT LIST_ENTRY  *ListHead
+  )
+{
+  ListHead->ForwardLink = ListHead;
+  ListHead->BackLink    = ListHead;
+  return ListHead;
+}
+
+LIST_ENTRY *
+EFIAPI
+InsertTailList (
+  IN OUT LIST_ENTRY  *ListHead,
+  IN OUT LIST_ENTRY  *Entry
+  )
+{
+  Entry->ForwardLink = ListHead;
+  Entry->BackLink    = ListHead->BackLink;
+  Entry->BackLink->ForwardLink = Entry;
+  ListHead->BackLink = Entry;
+  return ListHead;
+}
+
+LIST_ENTRY *
+EFIAPI
+RemoveEntryList (
+  IN CONST LIST_ENTRY  *Entry
+  )
+{
+  ASSERT (!IsListEmpty (Entry));
+  Entry->ForwardLink->BackLink = Entry->BackLink;
+  Entry->BackLink->ForwardLink = Entry->ForwardLink;
+  return Entry->ForwardLink;
+}
+
+BOOLEAN
+EFIAPI
+IsListEmpty (
+  IN CONST LIST_ENTRY  *ListHead
+  )
+{
+  return (BOOLEAN)(ListHead->ForwardLink == ListHead);
+}
+
+LIST_ENTRY *
+EFIAPI
+GetFirstNode (
+  IN CONST LIST_ENTRY  *List
+  )
+{
+  return List->ForwardLink;
+}
+
+UINT64
+EFIAPI
+MultU64x32 (
+  IN UINT64  Multiplicand,
+  IN UINT32  Multiplier
+  )
+{
+  return Multiplicand * Multiplier;
+}
+
+UINT64
+EFIAPI
+DivU64x32 (
+  IN UINT64  Dividend,
+  IN UINT32  Divisor
+  )
+{
+  return Dividend / Divisor;
+}
+
+UINT32
+EFIAPI
+ModU64x32 (
+  IN UINT64  Dividend,
+  IN UINT32  Divisor
+  )
+{
+  return (UINT32)(Dividend % Divisor);
+}
+
+UINT64
+EFIAPI
+LShiftU64 (
+  IN UINT64  Operand,
+  IN UINTN   Count
+  )
+{
+  return Operand << Count;
+}
+
+INTN
+EFIAPI
+HighBitSet64 (
+  IN UINT64  Operand
+  )
+{
+  return Operand == 0 ? -1 : 63 - __builtin_clzll (Operand);
+}
+
+VOID
+EFIAPI
+CpuPause (
+  VOID
+  )
+{
+  __builtin_ia32_pause ();
+}
+
+VOID
+EFIAPI
+MemoryFence (
+  VOID
+  )
+{
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+}
+
+VOID *
+EFIAPI
+CopyMem (
+  OUT VOID       *DestinationBuffer,
+  IN CONST VOID  *SourceBuffer,
+  IN UINTN       Length
+  )
+{
+  return __builtin_memmove (DestinationBuffer, SourceBuffer, Length);
+}
+
+VOID *
+EFIAPI
+SetMem (
+  OUT VOID  *Buffer,
+  IN UINTN  Length,
+  IN UINT8  Value
+  )
+{
+  return __builtin_memset (Buffer, Value, Length);
+}
+
+VOID *
+EFIAPI
+ZeroMem (
+  OUT VOID  *Buffer,
+  IN UINTN  Length
+  )
+{
+  return __builtin_memset (Buffer, 0, Length);
+}
+
+INTN
+EFIAPI
+CompareMem (
+  IN CONST VOID  *DestinationBuffer,
+  IN CONST VOID  *SourceBuffer,
+  IN UINTN       Length
+  )
+{
+  return __builtin_memcmp (DestinationBuffer, SourceBuffer, Length);
+}
+
+//
+// MemoryAllocationLib
+//
+
+VOID *
+EFIAPI
+AllocatePool (
+  IN UINTN  AllocationSize
+  )
+{
+  VOID  *Buffer;
+
+  Buffer = HostAllocate (AllocationSize);
+  if (Buffer != NULL) {
+    mHostPoolAllocations++;
+  }
+  return Buffer;
+}
+
+VOID *
+EFIAPI
+AllocateZeroPool (
+  IN UINTN  AllocationSize
+  )
+{
+  VOID  *Buffer;
+
+  Buffer = AllocatePool (AllocationSize);
+  if (Buffer != NULL) {
+    ZeroMem (Buffer, AllocationSize);
+  }
+  return Buffer;
+}
+
+VOID
+EFIAPI
+FreePool (
+  IN VOID  *Buffer
+  )
+{
+  ASSERT (mHostPoolAllocations > 0);
+  mHostPoolAllocations--;
+  HostFree (Buffer);
+}
+
+//
+// UefiLib
+//
+
+EFI_STATUS
+EFIAPI
+EfiLibInstallDriverBindingComponentName2 (
+  IN CONST EFI_HANDLE                    ImageHandle,
+  IN CONST EFI_SYSTEM_TABLE              *SystemTable,
+  IN EFI_DRIVER_BINDING_PROTOCOL         *DriverBinding,
+  IN EFI_HANDLE                          DriverBindingHandle,
+  IN CONST EFI_COMPONENT_NAME_PROTOCOL   *ComponentName,       OPTIONAL
+  IN CONST EFI_COMPONENT_NAME2_PROTOCOL  *ComponentName2       OPTIONAL
+  )
+{
+  DriverBinding->ImageHandle         = ImageHandle;
+  DriverBinding->DriverBindingHandle = DriverBindingHandle;
+  mHostDriverBinding = DriverBinding;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+LookupUnicodeString2 (
+  IN CONST CHAR8                     *Language,
+  IN CONST CHAR8                     *SupportedLanguages,
+  IN CONST EFI_UNICODE_STRING_TABLE  *UnicodeStringTable,
+  OUT CHAR16                         **UnicodeString,
+  IN BOOLEAN                         Iso639Language
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+//
+// Boot services: TPL and events
+//
+
+/**
+  Run the notification functions of the signaled events that the current
+  TPL does not mask, highest TPL first, each at its own TPL.
+**/
+STATIC
+VOID
+HostDispatchEvents (
+  VOID
+  )
+{
+  HOST_EVENT  *Event;
+  UINTN       Index;
+  EFI_TPL     OldTpl;
+
+  for (;;) {
+    Event = NULL;
+    for (Index = 0; Index < HOST_MAX_EVENTS; Index++) {
+      if (mHostEvents[Index] != NULL && mHostEvents[Index]->Signaled &&
+          mHostEvents[Index]->NotifyTpl > mHostTpl &&
+          (Event == NULL ||
+           mHostEvents[Index]->NotifyTpl > Event->NotifyTpl)) {
+        Event = mHostEvents[Index];
+      }
+    }
+    if (Event == NULL) {
+      return;
+    }
+
+    Event->Signaled = FALSE;
+    OldTpl   = mHostTpl;
+    mHostTpl = Event->NotifyTpl;
+    Event->NotifyFunction (Event, Event->NotifyContext);
+    ASSERT (mHostTpl == Event->NotifyTpl);
+    mHostTpl = OldTpl;
+  }
+}
+
+STATIC
+EFI_TPL
+EFIAPI
+HostRaiseTpl (
+  IN EFI_TPL  NewTpl
+  )
+{
+  EFI_TPL  OldTpl;
+
+  ASSERT (NewTpl >= mHostTpl);
+  OldTpl   = mHostTpl;
+  mHostTpl = NewTpl;
+  return OldTpl;
+}
+
+STATIC
+VOID
+EFIAPI
+HostRestoreTpl (
+  IN EFI_TPL  OldTpl
+  )
+{
+  ASSERT (OldTpl <= mHostTpl);
+  mHostTpl = OldTpl;
+  HostDispatchEvents ();
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostCreateEvent (
+  IN  UINT32            Type,
+  IN  EFI_TPL           NotifyTpl,
+  IN  EFI_EVENT_NOTIFY  NotifyFunction,
+  IN  VOID              *NotifyContext,
+  OUT EFI_EVENT         *Event
+  )
+{
+  HOST_EVENT  *NewEvent;
+  UINTN       Index;
+
+  for (Index = 0; Index < HOST_MAX_EVENTS; Index++) {
+    if (mHostEvents[Index] == NULL) {
+      break;
+    }
+  }
+  if (Index == HOST_MAX_EVENTS) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  NewEvent = AllocateZeroPool (sizeof *NewEvent);
+  if (NewEvent == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  NewEvent->Type           = Type;
+  NewEvent->NotifyTpl      = NotifyTpl;
+  NewEvent->NotifyFunction = NotifyFunction;
+  NewEvent->NotifyContext  = NotifyContext;
+  mHostEvents[Index] = NewEvent;
+  *Event = NewEvent;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostSetTimer (
+  IN EFI_EVENT        Event,
+  IN EFI_TIMER_DELAY  Type,
+  IN UINT64           TriggerTime
+  )
+{
+  HOST_EVENT  *TimerEvent;
+
+  TimerEvent = Event;
+  ASSERT ((TimerEvent->Type & EVT_TIMER) != 0);
+  TimerEvent->TimerArmed = (BOOLEAN)(Type != TimerCancel);
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostSignalEvent (
+  IN EFI_EVENT  Event
+  )
+{
+  HOST_EVENT  *SignaledEvent;
+
+  SignaledEvent = Event;
+  if ((SignaledEvent->Type & EVT_NOTIFY_SIGNAL) != 0) {
+    SignaledEvent->Signaled = TRUE;
+    HostDispatchEvents ();
+  }
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostCloseEvent (
+  IN EFI_EVENT  Event
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < HOST_MAX_EVENTS; Index++) {
+    if (mHostEvents[Index] == Event) {
+      mHostEvents[Index] = NULL;
+      FreePool (Event);
+      return EFI_SUCCESS;
+    }
+  }
+  return EFI_INVALID_PARAMETER;
+}
+
+VOID
+HostTimerTick (
+  VOID
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < HOST_MAX_EVENTS; Index++) {
+    if (mHostEvents[Index] != NULL && mHostEvents[Index]->TimerArmed) {
+      mHostEvents[Index]->Signaled = TRUE;
+    }
+  }
+  HostDispatchEvents ();
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostStallService (
+  IN UINTN  Microseconds
+  )
+{
+  HostStall (Microseconds);
+  return EFI_SUCCESS;
+}
+
+//
+// Boot services: protocol handlers
+//
+
+STATIC
+HOST_PROTOCOL *
+HostLookupProtocol (
+  IN EFI_HANDLE  Handle,
+  IN EFI_GUID    *Protocol
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < HOST_MAX_PROTOCOLS; Index++) {
+    if (mHostProtocols[Index].Handle == Handle &&
+        CompareMem (mHostProtocols[Index].Protocol, Protocol,
+          sizeof *Protocol) == 0) {
+      return &mHostProtocols[Index];
+    }
+  }
+  return NULL;
+}
+
+VOID
+HostInstallProtocol (
+  IN EFI_HANDLE  Handle,
+  IN EFI_GUID    *Protocol,
+  IN VOID        *Interface
+  )
+{
+  UINTN  Index;
+
+  ASSERT (HostLookupProtocol (Handle, Protocol) == NULL);
+  for (Index = 0; Index < HOST_MAX_PROTOCOLS; Index++) {
+    if (mHostProtocols[Index].Handle == NULL) {
+      mHostProtocols[Index].Handle    = Handle;
+      mHostProtocols[Index].Protocol  = Protocol;
+      mHostProtocols[Index].Interface = Interface;
+      return;
+    }
+  }
+  ASSERT (FALSE);
+}
+
+VOID *
+HostFindProtocol (
+  IN EFI_HANDLE  Handle,
+  IN EFI_GUID    *Protocol
+  )
+{
+  HOST_PROTOCOL  *Entry;
+
+  Entry = HostLookupProtocol (Handle, Protocol);
+  return Entry == NULL ? NULL : Entry->Interface;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostOpenProtocol (
+  IN  EFI_HANDLE  Handle,
+  IN  EFI_GUID    *Protocol,
+  OUT VOID        **Interface,
+  IN  EFI_HANDLE  AgentHandle,
+  IN  EFI_HANDLE  ControllerHandle,
+  IN  UINT32      Attributes
+  )
+{
+  HOST_PROTOCOL  *Entry;
+
+  Entry = HostLookupProtocol (Handle, Protocol);
+  if (Entry == NULL) {
+    return EFI_UNSUPPORTED;
+  }
+  if (Attributes == EFI_OPEN_PROTOCOL_BY_DRIVER) {
+    if (Entry->OpenedByDriver) {
+      return EFI_ALREADY_STARTED;
+    }
+    Entry->OpenedByDriver = TRUE;
+  }
+  *Interface = Entry->Interface;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostCloseProtocol (
+  IN EFI_HANDLE  Handle,
+  IN EFI_GUID    *Protocol,
+  IN EFI_HANDLE  AgentHandle,
+  IN EFI_HANDLE  ControllerHandle
+  )
+{
+  HOST_PROTOCOL  *Entry;
+
+  Entry = HostLookupProtocol (Handle, Protocol);
+  if (Entry == NULL || !Entry->OpenedByDriver) {
+    return EFI_NOT_FOUND;
+  }
+  Entry->OpenedByDriver = FALSE;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostInstallMultipleProtocolInterfaces (
+  IN OUT EFI_HANDLE  *Handle,
+  ...
+  )
+{
+  VA_LIST   Marker;
+  EFI_GUID  *Protocol;
+
+  VA_START (Marker, Handle);
+  for (Protocol = VA_ARG (Marker, EFI_GUID *);
+       Protocol != NULL;
+       Protocol = VA_ARG (Marker, EFI_GUID *)) {
+    HostInstallProtocol (*Handle, Protocol, VA_ARG (Marker, VOID *));
+  }
+  VA_END (Marker);
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostUninstallMultipleProtocolInterfaces (
+  IN EFI_HANDLE  Handle,
+  ...
+  )
+{
+  VA_LIST        Marker;
+  EFI_GUID       *Protocol;
+  VOID           *Interface;
+  HOST_PROTOCOL  *Entry;
+
+  VA_START (Marker, Handle);
+  for (Protocol = VA_ARG (Marker, EFI_GUID *);
+       Protocol != NULL;
+       Protocol = VA_ARG (Marker, EFI_GUID *)) {
+    Interface = VA_ARG (Marker, VOID *);
+    Entry = HostLookupProtocol (Handle, Protocol);
+    ASSERT (Entry != NULL && Entry->Interface == Interface);
+    SetMem (Entry, sizeof *Entry, 0);
+  }
+  VA_END (Marker);
+  return EFI_SUCCESS;
+}
+
+STATIC EFI_BOOT_SERVICES  mHostBootServices = {
+  .RaiseTPL                            = HostRaiseTpl,
+  .RestoreTPL                          = HostRestoreTpl,
+  .CreateEvent                         = HostCreateEvent,
+  .SetTimer                            = HostSetTimer,
+  .SignalEvent                         = HostSignalEvent,
+  .CloseEvent                          = HostCloseEvent,
+  .Stall                               = HostStallService,
+  .OpenProtocol                        = HostOpenProtocol,
+  .CloseProtocol                       = HostCloseProtocol,
+  .InstallMultipleProtocolInterfaces   = HostInstallMultipleProtocolInterfaces,
+  .UninstallMultipleProtocolInterfaces = HostUninstallMultipleProtocolInterfaces
+};
+
+EFI_BOOT_SERVICES  *gBS = &mHostBootServices;
@@ -0,0 +1,1236 @@
+/** @file
+  Host test of VirtioBlkDxe under the DMA rules of an SEV guest.
+
+  The driver runs against a virtio-blk device model that, like the
+  hypervisor of an SEV guest, only sees memory that the driver has mapped:
+  - MapSharedBuffer() bounces BusMasterRead and BusMasterWrite buffers
+    through separate memory, as IoMmuDxe does, and copies the data in on Map
+    and out on Unmap. CommonBuffer mappings must lie in pages allocated with
+    AllocateSharedPages().
+  - Every descriptor address the device uses must lie in a live mapping
+    whose direction permits the access.
+  - Map and Unmap must be called at or below TPL_NOTIFY, and raise the TPL
+    to TPL_NOTIFY themselves, as IoMmuDxe does.
+
+  The device completes the requests in random order, a few at a time, when
+  the driver stalls and when the test lets time pass. The timer interrupt
+  fires at the same points, and drives the non-blocking transfers through
+  the driver's TPL_NOTIFY poll timer.
+
+  The test binds the driver to the device, and then uses BlockIo and
+  BlockIo2 for blocking and non-blocking reads, writes and flushes of
+  random extents, with misaligned buffers; for a read that the device
+  fails; for a transfer whose buffer fails to map; and for a reset with
+  transfers in flight. It checks every read against a model of the disk,
+  and the disk against the model after the writes. Stopping the driver must
+  release all mappings, shared pages and pool.
+
+  Usage: VblkHostTest [seed]
+
+**/
+
+#include <Uefi.h>
+#include <IndustryStandard/VirtioBlk.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+#include <Protocol/VirtioDevice.h>
+#include "HostOs.h"
+#include "VblkHostTest.h"
+
+#define HOST_BLOCK_SIZE      512
+#define HOST_DISK_SIZE       SIZE_16MB
+#define HOST_SLOT_SIZE       SIZE_2MB
+#define HOST_SLOT_COUNT      (HOST_DISK_SIZE / HOST_SLOT_SIZE)
+#define HOST_QUEUE_SIZE      64
+#define HOST_SIZE_MAX        SIZE_64KB
+#define HOST_SEG_MAX         8
+#define HOST_MAX_MAPPINGS    256
+#define HOST_MAX_SHARED      16
+#define HOST_MAX_TRANSFERS   32
+#define HOST_MAX_STEPS       1000000
+
+//
+// Expected status of a transfer that a reset may abort.
+//
+#define HOST_SUCCESS_OR_ABORTED  MAX_UINTN
+
+typedef struct {
+  VIRTIO_MAP_OPERATION  Operation;
+  VOID                  *HostAddress;
+  UINT8                 *Bounce;
+  UINTN                 Size;
+  EFI_PHYSICAL_ADDRESS  DeviceAddress;
+} HOST_MAPPING;
+
+typedef struct {
+  VOID   *Base;
+  UINTN  Pages;
+} HOST_SHARED;
+
+typedef struct {
+  VIRTIO_DEVICE_PROTOCOL  VirtIo;
+  UINT8                   Status;
+  UINT64                  GuestFeatures;
+  UINT16                  QueueNum;
+  VRING                   *Ring;
+  UINT16                  LastAvailIdx;
+  UINT16                  Pending[HOST_QUEUE_SIZE];
+  UINTN                   PendingCount;
+  UINT8                   *Disk;
+  UINT64                  FailSector;
+  UINTN                   FailMaps;
+  HOST_MAPPING            *Mappings[HOST_MAX_MAPPINGS];
+  HOST_SHARED             Shared[HOST_MAX_SHARED];
+  //
+  // Statistics
+  //
+  UINTN                   Maps;
+  UINTN                   MapsAtNotify;
+  UINTN                   Unmaps;
+  UINTN                   UnmapsAtNotify;
+  UINTN                   Requests;
+  UINTN                   Flushes;
+  UINTN                   MaxPending;
+} HOST_VBLK_DEVICE;
+
+typedef struct {
+  EFI_BLOCK_IO2_TOKEN  Token;
+  EFI_LBA              Lba;
+  UINTN                Size;
+  UINT8                *Allocation;
+  UINT8                *Buffer;
+  BOOLEAN              Write;
+  BOOLEAN              Flush;
+  UINT8                Generation;
+  BOOLEAN              Done;
+  EFI_STATUS           Expected;
+} HOST_TRANSFER;
+
+STATIC HOST_VBLK_DEVICE  mDevice;
+STATIC UINT8             *mModel;
+STATIC UINT32            mSeed;
+STATIC UINTN             mFailures;
+STATIC UINTN             mStalls;
+
+STATIC HOST_TRANSFER     mTransfers[HOST_MAX_TRANSFERS];
+STATIC UINTN             mTransferCount;
+
+STATIC EFI_BLOCK_IO_PROTOCOL   *mBlockIo;
+STATIC EFI_BLOCK_IO2_PROTOCOL  *mBlockIo2;
+
+#define FAIL(Args)  do { HostPrint Args; mFailures++; } while (FALSE)
+
+/**
+  Return the next number of the pseudo-random sequence (xorshift32).
+
+  @param[in] Limit  The upper bound of the result, exclusive; not zero.
+**/
+STATIC
+UINTN
+Random (
+  IN UINTN  Limit
+  )
+{
+  mSeed ^= mSeed << 13;
+  mSeed ^= mSeed >> 17;
+  mSeed ^= mSeed << 5;
+  return mSeed % Limit;
+}
+
+/**
+  The byte that generation Generation of the disk contents holds at Offset.
+**/
+STATIC
+UINT8
+PatternByte (
+  IN UINTN  Offset,
+  IN UINT8  Generation
+  )
+{
+  return (UINT8)((Offset >> 9) * 13 + Offset * 7 + Generation * 101);
+}
+
+//
+// The device's view of guest memory
+//
+
+/**
+  Translate a device address range to the memory that backs it.
+
+  @param[in] Address   The device address.
+  @param[in] Length    The length of the range.
+  @param[in] Write     TRUE if the device writes the range.
+
+  @return  The backing memory, or NULL if no mapping permits the access.
+**/
+STATIC
+UINT8 *
+DeviceTranslate (
+  IN UINT64   Address,
+  IN UINTN    Length,
+  IN BOOLEAN  Write
+  )
+{
+  HOST_MAPPING  *Mapping;
+  UINTN         Index;
+
+  for (Index = 0; Index < HOST_MAX_MAPPINGS; Index++) {
+    Mapping = mDevice.Mappings[Index];
+    if (Mapping == NULL || Address < Mapping->DeviceAddress ||
+        Address + Length > Mapping->DeviceAddress + Mapping->Size) {
+      continue;
+    }
+    if (Mapping->Operation == (Write ? VirtioOperationBusMasterRead :
+                                       VirtioOperationBusMasterWrite)) {
+      continue;
+    }
+    return (UINT8 *)(UINTN)Address;
+  }
+
+  FAIL (("device %s of %lu bytes at 0x%lx is not mapped\n",
+    Write ? "write" : "read", (unsigned long)Length,
+    (unsigned long)Address));
+  return NULL;
+}
+
+/**
+  Process one request that the driver has made available.
+
+  @param[in] Head  The head descriptor of the request.
+
+  @return  The number of bytes the device has written.
+**/
+STATIC
+UINT32
+DeviceProcess (
+  IN UINT16  Head
+  )
+{
+  volatile VRING_DESC  *Desc;
+  VIRTIO_BLK_REQ       *Request;
+  UINT8                *Data;
+  UINT8                *HostStatus;
+  UINT64               Offset;
+  UINT32               Written;
+  UINT8                Status;
+  UINT16               Index;
+
+  Desc    = &mDevice.Ring->Desc[Head];
+  Request = (VIRTIO_BLK_REQ *)DeviceTranslate (Desc->Addr, sizeof *Request,
+                                FALSE);
+  if (Request == NULL || Desc->Len != sizeof *Request ||
+      (Desc->Flags & VRING_DESC_F_NEXT) == 0) {
+    FAIL (("request %u: bad header descriptor\n", Head));
+    return 0;
+  }
+
+  Offset  = Request->Sector * 512;
+  Written = 0;
+  Status  = VIRTIO_BLK_S_OK;
+  if (Request->Type == VIRTIO_BLK_T_FLUSH) {
+    mDevice.Flushes++;
+  }
+
+  for (Index = Desc->Next;
+       (mDevice.Ring->Desc[Index].Flags & VRING_DESC_F_NEXT) != 0;
+       Index = mDevice.Ring->Desc[Index].Next) {
+    Desc = &mDevice.Ring->Desc[Index];
+    if ((Request->Type == VIRTIO_BLK_T_IN) !=
+        ((Desc->Flags & VRING_DESC_F_WRITE) != 0) ||
+        Request->Type == VIRTIO_BLK_T_FLUSH ||
+        Offset + Desc->Len > HOST_DISK_SIZE) {
+      FAIL (("request %u: bad data descriptor\n", Head));
+      return 0;
+    }
+    Data = DeviceTranslate (Desc->Addr, Desc->Len,
+             (BOOLEAN)(Request->Type == VIRTIO_BLK_T_IN));
+    if (Data == NULL) {
+      Status = VIRTIO_BLK_S_IOERR;
+    } else if (Request->Type == VIRTIO_BLK_T_IN) {
+      if (mDevice.FailSector >= Offset / 512 &&
+          mDevice.FailSector < (Offset + Desc->Len) / 512) {
+        Status = VIRTIO_BLK_S_IOERR;
+      }
+      CopyMem (Data, mDevice.Disk + Offset, Desc->Len);
+      Written += Desc->Len;
+    } else {
+      CopyMem (mDevice.Disk + Offset, Data, Desc->Len);
+    }
+    Offset += Desc->Len;
+  }
+
+  Desc = &mDevice.Ring->Desc[Index];
+  HostStatus = DeviceTranslate (Desc->Addr, 1, TRUE);
+  if (HostStatus == NULL || (Desc->Flags & VRING_DESC_F_WRITE) == 0) {
+    FAIL (("request %u: bad status descriptor\n", Head));
+    return Written;
+  }
+  *HostStatus = Status;
+  mDevice.Requests++;
+  return Written + 1;
+}
+
+/**
+  Let the device take the requests that the driver has made available, and
+  complete up to MaxCompletions of the requests it holds, in random order.
+**/
+STATIC
+VOID
+DeviceStep (
+  IN UINTN  MaxCompletions
+  )
+{
+  UINT16  Head;
+  UINTN   Index;
+  UINTN   Completions;
+  UINT32  Written;
+  UINT16  UsedIdx;
+
+  if (mDevice.Ring == NULL || (mDevice.Status & VSTAT_DRIVER_OK) == 0) {
+    return;
+  }
+
+  MemoryFence ();
+  while (mDevice.LastAvailIdx != *mDevice.Ring->Avail.Idx) {
+    Head = mDevice.Ring->Avail.Ring[mDevice.LastAvailIdx % mDevice.QueueNum];
+    mDevice.LastAvailIdx++;
+    //
+    // A flush is only made available once every earlier request has
+    // completed.
+    //
+    if (((VIRTIO_BLK_REQ *)(UINTN)mDevice.Ring->Desc[Head].Addr)->Type ==
+          VIRTIO_BLK_T_FLUSH &&
+        mDevice.PendingCount != 0) {
+      FAIL (("flush submitted with %u requests in flight\n",
+        (unsigned)mDevice.PendingCount));
+    }
+    ASSERT (mDevice.PendingCount < HOST_QUEUE_SIZE);
+    mDevice.Pending[mDevice.PendingCount++] = Head;
+  }
+  mDevice.MaxPending = MAX (mDevice.MaxPending, mDevice.PendingCount);
+
+  for (Completions = 0;
+       Completions < MaxCompletions && mDevice.PendingCount > 0;
+       Completions++) {
+    Index = Random (mDevice.PendingCount);
+    Head  = mDevice.Pending[Index];
+    mDevice.Pending[Index] = mDevice.Pending[--mDevice.PendingCount];
+
+    Written = DeviceProcess (Head);
+    UsedIdx = *mDevice.Ring->Used.Idx;
+    mDevice.Ring->Used.UsedElem[UsedIdx % mDevice.QueueNum].Id  = Head;
+    mDevice.Ring->Used.UsedElem[UsedIdx % mDevice.QueueNum].Len = Written;
+    MemoryFence ();
+    *mDevice.Ring->Used.Idx = (UINT16)(UsedIdx + 1);
+  }
+}
+
+VOID
+HostStall (
+  IN UINTN  Microseconds
+  )
+{
+  mStalls++;
+  DeviceStep (1 + Random (3));
+  HostTimerTick ();
+}
+
+//
+// VIRTIO_DEVICE_PROTOCOL
+//
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostGetDeviceFeatures (
+  IN  VIRTIO_DEVICE_PROTOCOL  *This,
+  OUT UINT64                  *DeviceFeatures
+  )
+{
+  *DeviceFeatures = VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_FLUSH |
+                    VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX |
+                    VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostSetGuestFeatures (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN UINT64                  Features
+  )
+{
+  mDevice.GuestFeatures = Features;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostSetQueueAddress (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN VRING                   *Ring,
+  IN UINT64                  RingBaseShift
+  )
+{
+  if (RingBaseShift != 0 ||
+      DeviceTranslate ((UINTN)Ring->Base, EFI_PAGES_TO_SIZE (Ring->NumPages),
+        TRUE) == NULL) {
+    FAIL (("the ring is not mapped as a common buffer\n"));
+  }
+  mDevice.Ring = Ring;
+  mDevice.LastAvailIdx = 0;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostSetQueueSel (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN UINT16                  Index
+  )
+{
+  return Index == 0 ? EFI_SUCCESS : EFI_UNSUPPORTED;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostSetQueueNotify (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN UINT16                  Index
+  )
+{
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostSetQueueAlign (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN UINT32                  Alignment
+  )
+{
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostSetPageSize (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN UINT32                  PageSize
+  )
+{
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostGetQueueNumMax (
+  IN  VIRTIO_DEVICE_PROTOCOL  *This,
+  OUT UINT16                  *QueueNumMax
+  )
+{
+  *QueueNumMax = HOST_QUEUE_SIZE;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostSetQueueNum (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN UINT16                  QueueSize
+  )
+{
+  mDevice.QueueNum = QueueSize;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostGetDeviceStatus (
+  IN  VIRTIO_DEVICE_PROTOCOL  *This,
+  OUT UINT8                   *DeviceStatus
+  )
+{
+  *DeviceStatus = mDevice.Status;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostSetDeviceStatus (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN UINT8                   DeviceStatus
+  )
+{
+  if (DeviceStatus == 0) {
+    if (mDevice.PendingCount != 0) {
+      FAIL (("device reset with %u requests in flight\n",
+        (unsigned)mDevice.PendingCount));
+    }
+    mDevice.Ring = NULL;
+    mDevice.PendingCount = 0;
+  }
+  mDevice.Status = DeviceStatus;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostWriteDevice (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN UINTN                   FieldOffset,
+  IN UINTN                   FieldSize,
+  IN UINT64                  Value
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostReadDevice (
+  IN  VIRTIO_DEVICE_PROTOCOL  *This,
+  IN  UINTN                   FieldOffset,
+  IN  UINTN                   FieldSize,
+  IN  UINTN                   BufferSize,
+  OUT VOID                    *Buffer
+  )
+{
+  VIRTIO_BLK_CONFIG  Config;
+
+  ZeroMem (&Config, sizeof Config);
+  Config.Capacity = HOST_DISK_SIZE / 512;
+  Config.SizeMax  = HOST_SIZE_MAX;
+  Config.SegMax   = HOST_SEG_MAX;
+  Config.BlkSize  = HOST_BLOCK_SIZE;
+
+  if (FieldSize != BufferSize || FieldOffset + FieldSize > sizeof Config) {
+    return EFI_INVALID_PARAMETER;
+  }
+  CopyMem (Buffer, (UINT8 *)&Config + FieldOffset, FieldSize);
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+HostAllocateSharedPages (
+  IN     VIRTIO_DEVICE_PROTOCOL  *This,
+  IN     UINTN                   Pages,
+  IN OUT VOID                    **HostAddress
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < HOST_MAX_SHARED; Index++) {
+    if (mDevice.Shared[Index].Base == NULL) {
+      mDevice.Shared[Index].Base = HostAllocatePages (Pages);
+      if (mDevice.Shared[Index].Base == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+      }
+      mDevice.Shared[Index].Pages = Pages;
+      *HostAddress = mDevice.Shared[Index].Base;
+      return EFI_SUCCESS;
+    }
+  }
+  return EFI_OUT_OF_RESOURCES;
+}
+
+STATIC
+VOID
+EFIAPI
+HostFreeSharedPages (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN UINTN                   Pages,
+  IN VOID                    *HostAddress
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < HOST_MAX_SHARED; Index++) {
+    if (mDevice.Shared[Index].Base == HostAddress) {
+      if (mDevice.Shared[Index].Pages != Pages) {
+        FAIL (("FreeSharedPages(): %u pages, allocated %u\n",
+          (unsigned)Pages, (unsigned)mDevice.Shared[Index].Pages));
+      }
+      HostFree (HostAddress);
+      mDevice.Shared[Index].Base = NULL;
+      return;
+    }
+  }
+  FAIL (("FreeSharedPages(): unknown address\n"));
+}
+
+/**
+  Map a buffer for the device, the way IoMmuDxe does in an SEV guest.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostMapSharedBuffer (
+  IN     VIRTIO_DEVICE_PROTOCOL  *This,
+  IN     VIRTIO_MAP_OPERATION    Operation,
+  IN     VOID                    *HostAddress,
+  IN OUT UINTN                   *NumberOfBytes,
+  OUT    EFI_PHYSICAL_ADDRESS    *DeviceAddress,
+  OUT    VOID                    **Mapping
+  )
+{
+  HOST_MAPPING  *NewMapping;
+  EFI_TPL       OldTpl;
+  UINTN         Index;
+  UINTN         Slot;
+  EFI_STATUS    Status;
+
+  mDevice.Maps++;
+  if (mHostTpl > TPL_NOTIFY) {
+    FAIL (("MapSharedBuffer() at TPL %u\n", (unsigned)mHostTpl));
+  } else if (mHostTpl == TPL_NOTIFY) {
+    mDevice.MapsAtNotify++;
+  }
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  Status = EFI_SUCCESS;
+  NewMapping = NULL;
+
+  if (Operation != VirtioOperationBusMasterCommonBuffer &&
+      mDevice.FailMaps > 0) {
+    mDevice.FailMaps--;
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  for (Slot = 0; Slot < HOST_MAX_MAPPINGS; Slot++) {
+    if (mDevice.Mappings[Slot] == NULL) {
+      break;
+    }
+  }
+  NewMapping = HostAllocate (sizeof *NewMapping);
+  if (Slot == HOST_MAX_MAPPINGS || NewMapping == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+  NewMapping->Operation   = Operation;
+  NewMapping->HostAddress = HostAddress;
+  NewMapping->Size        = *NumberOfBytes;
+  NewMapping->Bounce      = NULL;
+
+  if (Operation == VirtioOperationBusMasterCommonBuffer) {
+    for (Index = 0; Index < HOST_MAX_SHARED; Index++) {
+      if (mDevice.Shared[Index].Base != NULL &&
+          (UINT8 *)HostAddress >= (UINT8 *)mDevice.Shared[Index].Base &&
+          (UINT8 *)HostAddress + *NumberOfBytes <=
+            (UINT8 *)mDevice.Shared[Index].Base +
+            EFI_PAGES_TO_SIZE (mDevice.Shared[Index].Pages)) {
+        break;
+      }
+    }
+    if (Index == HOST_MAX_SHARED) {
+      FAIL (("common buffer outside of the shared pages\n"));
+      Status = EFI_UNSUPPORTED;
+      goto Done;
+    }
+    NewMapping->DeviceAddress = (UINTN)HostAddress;
+  } else {
+    NewMapping->Bounce = HostAllocatePages (EFI_SIZE_TO_PAGES (*NumberOfBytes));
+    if (NewMapping->Bounce == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      goto Done;
+    }
+    if (Operation == VirtioOperationBusMasterRead) {
+      CopyMem (NewMapping->Bounce, HostAddress, *NumberOfBytes);
+    }
+    NewMapping->DeviceAddress = (UINTN)NewMapping->Bounce;
+  }
+
+  mDevice.Mappings[Slot] = NewMapping;
+  *DeviceAddress = NewMapping->DeviceAddress;
+  *Mapping       = NewMapping;
+  NewMapping     = NULL;
+
+Done:
+  if (NewMapping != NULL) {
+    HostFree (NewMapping);
+  }
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
+/**
+  Unmap a buffer, the way IoMmuDxe does in an SEV guest: copy the data the
+  device wrote to the bounce buffer back to the caller's buffer, and scrub
+  the bounce buffer.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+HostUnmapSharedBuffer (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN VOID                    *Mapping
+  )
+{
+  HOST_MAPPING  *OldMapping;
+  EFI_TPL       OldTpl;
+  UINTN         Slot;
+
+  mDevice.Unmaps++;
+  if (mHostTpl > TPL_NOTIFY) {
+    FAIL (("UnmapSharedBuffer() at TPL %u\n", (unsigned)mHostTpl));
+  } else if (mHostTpl == TPL_NOTIFY) {
+    mDevice.UnmapsAtNotify++;
+  }
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  for (Slot = 0; Slot < HOST_MAX_MAPPINGS; Slot++) {
+    if (mDevice.Mappings[Slot] == Mapping) {
+      break;
+    }
+  }
+  if (Slot == HOST_MAX_MAPPINGS) {
+    gBS->RestoreTPL (OldTpl);
+    FAIL (("UnmapSharedBuffer(): unknown mapping\n"));
+    return EFI_INVALID_PARAMETER;
+  }
+
+  OldMapping = Mapping;
+  mDevice.Mappings[Slot] = NULL;
+  if (OldMapping->Bounce != NULL) {
+    if (OldMapping->Operation == VirtioOperationBusMasterWrite) {
+      CopyMem (OldMapping->HostAddress, OldMapping->Bounce, OldMapping->Size);
+    }
+    SetMem (OldMapping->Bounce, OldMapping->Size, 0xCC);
+    HostFree (OldMapping->Bounce);
+  }
+  HostFree (OldMapping);
+  gBS->RestoreTPL (OldTpl);
+  return EFI_SUCCESS;
+}
+
+STATIC HOST_VBLK_DEVICE  mDevice = {
+  {
+    VIRTIO_SPEC_REVISION (1, 0, 0),
+    VIRTIO_SUBSYSTEM_BLOCK_DEVICE,
+    HostGetDeviceFeatures,
+    HostSetGuestFeatures,
+    HostSetQueueAddress,
+    HostSetQueueSel,
+    HostSetQueueNotify,
+    HostSetQueueAlign,
+    HostSetPageSize,
+    HostGetQueueNumMax,
+    HostSetQueueNum,
+    HostGetDeviceStatus,
+    HostSetDeviceStatus,
+    HostWriteDevice,
+    HostReadDevice,
+    HostAllocateSharedPages,
+    HostFreeSharedPages,
+    HostMapSharedBuffer,
+    HostUnmapSharedBuffer
+  }
+};
+
+//
+// Transfers
+//
+
+/**
+  Notification function of the token events: check the outcome of the
+  transfer, and update the disk model after a write.
+**/
+STATIC
+VOID
+EFIAPI
+TransferDone (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  HOST_TRANSFER  *Transfer;
+  EFI_STATUS     Status;
+  UINTN          Offset;
+
+  Transfer = Context;
+  Status   = Transfer->Token.TransactionStatus;
+  Offset   = (UINTN)Transfer->Lba * HOST_BLOCK_SIZE;
+
+  if (mHostTpl != TPL_CALLBACK) {
+    FAIL (("token event notified at TPL %u\n", (unsigned)mHostTpl));
+  }
+  if (Transfer->Done) {
+    FAIL (("token event signaled twice\n"));
+  }
+  Transfer->Done = TRUE;
+
+  if (Transfer->Expected == HOST_SUCCESS_OR_ABORTED ?
+      (Status != EFI_SUCCESS && Status != EFI_ABORTED) :
+      Status != Transfer->Expected) {
+    FAIL (("%s of %lu bytes at LBA 0x%lx: status 0x%lx, expected 0x%lx\n",
+      Transfer->Write ? "write" : "read", (unsigned long)Transfer->Size,
+      (unsigned long)Transfer->Lba, (unsigned long)Status,
+      (unsigned long)Transfer->Expected));
+    return;
+  }
+  if (Status != EFI_SUCCESS || Transfer->Flush) {
+    return;
+  }
+
+  if (Transfer->Write) {
+    CopyMem (mModel + Offset, Transfer->Buffer, Transfer->Size);
+  } else if (CompareMem (Transfer->Buffer, mModel + Offset,
+               Transfer->Size) != 0) {
+    FAIL (("read of %lu bytes at LBA 0x%lx: wrong data\n",
+      (unsigned long)Transfer->Size, (unsigned long)Transfer->Lba));
+  }
+}
+
+/**
+  Prepare a transfer of Size bytes at Offset, with a buffer that is
+  misaligned by a random number of bytes.
+**/
+STATIC
+HOST_TRANSFER *
+NewTransfer (
+  IN UINTN       Offset,
+  IN UINTN       Size,
+  IN BOOLEAN     Write,
+  IN UINT8       Generation,
+  IN EFI_STATUS  Expected
+  )
+{
+  HOST_TRANSFER  *Transfer;
+  UINTN          Index;
+  EFI_STATUS     Status;
+
+  ASSERT (mTransferCount < HOST_MAX_TRANSFERS);
+  Transfer = &mTransfers[mTransferCount++];
+  ZeroMem (Transfer, sizeof *Transfer);
+  Transfer->Lba        = Offset / HOST_BLOCK_SIZE;
+  Transfer->Size       = Size;
+  Transfer->Write      = Write;
+  Transfer->Generation = Generation;
+  Transfer->Expected   = Expected;
+  Transfer->Allocation = HostAllocate (Size + 64);
+  ASSERT (Transfer->Allocation != NULL);
+  Transfer->Buffer     = Transfer->Allocation + Random (64);
+
+  for (Index = 0; Index < Size; Index++) {
+    Transfer->Buffer[Index] = Write ? PatternByte (Offset + Index, Generation) :
+                                      0x5A;
+  }
+
+  Status = gBS->CreateEvent (EVT_NOTIFY_SIGNAL, TPL_CALLBACK, TransferDone,
+                  Transfer, &Transfer->Token.Event);
+  ASSERT_EFI_ERROR (Status);
+  return Transfer;
+}
+
+/**
+  Submit a prepared transfer through BlockIo2.
+**/
+STATIC
+VOID
+SubmitTransfer (
+  IN HOST_TRANSFER  *Transfer
+  )
+{
+  EFI_STATUS  Status;
+
+  if (Transfer->Flush) {
+    Status = mBlockIo2->FlushBlocksEx (mBlockIo2, &Transfer->Token);
+  } else if (Transfer->Write) {
+    Status = mBlockIo2->WriteBlocksEx (mBlockIo2, 0, Transfer->Lba,
+                          &Transfer->Token, Transfer->Size, Transfer->Buffer);
+  } else {
+    Status = mBlockIo2->ReadBlocksEx (mBlockIo2, 0, Transfer->Lba,
+                          &Transfer->Token, Transfer->Size, Transfer->Buffer);
+  }
+  if (EFI_ERROR (Status)) {
+    FAIL (("BlockIo2 request failed: 0x%lx\n", (unsigned long)Status));
+    Transfer->Done = TRUE;
+  }
+}
+
+/**
+  Let time pass until every transfer has completed, then release them.
+**/
+STATIC
+VOID
+WaitTransfers (
+  VOID
+  )
+{
+  UINTN  Step;
+  UINTN  Index;
+  UINTN  Pending;
+
+  for (Step = 0; Step < HOST_MAX_STEPS; Step++) {
+    Pending = 0;
+    for (Index = 0; Index < mTransferCount; Index++) {
+      if (!mTransfers[Index].Done) {
+        Pending++;
+      }
+    }
+    if (Pending == 0) {
+      break;
+    }
+    DeviceStep (1 + Random (4));
+    HostTimerTick ();
+  }
+  if (Step == HOST_MAX_STEPS) {
+    FAIL (("%u transfers did not complete\n", (unsigned)Pending));
+  }
+
+  for (Index = 0; Index < mTransferCount; Index++) {
+    gBS->CloseEvent (mTransfers[Index].Token.Event);
+    HostFree (mTransfers[Index].Allocation);
+  }
+  mTransferCount = 0;
+}
+
+/**
+  Read an extent through BlockIo at the given TPL, and check it against the
+  disk model.
+**/
+STATIC
+VOID
+BlockingRead (
+  IN UINTN    Offset,
+  IN UINTN    Size,
+  IN EFI_TPL  Tpl
+  )
+{
+  UINT8       *Buffer;
+  EFI_TPL     OldTpl;
+  EFI_STATUS  Status;
+
+  Buffer = HostAllocate (Size);
+  ASSERT (Buffer != NULL);
+  OldTpl = gBS->RaiseTPL (Tpl);
+  Status = mBlockIo->ReadBlocks (mBlockIo, 0, Offset / HOST_BLOCK_SIZE, Size,
+                       Buffer);
+  gBS->RestoreTPL (OldTpl);
+  if (EFI_ERROR (Status)) {
+    FAIL (("ReadBlocks() at 0x%lx: 0x%lx\n", (unsigned long)Offset,
+      (unsigned long)Status));
+  } else if (CompareMem (Buffer, mModel + Offset, Size) != 0) {
+    FAIL (("ReadBlocks() at 0x%lx: wrong data\n", (unsigned long)Offset));
+  }
+  HostFree (Buffer);
+}
+
+/**
+  Return a random extent of at most MaxSize bytes within the given slot.
+**/
+STATIC
+VOID
+RandomExtent (
+  IN  UINTN  Slot,
+  IN  UINTN  MaxSize,
+  OUT UINTN  *Offset,
+  OUT UINTN  *Size
+  )
+{
+  *Size   = (1 + Random (MaxSize / HOST_BLOCK_SIZE)) * HOST_BLOCK_SIZE;
+  *Offset = Slot * HOST_SLOT_SIZE +
+            Random ((HOST_SLOT_SIZE - *Size) / HOST_BLOCK_SIZE + 1) *
+            HOST_BLOCK_SIZE;
+}
+
+//
+// Test phases
+//
+
+STATIC
+VOID
+TestBlockingFill (
+  VOID
+  )
+{
+  UINT8       *Buffer;
+  UINTN       Offset;
+  UINTN       Index;
+  EFI_STATUS  Status;
+
+  HostPrint ("Blocking writes, reads and flush of the whole disk\n");
+  Buffer = HostAllocate (SIZE_1MB);
+  ASSERT (Buffer != NULL);
+  for (Offset = 0; Offset < HOST_DISK_SIZE; Offset += SIZE_1MB) {
+    for (Index = 0; Index < SIZE_1MB; Index++) {
+      Buffer[Index] = PatternByte (Offset + Index, 1);
+    }
+    Status = mBlockIo->WriteBlocks (mBlockIo, 0, Offset / HOST_BLOCK_SIZE,
+                         SIZE_1MB, Buffer);
+    if (EFI_ERROR (Status)) {
+      FAIL (("WriteBlocks() at 0x%lx: 0x%lx\n", (unsigned long)Offset,
+        (unsigned long)Status));
+    }
+    CopyMem (mModel + Offset, Buffer, SIZE_1MB);
+  }
+  HostFree (Buffer);
+
+  Status = mBlockIo->FlushBlocks (mBlockIo);
+  if (EFI_ERROR (Status)) {
+    FAIL (("FlushBlocks(): 0x%lx\n", (unsigned long)Status));
+  }
+  for (Offset = 0; Offset < HOST_DISK_SIZE; Offset += SIZE_4MB) {
+    BlockingRead (Offset, SIZE_4MB, TPL_APPLICATION);
+  }
+}
+
+STATIC
+VOID
+TestAsyncWritesAndFlush (
+  VOID
+  )
+{
+  HOST_TRANSFER  *Flush;
+  UINTN          Slot;
+  UINTN          Offset;
+  UINTN          Size;
+
+  HostPrint ("Non-blocking writes in every slot, then a flush\n");
+  for (Slot = 0; Slot < HOST_SLOT_COUNT; Slot++) {
+    RandomExtent (Slot, HOST_SLOT_SIZE, &Offset, &Size);
+    SubmitTransfer (NewTransfer (Offset, Size, TRUE, 2, EFI_SUCCESS));
+  }
+  Flush = NewTransfer (0, 0, TRUE, 2, EFI_SUCCESS);
+  Flush->Flush = TRUE;
+  SubmitTransfer (Flush);
+  WaitTransfers ();
+}
+
+STATIC
+VOID
+TestAsyncReads (
+  VOID
+  )
+{
+  UINTN  Index;
+  UINTN  Offset;
+  UINTN  Size;
+
+  HostPrint ("Non-blocking reads of random extents\n");
+  for (Index = 0; Index < 16; Index++) {
+    RandomExtent (Random (HOST_SLOT_COUNT), HOST_SLOT_SIZE, &Offset, &Size);
+    SubmitTransfer (NewTransfer (Offset, Size, FALSE, 0, EFI_SUCCESS));
+  }
+  WaitTransfers ();
+}
+
+STATIC
+VOID
+TestMixed (
+  VOID
+  )
+{
+  UINTN  Round;
+  UINTN  Slot;
+  UINTN  Offset;
+  UINTN  Size;
+
+  HostPrint ("Non-blocking writes and reads with blocking reads\n");
+  for (Round = 0; Round < 4; Round++) {
+    for (Slot = 0; Slot < HOST_SLOT_COUNT; Slot++) {
+      RandomExtent (Slot, SIZE_1MB, &Offset, &Size);
+      SubmitTransfer (NewTransfer (Offset, Size, (BOOLEAN)(Slot % 2 == 0),
+                        (UINT8)(3 + Round), EFI_SUCCESS));
+      if (Slot % 2 == 1) {
+        RandomExtent (Slot, SIZE_64KB, &Offset, &Size);
+        BlockingRead (Offset, Size,
+          Slot % 4 == 1 ? TPL_APPLICATION : TPL_CALLBACK);
+      }
+    }
+    WaitTransfers ();
+  }
+}
+
+STATIC
+VOID
+TestErrors (
+  VOID
+  )
+{
+  UINTN  Offset;
+  UINTN  Size;
+
+  HostPrint ("A read that the device fails, and a buffer that fails to "
+    "map\n");
+  RandomExtent (1, SIZE_1MB, &Offset, &Size);
+  SubmitTransfer (NewTransfer (Offset, Size, FALSE, 0, EFI_SUCCESS));
+  RandomExtent (2, SIZE_1MB, &Offset, &Size);
+  mDevice.FailSector = (Offset + Size) / 512 - 1;
+  SubmitTransfer (NewTransfer (Offset, Size, FALSE, 0, EFI_DEVICE_ERROR));
+  RandomExtent (3, SIZE_1MB, &Offset, &Size);
+  SubmitTransfer (NewTransfer (Offset, Size, FALSE, 0, EFI_SUCCESS));
+  WaitTransfers ();
+  mDevice.FailSector = MAX_UINT64;
+
+  mDevice.FailMaps = 1;
+  RandomExtent (4, SIZE_1MB, &Offset, &Size);
+  SubmitTransfer (NewTransfer (Offset, Size, FALSE, 0, EFI_DEVICE_ERROR));
+  WaitTransfers ();
+  if (mDevice.FailMaps != 0) {
+    FAIL (("the injected map failure was not hit\n"));
+    mDevice.FailMaps = 0;
+  }
+  RandomExtent (4, SIZE_1MB, &Offset, &Size);
+  BlockingRead (Offset, Size, TPL_APPLICATION);
+}
+
+STATIC
+VOID
+TestReset (
+  VOID
+  )
+{
+  UINTN       Slot;
+  UINTN       Index;
+  EFI_STATUS  Status;
+
+  HostPrint ("Reset with non-blocking transfers in flight\n");
+  for (Slot = 0; Slot < HOST_SLOT_COUNT; Slot++) {
+    SubmitTransfer (NewTransfer (Slot * HOST_SLOT_SIZE, HOST_SLOT_SIZE, FALSE,
+                      0, HOST_SUCCESS_OR_ABORTED));
+  }
+  DeviceStep (2);
+  Status = mBlockIo2->Reset (mBlockIo2, FALSE);
+  if (EFI_ERROR (Status)) {
+    FAIL (("Reset(): 0x%lx\n", (unsigned long)Status));
+  }
+  for (Index = 0; Index < mTransferCount; Index++) {
+    if (!mTransfers[Index].Done) {
+      FAIL (("transfer %u still pending after Reset()\n", (unsigned)Index));
+    }
+  }
+  WaitTransfers ();
+}
+
+int
+main (
+  int   Argc,
+  char  **Argv
+  )
+{
+  EFI_HANDLE  DeviceHandle;
+  EFI_HANDLE  ImageHandle;
+  UINTN       Pool;
+  UINTN       Index;
+  CHAR8       *Digit;
+  EFI_STATUS  Status;
+
+  mSeed = 1;
+  if (Argc > 1) {
+    mSeed = 0;
+    for (Digit = Argv[1]; *Digit >= '0' && *Digit <= '9'; Digit++) {
+      mSeed = mSeed * 10 + (*Digit - '0');
+    }
+    if (mSeed == 0) {
+      mSeed = 1;
+    }
+  }
+
+  mDevice.Disk       = HostAllocatePages (EFI_SIZE_TO_PAGES (HOST_DISK_SIZE));
+  mModel             = HostAllocatePages (EFI_SIZE_TO_PAGES (HOST_DISK_SIZE));
+  mDevice.FailSector = MAX_UINT64;
+  if (mDevice.Disk == NULL || mModel == NULL) {
+    HostPrint ("out of memory\n");
+    return 1;
+  }
+
+  DeviceHandle = &DeviceHandle;
+  ImageHandle  = &ImageHandle;
+  HostInstallProtocol (DeviceHandle, &gVirtioDeviceProtocolGuid,
+    &mDevice.VirtIo);
+
+  Status = VirtioBlkEntryPoint (ImageHandle, NULL);
+  ASSERT_EFI_ERROR (Status);
+  Pool = mHostPoolAllocations;
+  Status = mHostDriverBinding->Supported (mHostDriverBinding, DeviceHandle,
+                                 NULL);
+  if (!EFI_ERROR (Status)) {
+    Status = mHostDriverBinding->Start (mHostDriverBinding, DeviceHandle,
+                                   NULL);
+  }
+  if (EFI_ERROR (Status)) {
+    HostPrint ("the driver failed to start: 0x%lx\n", (unsigned long)Status);
+    return 1;
+  }
+  mBlockIo  = HostFindProtocol (DeviceHandle, &gEfiBlockIoProtocolGuid);
+  mBlockIo2 = HostFindProtocol (DeviceHandle, &gEfiBlockIo2ProtocolGuid);
+  if (mBlockIo == NULL || mBlockIo2 == NULL ||
+      mBlockIo->Media->LastBlock != HOST_DISK_SIZE / HOST_BLOCK_SIZE - 1 ||
+      !mBlockIo->Media->WriteCaching ||
+      (mDevice.GuestFeatures & VIRTIO_F_IOMMU_PLATFORM) == 0) {
+    HostPrint ("unexpected BlockIo, media or features\n");
+    return 1;
+  }
+
+  TestBlockingFill ();
+  TestAsyncWritesAndFlush ();
+  TestAsyncReads ();
+  TestMixed ();
+  TestErrors ();
+  TestReset ();
+
+  if (CompareMem (mDevice.Disk, mModel, HOST_DISK_SIZE) != 0) {
+    FAIL (("the disk differs from the model\n"));
+  }
+
+  Status = mHostDriverBinding->Stop (mHostDriverBinding, DeviceHandle, 0,
+                                 NULL);
+  if (EFI_ERROR (Status)) {
+    FAIL (("Stop(): 0x%lx\n", (unsigned long)Status));
+  }
+  for (Index = 0; Index < HOST_MAX_MAPPINGS; Index++) {
+    if (mDevice.Mappings[Index] != NULL) {
+      FAIL (("a mapping is left after Stop()\n"));
+      break;
+    }
+  }
+  for (Index = 0; Index < HOST_MAX_SHARED; Index++) {
+    if (mDevice.Shared[Index].Base != NULL) {
+      FAIL (("shared pages are left after Stop()\n"));
+      break;
+    }
+  }
+  if (mHostPoolAllocations != Pool || mDevice.Status != 0 ||
+      HostFindProtocol (DeviceHandle, &gEfiBlockIoProtocolGuid) != NULL) {
+    FAIL (("Stop() left %d pool allocations, device status 0x%x\n",
+      (int)(mHostPoolAllocations - Pool), mDevice.Status));
+  }
+
+  HostPrint ("\n%lu requests, %lu flushes, up to %lu in flight, %lu stalls\n",
+    (unsigned long)mDevice.Requests, (unsigned long)mDevice.Flushes,
+    (unsigned long)mDevice.MaxPending, (unsigned long)mStalls);
+  HostPrint ("%lu maps (%lu at TPL_NOTIFY), %lu unmaps (%lu at TPL_NOTIFY)\n",
+    (unsigned long)mDevice.Maps, (unsigned long)mDevice.MapsAtNotify,
+    (unsigned long)mDevice.Unmaps, (unsigned long)mDevice.UnmapsAtNotify);
+  if (mDevice.MapsAtNotify == 0 || mDevice.UnmapsAtNotify == 0) {
+    FAIL (("the poll timer never mapped or unmapped\n"));
+  }
+
+  if (mFailures != 0) {
+    HostPrint ("%u failures\n", (unsigned)mFailures);
+    return 1;
+  }
+  HostPrint ("All tests passed\n");
+  return 0;
+}
@@ -0,0 +1,68 @@
+/** @file
+  Interface between the host versions of the boot services and libraries
+  (VblkHostLib.c) and the virtio-blk host test (VblkHostTest.c).
+
+**/
+
+#ifndef _VBLK_HOST_TEST_H_
+#define _VBLK_HOST_TEST_H_
+
+#include <Protocol/DriverBinding.h>
+
+//
+// The current TPL of the boot services.
+//
+extern EFI_TPL                      mHostTpl;
+
+//
+// The driver binding protocol installed by the driver's entry point.
+//
+extern EFI_DRIVER_BINDING_PROTOCOL  *mHostDriverBinding;
+
+//
+// Number of pool allocations that have not been freed.
+//
+extern UINTN                        mHostPoolAllocations;
+
+/**
+  Install a protocol interface on a handle, for the test.
+**/
+VOID
+HostInstallProtocol (
+  IN EFI_HANDLE  Handle,
+  IN EFI_GUID    *Protocol,
+  IN VOID        *Interface
+  );
+
+/**
+  Look up a protocol interface installed on a handle.
+
+  @return  The interface, or NULL if Protocol is not installed on Handle.
+**/
+VOID *
+HostFindProtocol (
+  IN EFI_HANDLE  Handle,
+  IN EFI_GUID    *Protocol
+  );
+
+/**
+  Let the timer interrupt fire: signal every armed timer event, and run the
+  notification functions that the current TPL does not mask.
+**/
+VOID
+HostTimerTick (
+  VOID
+  );
+
+/**
+  Called by gBS->Stall(). Implemented by the test: the device makes progress
+  while the driver waits, and the timer interrupt fires.
+
+  @param[in] Microseconds  The length of the stall.
+**/
+VOID
+HostStall (
+  IN UINTN  Microseconds
+  );
+
+#endif
@@ -1,14 +1,24 @@
 /** @file
 
-  This driver produces Block I/O Protocol instances for virtio-blk devices.
+  This driver produces Block I/O and Block I/O 2 Protocol instances for
+  virtio-blk devices.
 
   The implementation is basic:
 
   - No attach/detach (ie. removable media).
 
-  - Although the non-blocking interfaces of EFI_BLOCK_IO2_PROTOCOL could be a
-    good match for multiple in-flight virtio-blk requests, we stick to
-    synchronous requests and EFI_BLOCK_IO_PROTOCOL for now.
+  - The descriptor table is statically partitioned into tags, each carrying
+    one virtio-blk request. Transfers are split into requests of bounded size
+    that are kept in flight concurrently; blocking transfers poll the used
+    ring, non-blocking ones are driven by a periodic timer event.
+
+  - Requests are submitted and collected at TPL_NOTIFY, so the data buffers
+    are mapped and unmapped at TPL_NOTIFY too. VIRTIO_DEVICE_PROTOCOL
+    forwards MapSharedBuffer() and UnmapSharedBuffer() to
+    EDKII_IOMMU_PROTOCOL when the platform has one (IoMmuDxe in SEV guests),
+    which supports Map() and Unmap() calls at or below TPL_NOTIFY, and to
+    PciIo otherwise, which only allocates pool and pages then. Both are
+    allowed at TPL_NOTIFY.
 
   Copyright (C) 2012, Red Hat, Inc.
   Copyright (c) 2012 - 2018, Intel Corporation. All rights reserved.<BR>
@@ -113,9 +123,10 @@ VirtioBlkReset (
     - 24.2.2. ReadBlocks() and ReadBlocksEx() Implementation
     - 24.2.3 WriteBlocks() and WriteBlockEx() Implementation
 
-  Request sizes are limited to 1 GB (checked). This is not a practical
-  limitation, just conformance to virtio-0.9.5, 2.3.2 Descriptor Table: "no
-  descriptor chain may be more than 2^32 bytes long in total".
+  Request sizes are not limited here: virtio-0.9.5, 2.3.2 Descriptor Table
+  ("no descriptor chain may be more than 2^32 bytes long in total") is
+  satisfied by splitting transfers into requests of at most
+  VBLK_DEV.MaxChunkSize bytes.
 
   Some Media characteristics are hardcoded in VirtioBlkInit() below (like
   non-removable media, no restriction on buffer alignment etc); we rely on
@@ -159,8 +170,7 @@ VerifyReadWriteRequest (
 
   ASSERT (PositiveBufferSize > 0);
 
-  if (PositiveBufferSize > SIZE_1GB ||
-      PositiveBufferSize % Media->BlockSize > 0) {
+  if (PositiveBufferSize % Media->BlockSize > 0) {
     return EFI_BAD_BUFFER_SIZE;
   }
   BlockCount = PositiveBufferSize / Media->BlockSize;
@@ -184,280 +194,647 @@ VerifyReadWriteRequest (
 
 /**
 
-  Format a read / write / flush request as three consecutive virtio
-  descriptors, push them to the host, and poll for the response.
-
-  This is the main workhorse function. Two use cases are supported, read/write
-  and flush. The function may only be called after the request parameters have
-  been verified by
-  - specific checks in ReadBlocks() / WriteBlocks() / FlushBlocks(), and
-  - VerifyReadWriteRequest() (for read/write only).
-
-  Parameters handled commonly:
+  Complete a transfer whose requests have all been submitted and processed by
+  the host.
 
-    @param[in] Dev             The virtio-blk device the request is targeted
-                               at.
+  For a non-blocking transfer, the caller's token is updated and signaled, and
+  the transfer is released. For a blocking transfer, the waiter is notified
+  through Transfer->Done.
 
-  Flush request:
+  Must be called at TPL_NOTIFY.
 
-    @param[in] Lba             Must be zero.
+  @param[in out] Dev       The virtio-blk device the transfer belongs to.
 
-    @param[in] BufferSize      Must be zero.
+  @param[in] Transfer      The transfer to complete.
 
-    @param[in out] Buffer      Ignored by the function.
+**/
+STATIC
+VOID
+VirtioBlkCompleteTransfer (
+  IN OUT VBLK_DEV      *Dev,
+  IN     VBLK_TRANSFER *Transfer
+  )
+{
+  ASSERT (Transfer->Submitted);
+  ASSERT (Transfer->InFlight == 0);
 
-    @param[in] RequestIsWrite  Must be TRUE.
+  if (Transfer->Token == NULL) {
+    Transfer->Done = TRUE;
+    return;
+  }
 
-  Read/Write request:
+  Transfer->Token->TransactionStatus = Transfer->Status;
+  gBS->SignalEvent (Transfer->Token->Event);
+  FreePool (Transfer);
 
-    @param[in] Lba             Logical Block Address: number of logical blocks
-                               to skip from the beginning of the device.
+  ASSERT (Dev->AsyncTransfers > 0);
+  if (--Dev->AsyncTransfers == 0) {
+    gBS->SetTimer (Dev->PollTimer, TimerCancel, 0);
+  }
+}
 
-    @param[in] BufferSize      Size of buffer to transfer, in bytes. The caller
-                               is responsible to ensure this parameter is
-                               positive.
 
-    @param[in out] Buffer      The guest side area to read data from the device
-                               into, or write data to the device from.
+/**
 
-    @param[in] RequestIsWrite  TRUE iff data transfer goes from guest to
-                               device.
+  Stop creating further requests for a transfer, and complete it if it has no
+  requests in flight.
 
-  Return values are common to both use cases, and are appropriate to be
-  forwarded by the EFI_BLOCK_IO_PROTOCOL functions (ReadBlocks(),
-  WriteBlocks(), FlushBlocks()).
+  Must be called at TPL_NOTIFY.
 
+  @param[in out] Dev       The virtio-blk device the transfer belongs to.
 
-  @retval EFI_SUCCESS          Transfer complete.
+  @param[in] Transfer      The transfer to finish. Transfer->Submitted must be
+                           FALSE.
 
-  @retval EFI_DEVICE_ERROR     Failed to notify host side via VirtIo write, or
-                               unable to parse host response, or host response
-                               is not VIRTIO_BLK_S_OK or failed to map Buffer
-                               for a bus master operation.
+  @param[in] Status        The status to report for the transfer.
 
 **/
-
 STATIC
-EFI_STATUS
-EFIAPI
-SynchronousRequest (
-  IN              VBLK_DEV *Dev,
-  IN              EFI_LBA  Lba,
-  IN              UINTN    BufferSize,
-  IN OUT volatile VOID     *Buffer,
-  IN              BOOLEAN  RequestIsWrite
+VOID
+VirtioBlkFinishTransfer (
+  IN OUT VBLK_DEV      *Dev,
+  IN     VBLK_TRANSFER *Transfer,
+  IN     EFI_STATUS    Status
   )
 {
-  UINT32                  BlockSize;
-  volatile VIRTIO_BLK_REQ Request;
-  volatile UINT8          *HostStatus;
-  VOID                    *HostStatusBuffer;
-  DESC_INDICES            Indices;
-  VOID                    *RequestMapping;
-  VOID                    *StatusMapping;
-  VOID                    *BufferMapping;
-  EFI_PHYSICAL_ADDRESS    BufferDeviceAddress;
-  EFI_PHYSICAL_ADDRESS    HostStatusDeviceAddress;
-  EFI_PHYSICAL_ADDRESS    RequestDeviceAddress;
-  EFI_STATUS              Status;
-  EFI_STATUS              UnmapStatus;
+  ASSERT (!Transfer->Submitted);
 
-  BlockSize = Dev->BlockIoMedia.BlockSize;
+  Transfer->Status    = Status;
+  Transfer->Submitted = TRUE;
+  RemoveEntryList (&Transfer->Link);
+  if (Transfer->InFlight == 0) {
+    VirtioBlkCompleteTransfer (Dev, Transfer);
+  }
+}
 
-  //
-  // Set BufferMapping and BufferDeviceAddress to suppress incorrect
-  // compiler/analyzer warnings.
-  //
-  BufferMapping       = NULL;
-  BufferDeviceAddress = 0;
 
-  //
-  // ensured by VirtioBlkInit()
-  //
-  ASSERT (BlockSize > 0);
-  ASSERT (BlockSize % 512 == 0);
+/**
 
-  //
-  // ensured by contract above, plus VerifyReadWriteRequest()
-  //
-  ASSERT (BufferSize % BlockSize == 0);
+  Format the next virtio-blk request of a transfer in a free tag, and make it
+  available to the host.
 
-  //
-  // Prepare virtio-blk request header, setting zero size for flush.
-  // IO Priority is homogeneously 0.
-  //
-  Request.Type   = RequestIsWrite ?
-                   (BufferSize == 0 ? VIRTIO_BLK_T_FLUSH : VIRTIO_BLK_T_OUT) :
-                   VIRTIO_BLK_T_IN;
-  Request.IoPrio = 0;
-  Request.Sector = MultU64x32(Lba, BlockSize / 512);
+  The request consists of the virtio-blk header in the first descriptor, the
+  data buffer (split at Dev->SegSize boundaries) in the middle descriptors,
+  and the host status in the last descriptor. A read or write request covers
+  at most Dev->MaxChunkSize bytes; a flush request carries no data.
 
-  //
-  // Host status is bi-directional (we preset with a value and expect the
-  // device to update it). Allocate a host status buffer which can be mapped
-  // to access equally by both processor and the device.
-  //
-  Status = Dev->VirtIo->AllocateSharedPages (
-                          Dev->VirtIo,
-                          EFI_SIZE_TO_PAGES (sizeof *HostStatus),
-                          &HostStatusBuffer
-                          );
-  if (EFI_ERROR (Status)) {
-    return EFI_DEVICE_ERROR;
-  }
+  The host is not notified; that's left to the caller.
+
+  Must be called at TPL_NOTIFY, with at least one free tag.
+
+  @param[in out] Dev       The virtio-blk device to submit the request to.
+
+  @param[in out] Transfer  The transfer to take the next request from. On
+                           success, the transfer's progress is updated.
+
+  @retval EFI_SUCCESS       The request has been made available to the host.
 
-  HostStatus = HostStatusBuffer;
+  @retval EFI_DEVICE_ERROR  Failed to map the data buffer for a bus master
+                            operation.
+
+**/
+STATIC
+EFI_STATUS
+VirtioBlkSubmitRequest (
+  IN OUT VBLK_DEV      *Dev,
+  IN OUT VBLK_TRANSFER *Transfer
+  )
+{
+  UINT16               TagIdx;
+  VBLK_TAG             *Tag;
+  volatile VBLK_SHARED_TAG *SharedTag;
+  EFI_PHYSICAL_ADDRESS SharedTagDevAddr;
+  UINT32               BlockSize;
+  UINTN                ChunkSize;
+  UINTN                Offset;
+  UINT32               SegLen;
+  VOID                 *BufferMapping;
+  EFI_PHYSICAL_ADDRESS BufferDeviceAddress;
+  DESC_INDICES         Indices;
+  EFI_STATUS           Status;
+
+  ASSERT (Dev->FreeTagCount > 0);
+
+  BlockSize = Dev->BlockIoMedia.BlockSize;
+  ChunkSize = MIN (Transfer->RemainingSize, Dev->MaxChunkSize);
 
   //
-  // Map virtio-blk request header (must be done after request header is
-  // populated)
+  // ensured by VerifyReadWriteRequest() and VirtioBlkInit()
   //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             Dev->VirtIo,
-             VirtioOperationBusMasterRead,
-             (VOID *) &Request,
-             sizeof Request,
-             &RequestDeviceAddress,
-             &RequestMapping
-             );
-  if (EFI_ERROR (Status)) {
-    Status = EFI_DEVICE_ERROR;
-    goto FreeHostStatusBuffer;
-  }
+  ASSERT (ChunkSize % BlockSize == 0);
 
   //
-  // Map data buffer
+  // Map the data buffer first; there's nothing to roll back if that fails.
   //
-  if (BufferSize > 0) {
+  BufferMapping       = NULL;
+  BufferDeviceAddress = 0;
+  if (ChunkSize > 0) {
     Status = VirtioMapAllBytesInSharedBuffer (
                Dev->VirtIo,
-               (RequestIsWrite ?
+               (Transfer->RequestIsWrite ?
                 VirtioOperationBusMasterRead :
                 VirtioOperationBusMasterWrite),
-               (VOID *) Buffer,
-               BufferSize,
+               Transfer->NextBuffer,
+               ChunkSize,
                &BufferDeviceAddress,
                &BufferMapping
                );
     if (EFI_ERROR (Status)) {
-      Status = EFI_DEVICE_ERROR;
-      goto UnmapRequestBuffer;
+      return EFI_DEVICE_ERROR;
     }
   }
 
-  //
-  // preset a host status for ourselves that we do not accept as success
-  //
-  *HostStatus = VIRTIO_BLK_S_IOERR;
+  TagIdx = Dev->FreeTags[--Dev->FreeTagCount];
+  Tag    = &Dev->Tags[TagIdx];
+  ASSERT (Tag->Transfer == NULL);
 
   //
-  // Map the Status Buffer with VirtioOperationBusMasterCommonBuffer so that
-  // both processor and device can access it.
+  // Prepare the virtio-blk request header, setting zero size for flush. IO
+  // Priority is homogeneously 0. Preset a host status that we do not accept
+  // as success.
   //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             Dev->VirtIo,
-             VirtioOperationBusMasterCommonBuffer,
-             HostStatusBuffer,
-             sizeof *HostStatus,
-             &HostStatusDeviceAddress,
-             &StatusMapping
-             );
-  if (EFI_ERROR (Status)) {
-    Status = EFI_DEVICE_ERROR;
-    goto UnmapDataBuffer;
-  }
+  SharedTag        = &Dev->SharedTags[TagIdx];
+  SharedTagDevAddr = Dev->SharedTagsDevAddr + TagIdx * sizeof *SharedTag;
 
-  VirtioPrepare (&Dev->Ring, &Indices);
+  SharedTag->Request.Type   = Transfer->RequestIsWrite ?
+                              (ChunkSize == 0 ?
+                               VIRTIO_BLK_T_FLUSH :
+                               VIRTIO_BLK_T_OUT) :
+                              VIRTIO_BLK_T_IN;
+  SharedTag->Request.IoPrio = 0;
+  SharedTag->Request.Sector = MultU64x32 (Transfer->NextLba, BlockSize / 512);
+  SharedTag->HostStatus     = VIRTIO_BLK_S_IOERR;
 
   //
-  // ensured by VirtioBlkInit() -- this predicate, in combination with the
-  // lock-step progress, ensures we don't have to track free descriptors.
+  // The tag owns a fixed range of the descriptor table.
   //
-  ASSERT (Dev->Ring.QueueSize >= 3);
+  Indices.HeadDescIdx = (UINT16)(TagIdx * Dev->DescPerTag);
+  Indices.NextDescIdx = Indices.HeadDescIdx;
 
   //
   // virtio-blk header in first desc
   //
   VirtioAppendDesc (
     &Dev->Ring,
-    RequestDeviceAddress,
-    sizeof Request,
+    SharedTagDevAddr + OFFSET_OF (VBLK_SHARED_TAG, Request),
+    sizeof SharedTag->Request,
     VRING_DESC_F_NEXT,
     &Indices
     );
 
   //
-  // data buffer for read/write in second desc
+  // data buffer for read/write in the middle descs; VRING_DESC_F_WRITE is
+  // interpreted from the host's point of view
   //
-  if (BufferSize > 0) {
-    //
-    // From virtio-0.9.5, 2.3.2 Descriptor Table:
-    // "no descriptor chain may be more than 2^32 bytes long in total".
-    //
-    // The predicate is ensured by the call contract above (for flush), or
-    // VerifyReadWriteRequest() (for read/write). It also implies that
-    // converting BufferSize to UINT32 will not truncate it.
-    //
-    ASSERT (BufferSize <= SIZE_1GB);
-
-    //
-    // VRING_DESC_F_WRITE is interpreted from the host's point of view.
-    //
+  for (Offset = 0; Offset < ChunkSize; Offset += SegLen) {
+    SegLen = (UINT32)MIN (ChunkSize - Offset, Dev->SegSize);
     VirtioAppendDesc (
       &Dev->Ring,
-      BufferDeviceAddress,
-      (UINT32) BufferSize,
-      VRING_DESC_F_NEXT | (RequestIsWrite ? 0 : VRING_DESC_F_WRITE),
+      BufferDeviceAddress + Offset,
+      SegLen,
+      VRING_DESC_F_NEXT | (Transfer->RequestIsWrite ? 0 : VRING_DESC_F_WRITE),
       &Indices
       );
   }
 
   //
-  // host status in last (second or third) desc
+  // host status in last desc
   //
   VirtioAppendDesc (
     &Dev->Ring,
-    HostStatusDeviceAddress,
-    sizeof *HostStatus,
+    SharedTagDevAddr + OFFSET_OF (VBLK_SHARED_TAG, HostStatus),
+    sizeof SharedTag->HostStatus,
     VRING_DESC_F_WRITE,
     &Indices
     );
+  ASSERT ((UINT16)(Indices.NextDescIdx - Indices.HeadDescIdx) <=
+    Dev->DescPerTag);
 
-  //
-  // virtio-blk's only virtqueue is #0, called "requestq" (see Appendix D).
-  //
-  if (VirtioFlush (Dev->VirtIo, 0, &Dev->Ring, &Indices,
-        NULL) == EFI_SUCCESS &&
-      *HostStatus == VIRTIO_BLK_S_OK) {
-    Status = EFI_SUCCESS;
-  } else {
-    Status = EFI_DEVICE_ERROR;
+  Tag->Transfer      = Transfer;
+  Tag->BufferMapping = BufferMapping;
+  Tag->BufferSize    = ChunkSize;
+
+  VirtioAppendAvail (&Dev->Ring, &Indices);
+
+  Transfer->InFlight++;
+  Transfer->NextLba       += ChunkSize / BlockSize;
+  Transfer->NextBuffer    += ChunkSize;
+  Transfer->RemainingSize -= ChunkSize;
+  return EFI_SUCCESS;
+}
+
+
+/**
+
+  Create virtio-blk requests for the pending transfers, in submission order,
+  while free tags are available, and notify the host about them.
+
+  A flush transfer acts as a barrier: it is only submitted once all requests
+  submitted before it have completed.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in out] Dev  The virtio-blk device to submit the requests to.
+
+**/
+STATIC
+VOID
+VirtioBlkSubmitPending (
+  IN OUT VBLK_DEV *Dev
+  )
+{
+  VBLK_TRANSFER *Transfer;
+  BOOLEAN       IsFlush;
+  BOOLEAN       Notify;
+  EFI_STATUS    Status;
+
+  Notify = FALSE;
+  while (!IsListEmpty (&Dev->PendingTransfers) && Dev->FreeTagCount > 0) {
+    Transfer = VBLK_TRANSFER_FROM_LINK (
+                 GetFirstNode (&Dev->PendingTransfers)
+                 );
+    IsFlush = (BOOLEAN)(Transfer->RequestIsWrite &&
+                        Transfer->RemainingSize == 0);
+    if (IsFlush && Dev->FreeTagCount < Dev->TagCount) {
+      break;
+    }
+
+    Status = VirtioBlkSubmitRequest (Dev, Transfer);
+    if (EFI_ERROR (Status)) {
+      VirtioBlkFinishTransfer (Dev, Transfer, Status);
+      continue;
+    }
+    Notify = TRUE;
+
+    if (Transfer->RemainingSize == 0) {
+      Transfer->Submitted = TRUE;
+      RemoveEntryList (&Transfer->Link);
+    }
   }
 
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, StatusMapping);
+  if (Notify) {
+    //
+    // virtio-blk's only virtqueue is #0, called "requestq" (see Appendix D).
+    // virtio-0.9.5, 2.4.1.4 Notifying the Device -- gratuitous notifications
+    // are OK.
+    //
+    Status = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, 0);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: SetQueueNotify(): %r\n", __FUNCTION__,
+        Status));
+    }
+  }
+}
 
-UnmapDataBuffer:
-  if (BufferSize > 0) {
-    UnmapStatus = Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, BufferMapping);
-    if (EFI_ERROR (UnmapStatus) && !RequestIsWrite && !EFI_ERROR (Status)) {
-      //
-      // Data from the bus master may not reach the caller; fail the request.
-      //
-      Status = EFI_DEVICE_ERROR;
+
+/**
+
+  Collect the virtio-blk requests that the host has processed, release their
+  tags, complete the transfers that have no more requests outstanding, and
+  submit further pending requests into the released tags.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in out] Dev  The virtio-blk device to check.
+
+  @return  The number of requests collected.
+
+**/
+STATIC
+UINTN
+VirtioBlkCollectCompleted (
+  IN OUT VBLK_DEV *Dev
+  )
+{
+  UINTN         Collected;
+  UINT16        HeadDescIdx;
+  UINT16        TagIdx;
+  VBLK_TAG      *Tag;
+  VBLK_TRANSFER *Transfer;
+  EFI_STATUS    Status;
+  EFI_STATUS    UnmapStatus;
+
+  Collected = 0;
+  while (VirtioFetchUsed (&Dev->Ring, &Dev->LastUsedIdx, &HeadDescIdx,
+           NULL)) {
+    ASSERT (HeadDescIdx % Dev->DescPerTag == 0);
+    TagIdx = HeadDescIdx / Dev->DescPerTag;
+    ASSERT (TagIdx < Dev->TagCount);
+
+    Tag      = &Dev->Tags[TagIdx];
+    Transfer = Tag->Transfer;
+    ASSERT (Transfer != NULL);
+
+    Status = (Dev->SharedTags[TagIdx].HostStatus == VIRTIO_BLK_S_OK) ?
+             EFI_SUCCESS :
+             EFI_DEVICE_ERROR;
+
+    if (Tag->BufferSize > 0) {
+      UnmapStatus = Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo,
+                                   Tag->BufferMapping);
+      if (EFI_ERROR (UnmapStatus) && !Transfer->RequestIsWrite) {
+        //
+        // Data from the bus master may not reach the caller; fail the
+        // request.
+        //
+        Status = EFI_DEVICE_ERROR;
+      }
+    }
+
+    Tag->Transfer = NULL;
+    Dev->FreeTags[Dev->FreeTagCount++] = TagIdx;
+    ++Collected;
+
+    ASSERT (Transfer->InFlight > 0);
+    Transfer->InFlight--;
+    if (EFI_ERROR (Status)) {
+      if (Transfer->Submitted) {
+        Transfer->Status = Status;
+      } else {
+        //
+        // Don't create further requests for a failed transfer.
+        //
+        VirtioBlkFinishTransfer (Dev, Transfer, Status);
+        continue;
+      }
+    }
+    if (Transfer->Submitted && Transfer->InFlight == 0) {
+      VirtioBlkCompleteTransfer (Dev, Transfer);
     }
   }
 
-UnmapRequestBuffer:
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, RequestMapping);
+  VirtioBlkSubmitPending (Dev);
+  return Collected;
+}
 
-FreeHostStatusBuffer:
-  Dev->VirtIo->FreeSharedPages (
-                 Dev->VirtIo,
-                 EFI_SIZE_TO_PAGES (sizeof *HostStatus),
-                 HostStatusBuffer
-                 );
 
-  return Status;
+/**
+
+  Timer notification function that drives the non-blocking transfers.
+
+  It runs at TPL_NOTIFY, and unmaps the data buffers of the collected
+  requests and maps those of the next ones; see the file header for why
+  that is allowed.
+
+  @param[in] Event    Event whose notification function is being invoked.
+
+  @param[in] Context  Pointer to the VBLK_DEV structure.
+
+**/
+STATIC
+VOID
+EFIAPI
+VirtioBlkPollTimer (
+  IN EFI_EVENT Event,
+  IN VOID      *Context
+  )
+{
+  VirtioBlkCollectCompleted (Context);
+}
+
+
+/**
+
+  Abort the transfers that have not been fully submitted yet, and wait until
+  the host processes all requests in flight.
+
+  Non-blocking transfers that are aborted report EFI_ABORTED in their tokens.
+
+  @param[in out] Dev  The virtio-blk device to quiesce.
+
+**/
+STATIC
+VOID
+VirtioBlkAbortAll (
+  IN OUT VBLK_DEV *Dev
+  )
+{
+  EFI_TPL OldTpl;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  while (!IsListEmpty (&Dev->PendingTransfers)) {
+    VirtioBlkFinishTransfer (
+      Dev,
+      VBLK_TRANSFER_FROM_LINK (GetFirstNode (&Dev->PendingTransfers)),
+      EFI_ABORTED
+      );
+  }
+
+  while (Dev->FreeTagCount < Dev->TagCount) {
+    if (VirtioBlkCollectCompleted (Dev) == 0) {
+      VirtioWaitUsed (&Dev->Ring, Dev->LastUsedIdx, &Dev->Latency);
+    }
+  }
+  gBS->RestoreTPL (OldTpl);
+}
+
+
+/**
+
+  Initialize a transfer descriptor.
+
+  See SynchronousRequest() for the meaning of the parameters.
+
+**/
+STATIC
+VOID
+VirtioBlkInitTransfer (
+  OUT VBLK_TRANSFER       *Transfer,
+  IN  EFI_LBA             Lba,
+  IN  UINTN               BufferSize,
+  IN  VOID                *Buffer,
+  IN  BOOLEAN             RequestIsWrite,
+  IN  EFI_BLOCK_IO2_TOKEN *Token
+  )
+{
+  Transfer->Signature      = VBLK_TRANSFER_SIG;
+  Transfer->Token          = Token;
+  Transfer->RequestIsWrite = RequestIsWrite;
+  Transfer->Submitted      = FALSE;
+  Transfer->Done           = FALSE;
+  Transfer->NextLba        = Lba;
+  Transfer->NextBuffer     = Buffer;
+  Transfer->RemainingSize  = BufferSize;
+  Transfer->InFlight       = 0;
+  Transfer->Status         = EFI_SUCCESS;
+}
+
+
+/**
+
+  Carry out a read / write / flush operation, and poll for its completion.
+
+  The operation is split into virtio-blk requests of at most
+  Dev->MaxChunkSize bytes each, which are kept in flight concurrently, as
+  far as free tags permit. The function may only be called after the request
+  parameters have been verified by
+  - specific checks in ReadBlocks() / WriteBlocks() / FlushBlocks(), and
+  - VerifyReadWriteRequest() (for read/write only).
+
+  Parameters handled commonly:
+
+    @param[in] Dev             The virtio-blk device the request is targeted
+                               at.
+
+  Flush request:
+
+    @param[in] Lba             Must be zero.
+
+    @param[in] BufferSize      Must be zero.
+
+    @param[in out] Buffer      Ignored by the function.
+
+    @param[in] RequestIsWrite  Must be TRUE.
+
+  Read/Write request:
+
+    @param[in] Lba             Logical Block Address: number of logical blocks
+                               to skip from the beginning of the device.
+
+    @param[in] BufferSize      Size of buffer to transfer, in bytes. The caller
+                               is responsible to ensure this parameter is
+                               positive.
+
+    @param[in out] Buffer      The guest side area to read data from the device
+                               into, or write data to the device from.
+
+    @param[in] RequestIsWrite  TRUE iff data transfer goes from guest to
+                               device.
+
+  Return values are common to both use cases, and are appropriate to be
+  forwarded by the EFI_BLOCK_IO_PROTOCOL functions (ReadBlocks(),
+  WriteBlocks(), FlushBlocks()).
+
+
+  @retval EFI_SUCCESS          Transfer complete.
+
+  @retval EFI_DEVICE_ERROR     Unable to parse host response, or host response
+                               is not VIRTIO_BLK_S_OK or failed to map Buffer
+                               for a bus master operation.
+
+  @retval EFI_ABORTED          The transfer was aborted by a concurrent reset.
+
+**/
+
+STATIC
+EFI_STATUS
+EFIAPI
+SynchronousRequest (
+  IN              VBLK_DEV *Dev,
+  IN              EFI_LBA  Lba,
+  IN              UINTN    BufferSize,
+  IN OUT volatile VOID     *Buffer,
+  IN              BOOLEAN  RequestIsWrite
+  )
+{
+  VBLK_TRANSFER Transfer;
+  EFI_TPL       OldTpl;
+  BOOLEAN       Done;
+  UINT16        LastUsedIdx;
+
+  VirtioBlkInitTransfer (&Transfer, Lba, BufferSize, (VOID *)Buffer,
+    RequestIsWrite, NULL);
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  InsertTailList (&Dev->PendingTransfers, &Transfer.Link);
+  VirtioBlkSubmitPending (Dev);
+  Done = Transfer.Done;
+  gBS->RestoreTPL (OldTpl);
+
+  //
+  // Each wait restarts from the spin phase, as the rest of the transfer is
+  // likely to complete soon after a request of it completes. If the timer
+  // event collects completions while we're waiting, the used index moves
+  // past LastUsedIdx just the same.
+  //
+  while (!Done) {
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    VirtioBlkCollectCompleted (Dev);
+    Done = Transfer.Done;
+    LastUsedIdx = Dev->LastUsedIdx;
+    gBS->RestoreTPL (OldTpl);
+
+    if (!Done) {
+      VirtioWaitUsed (&Dev->Ring, LastUsedIdx, &Dev->Latency);
+    }
+  }
+
+  return Transfer.Status;
+}
+
+
+/**
+
+  Queue a read / write / flush operation for non-blocking completion.
+
+  See SynchronousRequest() for the requirements on the parameters. On
+  completion, Token->TransactionStatus is set to one of the return values
+  documented for SynchronousRequest(), and Token->Event is signaled.
+
+  @param[in] Token          The token of the non-blocking operation. Both
+                            Token and Token->Event must be non-NULL.
+
+  @retval EFI_SUCCESS           The operation has been queued.
+
+  @retval EFI_OUT_OF_RESOURCES  Memory allocation failed.
+
+**/
+
+STATIC
+EFI_STATUS
+AsynchronousRequest (
+  IN     VBLK_DEV            *Dev,
+  IN     EFI_LBA             Lba,
+  IN     UINTN               BufferSize,
+  IN OUT VOID                *Buffer,
+  IN     BOOLEAN             RequestIsWrite,
+  IN OUT EFI_BLOCK_IO2_TOKEN *Token
+  )
+{
+  VBLK_TRANSFER *Transfer;
+  EFI_TPL       OldTpl;
+
+  Transfer = AllocatePool (sizeof *Transfer);
+  if (Transfer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  VirtioBlkInitTransfer (Transfer, Lba, BufferSize, Buffer, RequestIsWrite,
+    Token);
+  Token->TransactionStatus = EFI_NOT_READY;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  if (Dev->AsyncTransfers++ == 0) {
+    gBS->SetTimer (Dev->PollTimer, TimerPeriodic, VBLK_POLL_PERIOD);
+  }
+  InsertTailList (&Dev->PendingTransfers, &Transfer->Link);
+  VirtioBlkSubmitPending (Dev);
+  gBS->RestoreTPL (OldTpl);
+
+  return EFI_SUCCESS;
+}
+
+
+/**
+
+  Finish a zero-sized or no-op EFI_BLOCK_IO2_PROTOCOL operation.
+
+  @param[in out] Token  The token of the operation; may be NULL, and
+                        Token->Event may be NULL, for blocking operations.
+
+  @retval EFI_SUCCESS  Always.
+
+**/
+STATIC
+EFI_STATUS
+VirtioBlkSignalNop (
+  IN OUT EFI_BLOCK_IO2_TOKEN *Token
+  )
+{
+  if (Token != NULL && Token->Event != NULL) {
+    Token->TransactionStatus = EFI_SUCCESS;
+    gBS->SignalEvent (Token->Event);
+  }
+  return EFI_SUCCESS;
 }
 
 
@@ -610,6 +987,165 @@ VirtioBlkFlushBlocks (
 }
 
 
+/**
+
+  Reset() operation of EFI_BLOCK_IO2_PROTOCOL for virtio-blk.
+
+  Transfers that have not been fully submitted to the device are aborted;
+  requests already in flight are waited for.
+
+**/
+
+EFI_STATUS
+EFIAPI
+VirtioBlkResetEx (
+  IN EFI_BLOCK_IO2_PROTOCOL *This,
+  IN BOOLEAN                ExtendedVerification
+  )
+{
+  VirtioBlkAbortAll (VIRTIO_BLK_FROM_BLOCK_IO2 (This));
+  return EFI_SUCCESS;
+}
+
+
+/**
+
+  ReadBlocksEx() operation for virtio-blk.
+
+  See
+  - UEFI Spec 2.7, 13.10 Block I/O 2 Protocol,
+    EFI_BLOCK_IO2_PROTOCOL.ReadBlocksEx().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.2. ReadBlocks() and
+    ReadBlocksEx() Implementation.
+
+  Parameter checks and conformant return values are implemented in
+  VerifyReadWriteRequest(), SynchronousRequest() and AsynchronousRequest().
+
+**/
+
+EFI_STATUS
+EFIAPI
+VirtioBlkReadBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  OUT    VOID                   *Buffer
+  )
+{
+  VBLK_DEV   *Dev;
+  EFI_STATUS Status;
+
+  if (BufferSize == 0) {
+    return VirtioBlkSignalNop (Token);
+  }
+
+  Dev = VIRTIO_BLK_FROM_BLOCK_IO2 (This);
+  Status = VerifyReadWriteRequest (
+             &Dev->BlockIoMedia,
+             Lba,
+             BufferSize,
+             FALSE               // RequestIsWrite
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (Token == NULL || Token->Event == NULL) {
+    return SynchronousRequest (Dev, Lba, BufferSize, Buffer, FALSE);
+  }
+  return AsynchronousRequest (Dev, Lba, BufferSize, Buffer, FALSE, Token);
+}
+
+
+/**
+
+  WriteBlocksEx() operation for virtio-blk.
+
+  See
+  - UEFI Spec 2.7, 13.10 Block I/O 2 Protocol,
+    EFI_BLOCK_IO2_PROTOCOL.WriteBlocksEx().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.3 WriteBlocks() and
+    WriteBlockEx() Implementation.
+
+  Parameter checks and conformant return values are implemented in
+  VerifyReadWriteRequest(), SynchronousRequest() and AsynchronousRequest().
+
+**/
+
+EFI_STATUS
+EFIAPI
+VirtioBlkWriteBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  IN     VOID                   *Buffer
+  )
+{
+  VBLK_DEV   *Dev;
+  EFI_STATUS Status;
+
+  if (BufferSize == 0) {
+    return VirtioBlkSignalNop (Token);
+  }
+
+  Dev = VIRTIO_BLK_FROM_BLOCK_IO2 (This);
+  Status = VerifyReadWriteRequest (
+             &Dev->BlockIoMedia,
+             Lba,
+             BufferSize,
+             TRUE                // RequestIsWrite
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (Token == NULL || Token->Event == NULL) {
+    return SynchronousRequest (Dev, Lba, BufferSize, Buffer, TRUE);
+  }
+  return AsynchronousRequest (Dev, Lba, BufferSize, Buffer, TRUE, Token);
+}
+
+
+/**
+
+  FlushBlocksEx() operation for virtio-blk.
+
+  See
+  - UEFI Spec 2.7, 13.10 Block I/O 2 Protocol,
+    EFI_BLOCK_IO2_PROTOCOL.FlushBlocksEx().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.4 FlushBlocks() and
+    FlushBlocksEx() Implementation.
+
+  The flush request is submitted only after all earlier requests have
+  completed. See VirtioBlkFlushBlocks() for devices without write-caching.
+
+**/
+
+EFI_STATUS
+EFIAPI
+VirtioBlkFlushBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token
+  )
+{
+  VBLK_DEV *Dev;
+
+  Dev = VIRTIO_BLK_FROM_BLOCK_IO2 (This);
+  if (!Dev->BlockIoMedia.WriteCaching) {
+    return VirtioBlkSignalNop (Token);
+  }
+
+  if (Token == NULL || Token->Event == NULL) {
+    return SynchronousRequest (Dev, 0, 0, NULL, TRUE);
+  }
+  return AsynchronousRequest (Dev, 0, 0, NULL, TRUE, Token);
+}
+
+
 /**
 
   Device probe function for this driver.
@@ -691,6 +1227,115 @@ VirtioBlkDriverBindingSupported (
 }
 
 
+/**
+
+  Allocate the tag table, and the request headers and host status bytes that
+  are shared with the device, according to Dev->TagCount.
+
+  @param[in out] Dev  The driver instance to configure.
+
+  @retval EFI_SUCCESS           All tags are free and ready for use.
+
+  @retval EFI_OUT_OF_RESOURCES  Memory allocation failed.
+
+  @return                       Error codes from
+                                VirtIo->AllocateSharedPages() or
+                                VirtioMapAllBytesInSharedBuffer().
+
+**/
+
+STATIC
+EFI_STATUS
+VirtioBlkInitTags (
+  IN OUT VBLK_DEV *Dev
+  )
+{
+  UINTN      SharedPages;
+  VOID       *SharedBuffer;
+  UINT16     TagIdx;
+  EFI_STATUS Status;
+
+  Dev->Tags = AllocateZeroPool (Dev->TagCount * sizeof *Dev->Tags);
+  if (Dev->Tags == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Dev->FreeTags = AllocatePool (Dev->TagCount * sizeof *Dev->FreeTags);
+  if (Dev->FreeTags == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto FreeTags;
+  }
+
+  SharedPages = EFI_SIZE_TO_PAGES (Dev->TagCount * sizeof *Dev->SharedTags);
+  Status = Dev->VirtIo->AllocateSharedPages (Dev->VirtIo, SharedPages,
+                          &SharedBuffer);
+  if (EFI_ERROR (Status)) {
+    goto FreeFreeTags;
+  }
+  ZeroMem (SharedBuffer, EFI_PAGES_TO_SIZE (SharedPages));
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             Dev->VirtIo,
+             VirtioOperationBusMasterCommonBuffer,
+             SharedBuffer,
+             EFI_PAGES_TO_SIZE (SharedPages),
+             &Dev->SharedTagsDevAddr,
+             &Dev->SharedTagsMap
+             );
+  if (EFI_ERROR (Status)) {
+    goto FreeSharedBuffer;
+  }
+  Dev->SharedTags = SharedBuffer;
+
+  //
+  // Hand out the tags in increasing order.
+  //
+  for (TagIdx = 0; TagIdx < Dev->TagCount; ++TagIdx) {
+    Dev->FreeTags[TagIdx] = Dev->TagCount - 1 - TagIdx;
+  }
+  Dev->FreeTagCount = Dev->TagCount;
+  return EFI_SUCCESS;
+
+FreeSharedBuffer:
+  Dev->VirtIo->FreeSharedPages (Dev->VirtIo, SharedPages, SharedBuffer);
+
+FreeFreeTags:
+  FreePool (Dev->FreeTags);
+
+FreeTags:
+  FreePool (Dev->Tags);
+
+  return Status;
+}
+
+
+/**
+
+  Release the resources allocated by VirtioBlkInitTags(). All tags must be
+  free.
+
+  @param[in out] Dev  The driver instance to clean up.
+
+**/
+
+STATIC
+VOID
+VirtioBlkUninitTags (
+  IN OUT VBLK_DEV *Dev
+  )
+{
+  UINTN SharedPages;
+
+  ASSERT (Dev->FreeTagCount == Dev->TagCount);
+
+  SharedPages = EFI_SIZE_TO_PAGES (Dev->TagCount * sizeof *Dev->SharedTags);
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->SharedTagsMap);
+  Dev->VirtIo->FreeSharedPages (Dev->VirtIo, SharedPages, Dev->SharedTags);
+  FreePool (Dev->FreeTags);
+  FreePool (Dev->Tags);
+}
+
+
 /**
 
   Set up all BlockIo and virtio-blk aspects of this driver for the specified
@@ -707,7 +1352,7 @@ VirtioBlkDriverBindingSupported (
 
   @return                  Error codes from VirtioRingInit() or
                            VIRTIO_CFG_READ() / VIRTIO_CFG_WRITE or
-                           VirtioRingMap().
+                           VirtioRingMap() or VirtioBlkInitTags().
 
 **/
 
@@ -729,10 +1374,15 @@ VirtioBlkInit (
   UINT32     OptIoSize;
   UINT16     QueueSize;
   UINT64     RingBaseShift;
+  UINT32     SizeMax;
+  UINT32     SegMax;
+  UINT32     SegsPerRequest;
 
   PhysicalBlockExp = 0;
   AlignmentOffset = 0;
   OptIoSize = 0;
+  SizeMax = 0;
+  SegMax = 0;
 
   //
   // Execute virtio-0.9.5, 2.2.1 Device Initialization Sequence.
@@ -821,8 +1471,30 @@ VirtioBlkInit (
     }
   }
 
+  if (Features & VIRTIO_BLK_F_SIZE_MAX) {
+    Status = VIRTIO_CFG_READ (Dev, SizeMax, &SizeMax);
+    if (EFI_ERROR (Status)) {
+      goto Failed;
+    }
+    if (SizeMax > 0 && SizeMax < BlockSize) {
+      //
+      // A single data descriptor could not carry a whole logical block.
+      //
+      Status = EFI_UNSUPPORTED;
+      goto Failed;
+    }
+  }
+
+  if (Features & VIRTIO_BLK_F_SEG_MAX) {
+    Status = VIRTIO_CFG_READ (Dev, SegMax, &SegMax);
+    if (EFI_ERROR (Status)) {
+      goto Failed;
+    }
+  }
+
   Features &= VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_TOPOLOGY | VIRTIO_BLK_F_RO |
-              VIRTIO_BLK_F_FLUSH | VIRTIO_F_VERSION_1 |
+              VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_SIZE_MAX |
+              VIRTIO_BLK_F_SEG_MAX | VIRTIO_F_VERSION_1 |
               VIRTIO_F_IOMMU_PLATFORM;
 
   //
@@ -847,11 +1519,37 @@ VirtioBlkInit (
   if (EFI_ERROR (Status)) {
     goto Failed;
   }
-  if (QueueSize < 3) { // SynchronousRequest() uses at most three descriptors
+  if (QueueSize < 3) { // a request needs at least three descriptors
     Status = EFI_UNSUPPORTED;
     goto Failed;
   }
 
+  //
+  // Partition the descriptor table into tags. A tag carries the request
+  // header, up to SegsPerRequest data segments of at most SegSize bytes each,
+  // and the host status. Without VIRTIO_BLK_F_SIZE_MAX, a single data segment
+  // suffices for VBLK_MAX_CHUNK_SIZE.
+  //
+  Dev->SegSize = MAX (VBLK_MAX_CHUNK_SIZE / BlockSize, 1) * BlockSize;
+  SegsPerRequest = 1;
+  if (SizeMax > 0) {
+    Dev->SegSize = MIN (Dev->SegSize, SizeMax / BlockSize * BlockSize);
+    SegsPerRequest = MIN (
+                       (VBLK_MAX_CHUNK_SIZE + Dev->SegSize - 1) / Dev->SegSize,
+                       VBLK_MAX_SEGS_PER_REQUEST
+                       );
+  }
+  if (SegMax > 0) {
+    SegsPerRequest = MIN (SegsPerRequest, SegMax);
+  }
+  SegsPerRequest = MIN (SegsPerRequest, (UINT32)QueueSize - 2);
+
+  Dev->DescPerTag   = (UINT16)(SegsPerRequest + 2);
+  Dev->TagCount     = QueueSize / Dev->DescPerTag;
+  Dev->MaxChunkSize = SegsPerRequest * Dev->SegSize;
+  Dev->LastUsedIdx  = 0;
+  InitializeListHead (&Dev->PendingTransfers);
+
   Status = VirtioRingInit (Dev->VirtIo, QueueSize, &Dev->Ring);
   if (EFI_ERROR (Status)) {
     goto Failed;
@@ -908,13 +1606,23 @@ VirtioBlkInit (
     }
   }
 
+  Status = VirtioBlkInitTags (Dev);
+  if (EFI_ERROR (Status)) {
+    goto UnmapQueue;
+  }
+
+  //
+  // We're going to poll the answers, the host should not send interrupts.
+  //
+  *Dev->Ring.Avail.Flags = (UINT16) VRING_AVAIL_F_NO_INTERRUPT;
+
   //
   // step 6 -- initialization complete
   //
   NextDevStat |= VSTAT_DRIVER_OK;
   Status = Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, NextDevStat);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UninitTags;
   }
 
   //
@@ -927,6 +1635,11 @@ VirtioBlkInit (
   Dev->BlockIo.ReadBlocks            = &VirtioBlkReadBlocks;
   Dev->BlockIo.WriteBlocks           = &VirtioBlkWriteBlocks;
   Dev->BlockIo.FlushBlocks           = &VirtioBlkFlushBlocks;
+  Dev->BlockIo2.Media                = &Dev->BlockIoMedia;
+  Dev->BlockIo2.Reset                = &VirtioBlkResetEx;
+  Dev->BlockIo2.ReadBlocksEx         = &VirtioBlkReadBlocksEx;
+  Dev->BlockIo2.WriteBlocksEx        = &VirtioBlkWriteBlocksEx;
+  Dev->BlockIo2.FlushBlocksEx        = &VirtioBlkFlushBlocksEx;
   Dev->BlockIoMedia.MediaId          = 0;
   Dev->BlockIoMedia.RemovableMedia   = FALSE;
   Dev->BlockIoMedia.MediaPresent     = TRUE;
@@ -941,6 +1654,8 @@ VirtioBlkInit (
   DEBUG ((DEBUG_INFO, "%a: LbaSize=0x%x[B] NumBlocks=0x%Lx[Lba]\n",
     __FUNCTION__, Dev->BlockIoMedia.BlockSize,
     Dev->BlockIoMedia.LastBlock + 1));
+  DEBUG ((DEBUG_INFO, "%a: Tags=%u SegsPerRequest=%u SegSize=0x%x[B]\n",
+    __FUNCTION__, Dev->TagCount, SegsPerRequest, Dev->SegSize));
 
   if (Features & VIRTIO_BLK_F_TOPOLOGY) {
     Dev->BlockIo.Revision = EFI_BLOCK_IO_PROTOCOL_REVISION3;
@@ -957,6 +1672,9 @@ VirtioBlkInit (
   }
   return EFI_SUCCESS;
 
+UninitTags:
+  VirtioBlkUninitTags (Dev);
+
 UnmapQueue:
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
 
@@ -998,10 +1716,12 @@ VirtioBlkUninit (
   //
   Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
 
+  VirtioBlkUninitTags (Dev);
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
   VirtioRingUninit (Dev->VirtIo, &Dev->Ring);
 
   SetMem (&Dev->BlockIo,      sizeof Dev->BlockIo,      0x00);
+  SetMem (&Dev->BlockIo2,     sizeof Dev->BlockIo2,     0x00);
   SetMem (&Dev->BlockIoMedia, sizeof Dev->BlockIoMedia, 0x00);
 }
 
@@ -1036,6 +1756,8 @@ VirtioBlkExitBoot (
   //
   Dev = Context;
   Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
+
+  VirtioLogLatency (__FUNCTION__, &Dev->Latency);
 }
 
 /**
@@ -1057,13 +1779,16 @@ VirtioBlkExitBoot (
 
   @retval EFI_SUCCESS           Driver instance has been created and
                                 initialized  for the virtio-blk device, it
-                                is now accessible via EFI_BLOCK_IO_PROTOCOL.
+                                is now accessible via EFI_BLOCK_IO_PROTOCOL
+                                and EFI_BLOCK_IO2_PROTOCOL.
 
   @retval EFI_OUT_OF_RESOURCES  Memory allocation failed.
 
   @return                       Error codes from the OpenProtocol() boot
                                 service, the VirtIo protocol, VirtioBlkInit(),
-                                or the InstallProtocolInterface() boot service.
+                                or the CreateEvent() and
+                                InstallMultipleProtocolInterfaces() boot
+                                services.
 
 **/
 
@@ -1104,19 +1829,30 @@ VirtioBlkDriverBindingStart (
     goto UninitDev;
   }
 
+  Status = gBS->CreateEvent (EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_NOTIFY,
+                  &VirtioBlkPollTimer, Dev, &Dev->PollTimer);
+  if (EFI_ERROR (Status)) {
+    goto CloseExitBoot;
+  }
+
   //
-  // Setup complete, attempt to export the driver instance's BlockIo interface.
+  // Setup complete, attempt to export the driver instance's BlockIo and
+  // BlockIo2 interfaces.
   //
   Dev->Signature = VBLK_SIG;
-  Status = gBS->InstallProtocolInterface (&DeviceHandle,
-                  &gEfiBlockIoProtocolGuid, EFI_NATIVE_INTERFACE,
-                  &Dev->BlockIo);
+  Status = gBS->InstallMultipleProtocolInterfaces (&DeviceHandle,
+                  &gEfiBlockIoProtocolGuid, &Dev->BlockIo,
+                  &gEfiBlockIo2ProtocolGuid, &Dev->BlockIo2,
+                  NULL);
   if (EFI_ERROR (Status)) {
-    goto CloseExitBoot;
+    goto ClosePollTimer;
   }
 
   return EFI_SUCCESS;
 
+ClosePollTimer:
+  gBS->CloseEvent (Dev->PollTimer);
+
 CloseExitBoot:
   gBS->CloseEvent (Dev->ExitBoot);
 
@@ -1136,7 +1872,8 @@ FreeVirtioBlk:
 
 /**
 
-  Stop driving a virtio-blk device and remove its BlockIo interface.
+  Stop driving a virtio-blk device and remove its BlockIo and BlockIo2
+  interfaces.
 
   This function replays the success path of DriverBindingStart() in reverse.
   The host side virtio-blk device is reset, so that the OS boot loader or the
@@ -1187,12 +1924,20 @@ VirtioBlkDriverBindingStop (
   //
   // Handle Stop() requests for in-use driver instances gracefully.
   //
-  Status = gBS->UninstallProtocolInterface (DeviceHandle,
-                  &gEfiBlockIoProtocolGuid, &Dev->BlockIo);
+  Status = gBS->UninstallMultipleProtocolInterfaces (DeviceHandle,
+                  &gEfiBlockIoProtocolGuid, &Dev->BlockIo,
+                  &gEfiBlockIo2ProtocolGuid, &Dev->BlockIo2,
+                  NULL);
   if (EFI_ERROR (Status)) {
     return Status;
   }
 
+  //
+  // Nobody can submit further transfers now; finish the outstanding ones
+  // before the timer driving them goes away.
+  //
+  VirtioBlkAbortAll (Dev);
+  gBS->CloseEvent (Dev->PollTimer);
   gBS->CloseEvent (Dev->ExitBoot);
 
   VirtioBlkUninit (Dev);
@@ -19,12 +19,80 @@
 #define _VIRTIO_BLK_DXE_H_
 
 #include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
 #include <Protocol/ComponentName.h>
 #include <Protocol/DriverBinding.h>
 
 #include <IndustryStandard/Virtio.h>
+#include <IndustryStandard/VirtioBlk.h>
+#include <Library/VirtioLib.h>
 
 
+//
+// Upper limit for the number of data bytes in a single virtio-blk request.
+// Larger transfers are split into several requests that are kept in flight
+// concurrently.
+//
+#define VBLK_MAX_CHUNK_SIZE SIZE_1MB
+
+//
+// Upper limit for the number of data descriptors in a single virtio-blk
+// request, when the host restricts the segment size with
+// VIRTIO_BLK_F_SIZE_MAX.
+//
+#define VBLK_MAX_SEGS_PER_REQUEST 16
+
+//
+// Period of the timer that collects completions for non-blocking
+// EFI_BLOCK_IO2_PROTOCOL requests, in 100ns units.
+//
+#define VBLK_POLL_PERIOD EFI_TIMER_PERIOD_MILLISECONDS (1)
+
+//
+// Request header and status byte of a single tag, in memory that is shared
+// with the device.
+//
+typedef struct {
+  VIRTIO_BLK_REQ Request;
+  UINT8          HostStatus;
+} VBLK_SHARED_TAG;
+
+#define VBLK_TRANSFER_SIG SIGNATURE_32 ('V', 'B', 'L', 'T')
+
+//
+// A read, write or flush operation submitted through EFI_BLOCK_IO_PROTOCOL or
+// EFI_BLOCK_IO2_PROTOCOL. The operation is carried out by one or more
+// virtio-blk requests, each occupying one tag.
+//
+typedef struct {
+  UINT32              Signature;
+  LIST_ENTRY          Link;           // on VBLK_DEV.PendingTransfers while
+                                      // Submitted is FALSE
+  EFI_BLOCK_IO2_TOKEN *Token;         // NULL for blocking operations
+  BOOLEAN             RequestIsWrite;
+  BOOLEAN             Submitted;      // no more requests will be created
+  BOOLEAN             Done;           // blocking operations only
+  EFI_LBA             NextLba;
+  UINT8               *NextBuffer;
+  UINTN               RemainingSize;  // bytes not covered by requests yet
+  UINTN               InFlight;       // requests not completed yet
+  EFI_STATUS          Status;
+} VBLK_TRANSFER;
+
+#define VBLK_TRANSFER_FROM_LINK(LinkPointer) \
+        CR (LinkPointer, VBLK_TRANSFER, Link, VBLK_TRANSFER_SIG)
+
+//
+// Driver-side state of a single tag. Tag #N owns the descriptors
+// [N * DescPerTag, (N + 1) * DescPerTag) in the descriptor table, hence the
+// head descriptor index reported by the host identifies the tag directly.
+//
+typedef struct {
+  VBLK_TRANSFER *Transfer;            // NULL if the tag is free
+  VOID          *BufferMapping;
+  UINTN         BufferSize;
+} VBLK_TAG;
+
 #define VBLK_SIG SIGNATURE_32 ('V', 'B', 'L', 'K')
 
 typedef struct {
@@ -38,15 +106,34 @@ typedef struct {
   UINT32                 Signature;            // DriverBindingStart  0
   VIRTIO_DEVICE_PROTOCOL *VirtIo;              // DriverBindingStart  0
   EFI_EVENT              ExitBoot;             // DriverBindingStart  0
+  EFI_EVENT              PollTimer;            // DriverBindingStart  0
   VRING                  Ring;                 // VirtioRingInit      2
   EFI_BLOCK_IO_PROTOCOL  BlockIo;              // VirtioBlkInit       1
+  EFI_BLOCK_IO2_PROTOCOL BlockIo2;             // VirtioBlkInit       1
   EFI_BLOCK_IO_MEDIA     BlockIoMedia;         // VirtioBlkInit       1
   VOID                   *RingMap;             // VirtioRingMap       2
+  UINT32                 SegSize;              // VirtioBlkInit       1
+  UINT32                 MaxChunkSize;         // VirtioBlkInit       1
+  UINT16                 DescPerTag;           // VirtioBlkInit       1
+  UINT16                 TagCount;             // VirtioBlkInit       1
+  VBLK_TAG               *Tags;                // VirtioBlkInitTags   2
+  UINT16                 *FreeTags;            // VirtioBlkInitTags   2
+  UINT16                 FreeTagCount;         // VirtioBlkInitTags   2
+  VBLK_SHARED_TAG        *SharedTags;          // VirtioBlkInitTags   2
+  EFI_PHYSICAL_ADDRESS   SharedTagsDevAddr;    // VirtioBlkInitTags   2
+  VOID                   *SharedTagsMap;       // VirtioBlkInitTags   2
+  UINT16                 LastUsedIdx;          // VirtioBlkInit       1
+  LIST_ENTRY             PendingTransfers;     // VirtioBlkInit       1
+  UINTN                  AsyncTransfers;       // VirtioBlkInit       1
+  VIRTIO_LATENCY_HISTOGRAM Latency;            // DriverBindingStart  0
 } VBLK_DEV;
 
 #define VIRTIO_BLK_FROM_BLOCK_IO(BlockIoPointer) \
         CR (BlockIoPointer, VBLK_DEV, BlockIo, VBLK_SIG)
 
+#define VIRTIO_BLK_FROM_BLOCK_IO2(BlockIo2Pointer) \
+        CR (BlockIo2Pointer, VBLK_DEV, BlockIo2, VBLK_SIG)
+
 
 /**
 
@@ -112,7 +199,8 @@ VirtioBlkDriverBindingSupported (
 
   @retval EFI_SUCCESS           Driver instance has been created and
                                 initialized  for the virtio-blk device, it
-                                is now accessible via EFI_BLOCK_IO_PROTOCOL.
+                                is now accessible via EFI_BLOCK_IO_PROTOCOL
+                                and EFI_BLOCK_IO2_PROTOCOL.
 
   @retval EFI_OUT_OF_RESOURCES  Memory allocation failed.
 
@@ -133,7 +221,8 @@ VirtioBlkDriverBindingStart (
 
 /**
 
-  Stop driving a virtio-blk device and remove its BlockIo interface.
+  Stop driving a virtio-blk device and remove its BlockIo and BlockIo2
+  interfaces.
 
   This function replays the success path of DriverBindingStart() in reverse.
   The host side virtio-blk device is reset, so that the OS boot loader or the
@@ -259,6 +348,50 @@ VirtioBlkFlushBlocks (
   );
 
 
+//
+// UEFI Spec 2.7, 13.10 Block I/O 2 Protocol
+//
+// Requests submitted with a NULL Token, or with a NULL Token->Event, are
+// carried out in blocking mode, like their EFI_BLOCK_IO_PROTOCOL
+// counterparts.
+//
+EFI_STATUS
+EFIAPI
+VirtioBlkResetEx (
+  IN EFI_BLOCK_IO2_PROTOCOL *This,
+  IN BOOLEAN                ExtendedVerification
+  );
+
+EFI_STATUS
+EFIAPI
+VirtioBlkReadBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  OUT    VOID                   *Buffer
+  );
+
+EFI_STATUS
+EFIAPI
+VirtioBlkWriteBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  IN     VOID                   *Buffer
+  );
+
+EFI_STATUS
+EFIAPI
+VirtioBlkFlushBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token
+  );
+
+
 //
 // The purpose of the following scaffolding (EFI_COMPONENT_NAME_PROTOCOL and
 // EFI_COMPONENT_NAME2_PROTOCOL implementation) is to format the driver's name
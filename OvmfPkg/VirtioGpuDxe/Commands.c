@@ -15,6 +15,7 @@
 
 **/
 
+#include <Library/UefiBootServicesTableLib.h>
 #include <Library/VirtioLib.h>
 
 #include "VirtioGpu.h"
@@ -332,8 +333,10 @@ VirtioGpuUnmapAndFreeBackingStore (
 }
 
 /**
-  EFI_EVENT_NOTIFY function for the VGPU_DEV.ExitBoot event. It resets the
-  VirtIo device, causing it to release its resources and to forget its
+  EFI_EVENT_NOTIFY function for the VGPU_DEV.ExitBoot event. It flushes the
+  display areas that Blt() has damaged since the last flush, so that the last
+  frame drawn by the boot loader reaches the display, then resets the VirtIo
+  device, causing it to release its resources and to forget its
   configuration.
 
   This function may only be called (that is, VGPU_DEV.ExitBoot may only be
@@ -351,11 +354,34 @@ VirtioGpuExitBoot (
   IN VOID      *Context
   )
 {
-  VGPU_DEV *VgpuDev;
+  VGPU_DEV   *VgpuDev;
+  EFI_STATUS Status;
 
   DEBUG ((DEBUG_VERBOSE, "%a: Context=0x%p\n", __FUNCTION__, Context));
   VgpuDev = Context;
+
+  //
+  // The IOMMU's own ExitBootServices() handler is queued after this one, so
+  // the command buffers can still be mapped here. The IOMMU serves those
+  // mappings from the MAP_INFO slabs and bounce buffers that earlier commands
+  // have released, so the flush does not allocate memory in the usual case.
+  //
+  if (VgpuDev->Child != NULL) {
+    gBS->SetTimer (VgpuDev->Child->FlushTimer, TimerCancel, 0);
+    Status = VirtioGpuFlushDamage (VgpuDev->Child);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: VirtioGpuFlushDamage(): %r\n", __FUNCTION__,
+        Status));
+    }
+  }
+
   VgpuDev->VirtIo->SetDeviceStatus (VgpuDev->VirtIo, 0);
+
+  VirtioLogLatency (__FUNCTION__, &VgpuDev->Latency);
+  if (VgpuDev->Child != NULL) {
+    DEBUG ((DEBUG_INFO, "%a: Blt=%Lu Flush=%Lu\n", __FUNCTION__,
+      VgpuDev->Child->BltCount, VgpuDev->Child->FlushCount));
+  }
 }
 
 /**
@@ -486,7 +512,7 @@ VirtioGpuSendCommand (
   // Send the command.
   //
   Status = VirtioFlush (VgpuDev->VirtIo, VIRTIO_GPU_CONTROL_QUEUE,
-             &VgpuDev->Ring, &Indices, &ResponseSize);
+             &VgpuDev->Ring, &Indices, &ResponseSize, &VgpuDev->Latency);
   if (EFI_ERROR (Status)) {
     goto UnmapResponse;
   }
@@ -342,6 +342,16 @@ InitVgpuGop (
   }
   ASSERT (ParentVirtIo == ParentBus->VirtIo);
 
+  //
+  // Create the timer that flushes Blt() damage to the display. It is only
+  // armed by Blt().
+  //
+  Status = gBS->CreateEvent (EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK,
+                  VirtioGpuFlushTimer, VgpuGop, &VgpuGop->FlushTimer);
+  if (EFI_ERROR (Status)) {
+    goto CloseVirtIoByChild;
+  }
+
   //
   // Initialize our Graphics Output Protocol.
   //
@@ -351,7 +361,7 @@ InitVgpuGop (
   CopyMem (&VgpuGop->Gop, &mGopTemplate, sizeof mGopTemplate);
   Status = VgpuGop->Gop.SetMode (&VgpuGop->Gop, 0);
   if (EFI_ERROR (Status)) {
-    goto CloseVirtIoByChild;
+    goto CloseFlushTimer;
   }
 
   //
@@ -372,7 +382,12 @@ InitVgpuGop (
   return EFI_SUCCESS;
 
 UninitGop:
+  gBS->CloseEvent (VgpuGop->FlushTimer);
   ReleaseGopResources (VgpuGop, TRUE /* DisableHead */);
+  goto CloseVirtIoByChild;
+
+CloseFlushTimer:
+  gBS->CloseEvent (VgpuGop->FlushTimer);
 
 CloseVirtIoByChild:
   gBS->CloseProtocol (ParentBusController, &gVirtioDeviceProtocolGuid,
@@ -432,8 +447,11 @@ UninitVgpuGop (
   ASSERT_EFI_ERROR (Status);
 
   //
-  // Uninitialize VgpuGop->Gop.
+  // Uninitialize VgpuGop->Gop. Closing the flush timer first keeps it from
+  // racing the teardown; pending damage is dropped along with the resource.
   //
+  Status = gBS->CloseEvent (VgpuGop->FlushTimer);
+  ASSERT_EFI_ERROR (Status);
   ReleaseGopResources (VgpuGop, TRUE /* DisableHead */);
 
   Status = gBS->CloseProtocol (ParentBusController, &gVirtioDeviceProtocolGuid,
@@ -15,6 +15,7 @@
 **/
 
 #include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
 
 #include "VirtioGpu.h"
 
@@ -138,6 +139,221 @@ ReleaseGopResources (
     CpuDeadLoop ();
   }
   VgpuGop->ResourceId = 0;
+
+  //
+  // Any damage still pending referred to the resource just destroyed.
+  //
+  VgpuGop->DamageCount = 0;
+}
+
+/**
+  Record a display area that Blt() has rendered into VgpuGop->BackingStore,
+  and arm VgpuGop->FlushTimer if there was no pending damage before.
+
+  The rectangle is merged with every tracked rectangle that it overlaps or
+  touches, so that a sequence of Blt() calls covering the same area (for
+  example, a scrolling console) produces a single transfer.
+
+  The caller is responsible for running at TPL_NOTIFY.
+
+  @param[in,out] VgpuGop  The VGPU_GOP object to add the damage to.
+
+  @param[in] X            Left edge of the damaged area.
+
+  @param[in] Y            Top edge of the damaged area.
+
+  @param[in] Width        Width of the damaged area. Must be nonzero.
+
+  @param[in] Height       Height of the damaged area. Must be nonzero.
+**/
+STATIC
+VOID
+AddDamage (
+  IN OUT VGPU_GOP *VgpuGop,
+  IN     UINT32   X,
+  IN     UINT32   Y,
+  IN     UINT32   Width,
+  IN     UINT32   Height
+  )
+{
+  VGPU_DAMAGE_RECT New;
+  VGPU_DAMAGE_RECT *Old;
+  UINTN            Index;
+
+  ASSERT (Width > 0);
+  ASSERT (Height > 0);
+
+  if (VgpuGop->DamageCount == 0) {
+    gBS->SetTimer (VgpuGop->FlushTimer, TimerRelative, VGPU_FLUSH_DELAY);
+  }
+
+  New.Left   = X;
+  New.Top    = Y;
+  New.Right  = X + Width;
+  New.Bottom = Y + Height;
+
+  //
+  // Absorb the tracked rectangles that New overlaps or touches. Growing New
+  // may make it reach rectangles that it did not reach before, hence restart
+  // the scan after each merge.
+  //
+  Index = 0;
+  while (Index < VgpuGop->DamageCount) {
+    Old = &VgpuGop->Damage[Index];
+    if (Old->Left <= New.Right && New.Left <= Old->Right &&
+        Old->Top <= New.Bottom && New.Top <= Old->Bottom) {
+      New.Left   = MIN (New.Left, Old->Left);
+      New.Top    = MIN (New.Top, Old->Top);
+      New.Right  = MAX (New.Right, Old->Right);
+      New.Bottom = MAX (New.Bottom, Old->Bottom);
+
+      --VgpuGop->DamageCount;
+      *Old = VgpuGop->Damage[VgpuGop->DamageCount];
+      Index = 0;
+      continue;
+    }
+    ++Index;
+  }
+
+  //
+  // If the list is full of disjoint rectangles, collapse it into the bounding
+  // box.
+  //
+  if (VgpuGop->DamageCount == VGPU_MAX_DAMAGE_RECTS) {
+    for (Index = 0; Index < VgpuGop->DamageCount; ++Index) {
+      Old = &VgpuGop->Damage[Index];
+      New.Left   = MIN (New.Left, Old->Left);
+      New.Top    = MIN (New.Top, Old->Top);
+      New.Right  = MAX (New.Right, Old->Right);
+      New.Bottom = MAX (New.Bottom, Old->Bottom);
+    }
+    VgpuGop->DamageCount = 0;
+  }
+
+  VgpuGop->Damage[VgpuGop->DamageCount++] = New;
+}
+
+/**
+  Transfer the display areas that Blt() has damaged since the last flush to
+  the host resource, and flush them to head (scanout) #0.
+
+  Each tracked damage rectangle is transferred separately, then their bounding
+  box is flushed with a single command. On error, the damage is retained, so
+  that the next flush retries it, and the error is latched in
+  VgpuGop->FlushStatus, so that the next Blt() call reports it.
+
+  The commands are sent at TPL_NOTIFY. This is allowed, as the VirtIo device
+  maps and unmaps the command buffers with EDKII_IOMMU_PROTOCOL (IoMmuDxe in
+  SEV guests), whose Map() and Unmap() may be called at or below TPL_NOTIFY,
+  or with PciIo otherwise.
+
+  @param[in,out] VgpuGop  The VGPU_GOP object whose damage should be flushed.
+                          The caller is responsible for having called
+                          VgpuGop->Gop.SetMode() at least once successfully.
+
+  @retval EFI_SUCCESS  The damage has been flushed, or there was none.
+
+  @return              Error codes from VirtioGpuTransferToHost2d() and
+                       VirtioGpuResourceFlush().
+**/
+EFI_STATUS
+VirtioGpuFlushDamage (
+  IN OUT VGPU_GOP *VgpuGop
+  )
+{
+  EFI_TPL          OldTpl;
+  EFI_STATUS       Status;
+  UINT32           CurrentHorizontal;
+  VGPU_DAMAGE_RECT Bounds;
+  VGPU_DAMAGE_RECT *Rect;
+  UINTN            Index;
+
+  //
+  // Serialize against Blt() and SetMode(), which may be running at any TPL up
+  // to and including TPL_NOTIFY.
+  //
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
+  Status = EFI_SUCCESS;
+  if (VgpuGop->DamageCount == 0) {
+    goto RestoreTpl;
+  }
+
+  CurrentHorizontal = VgpuGop->GopModeInfo.HorizontalResolution;
+  Bounds = VgpuGop->Damage[0];
+  for (Index = 0; Index < VgpuGop->DamageCount; ++Index) {
+    Rect = &VgpuGop->Damage[Index];
+    Status = VirtioGpuTransferToHost2d (
+               VgpuGop->ParentBus,                                // VgpuDev
+               Rect->Left,                                        // X
+               Rect->Top,                                         // Y
+               Rect->Right - Rect->Left,                          // Width
+               Rect->Bottom - Rect->Top,                          // Height
+               sizeof (UINT32) *
+                 ((UINT64)Rect->Top * CurrentHorizontal + Rect->Left),
+                                                                  // Offset
+               VgpuGop->ResourceId                                // ResourceId
+               );
+    if (EFI_ERROR (Status)) {
+      goto RestoreTpl;
+    }
+
+    Bounds.Left   = MIN (Bounds.Left, Rect->Left);
+    Bounds.Top    = MIN (Bounds.Top, Rect->Top);
+    Bounds.Right  = MAX (Bounds.Right, Rect->Right);
+    Bounds.Bottom = MAX (Bounds.Bottom, Rect->Bottom);
+  }
+
+  Status = VirtioGpuResourceFlush (
+             VgpuGop->ParentBus,           // VgpuDev
+             Bounds.Left,                  // X
+             Bounds.Top,                   // Y
+             Bounds.Right - Bounds.Left,   // Width
+             Bounds.Bottom - Bounds.Top,   // Height
+             VgpuGop->ResourceId           // ResourceId
+             );
+  if (EFI_ERROR (Status)) {
+    goto RestoreTpl;
+  }
+
+  VgpuGop->DamageCount = 0;
+  ++VgpuGop->FlushCount;
+
+RestoreTpl:
+  if (EFI_ERROR (Status)) {
+    VgpuGop->FlushStatus = Status;
+  }
+  gBS->RestoreTPL (OldTpl);
+  return Status;
+}
+
+/**
+  EFI_EVENT_NOTIFY function for the VGPU_GOP.FlushTimer event. It calls
+  VirtioGpuFlushDamage().
+
+  @param[in] Event    Event whose notification function is being invoked.
+
+  @param[in] Context  Pointer to the associated VGPU_GOP object.
+**/
+VOID
+EFIAPI
+VirtioGpuFlushTimer (
+  IN EFI_EVENT Event,
+  IN VOID      *Context
+  )
+{
+  VGPU_GOP   *VgpuGop;
+  EFI_STATUS Status;
+
+  VgpuGop = Context;
+  Status = VirtioGpuFlushDamage (VgpuGop);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: %r\n", __FUNCTION__, Status));
+    //
+    // Retry later; the damage has been retained.
+    //
+    gBS->SetTimer (VgpuGop->FlushTimer, TimerRelative, VGPU_FLUSH_DELAY);
+  }
 }
 
 //
@@ -243,6 +459,7 @@ GopSetMode (
   VOID                 *NewBackingStore;
   EFI_PHYSICAL_ADDRESS NewBackingStoreDeviceAddress;
   VOID                 *NewBackingStoreMap;
+  EFI_TPL              OldTpl;
 
   EFI_STATUS Status;
   EFI_STATUS Status2;
@@ -253,6 +470,12 @@ GopSetMode (
 
   VgpuGop = VGPU_GOP_FROM_GOP (This);
 
+  //
+  // Keep VgpuGop->FlushTimer from submitting commands while we switch
+  // resources.
+  //
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
   //
   // Distinguish the first (internal) call from the other (protocol consumer)
   // calls.
@@ -298,7 +521,7 @@ GopSetMode (
              mGopResolutions[ModeNumber].Height // Height
              );
   if (EFI_ERROR (Status)) {
-    return Status;
+    goto RestoreTpl;
   }
 
   //
@@ -412,6 +635,7 @@ GopSetMode (
                                              mGopResolutions[ModeNumber].Width;
   VgpuGop->GopModeInfo.VerticalResolution = mGopResolutions[ModeNumber].Height;
   VgpuGop->GopModeInfo.PixelsPerScanLine = mGopResolutions[ModeNumber].Width;
+  gBS->RestoreTPL (OldTpl);
   return EFI_SUCCESS;
 
 DetachBackingStore:
@@ -436,6 +660,8 @@ DestroyHostResource:
     CpuDeadLoop ();
   }
 
+RestoreTpl:
+  gBS->RestoreTPL (OldTpl);
   return Status;
 }
 
@@ -460,7 +686,7 @@ GopBlt (
   UINT32     CurrentVertical;
   UINTN      SegmentSize;
   UINTN      Y;
-  UINTN      ResourceOffset;
+  EFI_TPL    OldTpl;
   EFI_STATUS Status;
 
   VgpuGop = VGPU_GOP_FROM_GOP (This);
@@ -619,35 +845,29 @@ GopBlt (
   }
 
   //
-  // For operations that wrote to the display, submit the updated area to the
-  // host -- update the host resource from guest memory.
-  //
-  ResourceOffset = sizeof (UINT32) * (DestinationY * CurrentHorizontal +
-                                      DestinationX);
-  Status = VirtioGpuTransferToHost2d (
-             VgpuGop->ParentBus,   // VgpuDev
-             (UINT32)DestinationX, // X
-             (UINT32)DestinationY, // Y
-             (UINT32)Width,        // Width
-             (UINT32)Height,       // Height
-             ResourceOffset,       // Offset
-             VgpuGop->ResourceId   // ResourceId
-             );
-  if (EFI_ERROR (Status)) {
-    return Status;
-  }
-
+  // For operations that wrote to the display, record the updated area. It is
+  // transferred to the host resource and flushed to the display by
+  // VgpuGop->FlushTimer, so that a burst of Blt() calls -- such as a console
+  // scrolling line by line -- costs one round trip to the host rather than
+  // two per call.
   //
-  // Flush the updated resource to the display.
+  // As the flush is deferred, a failure to flush earlier damage is reported
+  // here, by the next call that modifies the display. The damage is retained
+  // and retried in any case.
   //
-  Status = VirtioGpuResourceFlush (
-             VgpuGop->ParentBus,   // VgpuDev
-             (UINT32)DestinationX, // X
-             (UINT32)DestinationY, // Y
-             (UINT32)Width,        // Width
-             (UINT32)Height,       // Height
-             VgpuGop->ResourceId   // ResourceId
-             );
+  if (Width == 0 || Height == 0) {
+    return EFI_SUCCESS;
+  }
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  AddDamage (VgpuGop, (UINT32)DestinationX, (UINT32)DestinationY,
+    (UINT32)Width, (UINT32)Height);
+  ++VgpuGop->BltCount;
+  Status = EFI_SUCCESS;
+  if (EFI_ERROR (VgpuGop->FlushStatus)) {
+    VgpuGop->FlushStatus = EFI_SUCCESS;
+    Status = EFI_DEVICE_ERROR;
+  }
+  gBS->RestoreTPL (OldTpl);
   return Status;
 }
 
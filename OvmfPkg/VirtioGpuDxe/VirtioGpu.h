@@ -21,6 +21,7 @@
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/UefiLib.h>
+#include <Library/VirtioLib.h>
 #include <Protocol/GraphicsOutput.h>
 #include <Protocol/VirtioDevice.h>
 
@@ -72,6 +73,12 @@ typedef struct {
   //
   UINT64                   FenceId;
 
+  //
+  // Completion wait statistics of the control queue, logged at
+  // ExitBootServices().
+  //
+  VIRTIO_LATENCY_HISTOGRAM Latency;
+
   //
   // The Child field references the GOP wrapper structure. If this pointer is
   // NULL, then the hybrid driver has bound (i.e., started) the
@@ -86,6 +93,30 @@ typedef struct {
   VGPU_GOP                 *Child;
 } VGPU_DEV;
 
+//
+// Display damage that Blt() accumulates is transferred to the host and flushed
+// to the scanout at the latest this long after the first Blt() that produced
+// it.
+//
+#define VGPU_FLUSH_DELAY EFI_TIMER_PERIOD_MILLISECONDS (16)
+
+//
+// Maximum number of disjoint damage rectangles tracked per head. When a new
+// rectangle would overflow the list, the damage collapses into its bounding
+// box.
+//
+#define VGPU_MAX_DAMAGE_RECTS 8
+
+//
+// A damaged display area. Right and Bottom are exclusive.
+//
+typedef struct {
+  UINT32 Left;
+  UINT32 Top;
+  UINT32 Right;
+  UINT32 Bottom;
+} VGPU_DAMAGE_RECT;
+
 //
 // The Graphics Output Protocol wrapper structure.
 //
@@ -157,6 +188,34 @@ struct VGPU_GOP_STRUCT {
   // BackingStore is non-NULL.
   //
   VOID                                 *BackingStoreMap;
+
+  //
+  // Display areas that Blt() has rendered into BackingStore, but that have not
+  // been transferred to the host resource and flushed to the scanout yet.
+  // Accessed at TPL_NOTIFY.
+  //
+  VGPU_DAMAGE_RECT                     Damage[VGPU_MAX_DAMAGE_RECTS];
+  UINTN                                DamageCount;
+
+  //
+  // One-shot timer, armed whenever DamageCount leaves zero, that calls
+  // VirtioGpuFlushDamage(). Never NULL.
+  //
+  EFI_EVENT                            FlushTimer;
+
+  //
+  // Error of the last damage flush that failed, to be reported by the next
+  // display-modifying Blt() call; EFI_SUCCESS otherwise. Accessed at
+  // TPL_NOTIFY.
+  //
+  EFI_STATUS                           FlushStatus;
+
+  //
+  // Number of display-modifying Blt() calls, and of damage flushes that
+  // carried them to the host. Logged at ExitBootServices().
+  //
+  UINT64                               BltCount;
+  UINT64                               FlushCount;
 };
 
 //
@@ -400,6 +459,49 @@ ReleaseGopResources (
   IN     BOOLEAN  DisableHead
   );
 
+/**
+  Transfer the display areas that Blt() has damaged since the last flush to
+  the host resource, and flush them to head (scanout) #0.
+
+  Each tracked damage rectangle is transferred separately, then their bounding
+  box is flushed with a single command. On error, the damage is retained, so
+  that the next flush retries it, and the error is latched in
+  VgpuGop->FlushStatus, so that the next Blt() call reports it.
+
+  The commands are sent at TPL_NOTIFY. This is allowed, as the VirtIo device
+  maps and unmaps the command buffers with EDKII_IOMMU_PROTOCOL (IoMmuDxe in
+  SEV guests), whose Map() and Unmap() may be called at or below TPL_NOTIFY,
+  or with PciIo otherwise.
+
+  @param[in,out] VgpuGop  The VGPU_GOP object whose damage should be flushed.
+                          The caller is responsible for having called
+                          VgpuGop->Gop.SetMode() at least once successfully.
+
+  @retval EFI_SUCCESS  The damage has been flushed, or there was none.
+
+  @return              Error codes from VirtioGpuTransferToHost2d() and
+                       VirtioGpuResourceFlush().
+**/
+EFI_STATUS
+VirtioGpuFlushDamage (
+  IN OUT VGPU_GOP *VgpuGop
+  );
+
+/**
+  EFI_EVENT_NOTIFY function for the VGPU_GOP.FlushTimer event. It calls
+  VirtioGpuFlushDamage().
+
+  @param[in] Event    Event whose notification function is being invoked.
+
+  @param[in] Context  Pointer to the associated VGPU_GOP object.
+**/
+VOID
+EFIAPI
+VirtioGpuFlushTimer (
+  IN EFI_EVENT Event,
+  IN VOID      *Context
+  );
+
 //
 // Template for initializing VGPU_GOP.Gop.
 //
@@ -66,7 +66,6 @@ VirtioNetGetStatus (
   EFI_STATUS           Status;
   UINT16               RxCurUsed;
   UINT16               TxCurUsed;
-  EFI_PHYSICAL_ADDRESS DeviceAddress;
 
   if (This == NULL) {
     return EFI_INVALID_PARAMETER;
@@ -142,34 +141,16 @@ VirtioNetGetStatus (
       ASSERT (DescIdx < (UINT32) (2 * Dev->TxMaxPending - 1));
 
       //
-      // get the device address that has been enqueued for the caller's
-      // transmit buffer
+      // return the caller's buffer that has been copied into the transmit
+      // slab slot of this descriptor chain
       //
-      DeviceAddress = Dev->TxRing.Desc[DescIdx + 1].Addr;
+      *TxBuf = Dev->TxCallerBuf[DescIdx / 2];
+      Dev->TxCallerBuf[DescIdx / 2] = NULL;
 
       //
       // now this descriptor can be used again to enqueue a transmit buffer
       //
       Dev->TxFreeStack[--Dev->TxCurPending] = (UINT16) DescIdx;
-
-      //
-      // Unmap the device address and perform the reverse mapping to find the
-      // caller buffer address.
-      //
-      Status = VirtioNetUnmapTxBuf (
-                 Dev,
-                 TxBuf,
-                 DeviceAddress
-                 );
-      if (EFI_ERROR (Status)) {
-        //
-        // VirtioNetUnmapTxBuf should never fail, if we have reached here
-        // that means our internal state has been corrupted
-        //
-        ASSERT (FALSE);
-        Status = EFI_DEVICE_ERROR;
-        goto Exit;
-      }
     }
   }
 
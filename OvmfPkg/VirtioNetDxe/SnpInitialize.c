@@ -141,14 +141,17 @@ ReleaseQueue:
   - tracking of heads of free descriptor chains from the above,
   - one common virtio-net request header (never modified by the host) for all
     pending TX packets,
+  - a transmit slab with one packet-sized slot per descriptor chain, mapped
+    for the device once; VirtioNetTransmit() copies packets into it, rather
+    than mapping the caller's buffer,
   - select polling over TX interrupt.
 
   @param[in,out] Dev       The VNET_DEV driver instance about to enter the
                            EfiSimpleNetworkInitialized state.
 
   @retval EFI_OUT_OF_RESOURCES  Failed to allocate the stack to track the heads
-                                of free descriptor chains or failed to init
-                                TxBufCollection.
+                                of free descriptor chains, or the array of
+                                caller buffers pending recycling.
   @return                       Status codes from VIRTIO_DEVICE_PROTOCOL.
                                 AllocateSharedPages() or
                                 VirtioMapAllBytesInSharedBuffer()
@@ -163,10 +166,14 @@ VirtioNetInitTx (
   )
 {
   UINTN                 TxSharedReqSize;
+  UINTN                 TxSlotSize;
+  UINTN                 NumBytes;
   UINTN                 PktIdx;
   EFI_STATUS            Status;
   EFI_PHYSICAL_ADDRESS  DeviceAddress;
+  EFI_PHYSICAL_ADDRESS  TxBufDeviceAddress;
   VOID                  *TxSharedReqBuffer;
+  VOID                  *TxBuffer;
 
   Dev->TxMaxPending = (UINT16) MIN (Dev->TxRing.QueueSize / 2,
                                  VNET_MAX_PENDING);
@@ -177,11 +184,9 @@ VirtioNetInitTx (
     return EFI_OUT_OF_RESOURCES;
   }
 
-  Dev->TxBufCollection = OrderedCollectionInit (
-                           VirtioNetTxBufMapInfoCompare,
-                           VirtioNetTxBufDeviceAddressCompare
-                           );
-  if (Dev->TxBufCollection == NULL) {
+  Dev->TxCallerBuf = AllocateZeroPool (Dev->TxMaxPending *
+                       sizeof *Dev->TxCallerBuf);
+  if (Dev->TxCallerBuf == NULL) {
     Status = EFI_OUT_OF_RESOURCES;
     goto FreeTxFreeStack;
   }
@@ -196,7 +201,7 @@ VirtioNetInitTx (
                           &TxSharedReqBuffer
                           );
   if (EFI_ERROR (Status)) {
-    goto UninitTxBufCollection;
+    goto FreeTxCallerBuf;
   }
 
   ZeroMem (TxSharedReqBuffer, sizeof *Dev->TxSharedReq);
@@ -215,12 +220,44 @@ VirtioNetInitTx (
 
   Dev->TxSharedReq = TxSharedReqBuffer;
 
+  //
+  // Allocate the transmit slab, and map it with BusMasterCommonBuffer as well.
+  // Under memory encryption, this replaces a bounce buffer allocation and a
+  // page encryption state flip per transmitted packet with a copy of at most
+  // 1514 bytes.
+  //
+  TxSlotSize = Dev->Snm.MediaHeaderSize + Dev->Snm.MaxPacketSize;
+  NumBytes = Dev->TxMaxPending * TxSlotSize;
+  Dev->TxBufNrPages = EFI_SIZE_TO_PAGES (NumBytes);
+  Status = Dev->VirtIo->AllocateSharedPages (
+                          Dev->VirtIo,
+                          Dev->TxBufNrPages,
+                          &TxBuffer
+                          );
+  if (EFI_ERROR (Status)) {
+    goto UnmapTxSharedReqBuffer;
+  }
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             Dev->VirtIo,
+             VirtioOperationBusMasterCommonBuffer,
+             TxBuffer,
+             NumBytes,
+             &TxBufDeviceAddress,
+             &Dev->TxBufMap
+             );
+  if (EFI_ERROR (Status)) {
+    goto FreeTxBuffer;
+  }
+
+  Dev->TxBuf = TxBuffer;
 
   //
   // In VirtIo 1.0, the NumBuffers field is mandatory. In 0.9.5, it depends on
-  // VIRTIO_NET_F_MRG_RXBUF, which we never negotiate.
+  // VIRTIO_NET_F_MRG_RXBUF, which affects the TX header as well.
   //
-  TxSharedReqSize = (Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0)) ?
+  TxSharedReqSize = (Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0) &&
+                     !Dev->MergeableRx) ?
                     sizeof (Dev->TxSharedReq->V0_9_5) :
                     sizeof *Dev->TxSharedReq;
 
@@ -240,9 +277,12 @@ VirtioNetInitTx (
     Dev->TxRing.Desc[DescIdx].Next  = (UINT16) (DescIdx + 1);
 
     //
-    // The second descriptor of each pending TX packet is updated on the fly,
-    // but it always terminates the descriptor chain of the packet.
+    // The second descriptor of each pending TX packet always points to the
+    // packet's slot in the transmit slab, and it terminates the descriptor
+    // chain of the packet. Only its length is updated on the fly.
     //
+    Dev->TxRing.Desc[DescIdx + 1].Addr  = TxBufDeviceAddress +
+                                          PktIdx * TxSlotSize;
     Dev->TxRing.Desc[DescIdx + 1].Flags = 0;
   }
 
@@ -253,7 +293,8 @@ VirtioNetInitTx (
   Dev->TxSharedReq->V0_9_5.GsoType = VIRTIO_NET_HDR_GSO_NONE;
 
   //
-  // For VirtIo 1.0 only -- the field exists, but it is unused
+  // For VirtIo 1.0 and VIRTIO_NET_F_MRG_RXBUF only -- the field exists, but
+  // it is unused
   //
   Dev->TxSharedReq->NumBuffers = 0;
 
@@ -271,6 +312,16 @@ VirtioNetInitTx (
 
   return EFI_SUCCESS;
 
+FreeTxBuffer:
+  Dev->VirtIo->FreeSharedPages (
+                 Dev->VirtIo,
+                 Dev->TxBufNrPages,
+                 TxBuffer
+                 );
+
+UnmapTxSharedReqBuffer:
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->TxSharedReqMap);
+
 FreeTxSharedReqBuffer:
   Dev->VirtIo->FreeSharedPages (
                  Dev->VirtIo,
@@ -278,8 +329,8 @@ FreeTxSharedReqBuffer:
                  TxSharedReqBuffer
                  );
 
-UninitTxBufCollection:
-  OrderedCollectionUninit (Dev->TxBufCollection);
+FreeTxCallerBuf:
+  FreePool (Dev->TxCallerBuf);
 
 FreeTxFreeStack:
   FreePool (Dev->TxFreeStack);
@@ -299,7 +350,8 @@ FreeTxFreeStack:
     packet data into,
   - select polling over RX interrupt,
   - fully populate the RX queue with a static pattern of virtio descriptor
-    chains.
+    chains (two-part chains by default, single descriptors if
+    VIRTIO_NET_F_MRG_RXBUF has been negotiated).
 
   @param[in,out] Dev       The VNET_DEV driver instance about to enter the
                            EfiSimpleNetworkInitialized state.
@@ -330,26 +382,39 @@ VirtioNetInitRx (
 
   //
   // In VirtIo 1.0, the NumBuffers field is mandatory. In 0.9.5, it depends on
-  // VIRTIO_NET_F_MRG_RXBUF, which we never negotiate.
+  // VIRTIO_NET_F_MRG_RXBUF.
   //
-  VirtioNetReqSize = (Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0)) ?
+  VirtioNetReqSize = (Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0) &&
+                      !Dev->MergeableRx) ?
                      sizeof (VIRTIO_NET_REQ) :
                      sizeof (VIRTIO_1_0_NET_REQ);
 
   //
-  // For each incoming packet we must supply two descriptors:
+  // Without VIRTIO_NET_F_MRG_RXBUF, for each incoming packet we must supply
+  // two descriptors:
   // - the recipient for the virtio-net request header, plus
   // - the recipient for the network data (which consists of Ethernet header
   //   and Ethernet payload).
   //
+  // With VIRTIO_NET_F_MRG_RXBUF, a single descriptor covers both, and the
+  // host places the header at the start of the buffer. Either way, one buffer
+  // fits a full frame.
+  //
   RxBufSize = VirtioNetReqSize +
               (Dev->Snm.MediaHeaderSize + Dev->Snm.MaxPacketSize);
 
   //
   // Limit the number of pending RX packets if the queue is big. The division
-  // by two is due to the above "two descriptors per packet" trait.
-  //
-  RxAlwaysPending = (UINT16) MIN (Dev->RxRing.QueueSize / 2, VNET_MAX_PENDING);
+  // by two is due to the above "two descriptors per packet" trait. Mergeable
+  // buffers take one descriptor each, so we can keep more of them pending.
+  //
+  if (Dev->MergeableRx) {
+    RxAlwaysPending = (UINT16) MIN (Dev->RxRing.QueueSize,
+                                 VNET_MAX_RX_PENDING);
+  } else {
+    RxAlwaysPending = (UINT16) MIN (Dev->RxRing.QueueSize / 2,
+                                 VNET_MAX_PENDING);
+  }
 
   //
   // The RxBuf is shared between guest and hypervisor, use
@@ -399,8 +464,8 @@ VirtioNetInitRx (
   *Dev->RxRing.Avail.Flags = (UINT16) VRING_AVAIL_F_NO_INTERRUPT;
 
   //
-  // now set up a separate, two-part descriptor chain for each RX packet, and
-  // link each chain into (from) the available ring as well
+  // now set up a separate descriptor chain for each RX packet, and link each
+  // chain into (from) the available ring as well
   //
   DescIdx = 0;
   RxBufDeviceAddress = Dev->RxBufDeviceBase;
@@ -414,6 +479,14 @@ VirtioNetInitRx (
     //
     // virtio-0.9.5, 2.4.1.1 Placing Buffers into the Descriptor Table
     //
+    if (Dev->MergeableRx) {
+      Dev->RxRing.Desc[DescIdx].Addr  = RxBufDeviceAddress;
+      Dev->RxRing.Desc[DescIdx].Len   = (UINT32) RxBufSize;
+      Dev->RxRing.Desc[DescIdx].Flags = VRING_DESC_F_WRITE;
+      RxBufDeviceAddress += Dev->RxRing.Desc[DescIdx++].Len;
+      continue;
+    }
+
     Dev->RxRing.Desc[DescIdx].Addr  = RxBufDeviceAddress;
     Dev->RxRing.Desc[DescIdx].Len   = (UINT32) VirtioNetReqSize;
     Dev->RxRing.Desc[DescIdx].Flags = VRING_DESC_F_WRITE | VRING_DESC_F_NEXT;
@@ -563,7 +636,8 @@ VirtioNetInitialize (
     !!(Features & VIRTIO_NET_F_STATUS));
 
   Features &= VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS | VIRTIO_F_VERSION_1 |
-              VIRTIO_F_IOMMU_PLATFORM;
+              VIRTIO_F_IOMMU_PLATFORM | VIRTIO_NET_F_MRG_RXBUF;
+  Dev->MergeableRx = (BOOLEAN) ((Features & VIRTIO_NET_F_MRG_RXBUF) != 0);
 
   //
   // In virtio-1.0, feature negotiation is expected to complete before queue
@@ -78,11 +78,15 @@ VirtioNetReceive (
   UINT16     UsedElemIdx;
   UINT32     DescIdx;
   UINT32     RxLen;
+  UINT32     SegLen;
+  UINT32     HdrLen;
+  UINT16     NumBuffers;
+  UINT16     BufIdx;
   UINTN      OrigBufferSize;
   UINT8      *RxPtr;
+  UINT8      *DestPtr;
   UINT16     AvailIdx;
   EFI_STATUS NotifyStatus;
-  UINTN      RxBufOffset;
 
   if (This == NULL || BufferSize == NULL || Buffer == NULL) {
     return EFI_INVALID_PARAMETER;
@@ -113,19 +117,43 @@ VirtioNetReceive (
     goto Exit;
   }
 
-  UsedElemIdx = Dev->RxLastUsed % Dev->RxRing.QueueSize;
-  DescIdx = Dev->RxRing.Used.UsedElem[UsedElemIdx].Id;
-  RxLen   = Dev->RxRing.Used.UsedElem[UsedElemIdx].Len;
-
   //
-  // the virtio-net request header must be complete; we skip it
+  // With mergeable RX buffers, the packet may span several buffers, each
+  // consumed from the Used Ring in turn; the header in the first buffer tells
+  // how many. The host publishes them together, so they must all be there.
   //
-  ASSERT (RxLen >= Dev->RxRing.Desc[DescIdx].Len);
-  RxLen -= Dev->RxRing.Desc[DescIdx].Len;
+  NumBuffers = 1;
+  if (Dev->MergeableRx) {
+    UsedElemIdx = Dev->RxLastUsed % Dev->RxRing.QueueSize;
+    DescIdx = Dev->RxRing.Used.UsedElem[UsedElemIdx].Id;
+    NumBuffers = ((VIRTIO_1_0_NET_REQ *)(Dev->RxBuf +
+                    (UINTN)(Dev->RxRing.Desc[DescIdx].Addr -
+                            Dev->RxBufDeviceBase)))->NumBuffers;
+    if (NumBuffers == 0 ||
+        NumBuffers > (UINT16) (RxCurUsed - Dev->RxLastUsed)) {
+      NumBuffers = 1;
+      Status = EFI_DEVICE_ERROR;
+      goto RecycleDesc; // drop the malformed buffer
+    }
+  }
+
   //
-  // the host must not have filled in more data than requested
+  // Add up the data lengths; the virtio-net request header, at the start of
+  // the first buffer, must be complete, and we skip it.
   //
-  ASSERT (RxLen <= Dev->RxRing.Desc[DescIdx + 1].Len);
+  RxLen = 0;
+  for (BufIdx = 0; BufIdx < NumBuffers; ++BufIdx) {
+    UsedElemIdx = (UINT16) (Dev->RxLastUsed + BufIdx) % Dev->RxRing.QueueSize;
+    DescIdx = Dev->RxRing.Used.UsedElem[UsedElemIdx].Id;
+    SegLen  = Dev->RxRing.Used.UsedElem[UsedElemIdx].Len;
+    if (BufIdx == 0) {
+      HdrLen = Dev->MergeableRx ? sizeof (VIRTIO_1_0_NET_REQ) :
+                                  Dev->RxRing.Desc[DescIdx].Len;
+      ASSERT (SegLen >= HdrLen);
+      SegLen -= HdrLen;
+    }
+    RxLen += SegLen;
+  }
 
   OrigBufferSize = *BufferSize;
   *BufferSize = RxLen;
@@ -144,11 +172,39 @@ VirtioNetReceive (
     *HeaderSize = Dev->Snm.MediaHeaderSize;
   }
 
-  RxBufOffset = (UINTN)(Dev->RxRing.Desc[DescIdx + 1].Addr -
-                        Dev->RxBufDeviceBase);
-  RxPtr = Dev->RxBuf + RxBufOffset;
-  CopyMem (Buffer, RxPtr, RxLen);
+  //
+  // Gather the packet data. Without mergeable RX buffers, the data lives in
+  // the second descriptor of the single chain; the host must not have filled
+  // in more data than requested.
+  //
+  DestPtr = Buffer;
+  for (BufIdx = 0; BufIdx < NumBuffers; ++BufIdx) {
+    UsedElemIdx = (UINT16) (Dev->RxLastUsed + BufIdx) % Dev->RxRing.QueueSize;
+    DescIdx = Dev->RxRing.Used.UsedElem[UsedElemIdx].Id;
+    SegLen  = Dev->RxRing.Used.UsedElem[UsedElemIdx].Len;
+    if (!Dev->MergeableRx) {
+      SegLen -= Dev->RxRing.Desc[DescIdx].Len;
+      ASSERT (SegLen <= Dev->RxRing.Desc[DescIdx + 1].Len);
+      RxPtr = Dev->RxBuf + (UINTN)(Dev->RxRing.Desc[DescIdx + 1].Addr -
+                                   Dev->RxBufDeviceBase);
+    } else {
+      ASSERT (SegLen <= Dev->RxRing.Desc[DescIdx].Len);
+      RxPtr = Dev->RxBuf + (UINTN)(Dev->RxRing.Desc[DescIdx].Addr -
+                                   Dev->RxBufDeviceBase);
+      if (BufIdx == 0) {
+        SegLen -= sizeof (VIRTIO_1_0_NET_REQ);
+        RxPtr  += sizeof (VIRTIO_1_0_NET_REQ);
+      }
+    }
+    CopyMem (DestPtr, RxPtr, SegLen);
+    DestPtr += SegLen;
+  }
 
+  //
+  // The media header may have been split across buffers; parse it from the
+  // caller's copy.
+  //
+  RxPtr = Buffer;
   if (DestAddr != NULL) {
     CopyMem (DestAddr, RxPtr, SIZE_OF_VNET (Mac));
   }
@@ -167,14 +223,16 @@ VirtioNetReceive (
   Status = EFI_SUCCESS;
 
 RecycleDesc:
-  ++Dev->RxLastUsed;
-
   //
   // virtio-0.9.5, 2.4.1 Supplying Buffers to The Device
   //
   AvailIdx = *Dev->RxRing.Avail.Idx;
-  Dev->RxRing.Avail.Ring[AvailIdx++ % Dev->RxRing.QueueSize] =
-    (UINT16) DescIdx;
+  for (BufIdx = 0; BufIdx < NumBuffers; ++BufIdx) {
+    UsedElemIdx = Dev->RxLastUsed++ % Dev->RxRing.QueueSize;
+    DescIdx = Dev->RxRing.Used.UsedElem[UsedElemIdx].Id;
+    Dev->RxRing.Avail.Ring[AvailIdx++ % Dev->RxRing.QueueSize] =
+      (UINT16) DescIdx;
+  }
 
   MemoryFence ();
   *Dev->RxRing.Avail.Idx = AvailIdx;
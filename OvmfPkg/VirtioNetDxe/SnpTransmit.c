@@ -78,7 +78,7 @@ VirtioNetTransmit (
   EFI_STATUS            Status;
   UINT16                DescIdx;
   UINT16                AvailIdx;
-  EFI_PHYSICAL_ADDRESS  DeviceAddress;
+  UINTN                 TxSlotSize;
 
   if (This == NULL || BufferSize == 0 || Buffer == NULL) {
     return EFI_INVALID_PARAMETER;
@@ -145,24 +145,18 @@ VirtioNetTransmit (
   }
 
   //
-  // Map the transmit buffer system physical address to device address.
+  // Copy the packet into the transmit slab slot that belongs to the free
+  // descriptor chain; the tail descriptor already points to that slot. The
+  // caller's buffer is only remembered, for VirtioNetGetStatus() to recycle.
   //
-  Status = VirtioNetMapTxBuf (
-             Dev,
-             Buffer,
-             BufferSize,
-             &DeviceAddress
-             );
-  if (EFI_ERROR (Status)) {
-    Status = EFI_DEVICE_ERROR;
-    goto Exit;
-  }
+  DescIdx = Dev->TxFreeStack[Dev->TxCurPending++];
+  TxSlotSize = Dev->Snm.MediaHeaderSize + Dev->Snm.MaxPacketSize;
+  CopyMem (Dev->TxBuf + (DescIdx / 2) * TxSlotSize, Buffer, BufferSize);
+  Dev->TxCallerBuf[DescIdx / 2] = Buffer;
 
   //
   // virtio-0.9.5, 2.4.1 Supplying Buffers to The Device
   //
-  DescIdx = Dev->TxFreeStack[Dev->TxCurPending++];
-  Dev->TxRing.Desc[DescIdx + 1].Addr  = DeviceAddress;
   Dev->TxRing.Desc[DescIdx + 1].Len   = (UINT32) BufferSize;
 
   //
@@ -26,7 +26,6 @@
 #include <Protocol/DevicePath.h>
 #include <Protocol/DriverBinding.h>
 #include <Protocol/SimpleNetwork.h>
-#include <Library/OrderedCollectionLib.h>
 
 #define VNET_SIG SIGNATURE_32 ('V', 'N', 'E', 'T')
 
@@ -35,6 +34,12 @@
 //
 #define VNET_MAX_PENDING 64
 
+//
+// maximum number of pending RX packets when VIRTIO_NET_F_MRG_RXBUF has been
+// negotiated; each RX buffer takes a single descriptor then, rather than two
+//
+#define VNET_MAX_RX_PENDING 256
+
 //
 // State diagram:
 //
@@ -82,6 +87,7 @@ typedef struct {
   EFI_EVENT                   ExitBoot;          // VirtioNetSnpPopulate
   EFI_DEVICE_PATH_PROTOCOL    *MacDevicePath;    // VirtioNetDriverBindingStart
   EFI_HANDLE                  MacHandle;         // VirtioNetDriverBindingStart
+  BOOLEAN                     MergeableRx;       // VirtioNetInitialize
 
   VRING                       RxRing;            // VirtioNetInitRing
   VOID                        *RxRingMap;        // VirtioRingMap and
@@ -101,7 +107,10 @@ typedef struct {
   VIRTIO_1_0_NET_REQ          *TxSharedReq;      // VirtioNetInitTx
   VOID                        *TxSharedReqMap;   // VirtioNetInitTx
   UINT16                      TxLastUsed;        // VirtioNetInitTx
-  ORDERED_COLLECTION          *TxBufCollection;  // VirtioNetInitTx
+  VOID                        **TxCallerBuf;     // VirtioNetInitTx
+  UINT8                       *TxBuf;            // VirtioNetInitTx
+  UINTN                       TxBufNrPages;      // VirtioNetInitTx
+  VOID                        *TxBufMap;         // VirtioNetInitTx
 } VNET_DEV;
 
 
@@ -282,41 +291,6 @@ VirtioNetUninitRing (
   IN     VOID     *RingMap
   );
 
-//
-// utility functions to map caller-supplied Tx buffer system physical address
-// to a device address and vice versa
-//
-EFI_STATUS
-EFIAPI
-VirtioNetMapTxBuf (
-  IN  VNET_DEV              *Dev,
-  IN  VOID                  *Buffer,
-  IN  UINTN                 NumberOfBytes,
-  OUT EFI_PHYSICAL_ADDRESS  *DeviceAddress
-  );
-
-EFI_STATUS
-EFIAPI
-VirtioNetUnmapTxBuf (
-  IN  VNET_DEV              *Dev,
-  OUT VOID                  **Buffer,
-  IN  EFI_PHYSICAL_ADDRESS  DeviceAddress
-  );
-
-INTN
-EFIAPI
-VirtioNetTxBufMapInfoCompare (
-  IN CONST VOID *UserStruct1,
-  IN CONST VOID *UserStruct2
-  );
-
-INTN
-EFIAPI
-VirtioNetTxBufDeviceAddressCompare (
-  IN CONST VOID *StandaloneKey,
-  IN CONST VOID *UserStruct
-  );
-
 
 //
 // event callbacks
@@ -192,8 +192,8 @@ VirtioRngGetRNG (
       VRING_DESC_F_WRITE,
       &Indices);
 
-    if (VirtioFlush (Dev->VirtIo, 0, &Dev->Ring, &Indices, &Len) !=
-        EFI_SUCCESS) {
+    if (VirtioFlush (Dev->VirtIo, 0, &Dev->Ring, &Indices, &Len,
+          &Dev->Latency) != EFI_SUCCESS) {
       Status = EFI_DEVICE_ERROR;
       goto UnmapBuffer;
     }
@@ -445,6 +445,8 @@ VirtioRngExitBoot (
   //
   Dev = Context;
   Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
+
+  VirtioLogLatency (__FUNCTION__, &Dev->Latency);
 }
 
 
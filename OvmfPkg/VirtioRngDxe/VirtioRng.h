@@ -22,6 +22,7 @@
 #include <Protocol/Rng.h>
 
 #include <IndustryStandard/Virtio.h>
+#include <Library/VirtioLib.h>
 
 #define VIRTIO_RNG_SIG SIGNATURE_32 ('V', 'R', 'N', 'G')
 
@@ -39,6 +40,7 @@ typedef struct {
   VRING                     Ring;           // VirtioRingInit       2
   EFI_RNG_PROTOCOL          Rng;            // VirtioRngInit        1
   VOID                      *RingMap;       // VirtioRingMap        2
+  VIRTIO_LATENCY_HISTOGRAM  Latency;        // DriverBindingStart   0
 } VIRTIO_RNG_DEV;
 
 #define VIRTIO_ENTROPY_SOURCE_FROM_RNG(RngPointer) \
@@ -7,16 +7,25 @@
 
   - No hotplug / hot-unplug.
 
-  - Although EFI_EXT_SCSI_PASS_THRU_PROTOCOL.PassThru() could be a good match
-    for multiple in-flight virtio-scsi requests, we stick to synchronous
-    requests for now.
+  - The descriptor table is statically partitioned into tags, each carrying
+    one virtio-scsi request. Blocking PassThru() requests poll the used ring,
+    non-blocking ones are completed by a periodic timer event.
+
+  - Requests are submitted and completed at TPL_NOTIFY, so their data
+    buffers are allocated, mapped, unmapped and freed at TPL_NOTIFY too.
+    VIRTIO_DEVICE_PROTOCOL forwards these calls to EDKII_IOMMU_PROTOCOL when
+    the platform has one (IoMmuDxe in SEV guests), whose Map() and Unmap()
+    may be called at or below TPL_NOTIFY, and whose AllocateBuffer() and
+    FreeBuffer() follow gBS->AllocatePages() and gBS->FreePages(); without an
+    IOMMU, PciIo only allocates and frees pool and pages. All of that is
+    allowed at TPL_NOTIFY.
 
   - Timeouts are not supported for EFI_EXT_SCSI_PASS_THRU_PROTOCOL.PassThru().
 
   - Only one channel is supported. (At the time of this writing, host-side
     virtio-scsi supports a single channel too.)
 
-  - Only one request queue is used (for the one synchronous request).
+  - Only one request queue is used.
 
   - The ResetChannel() and ResetTargetLun() functions of
     EFI_EXT_SCSI_PASS_THRU_PROTOCOL are not supported (which is allowed by the
@@ -419,79 +428,109 @@ ReportHostAdapterError (
 }
 
 
-//
-// The next seven functions implement EFI_EXT_SCSI_PASS_THRU_PROTOCOL
-// for the virtio-scsi HBA. Refer to UEFI Spec 2.3.1 + Errata C, sections
-// - 14.1 SCSI Driver Model Overview,
-// - 14.7 Extended SCSI Pass Thru Protocol.
-//
+/**
+
+  Release the data buffer resources of a tag, set up by SubmitRequest().
+
+  @param[in out] Dev  The virtio-scsi device the tag belongs to.
+
+  @param[in out] Tag  The tag whose resources should be released.
+
+**/
+STATIC
+VOID
+ReleaseDataBuffers (
+  IN OUT VSCSI_DEV *Dev,
+  IN OUT VSCSI_TAG *Tag
+  )
+{
+  if (Tag->OutDataMapping != NULL) {
+    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Tag->OutDataMapping);
+    Tag->OutDataMapping = NULL;
+  }
+  if (Tag->InDataMapping != NULL) {
+    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Tag->InDataMapping);
+    Tag->InDataMapping = NULL;
+  }
+  if (Tag->InDataBuffer != NULL) {
+    Dev->VirtIo->FreeSharedPages (Dev->VirtIo, Tag->InDataNumPages,
+                   Tag->InDataBuffer);
+    Tag->InDataBuffer = NULL;
+  }
+}
+
+
+/**
+
+  Translate an Extended SCSI Pass Thru Protocol packet to a virtio-scsi
+  request in a free tag, and make it available to the host.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in out] Dev     The virtio-scsi host device the packet targets.
+
+  @param[in] TagIdx      The free tag to use.
+
+  @param[in] Target      The SCSI target controlled by the virtio-scsi host
+                         device.
+
+  @param[in] Lun         The Logical Unit Number under the SCSI target.
+
+  @param[in out] Packet  The Extended SCSI Pass Thru Protocol packet to submit.
+                         On failure this parameter relays error contents.
 
+  @param[in] Event       The event to signal on completion, for a
+                         non-blocking request. NULL otherwise.
+
+  @param[out] Waiter     The completion to fill in, for a blocking request.
+                         NULL otherwise.
+
+  @retval EFI_SUCCESS  The request has been made available to the host; the
+                       tag is in use.
+
+  @return              Status codes to be forwarded by
+                       EFI_EXT_SCSI_PASS_THRU_PROTOCOL.PassThru(); the tag
+                       is left unused.
+
+**/
+STATIC
 EFI_STATUS
-EFIAPI
-VirtioScsiPassThru (
-  IN     EFI_EXT_SCSI_PASS_THRU_PROTOCOL            *This,
-  IN     UINT8                                      *Target,
+SubmitRequest (
+  IN OUT VSCSI_DEV                                  *Dev,
+  IN     UINT16                                     TagIdx,
+  IN     UINT16                                     Target,
   IN     UINT64                                     Lun,
   IN OUT EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET *Packet,
-  IN     EFI_EVENT                                  Event   OPTIONAL
+  IN     EFI_EVENT                                  Event,
+  OUT    VSCSI_WAITER                               *Waiter OPTIONAL
   )
 {
-  VSCSI_DEV                 *Dev;
-  UINT16                    TargetValue;
-  EFI_STATUS                Status;
-  volatile VIRTIO_SCSI_REQ  Request;
-  volatile VIRTIO_SCSI_RESP *Response;
-  VOID                      *ResponseBuffer;
-  DESC_INDICES              Indices;
-  VOID                      *RequestMapping;
-  VOID                      *ResponseMapping;
-  VOID                      *InDataMapping;
-  VOID                      *OutDataMapping;
-  EFI_PHYSICAL_ADDRESS      RequestDeviceAddress;
-  EFI_PHYSICAL_ADDRESS      ResponseDeviceAddress;
+  VSCSI_TAG                 *Tag;
+  volatile VSCSI_SHARED_TAG *SharedTag;
+  EFI_PHYSICAL_ADDRESS      SharedTagDevAddr;
   EFI_PHYSICAL_ADDRESS      InDataDeviceAddress;
   EFI_PHYSICAL_ADDRESS      OutDataDeviceAddress;
-  VOID                      *InDataBuffer;
-  UINTN                     InDataNumPages;
-  BOOLEAN                   OutDataBufferIsMapped;
+  DESC_INDICES              Indices;
+  EFI_STATUS                Status;
+
+  Tag              = &Dev->Tags[TagIdx];
+  SharedTag        = &Dev->SharedTags[TagIdx];
+  SharedTagDevAddr = Dev->SharedTagsDevAddr + TagIdx * sizeof *SharedTag;
+  ASSERT (Tag->Packet == NULL);
 
   //
-  // Set InDataMapping,OutDataMapping,InDataDeviceAddress and OutDataDeviceAddress to
-  // suppress incorrect compiler/analyzer warnings.
+  // Set InDataDeviceAddress and OutDataDeviceAddress to suppress incorrect
+  // compiler/analyzer warnings.
   //
-  InDataMapping        = NULL;
-  OutDataMapping       = NULL;
   InDataDeviceAddress  = 0;
   OutDataDeviceAddress = 0;
 
-  ZeroMem ((VOID*) &Request, sizeof (Request));
-
-  Dev = VIRTIO_SCSI_FROM_PASS_THRU (This);
-  CopyMem (&TargetValue, Target, sizeof TargetValue);
-
-  InDataBuffer = NULL;
-  OutDataBufferIsMapped = FALSE;
-  InDataNumPages = 0;
-
-  Status = PopulateRequest (Dev, TargetValue, Lun, Packet, &Request);
+  ZeroMem ((VOID *) &SharedTag->Request, sizeof SharedTag->Request);
+  Status = PopulateRequest (Dev, Target, Lun, Packet, &SharedTag->Request);
   if (EFI_ERROR (Status)) {
     return Status;
   }
 
-  //
-  // Map the virtio-scsi Request header buffer
-  //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             Dev->VirtIo,
-             VirtioOperationBusMasterRead,
-             (VOID *) &Request,
-             sizeof Request,
-             &RequestDeviceAddress,
-             &RequestMapping);
-  if (EFI_ERROR (Status)) {
-    return ReportHostAdapterError (Packet);
-  }
-
   //
   // Map the input buffer
   //
@@ -511,30 +550,31 @@ VirtioScsiPassThru (
     // the Virtio request is successful then we copy the data from temporary
     // buffer into Packet->InDataBuffer.
     //
-    InDataNumPages = EFI_SIZE_TO_PAGES ((UINTN)Packet->InTransferLength);
+    Tag->InDataNumPages = EFI_SIZE_TO_PAGES ((UINTN)Packet->InTransferLength);
     Status = Dev->VirtIo->AllocateSharedPages (
                             Dev->VirtIo,
-                            InDataNumPages,
-                            &InDataBuffer
+                            Tag->InDataNumPages,
+                            &Tag->InDataBuffer
                             );
     if (EFI_ERROR (Status)) {
-      Status = ReportHostAdapterError (Packet);
-      goto UnmapRequestBuffer;
+      Tag->InDataBuffer = NULL;
+      return ReportHostAdapterError (Packet);
     }
 
-    ZeroMem (InDataBuffer, Packet->InTransferLength);
+    ZeroMem (Tag->InDataBuffer, Packet->InTransferLength);
 
     Status = VirtioMapAllBytesInSharedBuffer (
                Dev->VirtIo,
                VirtioOperationBusMasterCommonBuffer,
-               InDataBuffer,
+               Tag->InDataBuffer,
                Packet->InTransferLength,
                &InDataDeviceAddress,
-               &InDataMapping
+               &Tag->InDataMapping
                );
     if (EFI_ERROR (Status)) {
+      Tag->InDataMapping = NULL;
       Status = ReportHostAdapterError (Packet);
-      goto FreeInDataBuffer;
+      goto ReleaseDataBuffers;
     }
   }
 
@@ -548,72 +588,34 @@ VirtioScsiPassThru (
                Packet->OutDataBuffer,
                Packet->OutTransferLength,
                &OutDataDeviceAddress,
-               &OutDataMapping
+               &Tag->OutDataMapping
                );
     if (EFI_ERROR (Status)) {
+      Tag->OutDataMapping = NULL;
       Status = ReportHostAdapterError (Packet);
-      goto UnmapInDataBuffer;
+      goto ReleaseDataBuffers;
     }
-
-    OutDataBufferIsMapped = TRUE;
   }
 
-  //
-  // Response header is bi-direction (we preset with host status and expect
-  // the device to update it). Allocate a response buffer which can be mapped
-  // to access equally by both processor and device.
-  //
-  Status = Dev->VirtIo->AllocateSharedPages (
-                          Dev->VirtIo,
-                          EFI_SIZE_TO_PAGES (sizeof *Response),
-                          &ResponseBuffer
-                          );
-  if (EFI_ERROR (Status)) {
-    Status = ReportHostAdapterError (Packet);
-    goto UnmapOutDataBuffer;
-  }
-
-  Response = ResponseBuffer;
-
-  ZeroMem ((VOID *)Response, sizeof (*Response));
-
   //
   // preset a host status for ourselves that we do not accept as success
   //
-  Response->Response = VIRTIO_SCSI_S_FAILURE;
+  ZeroMem ((VOID *) &SharedTag->Response, sizeof SharedTag->Response);
+  SharedTag->Response.Response = VIRTIO_SCSI_S_FAILURE;
 
   //
-  // Map the response buffer with BusMasterCommonBuffer so that response
-  // buffer can be accessed by both host and device.
+  // The tag owns a fixed range of the descriptor table.
   //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             Dev->VirtIo,
-             VirtioOperationBusMasterCommonBuffer,
-             ResponseBuffer,
-             sizeof (*Response),
-             &ResponseDeviceAddress,
-             &ResponseMapping
-             );
-  if (EFI_ERROR (Status)) {
-    Status = ReportHostAdapterError (Packet);
-    goto FreeResponseBuffer;
-  }
-
-  VirtioPrepare (&Dev->Ring, &Indices);
-
-  //
-  // ensured by VirtioScsiInit() -- this predicate, in combination with the
-  // lock-step progress, ensures we don't have to track free descriptors.
-  //
-  ASSERT (Dev->Ring.QueueSize >= 4);
+  Indices.HeadDescIdx = (UINT16)(TagIdx * VSCSI_DESC_PER_TAG);
+  Indices.NextDescIdx = Indices.HeadDescIdx;
 
   //
   // enqueue Request
   //
   VirtioAppendDesc (
     &Dev->Ring,
-    RequestDeviceAddress,
-    sizeof Request,
+    SharedTagDevAddr + OFFSET_OF (VSCSI_SHARED_TAG, Request),
+    sizeof SharedTag->Request,
     VRING_DESC_F_NEXT,
     &Indices
     );
@@ -636,8 +638,8 @@ VirtioScsiPassThru (
   //
   VirtioAppendDesc (
     &Dev->Ring,
-    ResponseDeviceAddress,
-    sizeof *Response,
+    SharedTagDevAddr + OFFSET_OF (VSCSI_SHARED_TAG, Response),
+    sizeof SharedTag->Response,
     VRING_DESC_F_WRITE | (Packet->InTransferLength > 0 ? VRING_DESC_F_NEXT : 0),
     &Indices
     );
@@ -655,56 +657,240 @@ VirtioScsiPassThru (
       );
   }
 
-  // If kicking the host fails, we must fake a host adapter error.
-  // EFI_NOT_READY would save us the effort, but it would also suggest that the
-  // caller retry.
-  //
-  if (VirtioFlush (Dev->VirtIo, VIRTIO_SCSI_REQUEST_QUEUE, &Dev->Ring,
-        &Indices, NULL) != EFI_SUCCESS) {
-    Status = ReportHostAdapterError (Packet);
-    goto UnmapResponseBuffer;
-  }
+  Tag->Packet = Packet;
+  Tag->Event  = Event;
+  Tag->Waiter = Waiter;
 
-  Status = ParseResponse (Packet, Response);
+  VirtioAppendAvail (&Dev->Ring, &Indices);
 
   //
-  // If virtio request was successful and it was a CPU read request then we
-  // have used an intermediate buffer. Copy the data from intermediate buffer
-  // to the final buffer.
+  // The descriptor chain has been published, so even if kicking the host
+  // fails, the request stays in flight. Gratuitous notifications are OK, so
+  // a later request may get it going.
   //
-  if (InDataBuffer != NULL) {
-    CopyMem (Packet->InDataBuffer, InDataBuffer, Packet->InTransferLength);
+  Status = Dev->VirtIo->SetQueueNotify (Dev->VirtIo,
+                          VIRTIO_SCSI_REQUEST_QUEUE);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: SetQueueNotify(): %r\n", __FUNCTION__,
+      Status));
+  }
+  return EFI_SUCCESS;
+
+ReleaseDataBuffers:
+  ReleaseDataBuffers (Dev, Tag);
+  return Status;
+}
+
+
+/**
+
+  Collect the virtio-scsi requests that the host has processed, update their
+  Extended SCSI Pass Thru Protocol packets, release their tags, and notify
+  their submitters.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in out] Dev  The virtio-scsi device to check.
+
+  @return  The number of requests collected.
+
+**/
+STATIC
+UINTN
+CollectCompleted (
+  IN OUT VSCSI_DEV *Dev
+  )
+{
+  UINTN                                      Collected;
+  UINT16                                     HeadDescIdx;
+  UINT16                                     TagIdx;
+  VSCSI_TAG                                  *Tag;
+  EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET *Packet;
+  EFI_EVENT                                  Event;
+  VSCSI_WAITER                               *Waiter;
+  EFI_STATUS                                 Status;
+
+  Collected = 0;
+  while (VirtioFetchUsed (&Dev->Ring, &Dev->LastUsedIdx, &HeadDescIdx,
+           NULL)) {
+    ASSERT (HeadDescIdx % VSCSI_DESC_PER_TAG == 0);
+    TagIdx = HeadDescIdx / VSCSI_DESC_PER_TAG;
+    ASSERT (TagIdx < Dev->TagCount);
+
+    Tag    = &Dev->Tags[TagIdx];
+    Packet = Tag->Packet;
+    Event  = Tag->Event;
+    Waiter = Tag->Waiter;
+    ASSERT (Packet != NULL);
+
+    Status = ParseResponse (Packet, &Dev->SharedTags[TagIdx].Response);
+
+    //
+    // If virtio request was successful and it was a CPU read request then we
+    // have used an intermediate buffer. Copy the data from intermediate
+    // buffer to the final buffer.
+    //
+    if (Tag->InDataBuffer != NULL) {
+      CopyMem (Packet->InDataBuffer, Tag->InDataBuffer,
+        Packet->InTransferLength);
+    }
+
+    ReleaseDataBuffers (Dev, Tag);
+    Tag->Packet = NULL;
+    Tag->Event  = NULL;
+    Tag->Waiter = NULL;
+    Dev->FreeTags[Dev->FreeTagCount++] = TagIdx;
+    ++Collected;
+
+    if (Event != NULL) {
+      //
+      // The outcome of a non-blocking request is reported through the
+      // Packet fields only.
+      //
+      gBS->SignalEvent (Event);
+      ASSERT (Dev->AsyncRequests > 0);
+      if (--Dev->AsyncRequests == 0) {
+        gBS->SetTimer (Dev->PollTimer, TimerCancel, 0);
+      }
+    } else {
+      Waiter->Status = Status;
+      Waiter->Done   = TRUE;
+    }
+  }
+  return Collected;
+}
+
+
+/**
+
+  Timer notification function that drives the non-blocking requests.
+
+  It runs at TPL_NOTIFY, and releases the data buffers of the completed
+  requests; see the file header for why that is allowed.
+
+  @param[in] Event    Event whose notification function is being invoked.
+
+  @param[in] Context  Pointer to the VSCSI_DEV structure.
+
+**/
+STATIC
+VOID
+EFIAPI
+VirtioScsiPollTimer (
+  IN EFI_EVENT Event,
+  IN VOID      *Context
+  )
+{
+  CollectCompleted (Context);
+}
+
+
+/**
+
+  Wait until the host processes all requests in flight.
+
+  @param[in out] Dev  The virtio-scsi device to quiesce.
+
+**/
+STATIC
+VOID
+DrainRequests (
+  IN OUT VSCSI_DEV *Dev
+  )
+{
+  EFI_TPL OldTpl;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  while (Dev->FreeTagCount < Dev->TagCount) {
+    if (CollectCompleted (Dev) == 0) {
+      VirtioWaitUsed (&Dev->Ring, Dev->LastUsedIdx, &Dev->Latency);
+    }
   }
+  gBS->RestoreTPL (OldTpl);
+}
 
-UnmapResponseBuffer:
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, ResponseMapping);
 
-FreeResponseBuffer:
-  Dev->VirtIo->FreeSharedPages (
-                 Dev->VirtIo,
-                 EFI_SIZE_TO_PAGES (sizeof *Response),
-                 ResponseBuffer
-                 );
+//
+// The next seven functions implement EFI_EXT_SCSI_PASS_THRU_PROTOCOL
+// for the virtio-scsi HBA. Refer to UEFI Spec 2.3.1 + Errata C, sections
+// - 14.1 SCSI Driver Model Overview,
+// - 14.7 Extended SCSI Pass Thru Protocol.
+//
 
-UnmapOutDataBuffer:
-  if (OutDataBufferIsMapped) {
-    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, OutDataMapping);
+EFI_STATUS
+EFIAPI
+VirtioScsiPassThru (
+  IN     EFI_EXT_SCSI_PASS_THRU_PROTOCOL            *This,
+  IN     UINT8                                      *Target,
+  IN     UINT64                                     Lun,
+  IN OUT EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET *Packet,
+  IN     EFI_EVENT                                  Event   OPTIONAL
+  )
+{
+  VSCSI_DEV    *Dev;
+  UINT16       TargetValue;
+  EFI_STATUS   Status;
+  EFI_TPL      OldTpl;
+  UINT16       TagIdx;
+  UINT16       LastUsedIdx;
+  VSCSI_WAITER Waiter;
+
+  Dev = VIRTIO_SCSI_FROM_PASS_THRU (This);
+  CopyMem (&TargetValue, Target, sizeof TargetValue);
+
+  //
+  // Get a free tag. A non-blocking request is refused if none is available;
+  // a blocking one waits for a request in flight to complete.
+  //
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  while (Dev->FreeTagCount == 0 && CollectCompleted (Dev) == 0) {
+    if (Event != NULL) {
+      gBS->RestoreTPL (OldTpl);
+      return EFI_NOT_READY;
+    }
+    LastUsedIdx = Dev->LastUsedIdx;
+    gBS->RestoreTPL (OldTpl);
+
+    VirtioWaitUsed (&Dev->Ring, LastUsedIdx, &Dev->Latency);
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
   }
+  TagIdx = Dev->FreeTags[--Dev->FreeTagCount];
 
-UnmapInDataBuffer:
-  if (InDataBuffer != NULL) {
-    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, InDataMapping);
+  Waiter.Done = FALSE;
+  Status = SubmitRequest (Dev, TagIdx, TargetValue, Lun, Packet, Event,
+             (Event == NULL) ? &Waiter : NULL);
+  if (EFI_ERROR (Status)) {
+    Dev->FreeTags[Dev->FreeTagCount++] = TagIdx;
+    gBS->RestoreTPL (OldTpl);
+    return Status;
   }
 
-FreeInDataBuffer:
-  if (InDataBuffer != NULL) {
-    Dev->VirtIo->FreeSharedPages (Dev->VirtIo, InDataNumPages, InDataBuffer);
+  if (Event != NULL) {
+    if (Dev->AsyncRequests++ == 0) {
+      gBS->SetTimer (Dev->PollTimer, TimerPeriodic, VSCSI_POLL_PERIOD);
+    }
+    gBS->RestoreTPL (OldTpl);
+    return EFI_SUCCESS;
   }
+  gBS->RestoreTPL (OldTpl);
 
-UnmapRequestBuffer:
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, RequestMapping);
+  //
+  // Poll for the completion of the blocking request. If the timer event
+  // collects completions while we're waiting, the used index moves past
+  // LastUsedIdx just the same.
+  //
+  for (;;) {
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    CollectCompleted (Dev);
+    LastUsedIdx = Dev->LastUsedIdx;
+    gBS->RestoreTPL (OldTpl);
 
-  return Status;
+    if (Waiter.Done) {
+      break;
+    }
+    VirtioWaitUsed (&Dev->Ring, LastUsedIdx, &Dev->Latency);
+  }
+  return Waiter.Status;
 }
 
 
@@ -922,6 +1108,86 @@ VirtioScsiGetNextTarget (
 }
 
 
+STATIC
+EFI_STATUS
+VirtioScsiInitTags (
+  IN OUT VSCSI_DEV *Dev
+  )
+{
+  UINTN      SharedPages;
+  VOID       *SharedBuffer;
+  UINT16     TagIdx;
+  EFI_STATUS Status;
+
+  Dev->Tags = AllocateZeroPool (Dev->TagCount * sizeof *Dev->Tags);
+  if (Dev->Tags == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Dev->FreeTags = AllocatePool (Dev->TagCount * sizeof *Dev->FreeTags);
+  if (Dev->FreeTags == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto FreeTags;
+  }
+
+  SharedPages = EFI_SIZE_TO_PAGES (Dev->TagCount * sizeof *Dev->SharedTags);
+  Status = Dev->VirtIo->AllocateSharedPages (Dev->VirtIo, SharedPages,
+                          &SharedBuffer);
+  if (EFI_ERROR (Status)) {
+    goto FreeFreeTags;
+  }
+  ZeroMem (SharedBuffer, EFI_PAGES_TO_SIZE (SharedPages));
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             Dev->VirtIo,
+             VirtioOperationBusMasterCommonBuffer,
+             SharedBuffer,
+             EFI_PAGES_TO_SIZE (SharedPages),
+             &Dev->SharedTagsDevAddr,
+             &Dev->SharedTagsMap
+             );
+  if (EFI_ERROR (Status)) {
+    goto FreeSharedBuffer;
+  }
+  Dev->SharedTags = SharedBuffer;
+
+  for (TagIdx = 0; TagIdx < Dev->TagCount; ++TagIdx) {
+    Dev->FreeTags[TagIdx] = Dev->TagCount - 1 - TagIdx;
+  }
+  Dev->FreeTagCount = Dev->TagCount;
+  return EFI_SUCCESS;
+
+FreeSharedBuffer:
+  Dev->VirtIo->FreeSharedPages (Dev->VirtIo, SharedPages, SharedBuffer);
+
+FreeFreeTags:
+  FreePool (Dev->FreeTags);
+
+FreeTags:
+  FreePool (Dev->Tags);
+
+  return Status;
+}
+
+
+STATIC
+VOID
+VirtioScsiUninitTags (
+  IN OUT VSCSI_DEV *Dev
+  )
+{
+  UINTN SharedPages;
+
+  ASSERT (Dev->FreeTagCount == Dev->TagCount);
+
+  SharedPages = EFI_SIZE_TO_PAGES (Dev->TagCount * sizeof *Dev->SharedTags);
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->SharedTagsMap);
+  Dev->VirtIo->FreeSharedPages (Dev->VirtIo, SharedPages, Dev->SharedTags);
+  FreePool (Dev->FreeTags);
+  FreePool (Dev->Tags);
+}
+
+
 STATIC
 EFI_STATUS
 EFIAPI
@@ -1051,12 +1317,15 @@ VirtioScsiInit (
     goto Failed;
   }
   //
-  // VirtioScsiPassThru() uses at most four descriptors
+  // VirtioScsiPassThru() uses at most four descriptors per request
   //
-  if (QueueSize < 4) {
+  if (QueueSize < VSCSI_DESC_PER_TAG) {
     Status = EFI_UNSUPPORTED;
     goto Failed;
   }
+  Dev->TagCount      = QueueSize / VSCSI_DESC_PER_TAG;
+  Dev->LastUsedIdx   = 0;
+  Dev->AsyncRequests = 0;
 
   Status = VirtioRingInit (Dev->VirtIo, QueueSize, &Dev->Ring);
   if (EFI_ERROR (Status)) {
@@ -1126,13 +1395,23 @@ VirtioScsiInit (
     goto UnmapQueue;
   }
 
+  Status = VirtioScsiInitTags (Dev);
+  if (EFI_ERROR (Status)) {
+    goto UnmapQueue;
+  }
+
+  //
+  // We're going to poll the answers, the host should not send interrupts.
+  //
+  *Dev->Ring.Avail.Flags = (UINT16) VRING_AVAIL_F_NO_INTERRUPT;
+
   //
   // step 6 -- initialization complete
   //
   NextDevStat |= VSTAT_DRIVER_OK;
   Status = Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, NextDevStat);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UninitTags;
   }
 
   //
@@ -1159,7 +1438,8 @@ VirtioScsiInit (
   // SCSI Pass Thru Protocol.
   //
   Dev->PassThruMode.Attributes = EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_PHYSICAL |
-                                 EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_LOGICAL;
+                                 EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_LOGICAL |
+                                 EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_NONBLOCKIO;
 
   //
   // no restriction on transfer buffer alignment
@@ -1168,6 +1448,9 @@ VirtioScsiInit (
 
   return EFI_SUCCESS;
 
+UninitTags:
+  VirtioScsiUninitTags (Dev);
+
 UnmapQueue:
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
 
@@ -1210,6 +1493,7 @@ VirtioScsiUninit (
   Dev->MaxLun         = 0;
   Dev->MaxSectors     = 0;
 
+  VirtioScsiUninitTags (Dev);
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
   VirtioRingUninit (Dev->VirtIo, &Dev->Ring);
 
@@ -1242,6 +1526,8 @@ VirtioScsiExitBoot (
   //
   Dev = Context;
   Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
+
+  VirtioLogLatency (__FUNCTION__, &Dev->Latency);
 }
 
 
@@ -1341,6 +1627,12 @@ VirtioScsiDriverBindingStart (
     goto UninitDev;
   }
 
+  Status = gBS->CreateEvent (EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_NOTIFY,
+                  &VirtioScsiPollTimer, Dev, &Dev->PollTimer);
+  if (EFI_ERROR (Status)) {
+    goto CloseExitBoot;
+  }
+
   //
   // Setup complete, attempt to export the driver instance's PassThru
   // interface.
@@ -1350,11 +1642,14 @@ VirtioScsiDriverBindingStart (
                   &gEfiExtScsiPassThruProtocolGuid, EFI_NATIVE_INTERFACE,
                   &Dev->PassThru);
   if (EFI_ERROR (Status)) {
-    goto CloseExitBoot;
+    goto ClosePollTimer;
   }
 
   return EFI_SUCCESS;
 
+ClosePollTimer:
+  gBS->CloseEvent (Dev->PollTimer);
+
 CloseExitBoot:
   gBS->CloseEvent (Dev->ExitBoot);
 
@@ -1408,6 +1703,12 @@ VirtioScsiDriverBindingStop (
     return Status;
   }
 
+  //
+  // Nobody can submit further requests now; let the outstanding ones finish
+  // before the timer driving them goes away.
+  //
+  DrainRequests (Dev);
+  gBS->CloseEvent (Dev->PollTimer);
   gBS->CloseEvent (Dev->ExitBoot);
 
   VirtioScsiUninit (Dev);
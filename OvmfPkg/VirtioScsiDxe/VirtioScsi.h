@@ -23,6 +23,8 @@
 #include <Protocol/ScsiPassThruExt.h>
 
 #include <IndustryStandard/Virtio.h>
+#include <IndustryStandard/VirtioScsi.h>
+#include <Library/VirtioLib.h>
 
 
 //
@@ -40,6 +42,50 @@
 #endif
 
 
+//
+// Every request occupies a tag. Tag #N owns the descriptors
+// [N * VSCSI_DESC_PER_TAG, (N + 1) * VSCSI_DESC_PER_TAG) in the descriptor
+// table: request header, "dataout", response, and "datain".
+//
+#define VSCSI_DESC_PER_TAG 4
+
+//
+// Period of the timer that collects completions for non-blocking
+// EFI_EXT_SCSI_PASS_THRU_PROTOCOL.PassThru() requests, in 100ns units.
+//
+#define VSCSI_POLL_PERIOD EFI_TIMER_PERIOD_MILLISECONDS (1)
+
+//
+// Request header and response of a single tag, in memory that is shared with
+// the device.
+//
+typedef struct {
+  VIRTIO_SCSI_REQ  Request;
+  VIRTIO_SCSI_RESP Response;
+} VSCSI_SHARED_TAG;
+
+//
+// Completion of a blocking request, filled in by the code that collects the
+// responses from the used ring.
+//
+typedef struct {
+  BOOLEAN    Done;
+  EFI_STATUS Status;
+} VSCSI_WAITER;
+
+//
+// Driver-side state of a single tag.
+//
+typedef struct {
+  EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET *Packet; // NULL if tag is free
+  EFI_EVENT                                  Event;   // non-blocking only
+  VSCSI_WAITER                               *Waiter; // blocking only
+  VOID                                       *InDataBuffer;
+  UINTN                                      InDataNumPages;
+  VOID                                       *InDataMapping;
+  VOID                                       *OutDataMapping;
+} VSCSI_TAG;
+
 #define VSCSI_SIG SIGNATURE_32 ('V', 'S', 'C', 'S')
 
 typedef struct {
@@ -61,6 +107,17 @@ typedef struct {
   EFI_EXT_SCSI_PASS_THRU_PROTOCOL PassThru;       // VirtioScsiInit      1
   EFI_EXT_SCSI_PASS_THRU_MODE     PassThruMode;   // VirtioScsiInit      1
   VOID                            *RingMap;       // VirtioRingMap       2
+  VIRTIO_LATENCY_HISTOGRAM        Latency;        // DriverBindingStart  0
+  EFI_EVENT                       PollTimer;      // DriverBindingStart  0
+  UINT16                          TagCount;       // VirtioScsiInit      1
+  VSCSI_TAG                       *Tags;          // VirtioScsiInitTags  2
+  UINT16                          *FreeTags;      // VirtioScsiInitTags  2
+  UINT16                          FreeTagCount;   // VirtioScsiInitTags  2
+  VSCSI_SHARED_TAG                *SharedTags;    // VirtioScsiInitTags  2
+  EFI_PHYSICAL_ADDRESS            SharedTagsDevAddr; // VirtioScsiInitTags 2
+  VOID                            *SharedTagsMap; // VirtioScsiInitTags  2
+  UINT16                          LastUsedIdx;    // VirtioScsiInit      1
+  UINTN                           AsyncRequests;  // VirtioScsiInit      1
 } VSCSI_DEV;
 
 #define VIRTIO_SCSI_FROM_PASS_THRU(PassThruPointer) \
@@ -88,12 +88,48 @@ XenPvBlockFree (
   )
 {
   XENBUS_PROTOCOL *XenBusIo = Dev->XenBusIo;
+  XEN_BLOCK_FRONT_SLOT *Slot;
+  UINTN Index;
+  UINT32 Page;
 
-  if (Dev->RingRef != 0) {
-    XenBusIo->GrantEndAccess (XenBusIo, Dev->RingRef);
+  if (Dev->PollTimer != NULL) {
+    gBS->CloseEvent (Dev->PollTimer);
+  }
+  if (Dev->Slots != NULL) {
+    for (Index = 0; Index < Dev->SlotCount; Index++) {
+      Slot = &Dev->Slots[Index];
+      if (Slot->IndirectRef != 0) {
+        XenBusIo->GrantEndAccess (XenBusIo, Slot->IndirectRef);
+      }
+      if (Slot->Bounce != NULL) {
+        for (Page = 0; Page < Dev->MaxSegments; Page++) {
+          if (Slot->GrantRef[Page] != 0) {
+            XenBusIo->GrantEndAccess (XenBusIo, Slot->GrantRef[Page]);
+          }
+        }
+      }
+    }
+    FreePool (Dev->Slots);
+  }
+  if (Dev->FreeSlots != NULL) {
+    FreePool (Dev->FreeSlots);
+  }
+  if (Dev->GrantRefs != NULL) {
+    FreePool (Dev->GrantRefs);
+  }
+  if (Dev->IndirectPages != NULL) {
+    FreePages (Dev->IndirectPages, Dev->SlotCount);
+  }
+  if (Dev->BouncePages != NULL) {
+    FreePages (Dev->BouncePages, Dev->SlotCount * Dev->MaxSegments);
+  }
+  for (Index = 0; Index < XEN_BLOCK_FRONT_MAX_RING_PAGES; Index++) {
+    if (Dev->RingRef[Index] != 0) {
+      XenBusIo->GrantEndAccess (XenBusIo, Dev->RingRef[Index]);
+    }
   }
   if (Dev->Ring.sring != NULL) {
-    FreePages (Dev->Ring.sring, 1);
+    FreePages (Dev->Ring.sring, 1 << Dev->RingPageOrder);
   }
   if (Dev->EventChannel != 0) {
     XenBusIo->EventChannelClose (XenBusIo, Dev->EventChannel);
@@ -101,6 +137,127 @@ XenPvBlockFree (
   FreePool (Dev);
 }
 
+/**
+  Remove the nodes written by XenPvBlockFrontInitialization from XenStore.
+
+  @param Dev  A XEN_BLOCK_FRONT_DEVICE instance.
+**/
+STATIC
+VOID
+XenPvBlockRemoveFrontendNodes (
+  IN XEN_BLOCK_FRONT_DEVICE *Dev
+  )
+{
+  XENBUS_PROTOCOL *XenBusIo = Dev->XenBusIo;
+  CHAR8 Node[sizeof "ring-ref" + 10];
+  UINT32 Index;
+
+  if (Dev->RingPageOrder == 0) {
+    XenBusIo->XsRemove (XenBusIo, XST_NIL, "ring-ref");
+  } else {
+    for (Index = 0; Index < (1U << Dev->RingPageOrder); Index++) {
+      AsciiSPrint (Node, sizeof Node, "ring-ref%u", Index);
+      XenBusIo->XsRemove (XenBusIo, XST_NIL, Node);
+    }
+    XenBusIo->XsRemove (XenBusIo, XST_NIL, "ring-page-order");
+  }
+  XenBusIo->XsRemove (XenBusIo, XST_NIL, "event-channel");
+  XenBusIo->XsRemove (XenBusIo, XST_NIL, "protocol");
+  XenBusIo->XsRemove (XenBusIo, XST_NIL, "feature-persistent");
+}
+
+/**
+  Allocate the request slots, once the segments per request and the use of
+  persistent grants are known.
+
+  With indirect segments, every slot gets a granted indirect page. With
+  persistent grants, every slot gets Dev->MaxSegments granted data pages, and
+  the number of slots is limited by XEN_BLOCK_FRONT_MAX_PERSISTENT_PAGES.
+
+  @param Dev  A XEN_BLOCK_FRONT_DEVICE instance.
+
+  @retval EFI_SUCCESS           The slots have been allocated.
+  @retval EFI_OUT_OF_RESOURCES  Memory allocation failed.
+**/
+STATIC
+EFI_STATUS
+XenPvBlockInitSlots (
+  IN OUT XEN_BLOCK_FRONT_DEVICE *Dev
+  )
+{
+  XENBUS_PROTOCOL *XenBusIo = Dev->XenBusIo;
+  XEN_BLOCK_FRONT_SLOT *Slot;
+  UINTN Index;
+  UINT32 Page;
+
+  Dev->SlotCount = RING_SIZE (&Dev->Ring);
+  if (Dev->Persistent) {
+    Dev->SlotCount = MIN (Dev->SlotCount,
+                          MAX (1, XEN_BLOCK_FRONT_MAX_PERSISTENT_PAGES /
+                                  Dev->MaxSegments));
+  }
+
+  Dev->Slots = AllocateZeroPool (Dev->SlotCount * sizeof *Dev->Slots);
+  Dev->FreeSlots = AllocatePool (Dev->SlotCount * sizeof *Dev->FreeSlots);
+  Dev->GrantRefs = AllocateZeroPool (
+                     Dev->SlotCount * Dev->MaxSegments * sizeof (grant_ref_t)
+                     );
+  if (Dev->Slots == NULL || Dev->FreeSlots == NULL || Dev->GrantRefs == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  if (Dev->MaxSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST) {
+    Dev->IndirectPages = AllocatePages (Dev->SlotCount);
+    if (Dev->IndirectPages == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+  if (Dev->Persistent) {
+    Dev->BouncePages = AllocatePages (Dev->SlotCount * Dev->MaxSegments);
+    if (Dev->BouncePages == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  for (Index = 0; Index < Dev->SlotCount; Index++) {
+    Slot = &Dev->Slots[Index];
+    Slot->GrantRef = &Dev->GrantRefs[Index * Dev->MaxSegments];
+    if (Dev->IndirectPages != NULL) {
+      Slot->Indirect = (VOID *) ((UINTN) Dev->IndirectPages +
+                                 Index * EFI_PAGE_SIZE);
+      XenBusIo->GrantAccess (XenBusIo, Dev->DomainId,
+                             (UINTN) Slot->Indirect >> EFI_PAGE_SHIFT,
+                             TRUE, &Slot->IndirectRef);
+    }
+    if (Dev->BouncePages != NULL) {
+      Slot->Bounce = (UINT8 *) Dev->BouncePages +
+                     Index * Dev->MaxSegments * EFI_PAGE_SIZE;
+      for (Page = 0; Page < Dev->MaxSegments; Page++) {
+        XenBusIo->GrantAccess (XenBusIo, Dev->DomainId,
+                               ((UINTN) Slot->Bounce >> EFI_PAGE_SHIFT) + Page,
+                               FALSE, &Slot->GrantRef[Page]);
+      }
+    }
+    Dev->FreeSlots[Index] = Index;
+  }
+  Dev->FreeSlotCount = Dev->SlotCount;
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Timer notification function that drives the non-blocking operations.
+
+  @param Event    Event whose notification function is being invoked.
+  @param Context  Pointer to the XEN_BLOCK_FRONT_DEVICE instance.
+**/
+STATIC
+VOID
+EFIAPI
+XenPvBlockPollTimer (
+  IN EFI_EVENT Event,
+  IN VOID      *Context
+  );
+
 /**
   Wait until until the backend has reached the ExpectedState.
 
@@ -170,6 +327,10 @@ XenPvBlockFrontInitialization (
   XenbusState State;
   UINT64 Value;
   CHAR8 *Params;
+  UINT32 Index;
+  UINT32 RingPages;
+  CHAR8 Node[sizeof "ring-ref" + 10];
+  EFI_STATUS EfiStatus;
 
   ASSERT (NodeName != NULL);
 
@@ -178,6 +339,14 @@ XenPvBlockFrontInitialization (
   Dev->NodeName = NodeName;
   Dev->XenBusIo = XenBusIo;
   Dev->DeviceId = XenBusIo->DeviceId;
+  InitializeListHead (&Dev->PendingIo);
+
+  EfiStatus = gBS->CreateEvent (EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_NOTIFY,
+                                XenPvBlockPollTimer, Dev, &Dev->PollTimer);
+  if (EFI_ERROR (EfiStatus)) {
+    Dev->PollTimer = NULL;
+    goto Error;
+  }
 
   XenBusIo->XsRead (XenBusIo, XST_NIL, "device-type", (VOID**)&DeviceType);
   if (AsciiStrCmp (DeviceType, "cdrom") == 0) {
@@ -210,14 +379,27 @@ XenPvBlockFrontInitialization (
   Dev->DomainId = (domid_t)Value;
   XenBusIo->EventChannelAllocate (XenBusIo, Dev->DomainId, &Dev->EventChannel);
 
-  SharedRing = (blkif_sring_t*) AllocatePages (1);
+  //
+  // Use a multi-page ring if the backend supports it.
+  //
+  Value = 0;
+  XenBusReadUint64 (XenBusIo, "max-ring-page-order", TRUE, &Value);
+  Dev->RingPageOrder = (UINT32)MIN (Value, XEN_BLOCK_FRONT_MAX_RING_PAGE_ORDER);
+  RingPages = 1U << Dev->RingPageOrder;
+
+  SharedRing = (blkif_sring_t*) AllocatePages (RingPages);
+  if (SharedRing == NULL) {
+    goto Error;
+  }
   SHARED_RING_INIT (SharedRing);
-  FRONT_RING_INIT (&Dev->Ring, SharedRing, EFI_PAGE_SIZE);
-  XenBusIo->GrantAccess (XenBusIo,
-                         Dev->DomainId,
-                         (INTN) SharedRing >> EFI_PAGE_SHIFT,
-                         FALSE,
-                         &Dev->RingRef);
+  FRONT_RING_INIT (&Dev->Ring, SharedRing, EFI_PAGES_TO_SIZE (RingPages));
+  for (Index = 0; Index < RingPages; Index++) {
+    XenBusIo->GrantAccess (XenBusIo,
+                           Dev->DomainId,
+                           ((INTN) SharedRing >> EFI_PAGE_SHIFT) + Index,
+                           FALSE,
+                           &Dev->RingRef[Index]);
+  }
 
 Again:
   Status = XenBusIo->XsTransactionStart (XenBusIo, &Transaction);
@@ -226,8 +408,20 @@ Again:
     goto Error;
   }
 
-  Status = XenBusIo->XsPrintf (XenBusIo, &Transaction, NodeName, "ring-ref", "%d",
-                               Dev->RingRef);
+  if (Dev->RingPageOrder == 0) {
+    Status = XenBusIo->XsPrintf (XenBusIo, &Transaction, NodeName, "ring-ref", "%d",
+                                 Dev->RingRef[0]);
+  } else {
+    Status = XenBusIo->XsPrintf (XenBusIo, &Transaction, NodeName,
+                                 "ring-page-order", "%d", Dev->RingPageOrder);
+    for (Index = 0;
+         Index < RingPages && Status == XENSTORE_STATUS_SUCCESS;
+         Index++) {
+      AsciiSPrint (Node, sizeof Node, "ring-ref%u", Index);
+      Status = XenBusIo->XsPrintf (XenBusIo, &Transaction, NodeName, Node, "%d",
+                                   Dev->RingRef[Index]);
+    }
+  }
   if (Status != XENSTORE_STATUS_SUCCESS) {
     DEBUG ((EFI_D_ERROR, "XenPvBlk: Failed to write ring-ref.\n"));
     goto AbortTransaction;
@@ -244,6 +438,12 @@ Again:
     DEBUG ((EFI_D_ERROR, "XenPvBlk: Failed to write protocol.\n"));
     goto AbortTransaction;
   }
+  Status = XenBusIo->XsPrintf (XenBusIo, &Transaction, NodeName,
+                               "feature-persistent", "%d", 1);
+  if (Status != XENSTORE_STATUS_SUCCESS) {
+    DEBUG ((EFI_D_ERROR, "XenPvBlk: Failed to write feature-persistent.\n"));
+    goto AbortTransaction;
+  }
 
   Status = XenBusIo->SetState (XenBusIo, &Transaction, XenbusStateConnected);
   if (Status != XENSTORE_STATUS_SUCCESS) {
@@ -317,17 +517,44 @@ Again:
     Dev->MediaInfo.FeatureFlushCache = FALSE;
   }
 
+  // Default value
+  Value = 0;
+  XenBusReadUint64 (XenBusIo, "feature-max-indirect-segments", TRUE, &Value);
+  if (Value > BLKIF_MAX_SEGMENTS_PER_REQUEST) {
+    Dev->MaxSegments = (UINT32)MIN (Value, XEN_BLOCK_FRONT_MAX_INDIRECT_SEGMENTS);
+  } else {
+    Dev->MaxSegments = BLKIF_MAX_SEGMENTS_PER_REQUEST;
+  }
+
+  // Default value
+  Value = 0;
+  XenBusReadUint64 (XenBusIo, "feature-persistent", TRUE, &Value);
+  if (Value == 1) {
+    Dev->Persistent = TRUE;
+  } else {
+    Dev->Persistent = FALSE;
+  }
+
+  EfiStatus = XenPvBlockInitSlots (Dev);
+  if (EFI_ERROR (EfiStatus)) {
+    DEBUG ((EFI_D_ERROR, "XenPvBlk: Failed to allocate request slots: %r\n",
+            EfiStatus));
+    goto Error2;
+  }
+
   DEBUG ((EFI_D_INFO, "XenPvBlk: New disk with %ld sectors of %d bytes\n",
           Dev->MediaInfo.Sectors, Dev->MediaInfo.SectorSize));
+  DEBUG ((EFI_D_INFO, "XenPvBlk: %d ring pages, %Lu slots, %d segments per "
+          "request, persistent grants %a\n",
+          RingPages, (UINT64)Dev->SlotCount, Dev->MaxSegments,
+          Dev->Persistent ? "on" : "off"));
 
   *DevPtr = Dev;
   return EFI_SUCCESS;
 
 Error2:
   XenBusIo->UnregisterWatch (XenBusIo, Dev->StateWatchToken);
-  XenBusIo->XsRemove (XenBusIo, XST_NIL, "ring-ref");
-  XenBusIo->XsRemove (XenBusIo, XST_NIL, "event-channel");
-  XenBusIo->XsRemove (XenBusIo, XST_NIL, "protocol");
+  XenPvBlockRemoveFrontendNodes (Dev);
   goto Error;
 AbortTransaction:
   XenBusIo->XsTransactionEnd (XenBusIo, &Transaction, TRUE);
@@ -406,142 +633,268 @@ XenPvBlockFrontShutdown (
 
 Close:
   XenBusIo->UnregisterWatch (XenBusIo, Dev->StateWatchToken);
-  XenBusIo->XsRemove (XenBusIo, XST_NIL, "ring-ref");
-  XenBusIo->XsRemove (XenBusIo, XST_NIL, "event-channel");
-  XenBusIo->XsRemove (XenBusIo, XST_NIL, "protocol");
+  XenPvBlockRemoveFrontendNodes (Dev);
 
   XenPvBlockFree (Dev);
 }
 
+/**
+  Whether a flush operation needs a request to the backend.
+
+  @param Dev  A XEN_BLOCK_FRONT_DEVICE instance.
+**/
 STATIC
-VOID
-XenPvBlockWaitSlot (
+BOOLEAN
+XenPvBlockFlushNeeded (
   IN XEN_BLOCK_FRONT_DEVICE *Dev
   )
 {
-  /* Wait for a slot */
-  if (RING_FULL (&Dev->Ring)) {
-    while (TRUE) {
-      XenPvBlockAsyncIoPoll (Dev);
-      if (!RING_FULL (&Dev->Ring)) {
-        break;
-      }
-      /* Really no slot, could wait for an event on Dev->EventChannel. */
-    }
-  }
+  return (BOOLEAN)(Dev->MediaInfo.ReadWrite &&
+                   (Dev->MediaInfo.FeatureFlushCache ||
+                    Dev->MediaInfo.FeatureBarrier));
 }
 
+/**
+  Complete an operation that has no more requests in flight.
+
+  Must be called at TPL_NOTIFY.
+
+  @param Dev     A XEN_BLOCK_FRONT_DEVICE instance.
+  @param IoData  The operation to complete.
+**/
+STATIC
 VOID
-XenPvBlockAsyncIo (
-  IN OUT XEN_BLOCK_FRONT_IO *IoData,
-  IN     BOOLEAN            IsWrite
+XenPvBlockCompleteIo (
+  IN XEN_BLOCK_FRONT_DEVICE *Dev,
+  IN XEN_BLOCK_FRONT_IO     *IoData
   )
 {
-  XEN_BLOCK_FRONT_DEVICE *Dev = IoData->Dev;
-  XENBUS_PROTOCOL *XenBusIo = Dev->XenBusIo;
-  blkif_request_t *Request;
-  RING_IDX RingIndex;
-  BOOLEAN Notify;
-  INT32 NumSegments, Index;
-  UINTN Start, End;
+  ASSERT (IoData->Submitted);
+  ASSERT (IoData->InFlight == 0);
 
-  // Can't io at non-sector-aligned location
-  ASSERT(!(IoData->Sector & ((Dev->MediaInfo.SectorSize / 512) - 1)));
-  // Can't io non-sector-sized amounts
-  ASSERT(!(IoData->Size & (Dev->MediaInfo.SectorSize - 1)));
-  // Can't io non-sector-aligned buffer
-  ASSERT(!((UINTN) IoData->Buffer & (Dev->MediaInfo.SectorSize - 1)));
+  if (IoData->Token == NULL) {
+    IoData->Done = TRUE;
+    return;
+  }
+
+  IoData->Token->TransactionStatus = IoData->Status;
+  gBS->SignalEvent (IoData->Token->Event);
+  FreePool (IoData);
 
-  Start = (UINTN) IoData->Buffer & ~EFI_PAGE_MASK;
-  End = ((UINTN) IoData->Buffer + IoData->Size + EFI_PAGE_SIZE - 1) & ~EFI_PAGE_MASK;
-  IoData->NumRef = NumSegments = (INT32)((End - Start) / EFI_PAGE_SIZE);
+  ASSERT (Dev->AsyncIo > 0);
+  if (--Dev->AsyncIo == 0) {
+    gBS->SetTimer (Dev->PollTimer, TimerCancel, 0);
+  }
+}
 
-  ASSERT (NumSegments <= BLKIF_MAX_SEGMENTS_PER_REQUEST);
+/**
+  Stop creating further requests for an operation, and complete it if it has
+  no requests in flight.
 
-  XenPvBlockWaitSlot (Dev);
-  RingIndex = Dev->Ring.req_prod_pvt;
-  Request = RING_GET_REQUEST (&Dev->Ring, RingIndex);
+  Must be called at TPL_NOTIFY.
 
-  Request->operation = IsWrite ? BLKIF_OP_WRITE : BLKIF_OP_READ;
-  Request->nr_segments = (UINT8)NumSegments;
-  Request->handle = Dev->DeviceId;
-  Request->id = (UINTN) IoData;
-  Request->sector_number = IoData->Sector;
+  @param Dev     A XEN_BLOCK_FRONT_DEVICE instance.
+  @param IoData  The operation to finish; it must not be Submitted yet.
+  @param Status  The status to report for the operation.
+**/
+STATIC
+VOID
+XenPvBlockFinishIo (
+  IN XEN_BLOCK_FRONT_DEVICE *Dev,
+  IN XEN_BLOCK_FRONT_IO     *IoData,
+  IN EFI_STATUS             Status
+  )
+{
+  ASSERT (!IoData->Submitted);
 
-  for (Index = 0; Index < NumSegments; Index++) {
-    Request->seg[Index].first_sect = 0;
-    Request->seg[Index].last_sect = EFI_PAGE_SIZE / 512 - 1;
-  }
-  Request->seg[0].first_sect = (UINT8)(((UINTN) IoData->Buffer & EFI_PAGE_MASK) / 512);
-  Request->seg[NumSegments - 1].last_sect =
-      (UINT8)((((UINTN) IoData->Buffer + IoData->Size - 1) & EFI_PAGE_MASK) / 512);
-  for (Index = 0; Index < NumSegments; Index++) {
-    UINTN Data = Start + Index * EFI_PAGE_SIZE;
-    XenBusIo->GrantAccess (XenBusIo, Dev->DomainId,
-                           Data >> EFI_PAGE_SHIFT, IsWrite,
-                           &Request->seg[Index].gref);
-    IoData->GrantRef[Index] = Request->seg[Index].gref;
+  IoData->Status = Status;
+  IoData->Submitted = TRUE;
+  RemoveEntryList (&IoData->Link);
+  if (IoData->InFlight == 0) {
+    XenPvBlockCompleteIo (Dev, IoData);
   }
+}
 
-  Dev->Ring.req_prod_pvt = RingIndex + 1;
+/**
+  Format the next ring request of an operation in a free slot.
 
-  MemoryFence ();
-  RING_PUSH_REQUESTS_AND_CHECK_NOTIFY (&Dev->Ring, Notify);
+  A read or write request covers at most Dev->MaxSegments pages of the
+  buffer; it is an indirect request if it needs more than
+  BLKIF_MAX_SEGMENTS_PER_REQUEST segments. With persistent grants, the data
+  is transferred through the slot's granted pages; otherwise the buffer pages
+  are granted for the duration of the request.
 
-  if (Notify) {
-    UINT32 ReturnCode;
-    ReturnCode = XenBusIo->EventChannelNotify (XenBusIo, Dev->EventChannel);
-    if (ReturnCode != 0) {
-      DEBUG ((EFI_D_ERROR,
-              "XenPvBlk: Unexpected return value from EventChannelNotify: %d\n",
-              ReturnCode));
-    }
-  }
-}
+  The backend is not notified; that's left to the caller.
 
-EFI_STATUS
-XenPvBlockIo (
-  IN OUT XEN_BLOCK_FRONT_IO *IoData,
-  IN     BOOLEAN            IsWrite
+  Must be called at TPL_NOTIFY, with at least one free slot.
+
+  @param Dev     A XEN_BLOCK_FRONT_DEVICE instance.
+  @param IoData  The operation to take the next request from. Its progress
+                 is updated.
+**/
+STATIC
+VOID
+XenPvBlockSubmitRequest (
+  IN     XEN_BLOCK_FRONT_DEVICE *Dev,
+  IN OUT XEN_BLOCK_FRONT_IO     *IoData
   )
 {
-  //
-  // Status value that correspond to an IO in progress.
-  //
-  IoData->Status = EFI_ALREADY_STARTED;
-  XenPvBlockAsyncIo (IoData, IsWrite);
+  XENBUS_PROTOCOL *XenBusIo = Dev->XenBusIo;
+  UINTN SlotIndex;
+  XEN_BLOCK_FRONT_SLOT *Slot;
+  blkif_request_t *Request;
+  blkif_request_indirect_t *IndirectRequest;
+  struct blkif_request_segment *Segments;
+  UINT8 Operation;
+  UINTN Offset, Size, Data, Start;
+  UINT32 NumSegments, Index;
 
-  while (IoData->Status == EFI_ALREADY_STARTED) {
-    XenPvBlockAsyncIoPoll (IoData->Dev);
+  ASSERT (Dev->FreeSlotCount > 0);
+  ASSERT (!RING_FULL (&Dev->Ring));
+
+  SlotIndex = Dev->FreeSlots[--Dev->FreeSlotCount];
+  Slot = &Dev->Slots[SlotIndex];
+  Request = RING_GET_REQUEST (&Dev->Ring, Dev->Ring.req_prod_pvt);
+
+  if (IoData->Size == 0) {
+    //
+    // Flush, see XenPvBlockFlushNeeded().
+    //
+    Request->operation = Dev->MediaInfo.FeatureFlushCache ?
+                         BLKIF_OP_FLUSH_DISKCACHE : BLKIF_OP_WRITE_BARRIER;
+    Request->nr_segments = 0;
+    Request->handle = Dev->DeviceId;
+    Request->id = SlotIndex;
+    /* Not needed anyway, but the backend will check it */
+    Request->sector_number = 0;
+    Slot->Size = 0;
+  } else {
+    Offset = (UINTN) IoData->Buffer & EFI_PAGE_MASK;
+    if (Offset == 0) {
+      Size = MIN (IoData->Size, Dev->MaxSegments * EFI_PAGE_SIZE);
+    } else {
+      Size = MIN (IoData->Size, (Dev->MaxSegments - 1) * EFI_PAGE_SIZE);
+    }
+
+    // Can't io at non-sector-aligned location
+    ASSERT(!(IoData->Sector & ((Dev->MediaInfo.SectorSize / 512) - 1)));
+    // Can't io non-sector-sized amounts
+    ASSERT(!(Size & (Dev->MediaInfo.SectorSize - 1)));
+
+    if (Dev->Persistent) {
+      Data = (UINTN) Slot->Bounce + Offset;
+      if (IoData->IsWrite) {
+        CopyMem ((VOID *) Data, IoData->Buffer, Size);
+      }
+    } else {
+      Data = (UINTN) IoData->Buffer;
+    }
+    Start = Data & ~EFI_PAGE_MASK;
+    NumSegments = (UINT32)((Data + Size - Start + EFI_PAGE_SIZE - 1) /
+                           EFI_PAGE_SIZE);
+    ASSERT (NumSegments <= Dev->MaxSegments);
+
+    Operation = IoData->IsWrite ? BLKIF_OP_WRITE : BLKIF_OP_READ;
+    if (NumSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST) {
+      ASSERT (Slot->Indirect != NULL);
+      IndirectRequest = (blkif_request_indirect_t *) Request;
+      IndirectRequest->operation = BLKIF_OP_INDIRECT;
+      IndirectRequest->indirect_op = Operation;
+      IndirectRequest->nr_segments = (UINT16)NumSegments;
+      IndirectRequest->handle = Dev->DeviceId;
+      IndirectRequest->id = SlotIndex;
+      IndirectRequest->sector_number = IoData->Sector;
+      IndirectRequest->indirect_grefs[0] = Slot->IndirectRef;
+      Segments = Slot->Indirect;
+    } else {
+      Request->operation = Operation;
+      Request->nr_segments = (UINT8)NumSegments;
+      Request->handle = Dev->DeviceId;
+      Request->id = SlotIndex;
+      Request->sector_number = IoData->Sector;
+      Segments = Request->seg;
+    }
+
+    for (Index = 0; Index < NumSegments; Index++) {
+      if (!Dev->Persistent) {
+        XenBusIo->GrantAccess (XenBusIo, Dev->DomainId,
+                               (Start >> EFI_PAGE_SHIFT) + Index,
+                               IoData->IsWrite, &Slot->GrantRef[Index]);
+      }
+      Segments[Index].gref = Slot->GrantRef[Index];
+      Segments[Index].first_sect = 0;
+      Segments[Index].last_sect = EFI_PAGE_SIZE / 512 - 1;
+    }
+    Segments[0].first_sect = (UINT8)((Data & EFI_PAGE_MASK) / 512);
+    Segments[NumSegments - 1].last_sect =
+        (UINT8)(((Data + Size - 1) & EFI_PAGE_MASK) / 512);
+    if (!Dev->Persistent) {
+      Slot->NumRef = NumSegments;
+    }
+
+    Slot->Buffer = IoData->Buffer;
+    Slot->Size = Size;
+    Slot->Sector = IoData->Sector;
+    IoData->Buffer += Size;
+    IoData->Size -= Size;
+    IoData->Sector += Size / 512;
   }
 
-  return IoData->Status;
+  Slot->IoData = IoData;
+  IoData->InFlight++;
+  Dev->Ring.req_prod_pvt++;
 }
 
+/**
+  Create ring requests for the pending operations, in submission order, while
+  free slots are available, and notify the backend about them.
+
+  A flush acts as a barrier: it is only submitted once all requests submitted
+  before it have completed.
+
+  Must be called at TPL_NOTIFY.
+
+  @param Dev  A XEN_BLOCK_FRONT_DEVICE instance.
+**/
 STATIC
 VOID
-XenPvBlockPushOperation (
-  IN XEN_BLOCK_FRONT_DEVICE *Dev,
-  IN UINT8                  Operation,
-  IN UINT64                 Id
+XenPvBlockSubmitPending (
+  IN XEN_BLOCK_FRONT_DEVICE *Dev
   )
 {
-  INT32 Index;
-  blkif_request_t *Request;
+  XEN_BLOCK_FRONT_IO *IoData;
+  BOOLEAN Pushed;
   BOOLEAN Notify;
 
-  XenPvBlockWaitSlot (Dev);
-  Index = Dev->Ring.req_prod_pvt;
-  Request = RING_GET_REQUEST(&Dev->Ring, Index);
-  Request->operation = Operation;
-  Request->nr_segments = 0;
-  Request->handle = Dev->DeviceId;
-  Request->id = Id;
-  /* Not needed anyway, but the backend will check it */
-  Request->sector_number = 0;
-  Dev->Ring.req_prod_pvt = Index + 1;
+  Pushed = FALSE;
+  while (!IsListEmpty (&Dev->PendingIo) && Dev->FreeSlotCount > 0) {
+    IoData = XEN_BLOCK_FRONT_IO_FROM_LINK (GetFirstNode (&Dev->PendingIo));
+    if (IoData->Size == 0) {
+      if (Dev->FreeSlotCount < Dev->SlotCount) {
+        break;
+      }
+      if (!XenPvBlockFlushNeeded (Dev)) {
+        XenPvBlockFinishIo (Dev, IoData, EFI_SUCCESS);
+        continue;
+      }
+    }
+
+    XenPvBlockSubmitRequest (Dev, IoData);
+    Pushed = TRUE;
+
+    if (IoData->Size == 0) {
+      IoData->Submitted = TRUE;
+      RemoveEntryList (&IoData->Link);
+    }
+  }
+
+  if (!Pushed) {
+    return;
+  }
+
   MemoryFence ();
   RING_PUSH_REQUESTS_AND_CHECK_NOTIFY (&Dev->Ring, Notify);
+
   if (Notify) {
     XENBUS_PROTOCOL *XenBusIo = Dev->XenBusIo;
     UINT32 ReturnCode;
@@ -554,39 +907,138 @@ XenPvBlockPushOperation (
   }
 }
 
+/**
+  Process one response of the backend: release the request's slot, and
+  complete its operation if it has no more requests outstanding.
+
+  Must be called at TPL_NOTIFY.
+
+  @param Dev       A XEN_BLOCK_FRONT_DEVICE instance.
+  @param Response  The response to process.
+**/
+STATIC
 VOID
-XenPvBlockSync (
-  IN XEN_BLOCK_FRONT_DEVICE *Dev
+XenPvBlockCompleteRequest (
+  IN XEN_BLOCK_FRONT_DEVICE *Dev,
+  IN blkif_response_t       *Response
   )
 {
-  if (Dev->MediaInfo.ReadWrite) {
-    if (Dev->MediaInfo.FeatureBarrier) {
-      XenPvBlockPushOperation (Dev, BLKIF_OP_WRITE_BARRIER, 0);
+  XENBUS_PROTOCOL *XenBusIo = Dev->XenBusIo;
+  XEN_BLOCK_FRONT_SLOT *Slot;
+  XEN_BLOCK_FRONT_IO *IoData;
+  INT16 Status;
+  UINT32 Index;
+
+  if (Response->id >= Dev->SlotCount ||
+      Dev->Slots[Response->id].IoData == NULL) {
+    DEBUG ((EFI_D_ERROR,
+            "XenPvBlk: unexpected response id %Lu (operation %d)\n",
+            Response->id, Response->operation));
+    return;
+  }
+  Slot = &Dev->Slots[Response->id];
+  IoData = Slot->IoData;
+  Status = Response->status;
+
+  switch (Response->operation) {
+  case BLKIF_OP_READ:
+  case BLKIF_OP_WRITE:
+  case BLKIF_OP_INDIRECT:
+    if (Status != BLKIF_RSP_OKAY) {
+      DEBUG ((EFI_D_ERROR,
+              "XenPvBlk: "
+              "%a error %d on %a at sector %Lx, num bytes %Lx\n",
+              IoData->IsWrite ? "write" : "read",
+              Status, Dev->NodeName,
+              (UINT64)Slot->Sector,
+              (UINT64)Slot->Size));
+    }
+
+    if (!Dev->Persistent) {
+      for (Index = 0; Index < Slot->NumRef; Index++) {
+        XenBusIo->GrantEndAccess (XenBusIo, Slot->GrantRef[Index]);
+      }
+      Slot->NumRef = 0;
+    } else if (!IoData->IsWrite && Status == BLKIF_RSP_OKAY) {
+      CopyMem (Slot->Buffer,
+               Slot->Bounce + ((UINTN) Slot->Buffer & EFI_PAGE_MASK),
+               Slot->Size);
     }
+    break;
 
-    if (Dev->MediaInfo.FeatureFlushCache) {
-      XenPvBlockPushOperation (Dev, BLKIF_OP_FLUSH_DISKCACHE, 0);
+  case BLKIF_OP_WRITE_BARRIER:
+  case BLKIF_OP_FLUSH_DISKCACHE:
+    if (Status == BLKIF_RSP_EOPNOTSUPP) {
+      //
+      // Don't try this operation again.
+      //
+      DEBUG ((EFI_D_WARN, "XenPvBlk: %a not supported\n",
+              Response->operation == BLKIF_OP_WRITE_BARRIER ?
+              "write barrier" : "flush"));
+      if (Response->operation == BLKIF_OP_WRITE_BARRIER) {
+        Dev->MediaInfo.FeatureBarrier = FALSE;
+      } else {
+        Dev->MediaInfo.FeatureFlushCache = FALSE;
+      }
+      Status = BLKIF_RSP_OKAY;
+    } else if (Status != BLKIF_RSP_OKAY) {
+      DEBUG ((EFI_D_ERROR, "XenPvBlk: %a error %d\n",
+              Response->operation == BLKIF_OP_WRITE_BARRIER ?
+              "write barrier" : "flush",
+              Status));
     }
+    break;
+
+  default:
+    DEBUG ((EFI_D_ERROR,
+            "XenPvBlk: unrecognized block operation %d response (status %d)\n",
+            Response->operation, Status));
+    break;
   }
 
-  /* Note: This won't finish if another thread enqueues requests.  */
-  while (TRUE) {
-    XenPvBlockAsyncIoPoll (Dev);
-    if (RING_FREE_REQUESTS (&Dev->Ring) == RING_SIZE (&Dev->Ring)) {
-      break;
+  Slot->IoData = NULL;
+  Dev->FreeSlots[Dev->FreeSlotCount++] = (UINTN) Response->id;
+
+  ASSERT (IoData->InFlight > 0);
+  IoData->InFlight--;
+  if (Status != BLKIF_RSP_OKAY) {
+    if (IoData->Submitted) {
+      IoData->Status = EFI_DEVICE_ERROR;
+    } else {
+      //
+      // Don't create further requests for a failed operation.
+      //
+      XenPvBlockFinishIo (Dev, IoData, EFI_DEVICE_ERROR);
+      return;
     }
   }
+  if (IoData->Submitted && IoData->InFlight == 0) {
+    XenPvBlockCompleteIo (Dev, IoData);
+  }
 }
 
-VOID
-XenPvBlockAsyncIoPoll (
+/**
+  Process the responses of the backend, and submit further pending requests
+  into the released slots.
+
+  Must be called at TPL_NOTIFY.
+
+  @param Dev  A XEN_BLOCK_FRONT_DEVICE instance.
+
+  @return The number of responses processed.
+**/
+STATIC
+UINTN
+XenPvBlockCollectCompleted (
   IN XEN_BLOCK_FRONT_DEVICE *Dev
   )
 {
   RING_IDX ProducerIndex, ConsumerIndex;
   blkif_response_t *Response;
   INT32 More;
+  UINTN Collected;
 
+  Collected = 0;
   do {
     ProducerIndex = Dev->Ring.sring->rsp_prod;
     /* Ensure we see queued responses up to 'ProducerIndex'. */
@@ -594,65 +1046,156 @@ XenPvBlockAsyncIoPoll (
     ConsumerIndex = Dev->Ring.rsp_cons;
 
     while (ConsumerIndex != ProducerIndex) {
-      XEN_BLOCK_FRONT_IO *IoData = NULL;
-      INT16 Status;
-
       Response = RING_GET_RESPONSE (&Dev->Ring, ConsumerIndex);
+      XenPvBlockCompleteRequest (Dev, Response);
+      Dev->Ring.rsp_cons = ++ConsumerIndex;
+      Collected++;
+    }
 
-      IoData = (VOID *) (UINTN) Response->id;
-      Status = Response->status;
-
-      switch (Response->operation) {
-      case BLKIF_OP_READ:
-      case BLKIF_OP_WRITE:
-        {
-          INT32 Index;
-
-          if (Status != BLKIF_RSP_OKAY) {
-            DEBUG ((EFI_D_ERROR,
-                    "XenPvBlk: "
-                    "%a error %d on %a at sector %Lx, num bytes %Lx\n",
-                    Response->operation == BLKIF_OP_READ ? "read" : "write",
-                    Status, IoData->Dev->NodeName,
-                    (UINT64)IoData->Sector,
-                    (UINT64)IoData->Size));
-          }
+    RING_FINAL_CHECK_FOR_RESPONSES (&Dev->Ring, More);
+  } while (More != 0);
 
-          for (Index = 0; Index < IoData->NumRef; Index++) {
-            Dev->XenBusIo->GrantEndAccess (Dev->XenBusIo, IoData->GrantRef[Index]);
-          }
+  XenPvBlockSubmitPending (Dev);
+  return Collected;
+}
 
-          break;
-        }
+STATIC
+VOID
+EFIAPI
+XenPvBlockPollTimer (
+  IN EFI_EVENT Event,
+  IN VOID      *Context
+  )
+{
+  XenPvBlockCollectCompleted (Context);
+}
 
-      case BLKIF_OP_WRITE_BARRIER:
-        if (Status != BLKIF_RSP_OKAY) {
-          DEBUG ((EFI_D_ERROR, "XenPvBlk: write barrier error %d\n", Status));
-        }
-        break;
-      case BLKIF_OP_FLUSH_DISKCACHE:
-        if (Status != BLKIF_RSP_OKAY) {
-          DEBUG ((EFI_D_ERROR, "XenPvBlk: flush error %d\n", Status));
-        }
-        break;
+/**
+  Initialize an operation.
 
-      default:
-        DEBUG ((EFI_D_ERROR,
-                "XenPvBlk: unrecognized block operation %d response (status %d)\n",
-                Response->operation, Status));
-        break;
-      }
+  See XenPvBlockAsyncIo() for the parameters.
+**/
+STATIC
+VOID
+XenPvBlockInitIo (
+  OUT XEN_BLOCK_FRONT_IO     *IoData,
+  IN  XEN_BLOCK_FRONT_DEVICE *Dev,
+  IN  UINTN                  Sector,
+  IN  UINTN                  Size,
+  IN  VOID                   *Buffer,
+  IN  BOOLEAN                IsWrite,
+  IN  EFI_BLOCK_IO2_TOKEN    *Token
+  )
+{
+  IoData->Signature = XEN_BLOCK_FRONT_IO_SIGNATURE;
+  IoData->Dev = Dev;
+  IoData->Token = Token;
+  IoData->Buffer = Buffer;
+  IoData->Size = Size;
+  IoData->Sector = Sector;
+  IoData->IsWrite = IsWrite;
+  IoData->Submitted = FALSE;
+  IoData->Done = FALSE;
+  IoData->InFlight = 0;
+  IoData->Status = EFI_SUCCESS;
+}
 
-      Dev->Ring.rsp_cons = ++ConsumerIndex;
-      if (IoData != NULL) {
-        IoData->Status = Status ? EFI_DEVICE_ERROR : EFI_SUCCESS;
-      }
-      if (Dev->Ring.rsp_cons != ConsumerIndex) {
-        /* We reentered, we must not continue here */
-        break;
-      }
+EFI_STATUS
+XenPvBlockAsyncIo (
+  IN     XEN_BLOCK_FRONT_DEVICE *Dev,
+  IN     UINTN                  Sector,
+  IN     UINTN                  Size,
+  IN OUT VOID                   *Buffer,
+  IN     BOOLEAN                IsWrite,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token
+  )
+{
+  XEN_BLOCK_FRONT_IO *IoData;
+  EFI_TPL OldTpl;
+
+  ASSERT (Token != NULL && Token->Event != NULL);
+
+  IoData = AllocatePool (sizeof *IoData);
+  if (IoData == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  XenPvBlockInitIo (IoData, Dev, Sector, Size, Buffer, IsWrite, Token);
+  Token->TransactionStatus = EFI_NOT_READY;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  if (Dev->AsyncIo++ == 0) {
+    gBS->SetTimer (Dev->PollTimer, TimerPeriodic, XEN_BLOCK_FRONT_POLL_PERIOD);
+  }
+  InsertTailList (&Dev->PendingIo, &IoData->Link);
+  XenPvBlockSubmitPending (Dev);
+  gBS->RestoreTPL (OldTpl);
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+XenPvBlockIo (
+  IN     XEN_BLOCK_FRONT_DEVICE *Dev,
+  IN     UINTN                  Sector,
+  IN     UINTN                  Size,
+  IN OUT VOID                   *Buffer,
+  IN     BOOLEAN                IsWrite
+  )
+{
+  XEN_BLOCK_FRONT_IO IoData;
+  EFI_TPL OldTpl;
+  BOOLEAN Done;
+
+  XenPvBlockInitIo (&IoData, Dev, Sector, Size, Buffer, IsWrite, NULL);
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  InsertTailList (&Dev->PendingIo, &IoData.Link);
+  XenPvBlockSubmitPending (Dev);
+  Done = IoData.Done;
+  gBS->RestoreTPL (OldTpl);
+
+  while (!Done) {
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    XenPvBlockCollectCompleted (Dev);
+    Done = IoData.Done;
+    gBS->RestoreTPL (OldTpl);
+    if (!Done) {
+      CpuPause ();
     }
+  }
 
-    RING_FINAL_CHECK_FOR_RESPONSES (&Dev->Ring, More);
-  } while (More != 0);
+  return IoData.Status;
+}
+
+VOID
+XenPvBlockAbortAll (
+  IN XEN_BLOCK_FRONT_DEVICE *Dev
+  )
+{
+  EFI_TPL OldTpl;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  while (!IsListEmpty (&Dev->PendingIo)) {
+    XenPvBlockFinishIo (
+      Dev,
+      XEN_BLOCK_FRONT_IO_FROM_LINK (GetFirstNode (&Dev->PendingIo)),
+      EFI_ABORTED
+      );
+  }
+
+  while (Dev->FreeSlotCount < Dev->SlotCount) {
+    if (XenPvBlockCollectCompleted (Dev) == 0) {
+      CpuPause ();
+    }
+  }
+  gBS->RestoreTPL (OldTpl);
+}
+
+VOID
+XenPvBlockSync (
+  IN XEN_BLOCK_FRONT_DEVICE *Dev
+  )
+{
+  XenPvBlockAbortAll (Dev);
+  XenPvBlockIo (Dev, 0, 0, NULL, TRUE);
 }
@@ -17,22 +17,83 @@
 #include <IndustryStandard/Xen/event_channel.h>
 #include <IndustryStandard/Xen/io/blkif.h>
 
+//
+// Largest shared ring the frontend asks for, as lb(pages), if the backend
+// offers "max-ring-page-order".
+//
+#define XEN_BLOCK_FRONT_MAX_RING_PAGE_ORDER     2
+#define XEN_BLOCK_FRONT_MAX_RING_PAGES          (1 << XEN_BLOCK_FRONT_MAX_RING_PAGE_ORDER)
+
+//
+// Largest number of segments (pages) the frontend puts in one indirect
+// request, if the backend offers "feature-max-indirect-segments". The
+// segments of one request must fit into one indirect page.
+//
+#define XEN_BLOCK_FRONT_MAX_INDIRECT_SEGMENTS   256
+
+//
+// Number of pages the frontend keeps granted for reuse, if the backend offers
+// "feature-persistent". This limits the number of requests in flight.
+//
+#define XEN_BLOCK_FRONT_MAX_PERSISTENT_PAGES    1024
+
+//
+// Polling period of the non-blocking (EFI_BLOCK_IO2_PROTOCOL) requests.
+//
+#define XEN_BLOCK_FRONT_POLL_PERIOD             EFI_TIMER_PERIOD_MILLISECONDS (1)
+
 typedef struct _XEN_BLOCK_FRONT_DEVICE XEN_BLOCK_FRONT_DEVICE;
 typedef struct _XEN_BLOCK_FRONT_IO XEN_BLOCK_FRONT_IO;
 
+#define XEN_BLOCK_FRONT_IO_SIGNATURE SIGNATURE_32 ('X', 'p', 'v', 'I')
+
+///
+/// A read, write or flush operation. It is carried out by one or more ring
+/// requests, each occupying one slot. A flush has a Size of zero.
+///
 struct _XEN_BLOCK_FRONT_IO
 {
+  UINT32                  Signature;
+  LIST_ENTRY              Link;       ///< On Dev->PendingIo while not Submitted.
   XEN_BLOCK_FRONT_DEVICE  *Dev;
-  UINT8                   *Buffer;
-  UINTN                   Size;
-  UINTN                   Sector; ///< 512 bytes sector.
-
-  grant_ref_t             GrantRef[BLKIF_MAX_SEGMENTS_PER_REQUEST];
-  INT32                   NumRef;
+  EFI_BLOCK_IO2_TOKEN     *Token;     ///< NULL for blocking operations.
+  UINT8                   *Buffer;    ///< Next byte to transfer.
+  UINTN                   Size;       ///< Bytes not covered by requests yet.
+  UINTN                   Sector;     ///< Next 512 bytes sector.
+  BOOLEAN                 IsWrite;
+  BOOLEAN                 Submitted;  ///< No more requests will be created.
+  BOOLEAN                 Done;       ///< Blocking operations only.
+  UINTN                   InFlight;   ///< Requests not completed yet.
 
   EFI_STATUS              Status;
 };
 
+#define XEN_BLOCK_FRONT_IO_FROM_LINK(l) \
+  CR (l, XEN_BLOCK_FRONT_IO, Link, XEN_BLOCK_FRONT_IO_SIGNATURE)
+
+///
+/// Frontend state of one ring request in flight. The request id is the slot
+/// index.
+///
+typedef struct
+{
+  XEN_BLOCK_FRONT_IO            *IoData;    ///< NULL if the slot is free.
+  UINT8                         *Buffer;    ///< Caller's buffer.
+  UINTN                         Size;
+  UINTN                         Sector;
+  UINT8                         *Bounce;    ///< Persistent grants only.
+
+  ///
+  /// Dev->MaxSegments grant references. With persistent grants, these are
+  /// the references of the Bounce pages, and they stay granted.
+  ///
+  grant_ref_t                   *GrantRef;
+  UINT32                        NumRef;
+
+  struct blkif_request_segment  *Indirect;  ///< NULL without indirect segments.
+  grant_ref_t                   IndirectRef;
+} XEN_BLOCK_FRONT_SLOT;
+
 typedef struct
 {
   UINT64    Sectors;
@@ -50,8 +111,11 @@ struct _XEN_BLOCK_FRONT_DEVICE {
   EFI_BLOCK_IO_PROTOCOL       BlockIo;
   domid_t                     DomainId;
 
+  EFI_BLOCK_IO2_PROTOCOL      BlockIo2;
+
   blkif_front_ring_t          Ring;
-  grant_ref_t                 RingRef;
+  UINT32                      RingPageOrder;
+  grant_ref_t                 RingRef[XEN_BLOCK_FRONT_MAX_RING_PAGES];
   evtchn_port_t               EventChannel;
   blkif_vdev_t                DeviceId;
 
@@ -61,10 +125,26 @@ struct _XEN_BLOCK_FRONT_DEVICE {
   VOID                        *StateWatchToken;
 
   XENBUS_PROTOCOL             *XenBusIo;
+
+  UINT32                      MaxSegments;  ///< Segments per request.
+  BOOLEAN                     Persistent;   ///< Using persistent grants.
+  XEN_BLOCK_FRONT_SLOT        *Slots;
+  UINTN                       SlotCount;
+  UINTN                       *FreeSlots;
+  UINTN                       FreeSlotCount;
+  grant_ref_t                 *GrantRefs;
+  VOID                        *IndirectPages;
+  VOID                        *BouncePages;
+
+  LIST_ENTRY                  PendingIo;
+  UINTN                       AsyncIo;      ///< Non-blocking operations.
+  EFI_EVENT                   PollTimer;
 };
 
 #define XEN_BLOCK_FRONT_FROM_BLOCK_IO(b) \
   CR (b, XEN_BLOCK_FRONT_DEVICE, BlockIo, XEN_BLOCK_FRONT_SIGNATURE)
+#define XEN_BLOCK_FRONT_FROM_BLOCK_IO2(b) \
+  CR (b, XEN_BLOCK_FRONT_DEVICE, BlockIo2, XEN_BLOCK_FRONT_SIGNATURE)
 
 EFI_STATUS
 XenPvBlockFrontInitialization (
@@ -78,20 +158,58 @@ XenPvBlockFrontShutdown (
   IN XEN_BLOCK_FRONT_DEVICE *Dev
   );
 
-VOID
+/**
+  Queue a read, write or flush operation for non-blocking completion.
+
+  On completion, Token->TransactionStatus is set to the status of the
+  operation, and Token->Event is signaled.
+
+  @param Dev      A XEN_BLOCK_FRONT_DEVICE instance.
+  @param Sector   The first 512 bytes sector to transfer.
+  @param Size     The number of bytes to transfer, zero for a flush.
+  @param Buffer   The buffer to transfer to or from.
+  @param IsWrite  Whether the operation is a write (or a flush).
+  @param Token    The token of the operation; Token->Event must not be NULL.
+
+  @retval EFI_SUCCESS           The operation has been queued.
+  @retval EFI_OUT_OF_RESOURCES  Memory allocation failed.
+**/
+EFI_STATUS
 XenPvBlockAsyncIo (
-  IN OUT XEN_BLOCK_FRONT_IO *IoData,
-  IN     BOOLEAN            IsWrite
+  IN     XEN_BLOCK_FRONT_DEVICE *Dev,
+  IN     UINTN                  Sector,
+  IN     UINTN                  Size,
+  IN OUT VOID                   *Buffer,
+  IN     BOOLEAN                IsWrite,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token
   );
 
+/**
+  Carry out a read, write or flush operation, and wait for its completion.
+
+  See XenPvBlockAsyncIo() for the parameters.
+
+  @retval EFI_SUCCESS       The operation completed.
+  @retval EFI_DEVICE_ERROR  The backend reported an error.
+  @retval EFI_ABORTED       The operation was aborted by a concurrent reset.
+**/
 EFI_STATUS
 XenPvBlockIo (
-  IN OUT XEN_BLOCK_FRONT_IO *IoData,
-  IN     BOOLEAN            IsWrite
+  IN     XEN_BLOCK_FRONT_DEVICE *Dev,
+  IN     UINTN                  Sector,
+  IN     UINTN                  Size,
+  IN OUT VOID                   *Buffer,
+  IN     BOOLEAN                IsWrite
   );
 
+/**
+  Abort the operations that have not been fully submitted yet, and wait until
+  the backend completes all requests in flight.
+
+  @param Dev  A XEN_BLOCK_FRONT_DEVICE instance.
+**/
 VOID
-XenPvBlockAsyncIoPoll (
+XenPvBlockAbortAll (
   IN XEN_BLOCK_FRONT_DEVICE *Dev
   );
 
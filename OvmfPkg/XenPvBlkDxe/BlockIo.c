@@ -52,6 +52,65 @@ EFI_BLOCK_IO_PROTOCOL  gXenPvBlkDxeBlockIo = {
   XenPvBlkDxeBlockIoFlushBlocks             // FlushBlocks
 };
 
+///
+/// Block I/O 2 Protocol instance
+///
+GLOBAL_REMOVE_IF_UNREFERENCED
+EFI_BLOCK_IO2_PROTOCOL  gXenPvBlkDxeBlockIo2 = {
+  &gXenPvBlkDxeBlockIoMedia,                // Media
+  XenPvBlkDxeBlockIo2Reset,                 // Reset
+  XenPvBlkDxeBlockIo2ReadBlocksEx,          // ReadBlocksEx
+  XenPvBlkDxeBlockIo2WriteBlocksEx,         // WriteBlocksEx
+  XenPvBlkDxeBlockIo2FlushBlocksEx          // FlushBlocksEx
+};
+
+/**
+  Check the parameters of a read or write request.
+
+  @param  Media      The media of the device.
+  @param  Lba        The starting Logical Block Address to read from/write to.
+  @param  BufferSize Size of Buffer, must be a multiple of device block size.
+  @param  Buffer     A pointer to the destination/source buffer for the data.
+  @param  IsWrite    Indicate if the operation is write or read.
+
+  @retval EFI_SUCCESS  The request can be carried out.
+  @return              See description of XenPvBlkDxeBlockIoReadBlocks and
+                       XenPvBlkDxeBlockIoWriteBlocks.
+**/
+STATIC
+EFI_STATUS
+XenPvBlkDxeCheckRequest (
+  IN EFI_BLOCK_IO_MEDIA     *Media,
+  IN EFI_LBA                Lba,
+  IN UINTN                  BufferSize,
+  IN VOID                   *Buffer,
+  IN BOOLEAN                IsWrite
+  )
+{
+  if (Buffer == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (BufferSize % Media->BlockSize != 0) {
+    DEBUG ((EFI_D_ERROR, "XenPvBlkDxe: Bad buffer size: 0x%Lx\n",
+      (UINT64)BufferSize));
+    return EFI_BAD_BUFFER_SIZE;
+  }
+
+  if (Lba > Media->LastBlock ||
+      (BufferSize / Media->BlockSize) - 1 > Media->LastBlock - Lba) {
+    DEBUG ((EFI_D_ERROR,
+      "XenPvBlkDxe: %a with invalid LBA: 0x%Lx, size: 0x%Lx\n",
+      IsWrite ? "Write" : "Read", Lba, (UINT64)BufferSize));
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (IsWrite && Media->ReadOnly) {
+    return EFI_WRITE_PROTECTED;
+  }
+
+  return EFI_SUCCESS;
+}
 
 
 
@@ -82,7 +141,6 @@ XenPvBlkDxeBlockIoReadWriteBlocks (
   IN     BOOLEAN                IsWrite
   )
 {
-  XEN_BLOCK_FRONT_IO IoData;
   EFI_BLOCK_IO_MEDIA *Media = This->Media;
   UINTN Sector;
   EFI_STATUS Status;
@@ -94,22 +152,9 @@ XenPvBlkDxeBlockIoReadWriteBlocks (
     return EFI_SUCCESS;
   }
 
-  if (BufferSize % Media->BlockSize != 0) {
-    DEBUG ((EFI_D_ERROR, "XenPvBlkDxe: Bad buffer size: 0x%Lx\n",
-      (UINT64)BufferSize));
-    return EFI_BAD_BUFFER_SIZE;
-  }
-
-  if (Lba > Media->LastBlock ||
-      (BufferSize / Media->BlockSize) - 1 > Media->LastBlock - Lba) {
-    DEBUG ((EFI_D_ERROR,
-      "XenPvBlkDxe: %a with invalid LBA: 0x%Lx, size: 0x%Lx\n",
-      IsWrite ? "Write" : "Read", Lba, (UINT64)BufferSize));
-    return EFI_INVALID_PARAMETER;
-  }
-
-  if (IsWrite && Media->ReadOnly) {
-    return EFI_WRITE_PROTECTED;
+  Status = XenPvBlkDxeCheckRequest (Media, Lba, BufferSize, Buffer, IsWrite);
+  if (EFI_ERROR (Status)) {
+    return Status;
   }
 
   if ((Media->IoAlign > 1) && (UINTN)Buffer & (Media->IoAlign - 1)) {
@@ -137,31 +182,18 @@ XenPvBlkDxeBlockIoReadWriteBlocks (
     return Status;
   }
 
-  IoData.Dev = XEN_BLOCK_FRONT_FROM_BLOCK_IO (This);
+  //
+  // BlockFront splits the transfer into ring requests, and keeps as many of
+  // them in flight as the ring allows.
+  //
   Sector = (UINTN)MultU64x32 (Lba, Media->BlockSize / 512);
-
-  while (BufferSize > 0) {
-    if (((UINTN)Buffer & EFI_PAGE_MASK) == 0) {
-      IoData.Size = MIN (BLKIF_MAX_SEGMENTS_PER_REQUEST * EFI_PAGE_SIZE,
-                         BufferSize);
-    } else {
-      IoData.Size = MIN ((BLKIF_MAX_SEGMENTS_PER_REQUEST - 1) * EFI_PAGE_SIZE,
-                         BufferSize);
-    }
-
-    IoData.Buffer = Buffer;
-    IoData.Sector = Sector;
-    BufferSize -= IoData.Size;
-    Buffer = (VOID*) ((UINTN) Buffer + IoData.Size);
-    Sector += IoData.Size / 512;
-    Status = XenPvBlockIo (&IoData, IsWrite);
-    if (EFI_ERROR (Status)) {
-      DEBUG ((EFI_D_ERROR, "XenPvBlkDxe: Error during %a operation.\n",
-              IsWrite ? "write" : "read"));
-      return Status;
-    }
+  Status = XenPvBlockIo (XEN_BLOCK_FRONT_FROM_BLOCK_IO (This), Sector,
+             BufferSize, Buffer, IsWrite);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "XenPvBlkDxe: Error during %a operation.\n",
+            IsWrite ? "write" : "read"));
   }
-  return EFI_SUCCESS;
+  return Status;
 }
 
 
@@ -248,8 +280,7 @@ XenPvBlkDxeBlockIoFlushBlocks (
   IN EFI_BLOCK_IO_PROTOCOL  *This
   )
 {
-  XenPvBlockSync (XEN_BLOCK_FRONT_FROM_BLOCK_IO (This));
-  return EFI_SUCCESS;
+  return XenPvBlockIo (XEN_BLOCK_FRONT_FROM_BLOCK_IO (This), 0, 0, NULL, TRUE);
 }
 
 /**
@@ -274,3 +305,195 @@ XenPvBlkDxeBlockIoReset (
   //
   return EFI_SUCCESS;
 }
+
+/**
+  Reset the block device hardware.
+
+  Operations that have not been fully submitted to the backend yet are
+  aborted; the function waits for the requests in flight to complete.
+
+  @param[in]  This                 Indicates a pointer to the calling context.
+  @param[in]  ExtendedVerification Not used.
+
+  @retval EFI_SUCCESS          The device was reset.
+
+**/
+EFI_STATUS
+EFIAPI
+XenPvBlkDxeBlockIo2Reset (
+  IN EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN BOOLEAN                 ExtendedVerification
+  )
+{
+  XenPvBlockAbortAll (XEN_BLOCK_FRONT_FROM_BLOCK_IO2 (This));
+  return EFI_SUCCESS;
+}
+
+/**
+  Read/Write BufferSize bytes from Lba into Buffer, without blocking if Token
+  carries an event.
+
+  This function is commun to XenPvBlkDxeBlockIo2ReadBlocksEx and
+  XenPvBlkDxeBlockIo2WriteBlocksEx.
+
+  @return See description of XenPvBlkDxeBlockIo2ReadBlocksEx and
+          XenPvBlkDxeBlockIo2WriteBlocksEx.
+**/
+STATIC
+EFI_STATUS
+XenPvBlkDxeBlockIo2ReadWriteBlocks (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  IN OUT VOID                   *Buffer,
+  IN     BOOLEAN                IsWrite
+  )
+{
+  XEN_BLOCK_FRONT_DEVICE *Dev = XEN_BLOCK_FRONT_FROM_BLOCK_IO2 (This);
+  EFI_BLOCK_IO_MEDIA *Media = This->Media;
+  EFI_STATUS Status;
+
+  if (Token == NULL || Token->Event == NULL) {
+    return XenPvBlkDxeBlockIoReadWriteBlocks (&Dev->BlockIo, MediaId, Lba,
+             BufferSize, Buffer, IsWrite);
+  }
+
+  if (BufferSize == 0) {
+    Token->TransactionStatus = EFI_SUCCESS;
+    gBS->SignalEvent (Token->Event);
+    return EFI_SUCCESS;
+  }
+
+  Status = XenPvBlkDxeCheckRequest (Media, Lba, BufferSize, Buffer, IsWrite);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // Unlike the blocking path, a misaligned buffer cannot be replaced by a
+  // bounce buffer here.
+  //
+  if ((Media->IoAlign > 1) && (UINTN)Buffer & (Media->IoAlign - 1)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  return XenPvBlockAsyncIo (Dev, (UINTN)MultU64x32 (Lba, Media->BlockSize / 512),
+           BufferSize, Buffer, IsWrite, Token);
+}
+
+/**
+  Read BufferSize bytes from Lba into Buffer.
+
+  @param[in]       This       Indicates a pointer to the calling context.
+  @param[in]       MediaId    Id of the media, changes every time the media is
+                              replaced.
+  @param[in]       Lba        The starting Logical Block Address to read from.
+  @param[in, out]  Token      A pointer to the token associated with the
+                              transaction.
+  @param[in]       BufferSize Size of Buffer, must be a multiple of device block
+                              size.
+  @param[out]      Buffer     A pointer to the destination buffer for the data.
+
+  @retval EFI_SUCCESS           The read request was queued if Token->Event is
+                                not NULL. The data was read correctly from the
+                                device if Token->Event is NULL.
+  @retval EFI_DEVICE_ERROR      The device reported an error while performing
+                                the read.
+  @retval EFI_BAD_BUFFER_SIZE   The BufferSize parameter is not a multiple of
+                                the intrinsic block size of the device.
+  @retval EFI_INVALID_PARAMETER The read request contains LBAs that are not
+                                valid, or the buffer is not on proper alignment.
+  @retval EFI_OUT_OF_RESOURCES  The request could not be completed due to a
+                                lack of resources.
+
+**/
+EFI_STATUS
+EFIAPI
+XenPvBlkDxeBlockIo2ReadBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  OUT    VOID                   *Buffer
+  )
+{
+  return XenPvBlkDxeBlockIo2ReadWriteBlocks (This,
+      MediaId, Lba, Token, BufferSize, Buffer, FALSE);
+}
+
+/**
+  Write BufferSize bytes from Buffer into Lba.
+
+  @param[in]       This       Indicates a pointer to the calling context.
+  @param[in]       MediaId    The media ID that the write request is for.
+  @param[in]       Lba        The starting logical block address to be written.
+  @param[in, out]  Token      A pointer to the token associated with the
+                              transaction.
+  @param[in]       BufferSize Size of Buffer, must be a multiple of device block
+                              size.
+  @param[in]       Buffer     A pointer to the source buffer for the data.
+
+  @retval EFI_SUCCESS           The write request was queued if Token->Event is
+                                not NULL. The data was written correctly to the
+                                device if Token->Event is NULL.
+  @retval EFI_WRITE_PROTECTED   The device can not be written to.
+  @retval EFI_DEVICE_ERROR      The device reported an error while performing
+                                the write.
+  @retval EFI_BAD_BUFFER_SIZE   The BufferSize parameter is not a multiple of
+                                the intrinsic block size of the device.
+  @retval EFI_INVALID_PARAMETER The write request contains LBAs that are not
+                                valid, or the buffer is not on proper alignment.
+  @retval EFI_OUT_OF_RESOURCES  The request could not be completed due to a
+                                lack of resources.
+
+**/
+EFI_STATUS
+EFIAPI
+XenPvBlkDxeBlockIo2WriteBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  IN     VOID                   *Buffer
+  )
+{
+  return XenPvBlkDxeBlockIo2ReadWriteBlocks (This,
+      MediaId, Lba, Token, BufferSize, Buffer, TRUE);
+}
+
+/**
+  Flush the Block Device.
+
+  The flush is ordered after all read and write requests queued before it.
+
+  @param[in]      This   Indicates a pointer to the calling context.
+  @param[in, out] Token  A pointer to the token associated with the
+                         transaction.
+
+  @retval EFI_SUCCESS           The flush request was queued if Token->Event is
+                                not NULL. All outstanding data was written to
+                                the device if Token->Event is NULL.
+  @retval EFI_DEVICE_ERROR      The device reported an error while writting
+                                back the data.
+  @retval EFI_OUT_OF_RESOURCES  The request could not be completed due to a
+                                lack of resources.
+
+**/
+EFI_STATUS
+EFIAPI
+XenPvBlkDxeBlockIo2FlushBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token
+  )
+{
+  XEN_BLOCK_FRONT_DEVICE *Dev = XEN_BLOCK_FRONT_FROM_BLOCK_IO2 (This);
+
+  if (Token == NULL || Token->Event == NULL) {
+    return XenPvBlockIo (Dev, 0, 0, NULL, TRUE);
+  }
+  return XenPvBlockAsyncIo (Dev, 0, 0, NULL, TRUE, Token);
+}
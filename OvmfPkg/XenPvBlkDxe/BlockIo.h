@@ -105,4 +105,41 @@ XenPvBlkDxeBlockIoReset (
   );
 
 extern EFI_BLOCK_IO_MEDIA  gXenPvBlkDxeBlockIoMedia;
+EFI_STATUS
+EFIAPI
+XenPvBlkDxeBlockIo2Reset (
+  IN EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN BOOLEAN                 ExtendedVerification
+  );
+
+EFI_STATUS
+EFIAPI
+XenPvBlkDxeBlockIo2ReadBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  OUT    VOID                   *Buffer
+  );
+
+EFI_STATUS
+EFIAPI
+XenPvBlkDxeBlockIo2WriteBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN     UINT32                 MediaId,
+  IN     EFI_LBA                Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token,
+  IN     UINTN                  BufferSize,
+  IN     VOID                   *Buffer
+  );
+
+EFI_STATUS
+EFIAPI
+XenPvBlkDxeBlockIo2FlushBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL *This,
+  IN OUT EFI_BLOCK_IO2_TOKEN    *Token
+  );
+
 extern EFI_BLOCK_IO_PROTOCOL  gXenPvBlkDxeBlockIo;
+extern EFI_BLOCK_IO2_PROTOCOL  gXenPvBlkDxeBlockIo2;
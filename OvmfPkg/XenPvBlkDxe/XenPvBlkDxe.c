@@ -1,5 +1,5 @@
 /** @file
-  This driver produce a BlockIo protocol instance for a Xen PV block device.
+  This driver produce BlockIo and BlockIo2 protocol instances for a Xen PV block device.
 
   This driver support XenBus protocol of type 'vbd'. Every function that
   comsume XenBus protocol are in BlockFront, which the implementation to access
@@ -281,6 +281,8 @@ XenPvBlkDxeDriverBindingStart (
   }
 
   CopyMem (&Dev->BlockIo, &gXenPvBlkDxeBlockIo, sizeof (EFI_BLOCK_IO_PROTOCOL));
+  CopyMem (&Dev->BlockIo2, &gXenPvBlkDxeBlockIo2,
+    sizeof (EFI_BLOCK_IO2_PROTOCOL));
   Media = AllocateCopyPool (sizeof (EFI_BLOCK_IO_MEDIA),
                             &gXenPvBlkDxeBlockIoMedia);
   if (Dev->MediaInfo.VDiskInfo & VDISK_REMOVABLE) {
@@ -303,10 +305,12 @@ XenPvBlkDxeDriverBindingStart (
   }
   ASSERT (Media->BlockSize % 512 == 0);
   Dev->BlockIo.Media = Media;
+  Dev->BlockIo2.Media = Media;
 
   Status = gBS->InstallMultipleProtocolInterfaces (
                     &ControllerHandle,
                     &gEfiBlockIoProtocolGuid, &Dev->BlockIo,
+                    &gEfiBlockIo2ProtocolGuid, &Dev->BlockIo2,
                     NULL
                     );
   if (EFI_ERROR (Status)) {
@@ -375,14 +379,17 @@ XenPvBlkDxeDriverBindingStop (
     return Status;
   }
 
-  Status = gBS->UninstallProtocolInterface (ControllerHandle,
-                  &gEfiBlockIoProtocolGuid, BlockIo);
+  Media = BlockIo->Media;
+  Dev = XEN_BLOCK_FRONT_FROM_BLOCK_IO (BlockIo);
+
+  Status = gBS->UninstallMultipleProtocolInterfaces (ControllerHandle,
+                  &gEfiBlockIoProtocolGuid, &Dev->BlockIo,
+                  &gEfiBlockIo2ProtocolGuid, &Dev->BlockIo2,
+                  NULL);
   if (EFI_ERROR (Status)) {
     return Status;
   }
 
-  Media = BlockIo->Media;
-  Dev = XEN_BLOCK_FRONT_FROM_BLOCK_IO (BlockIo);
   XenPvBlockFrontShutdown (Dev);
 
   FreePool (Media);
@@ -101,6 +101,82 @@ typedef union {
   UINT64    Uint64;
 } GHCB_EXIT_INFO;
 
+//
+// Every CPU owns GHCB_PER_CPU_PAGES consecutive pages: its GHCB page, which is
+// shared with the hypervisor, followed by an encrypted page holding the
+// SEV_ES_PER_CPU_DATA of the #VC handler.
+//
+#define GHCB_PER_CPU_PAGES       2
+
+//
+// CPUID results cached by the #VC handler, so that repeated CPUID
+// instructions need no VMGEXIT. The cache is direct-mapped, keyed by the
+// EAX and ECX inputs, plus XCR0 for leaf 0xD.
+//
+#define SEV_ES_CPUID_CACHE_SIZE  64
+
+typedef struct {
+  UINT64                 XCr0;
+  UINT32                 EaxIn;
+  UINT32                 EcxIn;
+  UINT32                 Eax;
+  UINT32                 Ebx;
+  UINT32                 Ecx;
+  UINT32                 Edx;
+  BOOLEAN                Valid;
+} SEV_ES_CPUID_CACHE_ENTRY;
+
+//
+// Decoded MMIO instructions cached by the #VC handler, indexed by RIP. Only
+// the effective address and the register operand are evaluated per fault.
+// The instruction bytes are kept so that an entry whose code was replaced
+// (e.g. by unloading and loading an image at the same address) is detected
+// and decoded again.
+//
+#define SEV_ES_MMIO_CACHE_SIZE   16
+#define SEV_ES_MAX_INSN_LENGTH   15
+
+typedef struct {
+  UINT64                 Rip;
+  UINT8                  Length;
+  UINT8                  Bytes[SEV_ES_MAX_INSN_LENGTH];
+  UINT8                  PrefixLength;
+  UINT8                  DataSize;
+  UINT8                  AddrSize;
+  UINT8                  RexPrefix;
+  UINT8                  ModRm;
+  UINT8                  Sib;
+  BOOLEAN                SibPresent;
+  UINT8                  Reserved;
+} SEV_ES_MMIO_CACHE_ENTRY;
+
+typedef struct {
+  SEV_ES_CPUID_CACHE_ENTRY  CpuidCache[SEV_ES_CPUID_CACHE_SIZE];
+  UINT64                    CpuidCacheHits;
+  UINT64                    CpuidCacheMisses;
+
+  SEV_ES_MMIO_CACHE_ENTRY   MmioCache[SEV_ES_MMIO_CACHE_SIZE];
+  UINT64                    MmioCacheHits;
+  UINT64                    MmioCacheMisses;
+
+  //
+  // Optional unencrypted scratch area for string I/O, used in place of the
+  // GHCB shared buffer when ScratchSize is not zero.
+  //
+  UINT64                    ScratchBase;
+  UINT64                    ScratchSize;
+  UINT64                    ScratchExitsAvoided;
+} SEV_ES_PER_CPU_DATA;
+
+static inline
+SEV_ES_PER_CPU_DATA *
+GhcbGetPerCpuData(
+  GHCB                   *Ghcb
+  )
+{
+  return (SEV_ES_PER_CPU_DATA *) ((UINT8 *) Ghcb + SIZE_4KB);
+}
+
 static inline
 BOOLEAN
 GhcbIsRegValid(
@@ -142,23 +218,19 @@ VmgException(
   }
 }
 
+/*
+ * Interpret the hypervisor's response to a VMGEXIT.  Returns 0 on success,
+ * or the exception to raise.
+ */
 static inline
 UINTN
-VmgExit(
-  GHCB                   *Ghcb,
-  UINT64                 ExitCode,
-  UINT64                 ExitInfo1,
-  UINT64                 ExitInfo2
+VmgExitResult(
+  GHCB                   *Ghcb
   )
 {
   GHCB_EXIT_INFO   ExitInfo;
   UINTN            Reason, Action;
 
-  Ghcb->SaveArea.SwExitCode = ExitCode;
-  Ghcb->SaveArea.SwExitInfo1 = ExitInfo1;
-  Ghcb->SaveArea.SwExitInfo2 = ExitInfo2;
-  AsmVmgExit ();
-
   if (!Ghcb->SaveArea.SwExitInfo1) {
     return 0;
   }
@@ -177,6 +249,23 @@ VmgExit(
   return Reason;
 }
 
+static inline
+UINTN
+VmgExit(
+  GHCB                   *Ghcb,
+  UINT64                 ExitCode,
+  UINT64                 ExitInfo1,
+  UINT64                 ExitInfo2
+  )
+{
+  Ghcb->SaveArea.SwExitCode = ExitCode;
+  Ghcb->SaveArea.SwExitInfo1 = ExitInfo1;
+  Ghcb->SaveArea.SwExitInfo2 = ExitInfo2;
+  AsmVmgExit ();
+
+  return VmgExitResult (Ghcb);
+}
+
 static inline
 VOID
 VmgInit(
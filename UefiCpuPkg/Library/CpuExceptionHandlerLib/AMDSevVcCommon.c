@@ -2,386 +2,107 @@
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include "AMDSevVcCommon.h"
+#include "AMDSevVcDecode.h"
 
 #define CR4_OSXSAVE (1 << 18)
 
-typedef enum {
-  LongMode64Bit        = 0,
-  LongModeCompat32Bit,
-  LongModeCompat16Bit,
-} SEV_ES_INSTRUCTION_MODE;
-
-typedef enum {
-  Size8Bits            = 0,
-  Size16Bits,
-  Size32Bits,
-  Size64Bits,
-} SEV_ES_INSTRUCTION_SIZE;
-
-typedef enum {
-  SegmentEs            = 0,
-  SegmentCs,
-  SegmentSs,
-  SegmentDs,
-  SegmentFs,
-  SegmentGs,
-} SEV_ES_INSTRUCTION_SEGMENT;
-
-typedef enum {
-  RepNone              = 0,
-  RepZ,
-  RepNZ,
-} SEV_ES_INSTRUCTION_REP;
-
-typedef union {
-  struct {
-    UINT8  B:1;
-    UINT8  X:1;
-    UINT8  R:1;
-    UINT8  W:1;
-    UINT8  REX:4;
-  } Bits;
-
-  UINT8  Uint8;
-} SEV_ES_INSTRUCTION_REX_PREFIX;
-
-typedef union {
-  struct {
-    UINT8  Rm:3;
-    UINT8  Reg:3;
-    UINT8  Mod:2;
-  } Bits;
-
-  UINT8  Uint8;
-} SEV_ES_INSTRUCTION_MODRM;
-
-typedef union {
-  struct {
-    UINT8  Base:3;
-    UINT8  Index:3;
-    UINT8  Scale:2;
-  } Bits;
-
-  UINT8  Uint8;
-} SEV_ES_INSTRUCTION_SIB;
-
-typedef struct {
-  struct {
-    UINT8  Rm;
-    UINT8  Reg;
-    UINT8  Mod;
-  } ModRm;
-
-  struct {
-    UINT8  Base;
-    UINT8  Index;
-    UINT8  Scale;
-  } Sib;
-
-  UINTN  RegData;
-  UINTN  RmData;
-} SEV_ES_INSTRUCTION_OPCODE_EXT;
-
-typedef struct {
-  GHCB                           *Ghcb;
-
-  SEV_ES_INSTRUCTION_MODE        Mode;
-  SEV_ES_INSTRUCTION_SIZE        DataSize;
-  SEV_ES_INSTRUCTION_SIZE        AddrSize;
-  BOOLEAN                        SegmentSpecified;
-  SEV_ES_INSTRUCTION_SEGMENT     Segment;
-  SEV_ES_INSTRUCTION_REP         RepMode;
-  UINT8                          *OpCodes;
-  UINT8                          *Displacement;
-
-  SEV_ES_INSTRUCTION_REX_PREFIX  RexPrefix;
-
-  BOOLEAN                        ModRmPresent;
-  SEV_ES_INSTRUCTION_MODRM       ModRm;
-
-  BOOLEAN                        SibPresent;
-  SEV_ES_INSTRUCTION_SIB         Sib;
-
-  BOOLEAN                        DisplacementSize;
-
-  SEV_ES_INSTRUCTION_OPCODE_EXT  Ext;
-} SEV_ES_INSTRUCTION_DATA;
-
 static
 VOID
-InitInstructionData (
-  SEV_ES_INSTRUCTION_DATA  *InstructionData,
+HardwareVmgExit (
   GHCB                     *Ghcb
   )
 {
-  SetMem (InstructionData, sizeof (*InstructionData), 0);
-  InstructionData->Ghcb = Ghcb;
-}
-
-static
-UINT64 *
-GetRegisterPointer (
-  EFI_SYSTEM_CONTEXT_X64   *Regs,
-  UINT8                    Register
-  )
-{
-  switch (Register) {
-  case 0:
-    return &Regs->Rax;
-  case 1:
-    return &Regs->Rcx;
-  case 2:
-    return &Regs->Rdx;
-  case 3:
-    return &Regs->Rbx;
-  case 4:
-    return &Regs->Rsp;
-  case 5:
-    return &Regs->Rbp;
-  case 6:
-    return &Regs->Rsi;
-  case 7:
-    return &Regs->Rdi;
-  case 8:
-    return &Regs->R8;
-  case 9:
-    return &Regs->R9;
-  case 10:
-    return &Regs->R10;
-  case 11:
-    return &Regs->R11;
-  case 12:
-    return &Regs->R12;
-  case 13:
-    return &Regs->R13;
-  case 14:
-    return &Regs->R14;
-  case 15:
-    return &Regs->R15;
-  }
-  ASSERT (0);
-
-  return 0;
+  AsmVmgExit ();
 }
 
 static
-BOOLEAN
-IsRipRelative (
-  SEV_ES_INSTRUCTION_DATA  *InstructionData
+UINTN
+VcExit (
+  SEV_ES_VMGEXIT           VmgExitFunction,
+  GHCB                     *Ghcb,
+  UINT64                   ExitCode,
+  UINT64                   ExitInfo1,
+  UINT64                   ExitInfo2
   )
 {
-  SEV_ES_INSTRUCTION_OPCODE_EXT  *Ext = &InstructionData->Ext;
+  Ghcb->SaveArea.SwExitCode = ExitCode;
+  Ghcb->SaveArea.SwExitInfo1 = ExitInfo1;
+  Ghcb->SaveArea.SwExitInfo2 = ExitInfo2;
+  VmgExitFunction (Ghcb);
 
-  return ((InstructionData == LongMode64Bit) &&
-          (Ext->ModRm.Mod == 0) &&
-          (Ext->ModRm.Rm == 5)  &&
-          (InstructionData->SibPresent == FALSE));
+  return VmgExitResult (Ghcb);
 }
 
 static
-UINTN
-GetEffectiveMemoryAddress (
-  EFI_SYSTEM_CONTEXT_X64   *Regs,
-  SEV_ES_INSTRUCTION_DATA  *InstructionData
+SEV_ES_MMIO_CACHE_ENTRY *
+MmioCacheEntry (
+  GHCB                     *Ghcb,
+  UINT64                   Rip
   )
 {
-  SEV_ES_INSTRUCTION_OPCODE_EXT  *Ext = &InstructionData->Ext;
-  UINTN                          EffectiveAddress = 0;
-
-  if (IsRipRelative (InstructionData)) {
-    /* RIP-relative displacement is a 32-bit signed value */
-    INT32 RipRelative = *(INT32 *)InstructionData->Displacement;
-
-    EffectiveAddress = (UINTN)((INTN)Regs->Rip + RipRelative);
-
-    return EffectiveAddress;
-  }
-
-  switch (Ext->ModRm.Mod) {
-  case 1:
-  case 2:
-    switch (InstructionData->AddrSize) {
-    case Size8Bits:
-      InstructionData->DisplacementSize = 1;
-      EffectiveAddress += (UINT8) (*(UINT8 *) (InstructionData->Displacement));
-      break;
-    case Size16Bits:
-      InstructionData->DisplacementSize = 2;
-      EffectiveAddress += (UINT16) (*(UINT16 *) (InstructionData->Displacement));
-      break;
-    case Size32Bits:
-      InstructionData->DisplacementSize = 4;
-      EffectiveAddress += (UINT32) (*(UINT32 *) (InstructionData->Displacement));
-      break;
-    case Size64Bits:
-      InstructionData->DisplacementSize = 8;
-      EffectiveAddress += (UINT64) (*(UINT64 *) (InstructionData->Displacement));
-      break;
-    }
-    break;
-  }
+  SEV_ES_PER_CPU_DATA  *PerCpuData;
 
-  if (InstructionData->SibPresent) {
-    switch (Ext->Sib.Index) {
-    case 4:
-      break;
-    default:
-      EffectiveAddress += (*GetRegisterPointer (Regs, Ext->Sib.Index) << Ext->Sib.Scale);
-    }
+  PerCpuData = GhcbGetPerCpuData (Ghcb);
 
-    switch (Ext->Sib.Base) {
-    case 5:
-      if (Ext->ModRm.Mod) {
-        EffectiveAddress += *GetRegisterPointer (Regs, Ext->Sib.Base);
-      }
-      break;
-    default:
-      EffectiveAddress += *GetRegisterPointer (Regs, Ext->Sib.Base);
-    }
-  } else {
-    EffectiveAddress += *GetRegisterPointer (Regs, Ext->ModRm.Rm);
-  }
-
-  return EffectiveAddress;
+  return &PerCpuData->MmioCache[(Rip ^ (Rip >> 4)) % SEV_ES_MMIO_CACHE_SIZE];
 }
 
 static
-UINT64
-DecodePrefixes (
+BOOLEAN
+MmioCacheLookup (
+  SEV_ES_MMIO_CACHE_ENTRY  *Entry,
   EFI_SYSTEM_CONTEXT_X64   *Regs,
   SEV_ES_INSTRUCTION_DATA  *InstructionData
   )
 {
-  SEV_ES_INSTRUCTION_MODE  Mode;
-  SEV_ES_INSTRUCTION_SIZE  ModeDataSize;
-  SEV_ES_INSTRUCTION_SIZE  ModeAddrSize;
-  UINT8                    *Byte;
-
-  /*TODO: Determine current mode - 64-bit for now */
-  Mode = LongMode64Bit;
-  ModeDataSize = Size32Bits;
-  ModeAddrSize = Size64Bits;
-
-  InstructionData->Mode = Mode;
-  InstructionData->DataSize = ModeDataSize;
-  InstructionData->AddrSize = ModeAddrSize;
-
-  Byte = (UINT8 *) Regs->Rip;
-  while (TRUE) {
-    switch (*Byte) {
-    case 0x26:
-    case 0x2E:
-    case 0x36:
-    case 0x3E:
-      if (Mode != LongMode64Bit) {
-        InstructionData->SegmentSpecified = TRUE;
-        InstructionData->Segment = (*Byte >> 3) & 3;
-      }
-      break;
-    case 0x40 ... 0x4F:
-      InstructionData->RexPrefix.Uint8 = *Byte;
-      if (*Byte & 0x08)
-        InstructionData->DataSize = Size64Bits;
-      break;
-    case 0x64:
-      InstructionData->SegmentSpecified = TRUE;
-      InstructionData->Segment = *Byte & 7;
-      break;
-    case 0x66:
-      if (!InstructionData->RexPrefix.Uint8) {
-        InstructionData->DataSize =
-          (Mode == LongMode64Bit)       ? Size16Bits :
-          (Mode == LongModeCompat32Bit) ? Size16Bits :
-          (Mode == LongModeCompat16Bit) ? Size32Bits : 0;
-      }
-      break;
-    case 0x67:
-      InstructionData->AddrSize =
-        (Mode == LongMode64Bit)       ? Size32Bits :
-        (Mode == LongModeCompat32Bit) ? Size16Bits :
-        (Mode == LongModeCompat16Bit) ? Size32Bits : 0;
-      break;
-    case 0xF0:
-      break;
-    case 0xF2:
-      InstructionData->RepMode = RepZ;
-      break;
-    case 0xF3:
-      InstructionData->RepMode = RepNZ;
-      break;
-    default:
-      InstructionData->OpCodes = Byte;
-      InstructionData->Displacement = Byte + 1;
-      return (UINT64) Byte;
-    }
-
-    Byte++;
+  if (Entry->Length == 0 || Entry->Rip != Regs->Rip ||
+      CompareMem ((VOID *) Regs->Rip, Entry->Bytes, Entry->Length) != 0) {
+    return FALSE;
   }
-}
 
-static
-VOID
-DecodeModRm (
-  EFI_SYSTEM_CONTEXT_X64   *Regs,
-  SEV_ES_INSTRUCTION_DATA  *InstructionData
-  )
-{
-  SEV_ES_INSTRUCTION_REX_PREFIX  *RexPrefix = &InstructionData->RexPrefix;
-  SEV_ES_INSTRUCTION_OPCODE_EXT  *Ext = &InstructionData->Ext;
-  SEV_ES_INSTRUCTION_MODRM       *ModRm = &InstructionData->ModRm;
-  SEV_ES_INSTRUCTION_SIB         *Sib = &InstructionData->Sib;
+  InstructionData->Mode = LongMode64Bit;
+  InstructionData->DataSize = Entry->DataSize;
+  InstructionData->AddrSize = Entry->AddrSize;
+  InstructionData->RexPrefix.Uint8 = Entry->RexPrefix;
+  InstructionData->OpCodes = (UINT8 *) Regs->Rip + Entry->PrefixLength;
 
-  InstructionData->Displacement++;
   InstructionData->ModRmPresent = TRUE;
-  ModRm->Uint8 = *(InstructionData->OpCodes + 1);
-
-  Ext->ModRm.Mod = ModRm->Bits.Mod;
-  Ext->ModRm.Reg = (RexPrefix->Bits.R << 3) | ModRm->Bits.Reg;
-  Ext->ModRm.Rm  = (RexPrefix->Bits.B << 3) | ModRm->Bits.Rm;
-
-  Ext->RegData = *GetRegisterPointer (Regs, Ext->ModRm.Reg);
-
-  if (Ext->ModRm.Mod == 3) {
-    Ext->RmData = *GetRegisterPointer (Regs, Ext->ModRm.Rm);
-  } else {
-    if (ModRm->Bits.Rm == 4) {
-      InstructionData->Displacement++;
-
-      InstructionData->SibPresent = TRUE;
-      Sib->Uint8 = *(InstructionData->OpCodes + 2);
-
-      Ext->Sib.Scale = Sib->Bits.Scale;
-      Ext->Sib.Index = (RexPrefix->Bits.X << 3) | Sib->Bits.Index;
-      Ext->Sib.Base  = (RexPrefix->Bits.B << 3) | Sib->Bits.Base;
-    }
+  InstructionData->ModRm.Uint8 = Entry->ModRm;
+  InstructionData->SibPresent = Entry->SibPresent;
+  InstructionData->Sib.Uint8 = Entry->Sib;
+  InstructionData->Displacement = InstructionData->OpCodes + 2 +
+                                  (Entry->SibPresent ? 1 : 0);
 
-    Ext->RmData = GetEffectiveMemoryAddress (Regs, InstructionData);
-  }
-}
+  DecodeModRmExt (InstructionData);
 
-static
-UINT64
-DecodeInstruction (
-  EFI_SYSTEM_CONTEXT_X64   *Regs,
-  SEV_ES_INSTRUCTION_DATA  *InstructionData
-  )
-{
-  return DecodePrefixes (Regs, InstructionData);
+  return TRUE;
 }
 
 static
 VOID
-AdvanceRip (
+MmioCacheStore (
+  SEV_ES_MMIO_CACHE_ENTRY  *Entry,
   EFI_SYSTEM_CONTEXT_X64   *Regs,
-  UINTN                    Bytes
+  SEV_ES_INSTRUCTION_DATA  *InstructionData,
+  UINTN                    Length
   )
 {
-  SEV_ES_INSTRUCTION_DATA  InstructionData;
-
-  InitInstructionData (&InstructionData, NULL);
+  if (Length > SEV_ES_MAX_INSN_LENGTH) {
+    Entry->Length = 0;
+    return;
+  }
 
-  Regs->Rip = DecodePrefixes (Regs, &InstructionData);
-  Regs->Rip += Bytes;
+  Entry->Rip = Regs->Rip;
+  Entry->Length = (UINT8) Length;
+  CopyMem (Entry->Bytes, (VOID *) Regs->Rip, Length);
+  Entry->PrefixLength = (UINT8) (InstructionData->OpCodes -
+                                 (UINT8 *) Regs->Rip);
+  Entry->DataSize = (UINT8) InstructionData->DataSize;
+  Entry->AddrSize = (UINT8) InstructionData->AddrSize;
+  Entry->RexPrefix = InstructionData->RexPrefix.Uint8;
+  Entry->ModRm = InstructionData->ModRm.Uint8;
+  Entry->Sib = InstructionData->Sib.Uint8;
+  Entry->SibPresent = InstructionData->SibPresent;
 }
 
 static
@@ -390,228 +111,113 @@ MmioExit (
   GHCB                     *Ghcb,
   EFI_SYSTEM_CONTEXT_X64   *Regs,
   UINTN                    ExitCode,
-  SEV_ES_INSTRUCTION_DATA  *InstructionData
+  SEV_ES_INSTRUCTION_DATA  *InstructionData,
+  SEV_ES_VMGEXIT           VmgExitFunction
   )
 {
   UINT64                   ExitInfo1, ExitInfo2;
   UINT8                    *OpCode;
   UINTN                    Status;
   UINTN                    Bytes;
+  BOOLEAN                  Write;
   UINTN                    *Register;
   UINTN                    InstructionLength;
-
-  OpCode = (UINT8 *) DecodeInstruction (Regs, InstructionData);
-  Bytes = 0;
-
-  InstructionLength = 1;
-
-  switch (*OpCode) {
-  /* MMIO write */
-  case 0x88:
-    Bytes = 1;
-  case 0x89:
-    DecodeModRm (Regs, InstructionData);
-    Bytes = (Bytes) ? Bytes
-                    : (InstructionData->DataSize == Size16Bits) ? 2
-                    : (InstructionData->DataSize == Size32Bits) ? 4
-                    : (InstructionData->DataSize == Size64Bits) ? 8
-                    : 0;
-
-    if (InstructionData->Ext.ModRm.Mod == 3) {
-      /* NPF on two register operands??? */
-      VmgExit (Ghcb, SvmExitUnsupported, ExitCode, 0);
-      ASSERT (0);
-    }
-
-    ExitInfo1 = InstructionData->Ext.RmData;
-    ExitInfo2 = Bytes;
-    CopyMem (Ghcb->SharedBuffer, &InstructionData->Ext.RegData, Bytes);
-
-    Ghcb->SaveArea.SwScratch = (UINT64) Ghcb->SharedBuffer;
-    Status = VmgExit (Ghcb, SvmExitMmioWrite, ExitInfo1, ExitInfo2);
-    if (Status) {
-      break;
+  SEV_ES_MMIO_CACHE_ENTRY  *CacheEntry;
+  BOOLEAN                  CacheHit;
+
+  /*
+   * Framebuffer and device register accesses fault on the same few
+   * instructions over and over again, so the decoded form is cached by RIP.
+   */
+  CacheEntry = MmioCacheEntry (Ghcb, Regs->Rip);
+  CacheHit = MmioCacheLookup (CacheEntry, Regs, InstructionData);
+  if (CacheHit) {
+    GhcbGetPerCpuData (Ghcb)->MmioCacheHits++;
+    OpCode = InstructionData->OpCodes;
+  } else {
+    GhcbGetPerCpuData (Ghcb)->MmioCacheMisses++;
+    OpCode = (UINT8 *) DecodeInstruction (Regs, InstructionData);
+    if (*OpCode >= 0x88 && *OpCode <= 0x8B) {
+      DecodeModRm (InstructionData);
     }
-    break;
+  }
 
-  /* MMIO read */
-  case 0x8A:
-    Bytes = 1;
-  case 0x8B:
-    DecodeModRm (Regs, InstructionData);
-    Bytes = (Bytes) ? Bytes
-                    : (InstructionData->DataSize == Size16Bits) ? 2
-                    : (InstructionData->DataSize == Size32Bits) ? 4
-                    : (InstructionData->DataSize == Size64Bits) ? 8
-                    : 0;
+  Bytes = MmioAccessSize (InstructionData, &Write);
+  if (Bytes == 0) {
+    Status = GP_EXCEPTION;
+    ASSERT (0);
+  } else {
+    GetModRmOperands (Regs, InstructionData);
     if (InstructionData->Ext.ModRm.Mod == 3) {
       /* NPF on two register operands??? */
-      VmgExit (Ghcb, SvmExitUnsupported, ExitCode, 0);
+      VcExit (VmgExitFunction, Ghcb, SvmExitUnsupported, ExitCode, 0);
       ASSERT (0);
     }
 
     ExitInfo1 = InstructionData->Ext.RmData;
     ExitInfo2 = Bytes;
-
     Ghcb->SaveArea.SwScratch = (UINT64) Ghcb->SharedBuffer;
-    Status = VmgExit (Ghcb, SvmExitMmioRead, ExitInfo1, ExitInfo2);
-    if (Status) {
-      break;
-    }
 
-    Register = GetRegisterPointer (Regs, InstructionData->Ext.ModRm.Reg);
-    if (Bytes == 4) {
-      /* Zero-extend for 32-bit operation */
-      *Register = 0;
+    if (Write) {
+      CopyMem (Ghcb->SharedBuffer, &InstructionData->Ext.RegData, Bytes);
+      Status = VcExit (VmgExitFunction, Ghcb, SvmExitMmioWrite,
+                 ExitInfo1, ExitInfo2);
+    } else {
+      Status = VcExit (VmgExitFunction, Ghcb, SvmExitMmioRead,
+                 ExitInfo1, ExitInfo2);
+      if (!Status) {
+        Register = GetRegisterPointer (Regs, InstructionData->Ext.ModRm.Reg);
+        if (Bytes == 4) {
+          /* Zero-extend for 32-bit operation */
+          *Register = 0;
+        }
+        CopyMem (Register, Ghcb->SharedBuffer, Bytes);
+      }
     }
-    CopyMem (Register, Ghcb->SharedBuffer, Bytes);
-    break;
-
-  default:
-    Status = GP_EXCEPTION;
-    ASSERT (0);
   }
 
-  InstructionLength += (InstructionData->ModRmPresent) ? 1 : 0;
-  InstructionLength += (InstructionData->SibPresent) ? 1 : 0;
-  InstructionLength += InstructionData->DisplacementSize;
+  InstructionLength = GetInstructionLength (InstructionData);
+
+  if (!CacheHit && InstructionData->ModRmPresent) {
+    MmioCacheStore (CacheEntry, Regs, InstructionData,
+      (UINTN) (OpCode - (UINT8 *) Regs->Rip) + InstructionLength);
+  }
 
-  AdvanceRip (Regs, InstructionLength);
+  Regs->Rip = (UINT64) OpCode + InstructionLength;
 
   return Status;
 }
 
-#define IOIO_TYPE_STR  (1 << 2)
-#define IOIO_TYPE_IN   1
-#define IOIO_TYPE_INS  (IOIO_TYPE_IN | IOIO_TYPE_STR)
-#define IOIO_TYPE_OUT  0
-#define IOIO_TYPE_OUTS (IOIO_TYPE_OUT | IOIO_TYPE_STR)
-
-#define IOIO_REP       (1 << 3)
-
-#define IOIO_ADDR_64   (1 << 9)
-#define IOIO_ADDR_32   (1 << 8)
-#define IOIO_ADDR_16   (1 << 7)
-
-#define IOIO_DATA_32   (1 << 6)
-#define IOIO_DATA_16   (1 << 5)
-#define IOIO_DATA_8    (1 << 4)
-
-#define IOIO_SEG_ES    (0 << 10)
-#define IOIO_SEG_DS    (3 << 10)
 
+/*
+ * CPUID results are cached per CPU, so a cached leaf is never subject to
+ * another CPU's APIC ID.  Leaves 0x1 and 0x7 report CR4-controlled feature
+ * bits (OSXSAVE, OSPKE) and are always passed to the hypervisor.
+ */
 static
-UINT64
-IoioExitInfo (
-  EFI_SYSTEM_CONTEXT_X64   *Regs,
-  SEV_ES_INSTRUCTION_DATA  *InstructionData
+BOOLEAN
+CpuidIsCacheable (
+  UINT32                   EaxIn
   )
 {
-  UINT64  ExitInfo = 0;
-
-  switch (*(InstructionData->OpCodes)) {
-  case 0x6C: /* INSB / INS mem8, DX */
-    ExitInfo |= IOIO_TYPE_INS;
-    ExitInfo |= IOIO_DATA_8;
-    ExitInfo |= IOIO_SEG_ES;
-    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
-    break;
-  case 0x6D: /* INSW / INS mem16, DX / INSD / INS mem32, DX */
-    ExitInfo |= IOIO_TYPE_INS;
-    ExitInfo |= (InstructionData->DataSize == Size16Bits) ? IOIO_DATA_16
-                                                          : IOIO_DATA_32;
-    ExitInfo |= IOIO_SEG_ES;
-    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
-    break;
-
-  case 0x6E: /* OUTSB / OUTS DX, mem8 */
-    ExitInfo |= IOIO_TYPE_OUTS;
-    ExitInfo |= IOIO_DATA_8;
-    ExitInfo |= IOIO_SEG_DS;
-    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
-    break;
-  case 0x6F: /* OUTSW / OUTS DX, mem16 / OUTSD / OUTS DX, mem32 */
-    ExitInfo |= IOIO_TYPE_OUTS;
-    ExitInfo |= (InstructionData->DataSize == Size16Bits) ? IOIO_DATA_16
-                                                          : IOIO_DATA_32;
-    ExitInfo |= IOIO_SEG_DS;
-    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
-    break;
-
-  case 0xE4: /* IN AL, imm8 */
-    ExitInfo |= IOIO_TYPE_IN;
-    ExitInfo |= IOIO_DATA_8;
-    ExitInfo |= ((*(InstructionData->OpCodes + 1)) << 16);
-    break;
-  case 0xE5: /* IN AX, imm8 / IN EAX, imm8 */
-    ExitInfo |= IOIO_TYPE_IN;
-    ExitInfo |= (InstructionData->DataSize == Size16Bits) ? IOIO_DATA_16
-                                                          : IOIO_DATA_32;
-    ExitInfo |= ((*(InstructionData->OpCodes + 1)) << 16);
-    break;
-
-  case 0xEC: /* IN AL, DX */
-    ExitInfo |= IOIO_TYPE_IN;
-    ExitInfo |= IOIO_DATA_8;
-    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
-    break;
-  case 0xED: /* IN AX, DX / IN EAX, DX */
-    ExitInfo |= IOIO_TYPE_IN;
-    ExitInfo |= (InstructionData->DataSize == Size16Bits) ? IOIO_DATA_16
-                                                          : IOIO_DATA_32;
-    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
-    break;
-
-  case 0xE6: /* OUT imm8, AL */
-    ExitInfo |= IOIO_TYPE_OUT;
-    ExitInfo |= IOIO_DATA_8;
-    ExitInfo |= ((*(InstructionData->OpCodes + 1)) << 16) | IOIO_TYPE_OUT;
-    break;
-  case 0xE7: /* OUT imm8, AX / OUT imm8, EAX */
-    ExitInfo |= IOIO_TYPE_OUT;
-    ExitInfo |= (InstructionData->DataSize == Size16Bits) ? IOIO_DATA_16
-                                                          : IOIO_DATA_32;
-    ExitInfo |= ((*(InstructionData->OpCodes + 1)) << 16) | IOIO_TYPE_OUT;
-    break;
-
-  case 0xEE: /* OUT DX, AL */
-    ExitInfo |= IOIO_TYPE_OUT;
-    ExitInfo |= IOIO_DATA_8;
-    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
-    break;
-  case 0xEF: /* OUT DX, AX / OUT DX, EAX */
-    ExitInfo |= IOIO_TYPE_OUT;
-    ExitInfo |= (InstructionData->DataSize == Size16Bits) ? IOIO_DATA_16
-                                                          : IOIO_DATA_32;
-    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
-    break;
-
-  default:
-    return 0;
-  }
-
-  switch (InstructionData->AddrSize) {
-  case Size16Bits:
-    ExitInfo |= IOIO_ADDR_16;
-    break;
-
-  case Size32Bits:
-    ExitInfo |= IOIO_ADDR_32;
-    break;
-
-  case Size64Bits:
-    ExitInfo |= IOIO_ADDR_64;
-    break;
+  return (EaxIn != 0x00000001) && (EaxIn != 0x00000007);
+}
 
-  default:
-    break;
-  }
+static
+SEV_ES_CPUID_CACHE_ENTRY *
+CpuidCacheEntry (
+  GHCB                     *Ghcb,
+  UINT32                   EaxIn,
+  UINT32                   EcxIn
+  )
+{
+  SEV_ES_PER_CPU_DATA  *PerCpuData;
+  UINTN                Index;
 
-  if (InstructionData->RepMode) {
-    ExitInfo |= IOIO_REP;
-  }
+  PerCpuData = GhcbGetPerCpuData (Ghcb);
+  Index = (EaxIn + (EaxIn >> 26) + (EcxIn * 5)) % SEV_ES_CPUID_CACHE_SIZE;
 
-  return ExitInfo;
+  return &PerCpuData->CpuidCache[Index];
 }
 
 UINTN
@@ -619,6 +225,16 @@ DoVcCommon(
   GHCB                   *Ghcb,
   EFI_SYSTEM_CONTEXT_X64 *Regs
   )
+{
+  return DoVcCommonWithExit (Ghcb, Regs, HardwareVmgExit);
+}
+
+UINTN
+DoVcCommonWithExit(
+  GHCB                   *Ghcb,
+  EFI_SYSTEM_CONTEXT_X64 *Regs,
+  SEV_ES_VMGEXIT         VmgExitFunction
+  )
 {
   SEV_ES_INSTRUCTION_DATA  InstructionData;
   UINTN                    ExitCode;
@@ -627,10 +243,42 @@ DoVcCommon(
   BOOLEAN                  String;
   UINT8                    *OpCode;
   UINTN                    InstructionLength;
+  SEV_ES_CPUID_CACHE_ENTRY *CpuidEntry;
+  UINT64                   XCr0;
+
+  ExitCode = Regs->ExceptionData;
+
+  /*
+   * A cached CPUID result is returned without touching the GHCB, so the
+   * VMGEXIT is avoided altogether.
+   */
+  CpuidEntry = NULL;
+  XCr0 = 0;
+  if (ExitCode == SvmExitCpuid && CpuidIsCacheable ((UINT32) Regs->Rax)) {
+    if (Regs->Rax == 0x0000000d) {
+      XCr0 = (AsmReadCr4 () & CR4_OSXSAVE) ? AsmXGetBv (0) : 1;
+    }
+
+    CpuidEntry = CpuidCacheEntry (Ghcb, (UINT32) Regs->Rax,
+                   (UINT32) Regs->Rcx);
+    if (CpuidEntry->Valid &&
+        CpuidEntry->EaxIn == (UINT32) Regs->Rax &&
+        CpuidEntry->EcxIn == (UINT32) Regs->Rcx &&
+        CpuidEntry->XCr0 == XCr0) {
+      GhcbGetPerCpuData (Ghcb)->CpuidCacheHits++;
+
+      Regs->Rax = CpuidEntry->Eax;
+      Regs->Rbx = CpuidEntry->Ebx;
+      Regs->Rcx = CpuidEntry->Ecx;
+      Regs->Rdx = CpuidEntry->Edx;
+
+      AdvanceRip (Regs, 2);
+      return 0;
+    }
+  }
 
   VmgInit (Ghcb);
 
-  ExitCode = Regs->ExceptionData;
   switch (ExitCode) {
   case SvmExitCpuid:
     Ghcb->SaveArea.Rax = Regs->Rax;
@@ -643,7 +291,7 @@ DoVcCommon(
       GhcbSetRegValid (Ghcb, GhcbXCr0);
     }
 
-    Status = VmgExit (Ghcb, ExitCode, 0, 0);
+    Status = VcExit (VmgExitFunction, Ghcb, ExitCode, 0, 0);
     if (Status) {
       break;
     }
@@ -652,9 +300,23 @@ DoVcCommon(
         !GhcbIsRegValid (Ghcb, GhcbRbx) ||
         !GhcbIsRegValid (Ghcb, GhcbRcx) ||
         !GhcbIsRegValid (Ghcb, GhcbRdx)) {
-      VmgExit (Ghcb, SvmExitUnsupported, ExitCode, 0);
+      VcExit (VmgExitFunction, Ghcb, SvmExitUnsupported, ExitCode, 0);
       ASSERT (0);
     }
+
+    if (CpuidEntry != NULL) {
+      GhcbGetPerCpuData (Ghcb)->CpuidCacheMisses++;
+
+      CpuidEntry->EaxIn = (UINT32) Regs->Rax;
+      CpuidEntry->EcxIn = (UINT32) Regs->Rcx;
+      CpuidEntry->XCr0 = XCr0;
+      CpuidEntry->Eax = (UINT32) Ghcb->SaveArea.Rax;
+      CpuidEntry->Ebx = (UINT32) Ghcb->SaveArea.Rbx;
+      CpuidEntry->Ecx = (UINT32) Ghcb->SaveArea.Rcx;
+      CpuidEntry->Edx = (UINT32) Ghcb->SaveArea.Rdx;
+      CpuidEntry->Valid = TRUE;
+    }
+
     Regs->Rax = Ghcb->SaveArea.Rax;
     Regs->Rbx = Ghcb->SaveArea.Rbx;
     Regs->Rcx = Ghcb->SaveArea.Rcx;
@@ -664,12 +326,12 @@ DoVcCommon(
     break;
 
   case SvmExitIoioProt:
-    InitInstructionData (&InstructionData, Ghcb);
+    InitInstructionData (&InstructionData);
     OpCode = (UINT8 *) DecodeInstruction (Regs, &InstructionData);
 
     ExitInfo1 = IoioExitInfo (Regs, &InstructionData);
     if (!ExitInfo1) {
-      VmgExit (Ghcb, SvmExitUnsupported, ExitCode, 0);
+      VcExit (VmgExitFunction, Ghcb, SvmExitUnsupported, ExitCode, 0);
       ASSERT (0);
     }
 
@@ -686,32 +348,51 @@ DoVcCommon(
     String = (ExitInfo1 & IOIO_TYPE_STR) ? TRUE : FALSE;
 
     if (String) {
-      UINTN  IoBytes, VmgExitBytes;
-      UINTN  GhcbCount, OpCount;
+      UINTN                IoBytes, VmgExitBytes;
+      UINTN                GhcbCount, ScratchCount, OpCount;
+      UINTN                Exits;
+      UINT8                *Scratch;
+      SEV_ES_PER_CPU_DATA  *PerCpuData;
 
       Status = 0;
 
       IoBytes = (ExitInfo1 >> 4) & 0x7;
       GhcbCount = sizeof (Ghcb->SharedBuffer) / IoBytes;
 
+      /*
+       * Use the per-CPU scratch area, when present, so that a large
+       * REP INS / REP OUTS needs far fewer exits than through the GHCB
+       * shared buffer.
+       */
+      PerCpuData = GhcbGetPerCpuData (Ghcb);
+      if (PerCpuData->ScratchSize > sizeof (Ghcb->SharedBuffer)) {
+        Scratch = (UINT8 *) PerCpuData->ScratchBase;
+        ScratchCount = PerCpuData->ScratchSize / IoBytes;
+      } else {
+        Scratch = Ghcb->SharedBuffer;
+        ScratchCount = GhcbCount;
+      }
+
       OpCount = (ExitInfo1 & IOIO_REP) ? Regs->Rcx : 1;
+      Exits = (OpCount + GhcbCount - 1) / GhcbCount;
       while (OpCount) {
-        ExitInfo2 = MIN (OpCount, GhcbCount);
+        ExitInfo2 = MIN (OpCount, ScratchCount);
         VmgExitBytes = ExitInfo2 * IoBytes;
 
         if (!(ExitInfo1 & IOIO_TYPE_IN)) {
-          CopyMem (Ghcb->SharedBuffer, (VOID *) Regs->Rsi, VmgExitBytes);
+          CopyMem (Scratch, (VOID *) Regs->Rsi, VmgExitBytes);
           Regs->Rsi += VmgExitBytes;
         }
 
-        Ghcb->SaveArea.SwScratch = (UINT64) Ghcb->SharedBuffer;
-        Status = VmgExit (Ghcb, ExitCode, ExitInfo1, ExitInfo2);
+        Ghcb->SaveArea.SwScratch = (UINT64) Scratch;
+        Status = VcExit (VmgExitFunction, Ghcb, ExitCode,
+                   ExitInfo1, ExitInfo2);
         if (Status) {
           break;
         }
 
         if (ExitInfo1 & IOIO_TYPE_IN) {
-          CopyMem ((VOID *) Regs->Rdi, Ghcb->SharedBuffer, VmgExitBytes);
+          CopyMem ((VOID *) Regs->Rdi, Scratch, VmgExitBytes);
           Regs->Rdi += VmgExitBytes;
         }
 
@@ -720,16 +401,22 @@ DoVcCommon(
         }
 
         OpCount -= ExitInfo2;
+        Exits--;
+      }
+
+      /* Exits now holds the surplus a GHCB-only transfer would have made */
+      if (!Status) {
+        PerCpuData->ScratchExitsAvoided += Exits;
       }
     } else {
-      Status = VmgExit (Ghcb, ExitCode, ExitInfo1, 0);
+      Status = VcExit (VmgExitFunction, Ghcb, ExitCode, ExitInfo1, 0);
       if (Status) {
         break;
       }
 
       if (ExitInfo1 & IOIO_TYPE_IN) {
         if (!GhcbIsRegValid (Ghcb, GhcbRax)) {
-          VmgExit (Ghcb, SvmExitUnsupported, ExitCode, 0);
+          VcExit (VmgExitFunction, Ghcb, SvmExitUnsupported, ExitCode, 0);
           ASSERT (0);
         }
         Regs->Rax = Ghcb->SaveArea.Rax;
@@ -751,7 +438,7 @@ DoVcCommon(
     break;
 
   case SvmExitMsr:
-    InitInstructionData (&InstructionData, Ghcb);
+    InitInstructionData (&InstructionData);
     OpCode = (UINT8 *) DecodePrefixes (Regs, &InstructionData);
     OpCode++;
 
@@ -770,11 +457,11 @@ DoVcCommon(
       GhcbSetRegValid (Ghcb, GhcbRcx);
       break;
     default:
-      VmgExit (Ghcb, SvmExitUnsupported, ExitCode, 0);
+      VcExit (VmgExitFunction, Ghcb, SvmExitUnsupported, ExitCode, 0);
       ASSERT (0);
     }
 
-    Status = VmgExit (Ghcb, ExitCode, ExitInfo1, 0);
+    Status = VcExit (VmgExitFunction, Ghcb, ExitCode, ExitInfo1, 0);
     if (Status) {
       break;
     }
@@ -782,7 +469,7 @@ DoVcCommon(
     if (!ExitInfo1) {
       if (!GhcbIsRegValid (Ghcb, GhcbRax) ||
           !GhcbIsRegValid (Ghcb, GhcbRdx)) {
-        VmgExit (Ghcb, SvmExitUnsupported, ExitCode, 0);
+        VcExit (VmgExitFunction, Ghcb, SvmExitUnsupported, ExitCode, 0);
         ASSERT (0);
       }
       Regs->Rax = Ghcb->SaveArea.Rax;
@@ -792,7 +479,7 @@ DoVcCommon(
     AdvanceRip (Regs, 2);
     break;
   case SvmExitWbinvd:
-    Status = VmgExit (Ghcb, ExitCode, 0, 0);
+    Status = VcExit (VmgExitFunction, Ghcb, ExitCode, 0, 0);
     if (Status) {
       break;
     }
@@ -801,12 +488,13 @@ DoVcCommon(
     break;
 
   case SvmExitNpf:
-    InitInstructionData (&InstructionData, Ghcb);
-    Status = MmioExit (Ghcb, Regs, ExitCode, &InstructionData);
+    InitInstructionData (&InstructionData);
+    Status = MmioExit (Ghcb, Regs, ExitCode, &InstructionData,
+               VmgExitFunction);
     break;
 
   default:
-    Status = VmgExit (Ghcb, SvmExitUnsupported, ExitCode, 0);
+    Status = VcExit (VmgExitFunction, Ghcb, SvmExitUnsupported, ExitCode, 0);
   }
 
   VmgDone (Ghcb);
@@ -5,6 +5,30 @@
 #include <Protocol/DebugSupport.h>
 #include <Register/Amd/Ghcb.h>
 
+/*
+ * The #VC handler is split in two:
+ *
+ *  - AMDSevVcDecode.c decodes the faulting instruction and computes the exit
+ *    information. It has no GHCB dependency.
+ *
+ *  - AMDSevVcCommon.c fills in the GHCB and exits to the hypervisor. Every
+ *    exit goes through an SEV_ES_VMGEXIT function, which is the only point
+ *    that requires SEV-ES hardware. DoVcCommon() issues the VMGEXIT
+ *    instruction; DoVcCommonWithExit() takes a function that emulates the
+ *    hypervisor's response in the GHCB instead, so the handler can run
+ *    against a plain memory buffer (see HostTest/).
+ */
+
+/*
+ * Exit to the hypervisor with the request in the GHCB, and return once the
+ * response has been written to the GHCB.
+ */
+typedef
+VOID
+(*SEV_ES_VMGEXIT) (
+  GHCB                   *Ghcb
+  );
+
 UINTN
 DoVcException(
   EFI_SYSTEM_CONTEXT_X64 *Regs
@@ -16,4 +40,11 @@ DoVcCommon(
   EFI_SYSTEM_CONTEXT_X64 *Regs
   );
 
+UINTN
+DoVcCommonWithExit(
+  GHCB                   *Ghcb,
+  EFI_SYSTEM_CONTEXT_X64 *Regs,
+  SEV_ES_VMGEXIT         VmgExitFunction
+  );
+
 #endif
@@ -0,0 +1,467 @@
+/*
+ * Decoder for the instructions that raise a #VC exception under SEV-ES.
+ *
+ * Nothing in this file touches the GHCB or issues a VMGEXIT: it turns an
+ * instruction stream and a register context into the decoded instruction
+ * and the exit information to hand to the hypervisor.  It only depends on
+ * BaseMemoryLib and DebugLib, so it can be built and exercised outside of
+ * an SEV-ES guest.
+ */
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include "AMDSevVcDecode.h"
+
+VOID
+InitInstructionData (
+  SEV_ES_INSTRUCTION_DATA  *InstructionData
+  )
+{
+  SetMem (InstructionData, sizeof (*InstructionData), 0);
+}
+
+UINT64 *
+GetRegisterPointer (
+  EFI_SYSTEM_CONTEXT_X64   *Regs,
+  UINT8                    Register
+  )
+{
+  switch (Register) {
+  case 0:
+    return &Regs->Rax;
+  case 1:
+    return &Regs->Rcx;
+  case 2:
+    return &Regs->Rdx;
+  case 3:
+    return &Regs->Rbx;
+  case 4:
+    return &Regs->Rsp;
+  case 5:
+    return &Regs->Rbp;
+  case 6:
+    return &Regs->Rsi;
+  case 7:
+    return &Regs->Rdi;
+  case 8:
+    return &Regs->R8;
+  case 9:
+    return &Regs->R9;
+  case 10:
+    return &Regs->R10;
+  case 11:
+    return &Regs->R11;
+  case 12:
+    return &Regs->R12;
+  case 13:
+    return &Regs->R13;
+  case 14:
+    return &Regs->R14;
+  case 15:
+    return &Regs->R15;
+  }
+  ASSERT (0);
+
+  return 0;
+}
+
+static
+BOOLEAN
+IsRipRelative (
+  SEV_ES_INSTRUCTION_DATA  *InstructionData
+  )
+{
+  SEV_ES_INSTRUCTION_OPCODE_EXT  *Ext = &InstructionData->Ext;
+
+  return ((InstructionData->Mode == LongMode64Bit) &&
+          (Ext->ModRm.Mod == 0) &&
+          ((Ext->ModRm.Rm & 7) == 5) &&
+          (InstructionData->SibPresent == FALSE));
+}
+
+UINTN
+GetEffectiveMemoryAddress (
+  EFI_SYSTEM_CONTEXT_X64   *Regs,
+  SEV_ES_INSTRUCTION_DATA  *InstructionData
+  )
+{
+  SEV_ES_INSTRUCTION_OPCODE_EXT  *Ext = &InstructionData->Ext;
+  UINTN                          EffectiveAddress = 0;
+
+  if (IsRipRelative (InstructionData)) {
+    /*
+     * RIP-relative displacement is a 32-bit signed value, relative to the
+     * end of the instruction
+     */
+    INT32 RipRelative = *(INT32 *)InstructionData->Displacement;
+
+    InstructionData->DisplacementSize = 4;
+    EffectiveAddress = (UINTN) InstructionData->OpCodes +
+                       GetInstructionLength (InstructionData);
+    EffectiveAddress += (UINTN)(INTN) RipRelative;
+
+    return EffectiveAddress;
+  }
+
+  /*
+   * In long mode, the displacement size follows from the ModRM and SIB
+   * bytes alone: disp8 for Mod 1, disp32 for Mod 2, and disp32 without a
+   * base register for Mod 0 with SIB base 5. Both are sign-extended.
+   */
+  switch (Ext->ModRm.Mod) {
+  case 0:
+    if (InstructionData->SibPresent && (Ext->Sib.Base & 7) == 5) {
+      InstructionData->DisplacementSize = 4;
+      EffectiveAddress += (UINTN)(INTN) (*(INT32 *) (InstructionData->Displacement));
+    }
+    break;
+  case 1:
+    InstructionData->DisplacementSize = 1;
+    EffectiveAddress += (UINTN)(INTN) (*(INT8 *) (InstructionData->Displacement));
+    break;
+  case 2:
+    InstructionData->DisplacementSize = 4;
+    EffectiveAddress += (UINTN)(INTN) (*(INT32 *) (InstructionData->Displacement));
+    break;
+  }
+
+  if (InstructionData->SibPresent) {
+    switch (Ext->Sib.Index) {
+    case 4:
+      break;
+    default:
+      EffectiveAddress += (*GetRegisterPointer (Regs, Ext->Sib.Index) << Ext->Sib.Scale);
+    }
+
+    if (Ext->ModRm.Mod != 0 || (Ext->Sib.Base & 7) != 5) {
+      EffectiveAddress += *GetRegisterPointer (Regs, Ext->Sib.Base);
+    }
+  } else {
+    EffectiveAddress += *GetRegisterPointer (Regs, Ext->ModRm.Rm);
+  }
+
+  if (InstructionData->AddrSize == Size32Bits) {
+    EffectiveAddress &= 0xFFFFFFFF;
+  }
+
+  return EffectiveAddress;
+}
+
+UINT64
+DecodePrefixes (
+  EFI_SYSTEM_CONTEXT_X64   *Regs,
+  SEV_ES_INSTRUCTION_DATA  *InstructionData
+  )
+{
+  SEV_ES_INSTRUCTION_MODE  Mode;
+  SEV_ES_INSTRUCTION_SIZE  ModeDataSize;
+  SEV_ES_INSTRUCTION_SIZE  ModeAddrSize;
+  UINT8                    *Byte;
+
+  /*TODO: Determine current mode - 64-bit for now */
+  Mode = LongMode64Bit;
+  ModeDataSize = Size32Bits;
+  ModeAddrSize = Size64Bits;
+
+  InstructionData->Mode = Mode;
+  InstructionData->DataSize = ModeDataSize;
+  InstructionData->AddrSize = ModeAddrSize;
+
+  Byte = (UINT8 *) Regs->Rip;
+  while (TRUE) {
+    switch (*Byte) {
+    case 0x26:
+    case 0x2E:
+    case 0x36:
+    case 0x3E:
+      if (Mode != LongMode64Bit) {
+        InstructionData->SegmentSpecified = TRUE;
+        InstructionData->Segment = (*Byte >> 3) & 3;
+      }
+      break;
+    case 0x40 ... 0x4F:
+      InstructionData->RexPrefix.Uint8 = *Byte;
+      if (*Byte & 0x08)
+        InstructionData->DataSize = Size64Bits;
+      break;
+    case 0x64:
+    case 0x65:
+      InstructionData->SegmentSpecified = TRUE;
+      InstructionData->Segment = *Byte & 7;
+      break;
+    case 0x66:
+      if (!InstructionData->RexPrefix.Uint8) {
+        InstructionData->DataSize =
+          (Mode == LongMode64Bit)       ? Size16Bits :
+          (Mode == LongModeCompat32Bit) ? Size16Bits :
+          (Mode == LongModeCompat16Bit) ? Size32Bits : 0;
+      }
+      break;
+    case 0x67:
+      InstructionData->AddrSize =
+        (Mode == LongMode64Bit)       ? Size32Bits :
+        (Mode == LongModeCompat32Bit) ? Size16Bits :
+        (Mode == LongModeCompat16Bit) ? Size32Bits : 0;
+      break;
+    case 0xF0:
+      break;
+    case 0xF2:
+      InstructionData->RepMode = RepZ;
+      break;
+    case 0xF3:
+      InstructionData->RepMode = RepNZ;
+      break;
+    default:
+      InstructionData->OpCodes = Byte;
+      InstructionData->Displacement = Byte + 1;
+      return (UINT64) Byte;
+    }
+
+    Byte++;
+  }
+}
+
+VOID
+DecodeModRmExt (
+  SEV_ES_INSTRUCTION_DATA  *InstructionData
+  )
+{
+  SEV_ES_INSTRUCTION_REX_PREFIX  *RexPrefix = &InstructionData->RexPrefix;
+  SEV_ES_INSTRUCTION_OPCODE_EXT  *Ext = &InstructionData->Ext;
+  SEV_ES_INSTRUCTION_MODRM       *ModRm = &InstructionData->ModRm;
+  SEV_ES_INSTRUCTION_SIB         *Sib = &InstructionData->Sib;
+
+  Ext->ModRm.Mod = ModRm->Bits.Mod;
+  Ext->ModRm.Reg = (RexPrefix->Bits.R << 3) | ModRm->Bits.Reg;
+  Ext->ModRm.Rm  = (RexPrefix->Bits.B << 3) | ModRm->Bits.Rm;
+
+  if (InstructionData->SibPresent) {
+    Ext->Sib.Scale = Sib->Bits.Scale;
+    Ext->Sib.Index = (RexPrefix->Bits.X << 3) | Sib->Bits.Index;
+    Ext->Sib.Base  = (RexPrefix->Bits.B << 3) | Sib->Bits.Base;
+  }
+}
+
+VOID
+DecodeModRm (
+  SEV_ES_INSTRUCTION_DATA  *InstructionData
+  )
+{
+  SEV_ES_INSTRUCTION_MODRM       *ModRm = &InstructionData->ModRm;
+  SEV_ES_INSTRUCTION_SIB         *Sib = &InstructionData->Sib;
+
+  InstructionData->Displacement++;
+  InstructionData->ModRmPresent = TRUE;
+  ModRm->Uint8 = *(InstructionData->OpCodes + 1);
+
+  if (ModRm->Bits.Mod != 3 && ModRm->Bits.Rm == 4) {
+    InstructionData->Displacement++;
+
+    InstructionData->SibPresent = TRUE;
+    Sib->Uint8 = *(InstructionData->OpCodes + 2);
+  }
+
+  DecodeModRmExt (InstructionData);
+}
+
+/*
+ * Evaluate the operands of a decoded ModRM instruction against the current
+ * register state. This is the only per-fault work for a cached instruction.
+ */
+VOID
+GetModRmOperands (
+  EFI_SYSTEM_CONTEXT_X64   *Regs,
+  SEV_ES_INSTRUCTION_DATA  *InstructionData
+  )
+{
+  SEV_ES_INSTRUCTION_OPCODE_EXT  *Ext = &InstructionData->Ext;
+
+  Ext->RegData = *GetRegisterPointer (Regs, Ext->ModRm.Reg);
+
+  if (Ext->ModRm.Mod == 3) {
+    Ext->RmData = *GetRegisterPointer (Regs, Ext->ModRm.Rm);
+  } else {
+    Ext->RmData = GetEffectiveMemoryAddress (Regs, InstructionData);
+  }
+}
+
+UINT64
+DecodeInstruction (
+  EFI_SYSTEM_CONTEXT_X64   *Regs,
+  SEV_ES_INSTRUCTION_DATA  *InstructionData
+  )
+{
+  return DecodePrefixes (Regs, InstructionData);
+}
+
+VOID
+AdvanceRip (
+  EFI_SYSTEM_CONTEXT_X64   *Regs,
+  UINTN                    Bytes
+  )
+{
+  SEV_ES_INSTRUCTION_DATA  InstructionData;
+
+  InitInstructionData (&InstructionData);
+
+  Regs->Rip = DecodePrefixes (Regs, &InstructionData);
+  Regs->Rip += Bytes;
+}
+
+UINT64
+IoioExitInfo (
+  EFI_SYSTEM_CONTEXT_X64   *Regs,
+  SEV_ES_INSTRUCTION_DATA  *InstructionData
+  )
+{
+  UINT64  ExitInfo = 0;
+
+  switch (*(InstructionData->OpCodes)) {
+  case 0x6C: /* INSB / INS mem8, DX */
+    ExitInfo |= IOIO_TYPE_INS;
+    ExitInfo |= IOIO_DATA_8;
+    ExitInfo |= IOIO_SEG_ES;
+    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
+    break;
+  case 0x6D: /* INSW / INS mem16, DX / INSD / INS mem32, DX */
+    ExitInfo |= IOIO_TYPE_INS;
+    ExitInfo |= (InstructionData->DataSize == Size16Bits) ? IOIO_DATA_16
+                                                          : IOIO_DATA_32;
+    ExitInfo |= IOIO_SEG_ES;
+    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
+    break;
+
+  case 0x6E: /* OUTSB / OUTS DX, mem8 */
+    ExitInfo |= IOIO_TYPE_OUTS;
+    ExitInfo |= IOIO_DATA_8;
+    ExitInfo |= IOIO_SEG_DS;
+    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
+    break;
+  case 0x6F: /* OUTSW / OUTS DX, mem16 / OUTSD / OUTS DX, mem32 */
+    ExitInfo |= IOIO_TYPE_OUTS;
+    ExitInfo |= (InstructionData->DataSize == Size16Bits) ? IOIO_DATA_16
+                                                          : IOIO_DATA_32;
+    ExitInfo |= IOIO_SEG_DS;
+    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
+    break;
+
+  case 0xE4: /* IN AL, imm8 */
+    ExitInfo |= IOIO_TYPE_IN;
+    ExitInfo |= IOIO_DATA_8;
+    ExitInfo |= ((*(InstructionData->OpCodes + 1)) << 16);
+    break;
+  case 0xE5: /* IN AX, imm8 / IN EAX, imm8 */
+    ExitInfo |= IOIO_TYPE_IN;
+    ExitInfo |= (InstructionData->DataSize == Size16Bits) ? IOIO_DATA_16
+                                                          : IOIO_DATA_32;
+    ExitInfo |= ((*(InstructionData->OpCodes + 1)) << 16);
+    break;
+
+  case 0xEC: /* IN AL, DX */
+    ExitInfo |= IOIO_TYPE_IN;
+    ExitInfo |= IOIO_DATA_8;
+    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
+    break;
+  case 0xED: /* IN AX, DX / IN EAX, DX */
+    ExitInfo |= IOIO_TYPE_IN;
+    ExitInfo |= (InstructionData->DataSize == Size16Bits) ? IOIO_DATA_16
+                                                          : IOIO_DATA_32;
+    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
+    break;
+
+  case 0xE6: /* OUT imm8, AL */
+    ExitInfo |= IOIO_TYPE_OUT;
+    ExitInfo |= IOIO_DATA_8;
+    ExitInfo |= ((*(InstructionData->OpCodes + 1)) << 16) | IOIO_TYPE_OUT;
+    break;
+  case 0xE7: /* OUT imm8, AX / OUT imm8, EAX */
+    ExitInfo |= IOIO_TYPE_OUT;
+    ExitInfo |= (InstructionData->DataSize == Size16Bits) ? IOIO_DATA_16
+                                                          : IOIO_DATA_32;
+    ExitInfo |= ((*(InstructionData->OpCodes + 1)) << 16) | IOIO_TYPE_OUT;
+    break;
+
+  case 0xEE: /* OUT DX, AL */
+    ExitInfo |= IOIO_TYPE_OUT;
+    ExitInfo |= IOIO_DATA_8;
+    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
+    break;
+  case 0xEF: /* OUT DX, AX / OUT DX, EAX */
+    ExitInfo |= IOIO_TYPE_OUT;
+    ExitInfo |= (InstructionData->DataSize == Size16Bits) ? IOIO_DATA_16
+                                                          : IOIO_DATA_32;
+    ExitInfo |= ((Regs->Rdx & 0xffff) << 16);
+    break;
+
+  default:
+    return 0;
+  }
+
+  switch (InstructionData->AddrSize) {
+  case Size16Bits:
+    ExitInfo |= IOIO_ADDR_16;
+    break;
+
+  case Size32Bits:
+    ExitInfo |= IOIO_ADDR_32;
+    break;
+
+  case Size64Bits:
+    ExitInfo |= IOIO_ADDR_64;
+    break;
+
+  default:
+    break;
+  }
+
+  if (InstructionData->RepMode) {
+    ExitInfo |= IOIO_REP;
+  }
+
+  return ExitInfo;
+}
+
+UINTN
+MmioAccessSize (
+  SEV_ES_INSTRUCTION_DATA  *InstructionData,
+  BOOLEAN                  *Write
+  )
+{
+  UINTN  Bytes;
+
+  switch (*(InstructionData->OpCodes)) {
+  case 0x88: /* MOV mem8, reg8 */
+  case 0x8A: /* MOV reg8, mem8 */
+    Bytes = 1;
+    break;
+  case 0x89: /* MOV mem, reg */
+  case 0x8B: /* MOV reg, mem */
+    Bytes = (InstructionData->DataSize == Size16Bits) ? 2
+          : (InstructionData->DataSize == Size32Bits) ? 4
+          : (InstructionData->DataSize == Size64Bits) ? 8
+          : 0;
+    break;
+  default:
+    return 0;
+  }
+
+  *Write = (*(InstructionData->OpCodes) == 0x88) ||
+           (*(InstructionData->OpCodes) == 0x89);
+
+  return Bytes;
+}
+
+UINTN
+GetInstructionLength (
+  SEV_ES_INSTRUCTION_DATA  *InstructionData
+  )
+{
+  UINTN  InstructionLength;
+
+  InstructionLength = 1;
+  InstructionLength += (InstructionData->ModRmPresent) ? 1 : 0;
+  InstructionLength += (InstructionData->SibPresent) ? 1 : 0;
+  InstructionLength += InstructionData->DisplacementSize;
+
+  return InstructionLength;
+}
@@ -0,0 +1,76 @@
+/** @file
+  Host implementations of the BaseLib and BaseMemoryLib functions that the #VC
+  handler uses.
+
+  The instructions that only work in an SEV-ES guest (VMGEXIT, reading CR4
+  and XCR0) are replaced: AsmVmgExit() must never be reached, because the
+  test drives the handler through DoVcCommonWithExit(), and the control
+  registers report that XSAVE is not enabled.
+
+**/
+
+#include <Base.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include "HostOs.h"
+
+VOID *
+EFIAPI
+CopyMem (
+  OUT VOID       *DestinationBuffer,
+  IN CONST VOID  *SourceBuffer,
+  IN UINTN       Length
+  )
+{
+  return __builtin_memmove (DestinationBuffer, SourceBuffer, Length);
+}
+
+VOID *
+EFIAPI
+SetMem (
+  OUT VOID  *Buffer,
+  IN UINTN  Length,
+  IN UINT8  Value
+  )
+{
+  return __builtin_memset (Buffer, Value, Length);
+}
+
+INTN
+EFIAPI
+CompareMem (
+  IN CONST VOID  *DestinationBuffer,
+  IN CONST VOID  *SourceBuffer,
+  IN UINTN       Length
+  )
+{
+  return __builtin_memcmp (DestinationBuffer, SourceBuffer, Length);
+}
+
+VOID
+EFIAPI
+AsmVmgExit (
+  VOID
+  )
+{
+  HostPrint ("AsmVmgExit() reached on the host\n");
+  HostAbort ();
+}
+
+UINTN
+EFIAPI
+AsmReadCr4 (
+  VOID
+  )
+{
+  return 0;
+}
+
+UINT64
+EFIAPI
+AsmXGetBv (
+  IN UINT32  Index
+  )
+{
+  return 1;
+}
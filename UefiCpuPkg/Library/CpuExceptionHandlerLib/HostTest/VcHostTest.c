@@ -0,0 +1,823 @@
+/** @file
+  Host test and benchmark for the SEV-ES #VC handler.
+
+  Each test case is an instruction byte stream plus a register context. The
+  test runs it through DoVcCommonWithExit() with a mock hypervisor in place
+  of the VMGEXIT instruction, and checks the exit code, the exit information
+  and the register state that result. Every case runs twice, so that the
+  second run goes through the CPUID and MMIO caches of the handler.
+
+  The benchmark then reports the cost of each #VC path, with and without the
+  caches, and the cost of decoding alone.
+
+  Finally, a stream of MMIO faults is replayed through the handler. Each MMIO
+  case sits at its own RIP, and the stream revisits those RIPs the way a
+  framebuffer fill interleaved with APIC and HPET accesses does. The replay
+  checks that the MMIO cache yields the same exits as a full decode, that it
+  notices an instruction replaced at a cached RIP, and reports its hit rate
+  and the cost per fault with a cold and a warm cache.
+
+  Usage: VcHostTest [iterations]
+
+**/
+
+#include <Base.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Register/Amd/Ghcb.h>
+#include "AMDSevVcCommon.h"
+#include "AMDSevVcDecode.h"
+#include "HostOs.h"
+
+#define MMIO_DATA         0x1122334455667788ULL
+#define STRING_BUFFER     8192
+#define SCRATCH_PAGES     4
+#define NO_REGISTER       0xFF
+#define REPLAY_SLOT_SIZE  16
+#define REPLAY_MAX_SLOTS  (EFI_PAGE_SIZE / REPLAY_SLOT_SIZE)
+
+typedef struct {
+  CONST CHAR8   *Name;
+  UINT64        Exception;
+  UINT8         Bytes[SEV_ES_MAX_INSN_LENGTH];
+  UINT8         Length;
+  //
+  // Register context; Rsi and Rdi point to a buffer for string I/O
+  //
+  UINT64        Rax;
+  UINT64        Rbx;
+  UINT64        Rcx;
+  UINT64        Rdx;
+  UINT64        Rsp;
+  UINT64        Rbp;
+  //
+  // Expected request to the hypervisor. For RIP-relative MMIO, ExitInfo1 is
+  // the displacement from the end of the instruction. For string I/O,
+  // ExitInfo2 is the total count over all exits.
+  //
+  UINT64        ExitCode;
+  UINT64        ExitInfo1;
+  UINT64        ExitInfo2;
+  BOOLEAN       RipRelative;
+  //
+  // Expected register value after the instruction, or the value written
+  // for an MMIO write
+  //
+  UINT8         Register;
+  UINT64        Value;
+} VC_TEST_CASE;
+
+typedef struct {
+  UINTN         Exits;
+  UINT64        ExitCode;
+  UINT64        ExitInfo1;
+  UINT64        ExitInfo2;
+  UINT64        StringCount;
+  UINT64        MmioData;
+  UINT8         IoData[STRING_BUFFER];
+  UINTN         IoDataSize;
+} MOCK_HYPERVISOR;
+
+STATIC MOCK_HYPERVISOR  mHv;
+
+STATIC CONST VC_TEST_CASE  mTestCases[] = {
+  //
+  // Port I/O
+  //
+  { "in al, dx",        SvmExitIoioProt, { 0xEC }, 1,
+    0, 0, 0, 0x3F8, 0, 0,
+    SvmExitIoioProt, 0x03F80211, 0, FALSE, 0, 0xA5 },
+  { "in ax, dx",        SvmExitIoioProt, { 0x66, 0xED }, 2,
+    0, 0, 0, 0xCFC, 0, 0,
+    SvmExitIoioProt, 0x0CFC0221, 0, FALSE, 0, 0xA5 },
+  { "in eax, dx",       SvmExitIoioProt, { 0xED }, 1,
+    0, 0, 0, 0xCFC, 0, 0,
+    SvmExitIoioProt, 0x0CFC0241, 0, FALSE, 0, 0xA5 },
+  { "in al, 0x71",      SvmExitIoioProt, { 0xE4, 0x71 }, 2,
+    0, 0, 0, 0, 0, 0,
+    SvmExitIoioProt, 0x00710211, 0, FALSE, 0, 0xA5 },
+  { "out 0x80, al",     SvmExitIoioProt, { 0xE6, 0x80 }, 2,
+    0x12, 0, 0, 0, 0, 0,
+    SvmExitIoioProt, 0x00800210, 0, FALSE, NO_REGISTER, 0 },
+  { "out dx, eax",      SvmExitIoioProt, { 0xEF }, 1,
+    0x80000000, 0, 0, 0xCF8, 0, 0,
+    SvmExitIoioProt, 0x0CF80240, 0, FALSE, NO_REGISTER, 0 },
+  { "rep outsb",        SvmExitIoioProt, { 0xF3, 0x6E }, 2,
+    0, 0, 5000, 0x3F8, 0, 0,
+    SvmExitIoioProt, 0x03F80E1C, 5000, FALSE, 1, 0 },
+  { "rep insd",         SvmExitIoioProt, { 0xF3, 0x6D }, 2,
+    0, 0, 1536, 0x1F0, 0, 0,
+    SvmExitIoioProt, 0x01F0024D, 1536, FALSE, 1, 0 },
+  { "outsw",            SvmExitIoioProt, { 0x66, 0x6F }, 2,
+    0, 0, 7, 0x1F0, 0, 0,
+    SvmExitIoioProt, 0x01F00E24, 1, FALSE, 1, 7 },
+
+  //
+  // CPUID, MSR and cache control
+  //
+  { "cpuid 0x80000008", SvmExitCpuid, { 0x0F, 0xA2 }, 2,
+    0x80000008, 0, 0, 0, 0, 0,
+    SvmExitCpuid, 0, 0, FALSE, 3, 0xB0B0B0B0 },
+  { "cpuid 0x1",        SvmExitCpuid, { 0x0F, 0xA2 }, 2,
+    0x1, 0, 0, 0, 0, 0,
+    SvmExitCpuid, 0, 0, FALSE, 3, 0xB0B0B0B0 },
+  { "rdmsr",            SvmExitMsr, { 0x0F, 0x32 }, 2,
+    0, 0, 0xC0010131, 0, 0, 0,
+    SvmExitMsr, 0, 0, FALSE, 2, 0xD0D0D0D0 },
+  { "wrmsr",            SvmExitMsr, { 0x0F, 0x30 }, 2,
+    1, 0, 0xC0010130, 2, 0, 0,
+    SvmExitMsr, 1, 0, FALSE, NO_REGISTER, 0 },
+  { "wbinvd",           SvmExitWbinvd, { 0x0F, 0x09 }, 2,
+    0, 0, 0, 0, 0, 0,
+    SvmExitWbinvd, 0, 0, FALSE, NO_REGISTER, 0 },
+
+  //
+  // MMIO
+  //
+  { "mov eax, [rbx]",   SvmExitNpf, { 0x8B, 0x03 }, 2,
+    0xFFFFFFFFFFFFFFFFULL, 0xFEE00020, 0, 0, 0, 0,
+    SvmExitMmioRead, 0xFEE00020, 4, FALSE, 0, 0x55667788 },
+  { "mov [rbx+0x10], eax", SvmExitNpf, { 0x89, 0x43, 0x10 }, 3,
+    0xCAFEF00D, 0xFEE00000, 0, 0, 0, 0,
+    SvmExitMmioWrite, 0xFEE00010, 4, FALSE, NO_REGISTER, 0xCAFEF00D },
+  { "mov rax, [rbp-8]", SvmExitNpf, { 0x48, 0x8B, 0x45, 0xF8 }, 4,
+    0, 0, 0, 0, 0, 0xFED00108,
+    SvmExitMmioRead, 0xFED00100, 8, FALSE, 0, MMIO_DATA },
+  { "mov [rsp], cl",    SvmExitNpf, { 0x88, 0x0C, 0x24 }, 3,
+    0, 0, 0x5A, 0, 0xFEC00000, 0,
+    SvmExitMmioWrite, 0xFEC00000, 1, FALSE, NO_REGISTER, 0x5A },
+  { "mov eax, [rcx*4+0xfee00000]", SvmExitNpf,
+    { 0x8B, 0x04, 0x8D, 0x00, 0x00, 0xE0, 0xFE }, 7,
+    0, 0, 0x40, 0, 0, 0,
+    SvmExitMmioRead, 0xFFFFFFFFFEE00100ULL, 4, FALSE, 0, 0x55667788 },
+  { "mov eax, [rip-0x10]", SvmExitNpf,
+    { 0x8B, 0x05, 0xF0, 0xFF, 0xFF, 0xFF }, 6,
+    0, 0, 0, 0, 0, 0,
+    SvmExitMmioRead, (UINT64)-0x10, 4, TRUE, 0, 0x55667788 },
+  { "mov r8d, [rdx+0x100]", SvmExitNpf,
+    { 0x44, 0x8B, 0x82, 0x00, 0x01, 0x00, 0x00 }, 7,
+    0, 0, 0, 0xFEB00000, 0, 0,
+    SvmExitMmioRead, 0xFEB00100, 4, FALSE, 8, 0x55667788 },
+  { "mov [rax], cx",    SvmExitNpf, { 0x66, 0x89, 0x08 }, 3,
+    0xFEA00000, 0, 0xBEEF, 0, 0, 0,
+    SvmExitMmioWrite, 0xFEA00000, 2, FALSE, NO_REGISTER, 0xBEEF },
+  { "mov eax, gs:[rbx]", SvmExitNpf, { 0x65, 0x8B, 0x03 }, 3,
+    0, 0xFEE000F0, 0, 0, 0, 0,
+    SvmExitMmioRead, 0xFEE000F0, 4, FALSE, 0, 0x55667788 },
+  { "mov al, [ebx]",    SvmExitNpf, { 0x67, 0x8A, 0x03 }, 3,
+    0, 0xFFFFFFFF00FE0000ULL, 0, 0, 0, 0,
+    SvmExitMmioRead, 0x00FE0000, 1, FALSE, 0, 0x88 },
+};
+
+//
+// MMIO fault stream for the replay, as indices into the MMIO test cases in
+// the order of mTestCases: a framebuffer fill (the 16-bit store), with
+// periodic APIC reads and writes, HPET reads and other device accesses.
+//
+STATIC CONST UINT8  mReplayStream[] = {
+  7, 7, 7, 7, 7, 7, 7, 7, 0, 1,
+  7, 7, 7, 7, 7, 7, 7, 7, 2, 3,
+  7, 7, 7, 7, 7, 7, 7, 7, 0, 1,
+  7, 7, 7, 7, 7, 7, 7, 7, 4, 5,
+  7, 7, 7, 7, 7, 7, 7, 7, 6, 8,
+  7, 7, 7, 7, 7, 7, 7, 7, 9, 2
+};
+
+STATIC CONST VC_TEST_CASE  *mReplayCases[REPLAY_MAX_SLOTS];
+STATIC UINTN               mReplayCaseCount;
+
+/**
+  Stand-in for the VMGEXIT instruction: record the request, and answer it the
+  way a hypervisor would.
+
+  @param[in, out] Ghcb  The GHCB holding the request.
+**/
+STATIC
+VOID
+MockVmgExit (
+  GHCB  *Ghcb
+  )
+{
+  UINT64  ExitInfo1;
+  UINT64  ExitInfo2;
+  UINTN   Bytes;
+  UINTN   Index;
+
+  mHv.Exits++;
+  mHv.ExitCode  = Ghcb->SaveArea.SwExitCode;
+  mHv.ExitInfo1 = ExitInfo1 = Ghcb->SaveArea.SwExitInfo1;
+  mHv.ExitInfo2 = ExitInfo2 = Ghcb->SaveArea.SwExitInfo2;
+
+  switch (mHv.ExitCode) {
+  case SvmExitIoioProt:
+    Bytes = (UINTN)((ExitInfo1 >> 4) & 0x7);
+    if ((ExitInfo1 & IOIO_TYPE_STR) != 0) {
+      mHv.StringCount += ExitInfo2;
+      if ((ExitInfo1 & IOIO_TYPE_IN) != 0) {
+        for (Index = 0; Index < ExitInfo2 * Bytes; Index++) {
+          ((UINT8 *)(UINTN)Ghcb->SaveArea.SwScratch)[Index] =
+            (UINT8)(mHv.IoDataSize + Index);
+        }
+      } else {
+        ASSERT (mHv.IoDataSize + ExitInfo2 * Bytes <= sizeof mHv.IoData);
+        CopyMem (&mHv.IoData[mHv.IoDataSize],
+          (VOID *)(UINTN)Ghcb->SaveArea.SwScratch, ExitInfo2 * Bytes);
+      }
+      mHv.IoDataSize += (UINTN)(ExitInfo2 * Bytes);
+    } else if ((ExitInfo1 & IOIO_TYPE_IN) != 0) {
+      Ghcb->SaveArea.Rax = 0xA5;
+      GhcbSetRegValid (Ghcb, GhcbRax);
+    }
+    break;
+
+  case SvmExitCpuid:
+    Ghcb->SaveArea.Rax = 0xA0A0A0A0;
+    Ghcb->SaveArea.Rbx = 0xB0B0B0B0;
+    Ghcb->SaveArea.Rcx = 0xC0C0C0C0;
+    Ghcb->SaveArea.Rdx = 0xD0D0D0D0;
+    GhcbSetRegValid (Ghcb, GhcbRax);
+    GhcbSetRegValid (Ghcb, GhcbRbx);
+    GhcbSetRegValid (Ghcb, GhcbRcx);
+    GhcbSetRegValid (Ghcb, GhcbRdx);
+    break;
+
+  case SvmExitMsr:
+    if (ExitInfo1 == 0) {
+      Ghcb->SaveArea.Rax = 0xA0A0A0A0;
+      Ghcb->SaveArea.Rdx = 0xD0D0D0D0;
+      GhcbSetRegValid (Ghcb, GhcbRax);
+      GhcbSetRegValid (Ghcb, GhcbRdx);
+    }
+    break;
+
+  case SvmExitMmioRead:
+    CopyMem ((VOID *)(UINTN)Ghcb->SaveArea.SwScratch, &mHv.MmioData,
+      (UINTN)ExitInfo2);
+    break;
+
+  case SvmExitMmioWrite:
+    mHv.MmioData = 0;
+    CopyMem (&mHv.MmioData, (VOID *)(UINTN)Ghcb->SaveArea.SwScratch,
+      (UINTN)ExitInfo2);
+    break;
+  }
+
+  Ghcb->SaveArea.SwExitInfo1 = 0;
+}
+
+/**
+  The cheapest possible hypervisor, for measuring the cost of the handler
+  itself: answer every request with success and valid registers.
+
+  @param[in, out] Ghcb  The GHCB holding the request.
+**/
+STATIC
+VOID
+NullVmgExit (
+  GHCB  *Ghcb
+  )
+{
+  Ghcb->SaveArea.ValidBitmap[GhcbRax / 8] |= 1 << (GhcbRax & 7);
+  Ghcb->SaveArea.ValidBitmap[GhcbRbx / 8] |= 1 << (GhcbRbx & 7);
+  Ghcb->SaveArea.ValidBitmap[GhcbRcx / 8] |= 1 << (GhcbRcx & 7);
+  Ghcb->SaveArea.ValidBitmap[GhcbRdx / 8] |= 1 << (GhcbRdx & 7);
+  Ghcb->SaveArea.SwExitInfo1 = 0;
+}
+
+/**
+  Set up the register context of a test case.
+**/
+STATIC
+VOID
+InitRegisters (
+  IN  CONST VC_TEST_CASE    *Case,
+  IN  UINT8                 *Code,
+  IN  UINT8                 *Buffer,
+  OUT EFI_SYSTEM_CONTEXT_X64 *Regs
+  )
+{
+  SetMem (Regs, sizeof *Regs, 0);
+  Regs->ExceptionData = Case->Exception;
+  Regs->Rip = (UINTN)Code;
+  Regs->Rax = Case->Rax;
+  Regs->Rbx = Case->Rbx;
+  Regs->Rcx = Case->Rcx;
+  Regs->Rdx = Case->Rdx;
+  Regs->Rsp = Case->Rsp;
+  Regs->Rbp = Case->Rbp;
+  Regs->Rsi = (UINTN)Buffer;
+  Regs->Rdi = (UINTN)Buffer;
+}
+
+/**
+  Run a test case once, and check the outcome.
+
+  @retval TRUE   The case passed.
+  @retval FALSE  The case failed; the reason has been printed.
+**/
+STATIC
+BOOLEAN
+RunTestCase (
+  IN CONST VC_TEST_CASE  *Case,
+  IN GHCB                *Ghcb,
+  IN UINT8               *Code,
+  IN UINT8               *Buffer,
+  IN BOOLEAN             Repeat
+  )
+{
+  EFI_SYSTEM_CONTEXT_X64  Regs;
+  UINTN                   Status;
+  UINT64                  ExitInfo1;
+  UINTN                   Bytes;
+  UINTN                   Index;
+  BOOLEAN                 String;
+
+  CopyMem (Code, Case->Bytes, Case->Length);
+  for (Index = 0; Index < STRING_BUFFER; Index++) {
+    Buffer[Index] = (UINT8)(Index * 7);
+  }
+  InitRegisters (Case, Code, Buffer, &Regs);
+
+  SetMem (&mHv, sizeof mHv, 0);
+  mHv.MmioData = MMIO_DATA;
+
+  Status = DoVcCommonWithExit (Ghcb, &Regs, MockVmgExit);
+  if (Status != 0) {
+    HostPrint ("  %s: status %u\n", Case->Name, (unsigned)Status);
+    return FALSE;
+  }
+
+  if (Regs.Rip != (UINTN)Code + Case->Length) {
+    HostPrint ("  %s: RIP advanced by %d, expected %u\n", Case->Name,
+      (int)(Regs.Rip - (UINTN)Code), Case->Length);
+    return FALSE;
+  }
+
+  //
+  // A repeated CPUID is answered from the cache, without an exit
+  //
+  if (Repeat && Case->Exception == SvmExitCpuid && Case->Rax != 1) {
+    if (mHv.Exits != 0) {
+      HostPrint ("  %s: cached CPUID made %u exits\n", Case->Name,
+        (unsigned)mHv.Exits);
+      return FALSE;
+    }
+  } else {
+    ExitInfo1 = Case->ExitInfo1;
+    if (Case->RipRelative) {
+      ExitInfo1 += (UINTN)Code + Case->Length;
+    }
+    String = (BOOLEAN)((Case->ExitInfo1 & IOIO_TYPE_STR) != 0 &&
+                       Case->ExitCode == SvmExitIoioProt);
+    if (mHv.Exits == 0 || mHv.ExitCode != Case->ExitCode ||
+        mHv.ExitInfo1 != ExitInfo1 ||
+        (String ? mHv.StringCount : mHv.ExitInfo2) != Case->ExitInfo2) {
+      HostPrint ("  %s: exit %x/%lx/%lx, expected %x/%lx/%lx\n", Case->Name,
+        (unsigned)mHv.ExitCode, (unsigned long)mHv.ExitInfo1,
+        (unsigned long)(String ? mHv.StringCount : mHv.ExitInfo2),
+        (unsigned)Case->ExitCode, (unsigned long)ExitInfo1,
+        (unsigned long)Case->ExitInfo2);
+      return FALSE;
+    }
+
+    if (String) {
+      Bytes = (UINTN)((Case->ExitInfo1 >> 4) & 0x7);
+      if (mHv.IoDataSize != Case->ExitInfo2 * Bytes) {
+        HostPrint ("  %s: transferred %u bytes\n", Case->Name,
+          (unsigned)mHv.IoDataSize);
+        return FALSE;
+      }
+      for (Index = 0; Index < mHv.IoDataSize; Index++) {
+        if ((Case->ExitInfo1 & IOIO_TYPE_IN) != 0 ?
+            Buffer[Index] != (UINT8)Index :
+            mHv.IoData[Index] != (UINT8)(Index * 7)) {
+          HostPrint ("  %s: data mismatch at %u\n", Case->Name,
+            (unsigned)Index);
+          return FALSE;
+        }
+      }
+      if ((Case->ExitInfo1 & IOIO_TYPE_IN) != 0 ?
+          Regs.Rdi != (UINTN)Buffer + mHv.IoDataSize :
+          Regs.Rsi != (UINTN)Buffer + mHv.IoDataSize) {
+        HostPrint ("  %s: string pointer not advanced\n", Case->Name);
+        return FALSE;
+      }
+    }
+  }
+
+  if (Case->Register != NO_REGISTER &&
+      *GetRegisterPointer (&Regs, Case->Register) != Case->Value) {
+    HostPrint ("  %s: register %u is %lx, expected %lx\n", Case->Name,
+      Case->Register, (unsigned long)*GetRegisterPointer (&Regs,
+      Case->Register), (unsigned long)Case->Value);
+    return FALSE;
+  }
+
+  if (Case->ExitCode == SvmExitMmioWrite && mHv.MmioData != Case->Value) {
+    HostPrint ("  %s: wrote %lx, expected %lx\n", Case->Name,
+      (unsigned long)mHv.MmioData, (unsigned long)Case->Value);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+  Run all test cases twice, with the given per-CPU scratch area.
+
+  @return The number of failed runs.
+**/
+STATIC
+UINTN
+RunTests (
+  IN GHCB     *Ghcb,
+  IN UINT8    *Code,
+  IN UINT8    *Buffer,
+  IN UINT64   ScratchBase,
+  IN UINT64   ScratchSize
+  )
+{
+  SEV_ES_PER_CPU_DATA  *PerCpuData;
+  UINTN                Index;
+  UINTN                Failed;
+
+  PerCpuData = GhcbGetPerCpuData (Ghcb);
+  SetMem (PerCpuData, sizeof *PerCpuData, 0);
+  PerCpuData->ScratchBase = ScratchBase;
+  PerCpuData->ScratchSize = ScratchSize;
+
+  Failed = 0;
+  for (Index = 0; Index < ARRAY_SIZE (mTestCases); Index++) {
+    if (!RunTestCase (&mTestCases[Index], Ghcb, Code, Buffer, FALSE)) {
+      Failed++;
+    }
+    if (!RunTestCase (&mTestCases[Index], Ghcb, Code, Buffer, TRUE)) {
+      Failed++;
+    }
+  }
+
+  if (PerCpuData->MmioCacheHits == 0 || PerCpuData->CpuidCacheHits == 0) {
+    HostPrint ("  caches unused: %lu MMIO hits, %lu CPUID hits\n",
+      (unsigned long)PerCpuData->MmioCacheHits,
+      (unsigned long)PerCpuData->CpuidCacheHits);
+    Failed++;
+  }
+
+  return Failed;
+}
+
+/**
+  Measure the cost of decoding a test case, without the GHCB handling.
+
+  @return The average time per decode, in nanoseconds.
+**/
+STATIC
+UINT64
+BenchmarkDecode (
+  IN CONST VC_TEST_CASE  *Case,
+  IN UINT8               *Code,
+  IN UINTN               Iterations
+  )
+{
+  EFI_SYSTEM_CONTEXT_X64   Regs;
+  SEV_ES_INSTRUCTION_DATA  InstructionData;
+  volatile UINT64          Sink;
+  UINT64                   Start;
+  UINTN                    Index;
+  BOOLEAN                  Write;
+
+  CopyMem (Code, Case->Bytes, Case->Length);
+  InitRegisters (Case, Code, Code, &Regs);
+
+  Sink = 0;
+  Start = HostNanoseconds ();
+  for (Index = 0; Index < Iterations; Index++) {
+    InitInstructionData (&InstructionData);
+    DecodeInstruction (&Regs, &InstructionData);
+    if (Case->Exception == SvmExitIoioProt) {
+      Sink += IoioExitInfo (&Regs, &InstructionData);
+    } else if (Case->Exception == SvmExitNpf) {
+      DecodeModRm (&InstructionData);
+      Sink += MmioAccessSize (&InstructionData, &Write);
+      GetModRmOperands (&Regs, &InstructionData);
+      Sink += InstructionData.Ext.RmData;
+    } else {
+      Sink += (UINTN)InstructionData.OpCodes;
+    }
+  }
+
+  return (HostNanoseconds () - Start) / Iterations;
+}
+
+/**
+  Measure the cost of handling a test case, with a hypervisor that costs
+  nothing.
+
+  @return The average time per #VC, in nanoseconds.
+**/
+STATIC
+UINT64
+BenchmarkHandler (
+  IN CONST VC_TEST_CASE  *Case,
+  IN GHCB                *Ghcb,
+  IN UINT8               *Code,
+  IN UINT8               *Buffer,
+  IN UINTN               Iterations,
+  IN BOOLEAN             Cached
+  )
+{
+  EFI_SYSTEM_CONTEXT_X64  Regs;
+  SEV_ES_PER_CPU_DATA     *PerCpuData;
+  UINT64                  Start;
+  UINTN                   Index;
+
+  PerCpuData = GhcbGetPerCpuData (Ghcb);
+  CopyMem (Code, Case->Bytes, Case->Length);
+
+  Start = HostNanoseconds ();
+  for (Index = 0; Index < Iterations; Index++) {
+    if (!Cached) {
+      SetMem (PerCpuData->CpuidCache, sizeof PerCpuData->CpuidCache, 0);
+      SetMem (PerCpuData->MmioCache, sizeof PerCpuData->MmioCache, 0);
+    }
+    InitRegisters (Case, Code, Buffer, &Regs);
+    DoVcCommonWithExit (Ghcb, &Regs, NullVmgExit);
+  }
+
+  return (HostNanoseconds () - Start) / Iterations;
+}
+
+/**
+  Place every MMIO test case at its own RIP in Code, REPLAY_SLOT_SIZE bytes
+  apart. The slots map to distinct entries of the MMIO cache.
+**/
+STATIC
+VOID
+InitReplay (
+  IN UINT8  *Code
+  )
+{
+  UINTN  Index;
+
+  mReplayCaseCount = 0;
+  for (Index = 0; Index < ARRAY_SIZE (mTestCases); Index++) {
+    if (mTestCases[Index].Exception == SvmExitNpf) {
+      ASSERT (mReplayCaseCount < REPLAY_MAX_SLOTS);
+      CopyMem (Code + mReplayCaseCount * REPLAY_SLOT_SIZE,
+        mTestCases[Index].Bytes, mTestCases[Index].Length);
+      mReplayCases[mReplayCaseCount++] = &mTestCases[Index];
+    }
+  }
+}
+
+/**
+  Take one MMIO fault of the replay stream.
+
+  @param[in] Slot  The slot of the faulting instruction.
+
+  @return  The status of the handler.
+**/
+STATIC
+UINTN
+ReplayFault (
+  IN GHCB             *Ghcb,
+  IN UINT8            *Code,
+  IN UINT8            *Buffer,
+  IN UINTN            Slot,
+  IN SEV_ES_VMGEXIT   VmgExitFunction,
+  OUT UINT64          *Rip
+  )
+{
+  EFI_SYSTEM_CONTEXT_X64  Regs;
+  UINTN                   Status;
+
+  InitRegisters (mReplayCases[Slot], Code + Slot * REPLAY_SLOT_SIZE, Buffer,
+    &Regs);
+  Status = DoVcCommonWithExit (Ghcb, &Regs, VmgExitFunction);
+  *Rip = Regs.Rip;
+  return Status;
+}
+
+/**
+  Replay the MMIO stream with the mock hypervisor, once with the MMIO cache
+  cleared before every fault and once with the cache kept, and check that
+  both runs make the same exits. Then replace the instruction at a cached
+  RIP, and check that the handler decodes the new instruction.
+
+  @retval TRUE   The replay passed.
+  @retval FALSE  The replay failed; the reason has been printed.
+**/
+STATIC
+BOOLEAN
+CheckReplay (
+  IN GHCB   *Ghcb,
+  IN UINT8  *Code,
+  IN UINT8  *Buffer
+  )
+{
+  SEV_ES_PER_CPU_DATA     *PerCpuData;
+  CONST VC_TEST_CASE      *Case;
+  EFI_SYSTEM_CONTEXT_X64  Regs;
+  UINT64                  ExitInfo1[ARRAY_SIZE (mReplayStream)];
+  UINT64                  ExitInfo2[ARRAY_SIZE (mReplayStream)];
+  UINT64                  Rip[ARRAY_SIZE (mReplayStream)];
+  UINT64                  WarmRip;
+  UINT64                  Expected;
+  UINT8                   *Insn;
+  UINTN                   Index;
+  UINTN                   Slot;
+
+  PerCpuData = GhcbGetPerCpuData (Ghcb);
+  SetMem (PerCpuData, sizeof *PerCpuData, 0);
+  InitReplay (Code);
+
+  for (Index = 0; Index < ARRAY_SIZE (mReplayStream); Index++) {
+    ASSERT (mReplayStream[Index] < mReplayCaseCount);
+    SetMem (PerCpuData->MmioCache, sizeof PerCpuData->MmioCache, 0);
+    SetMem (&mHv, sizeof mHv, 0);
+    mHv.MmioData = MMIO_DATA;
+    if (ReplayFault (Ghcb, Code, Buffer, mReplayStream[Index], MockVmgExit,
+          &Rip[Index]) != 0) {
+      HostPrint ("  replay %u: cold fault failed\n", (unsigned)Index);
+      return FALSE;
+    }
+    ExitInfo1[Index] = mHv.ExitInfo1;
+    ExitInfo2[Index] = mHv.ExitInfo2;
+  }
+
+  SetMem (PerCpuData->MmioCache, sizeof PerCpuData->MmioCache, 0);
+  PerCpuData->MmioCacheHits   = 0;
+  PerCpuData->MmioCacheMisses = 0;
+  for (Index = 0; Index < ARRAY_SIZE (mReplayStream); Index++) {
+    SetMem (&mHv, sizeof mHv, 0);
+    mHv.MmioData = MMIO_DATA;
+    if (ReplayFault (Ghcb, Code, Buffer, mReplayStream[Index], MockVmgExit,
+          &WarmRip) != 0 ||
+        mHv.ExitInfo1 != ExitInfo1[Index] ||
+        mHv.ExitInfo2 != ExitInfo2[Index] || WarmRip != Rip[Index]) {
+      HostPrint ("  replay %u: cached fault differs from decode\n",
+        (unsigned)Index);
+      return FALSE;
+    }
+  }
+  if (PerCpuData->MmioCacheMisses != mReplayCaseCount) {
+    HostPrint ("  replay: %lu misses for %u RIPs\n",
+      (unsigned long)PerCpuData->MmioCacheMisses, (unsigned)mReplayCaseCount);
+    return FALSE;
+  }
+
+  //
+  // Load a different instruction at every cached RIP, as an image loaded
+  // where an unloaded one was would, and check the exits against the case
+  // that now occupies the slot.
+  //
+  for (Slot = 0; Slot < mReplayCaseCount; Slot++) {
+    Case = mReplayCases[(Slot + 1) % mReplayCaseCount];
+    Insn = Code + Slot * REPLAY_SLOT_SIZE;
+    SetMem (Insn, REPLAY_SLOT_SIZE, 0x90);
+    CopyMem (Insn, Case->Bytes, Case->Length);
+
+    SetMem (&mHv, sizeof mHv, 0);
+    mHv.MmioData = MMIO_DATA;
+    InitRegisters (Case, Insn, Buffer, &Regs);
+    Expected = Case->ExitInfo1;
+    if (Case->RipRelative) {
+      Expected += (UINTN)Insn + Case->Length;
+    }
+    if (DoVcCommonWithExit (Ghcb, &Regs, MockVmgExit) != 0 ||
+        mHv.ExitCode != Case->ExitCode || mHv.ExitInfo1 != Expected ||
+        mHv.ExitInfo2 != Case->ExitInfo2 ||
+        Regs.Rip != (UINTN)Insn + Case->Length) {
+      HostPrint ("  replay: stale decode at slot %u\n", (unsigned)Slot);
+      return FALSE;
+    }
+  }
+
+  InitReplay (Code);
+  return TRUE;
+}
+
+/**
+  Replay the MMIO stream with a hypervisor that costs nothing.
+
+  @return The average time per fault, in nanoseconds.
+**/
+STATIC
+UINT64
+BenchmarkReplay (
+  IN GHCB     *Ghcb,
+  IN UINT8    *Code,
+  IN UINT8    *Buffer,
+  IN UINTN    Iterations,
+  IN BOOLEAN  Cached
+  )
+{
+  SEV_ES_PER_CPU_DATA  *PerCpuData;
+  UINT64               Start;
+  UINT64               Rip;
+  UINTN                Iteration;
+  UINTN                Index;
+
+  PerCpuData = GhcbGetPerCpuData (Ghcb);
+  SetMem (PerCpuData->MmioCache, sizeof PerCpuData->MmioCache, 0);
+
+  Start = HostNanoseconds ();
+  for (Iteration = 0; Iteration < Iterations; Iteration++) {
+    for (Index = 0; Index < ARRAY_SIZE (mReplayStream); Index++) {
+      if (!Cached) {
+        SetMem (PerCpuData->MmioCache, sizeof PerCpuData->MmioCache, 0);
+      }
+      ReplayFault (Ghcb, Code, Buffer, mReplayStream[Index], NullVmgExit,
+        &Rip);
+    }
+  }
+
+  return (HostNanoseconds () - Start) / Iterations /
+           ARRAY_SIZE (mReplayStream);
+}
+
+int
+main (
+  int   Argc,
+  char  **Argv
+  )
+{
+  GHCB                 *Ghcb;
+  UINT8                *Code;
+  UINT8                *Buffer;
+  UINT8                *Scratch;
+  UINTN                Iterations;
+  UINTN                Failed;
+  UINTN                Index;
+  CHAR8                *Digit;
+  SEV_ES_PER_CPU_DATA  *PerCpuData;
+  UINT64               Cold;
+  UINT64               Warm;
+
+  Iterations = 1000000;
+  if (Argc > 1) {
+    Iterations = 0;
+    for (Digit = Argv[1]; *Digit >= '0' && *Digit <= '9'; Digit++) {
+      Iterations = Iterations * 10 + (*Digit - '0');
+    }
+    if (Iterations == 0) {
+      Iterations = 1;
+    }
+  }
+
+  Ghcb    = HostAllocatePages (GHCB_PER_CPU_PAGES);
+  Code    = HostAllocatePages (1);
+  Buffer  = HostAllocatePages (EFI_SIZE_TO_PAGES (STRING_BUFFER));
+  Scratch = HostAllocatePages (SCRATCH_PAGES);
+  if (Ghcb == NULL || Code == NULL || Buffer == NULL || Scratch == NULL) {
+    HostPrint ("out of memory\n");
+    return 1;
+  }
+
+  HostPrint ("Running %u test cases through the GHCB shared buffer\n",
+    (unsigned)ARRAY_SIZE (mTestCases));
+  Failed = RunTests (Ghcb, Code, Buffer, 0, 0);
+  HostPrint ("Running %u test cases through a scratch area\n",
+    (unsigned)ARRAY_SIZE (mTestCases));
+  Failed += RunTests (Ghcb, Code, Buffer, (UINTN)Scratch,
+              EFI_PAGES_TO_SIZE (SCRATCH_PAGES));
+  if (Failed != 0) {
+    HostPrint ("%u failures\n", (unsigned)Failed);
+    return 1;
+  }
+  HostPrint ("Replaying %u MMIO faults\n",
+    (unsigned)ARRAY_SIZE (mReplayStream));
+  if (!CheckReplay (Ghcb, Code, Buffer)) {
+    HostPrint ("replay failed\n");
+    return 1;
+  }
+  HostPrint ("All tests passed\n\n");
+
+  HostPrint ("%-32s %10s %10s %10s\n", "ns per #VC", "decode", "handler",
+    "cached");
+  for (Index = 0; Index < ARRAY_SIZE (mTestCases); Index++) {
+    HostPrint ("%-32s %10lu %10lu %10lu\n", mTestCases[Index].Name,
+      (unsigned long)BenchmarkDecode (&mTestCases[Index], Code, Iterations),
+      (unsigned long)BenchmarkHandler (&mTestCases[Index], Ghcb, Code, Buffer,
+                       Iterations, FALSE),
+      (unsigned long)BenchmarkHandler (&mTestCases[Index], Ghcb, Code, Buffer,
+                       Iterations, TRUE));
+  }
+
+  //
+  // The replay takes ARRAY_SIZE (mReplayStream) faults per iteration.
+  //
+  Iterations = Iterations / ARRAY_SIZE (mReplayStream) + 1;
+  PerCpuData = GhcbGetPerCpuData (Ghcb);
+  Cold = BenchmarkReplay (Ghcb, Code, Buffer, Iterations, FALSE);
+  PerCpuData->MmioCacheHits   = 0;
+  PerCpuData->MmioCacheMisses = 0;
+  Warm = BenchmarkReplay (Ghcb, Code, Buffer, Iterations, TRUE);
+  HostPrint ("\nMMIO replay, %u faults on %u RIPs: %lu ns cold, %lu ns "
+    "cached, %lu%% hits\n", (unsigned)ARRAY_SIZE (mReplayStream),
+    (unsigned)mReplayCaseCount, (unsigned long)Cold, (unsigned long)Warm,
+    (unsigned long)(PerCpuData->MmioCacheHits * 100 /
+                    (PerCpuData->MmioCacheHits + PerCpuData->MmioCacheMisses)));
+
+  return 0;
+}
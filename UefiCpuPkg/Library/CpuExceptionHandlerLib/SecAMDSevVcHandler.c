@@ -36,6 +36,9 @@ DoVcException(
     Ghcb = (GHCB *) Msr.GhcbPhysicalAddress;
     SetMem (Ghcb, sizeof (*Ghcb), 0);
 
+    /* The per-CPU data page follows the GHCB and is not shared */
+    SetMem (GhcbGetPerCpuData (Ghcb), sizeof (SEV_ES_PER_CPU_DATA), 0);
+
     /* Set the version to the maximum that can be supported */
     Ghcb->ProtocolVersion = MIN (Msr.GhcbProtocol.SevEsProtocolMax, GHCB_VERSION_MAX);
     Ghcb->GhcbUsage = GHCB_STANDARD_USAGE;
@@ -362,11 +362,12 @@ MpInitChangeApLoopCallback (
   )
 {
   CPU_MP_DATA               *CpuMpData;
+  UINT32                    MonitorFilterSize;
 
   CpuMpData = GetCpuMpData ();
   CpuMpData->PmCodeSegment = GetProtectedModeCS ();
   CpuMpData->Pm16CodeSegment = GetProtectedMode16CS ();
-  CpuMpData->ApLoopMode = PcdGet8 (PcdCpuApLoopMode);
+  CpuMpData->ApLoopMode = GetApLoopMode (&MonitorFilterSize);
   mNumberToFinish = CpuMpData->CpuCount - 1;
   WakeUpAP (CpuMpData, TRUE, 0, RelocateApLoop, NULL, TRUE);
   while (mNumberToFinish > 0) {
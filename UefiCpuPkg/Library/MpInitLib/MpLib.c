@@ -298,6 +298,16 @@ GetApLoopMode (
     }
   }
 
+  if (ApLoopMode != ApInHltLoop && PcdGet32 (PcdCpuSevEsActive) != 0) {
+    //
+    // Under SEV-ES, an AP can only be restarted with INIT-SIPI-SIPI while it
+    // waits in the AP reset hold of the Hlt-loop; the Mwait-loop and the
+    // Run-loop never get there. (MONITOR/MWAIT are also intercepted, and the
+    // #VC handler does not emulate them.) Force AP in Hlt-loop mode.
+    //
+    ApLoopMode = ApInHltLoop;
+  }
+
   if (ApLoopMode != ApInMwaitLoop) {
     *MonitorFilterSize = sizeof (UINT32);
   } else {
@@ -466,6 +476,9 @@ CollectProcessorCount (
   )
 {
   UINTN                  Index;
+  UINT64                 StartTime;
+
+  StartTime = GetPerformanceCounter ();
 
   //
   // Send 1st broadcast IPI to APs to wakeup APs
@@ -518,6 +531,8 @@ CollectProcessorCount (
   SortApicId (CpuMpData);
 
   DEBUG ((DEBUG_INFO, "MpInitLib: Find %d processors in system.\n", CpuMpData->CpuCount));
+  DEBUG ((DEBUG_INFO, "%a: %Lu microseconds\n", __FUNCTION__,
+    GetElapsedMicroseconds (StartTime)));
 
   return CpuMpData->CpuCount;
 }
@@ -942,6 +957,7 @@ FillExchangeInfoData (
 
   ExchangeInfo->SevEsActive     = CpuMpData->SevEsActive;
   ExchangeInfo->GhcbBase        = CpuMpData->GhcbBase;
+  ExchangeInfo->GhcbPerCpuSize  = (UINTN) CpuMpData->GhcbPerCpuSize;
 
   //
   // Get the BSP's data of GDT and IDT
@@ -1283,6 +1299,9 @@ WakeUpAP (
 
   if (ResetVectorRequired) {
     FreeResetVector (CpuMpData);
+    CpuMpData->SipiWakeUpCount++;
+  } else {
+    CpuMpData->MailboxWakeUpCount++;
   }
 
   //
@@ -1422,6 +1441,33 @@ CheckTimeout (
   return FALSE;
 }
 
+/**
+  Get the time elapsed since the performance counter had the specified value.
+
+  @param[in] StartTime  The value of the performance counter at the start.
+
+  @return The elapsed time in microseconds.
+**/
+UINT64
+GetElapsedMicroseconds (
+  IN UINT64                     StartTime
+  )
+{
+  UINT64                        TotalTime;
+
+  //
+  // A timeout of MAX_UINT64 ticks never expires; CheckTimeout() then only
+  // accumulates the elapsed ticks, taking care of counter wrap-around.
+  //
+  TotalTime = 0;
+  CheckTimeout (&StartTime, &TotalTime, MAX_UINT64);
+  return DivU64x64Remainder (
+           MultU64x32 (TotalTime, 1000000),
+           GetPerformanceCounterProperties (NULL, NULL),
+           NULL
+           );
+}
+
 /**
   Helper function that waits until the finished AP count reaches the specified
   limit, or the specified timeout elapses (whichever comes first).
@@ -1864,6 +1910,13 @@ MpInitLibInitialize (
   CpuMpData->SevEsActive      = PcdGet32 (PcdCpuSevEsActive);
   CpuMpData->SevEsAPBuffer    = (UINTN) -1;
   CpuMpData->GhcbBase         = PcdGet64 (PcdGhcbBase);
+  //
+  // A zero per-CPU GHCB block size means the GHCB pages are contiguous.
+  //
+  CpuMpData->GhcbPerCpuSize   = PcdGet64 (PcdGhcbPerCpuSize);
+  if (CpuMpData->GhcbPerCpuSize == 0) {
+    CpuMpData->GhcbPerCpuSize = SIZE_4KB;
+  }
   InitializeSpinLock(&CpuMpData->MpLock);
 
   //
@@ -2393,6 +2446,10 @@ StartupAllAPsWorker (
   CPU_AP_DATA             *CpuData;
   BOOLEAN                 HasEnabledAp;
   CPU_STATE               ApState;
+  UINT64                  StartTime;
+  UINT64                  DispatchTime;
+  UINT32                  SipiWakeUpCount;
+  UINTN                   ApCount;
 
   CpuMpData = GetCpuMpData ();
 
@@ -2477,6 +2534,10 @@ StartupAllAPsWorker (
   CpuMpData->TotalTime     = 0;
   CpuMpData->WaitEvent     = WaitEvent;
 
+  StartTime       = CpuMpData->CurrentTime;
+  SipiWakeUpCount = CpuMpData->SipiWakeUpCount;
+  ApCount         = CpuMpData->RunningCount;
+
   if (!SingleThread) {
     WakeUpAP (CpuMpData, TRUE, 0, Procedure, ProcedureArgument, FALSE);
   } else {
@@ -2491,6 +2552,8 @@ StartupAllAPsWorker (
     }
   }
 
+  DispatchTime = GetElapsedMicroseconds (StartTime);
+
   Status = EFI_SUCCESS;
   if (WaitEvent == NULL) {
     do {
@@ -2498,6 +2561,18 @@ StartupAllAPsWorker (
     } while (Status == EFI_NOT_READY);
   }
 
+  DEBUG ((
+    DEBUG_VERBOSE,
+    "%a: %Lu APs woken by %a in %Lu microseconds, %a after %Lu microseconds: %r\n",
+    __FUNCTION__,
+    (UINT64)ApCount,
+    CpuMpData->SipiWakeUpCount != SipiWakeUpCount ? "INIT-SIPI-SIPI" : "mailbox",
+    DispatchTime,
+    WaitEvent == NULL ? "finished" : "returned",
+    GetElapsedMicroseconds (StartTime),
+    Status
+    ));
+
   return Status;
 }
 
@@ -2538,6 +2613,8 @@ StartupThisAPWorker (
   CPU_MP_DATA             *CpuMpData;
   CPU_AP_DATA             *CpuData;
   UINTN                   CallerNumber;
+  UINT64                  DispatchTime;
+  UINT32                  SipiWakeUpCount;
 
   CpuMpData = GetCpuMpData ();
 
@@ -2596,9 +2673,12 @@ StartupThisAPWorker (
   CpuData->Finished     = Finished;
   CpuData->ExpectedTime = CalculateTimeout (TimeoutInMicroseconds, &CpuData->CurrentTime);
   CpuData->TotalTime    = 0;
+  SipiWakeUpCount       = CpuMpData->SipiWakeUpCount;
 
   WakeUpAP (CpuMpData, FALSE, ProcessorNumber, Procedure, ProcedureArgument, TRUE);
 
+  DispatchTime = GetElapsedMicroseconds (CpuData->CurrentTime);
+
   //
   // If WaitEvent is NULL, execute in blocking mode.
   // BSP checks AP's state until it finishes or TimeoutInMicrosecsond expires.
@@ -2610,6 +2690,16 @@ StartupThisAPWorker (
     } while (Status == EFI_NOT_READY);
   }
 
+  DEBUG ((
+    DEBUG_VERBOSE,
+    "%a: AP %Lu woken by %a in %Lu microseconds: %r\n",
+    __FUNCTION__,
+    (UINT64)ProcessorNumber,
+    CpuMpData->SipiWakeUpCount != SipiWakeUpCount ? "INIT-SIPI-SIPI" : "mailbox",
+    DispatchTime,
+    Status
+    ));
+
   return Status;
 }
 
@@ -198,6 +198,7 @@ typedef struct {
   UINT16                ModeHighSegment;
   UINT32                SevEsActive;
   UINTN                 GhcbBase;
+  UINTN                 GhcbPerCpuSize;
 } MP_CPU_EXCHANGE_INFO;
 
 #pragma pack()
@@ -275,6 +276,15 @@ struct _CPU_MP_DATA {
   UINTN                          SevEsAPBuffer;
   UINTN                          SevEsAPResetStackStart;
   UINT64                         GhcbBase;
+  UINT64                         GhcbPerCpuSize;
+
+  //
+  // Number of WakeUpAP() calls that sent INIT-SIPI-SIPI, and number of calls
+  // that only wrote the start-up signal (mailbox) of APs parked in the MWAIT
+  // or run loop. Reported by the MP services timing messages.
+  //
+  UINT32                         SipiWakeUpCount;
+  UINT32                         MailboxWakeUpCount;
 };
 
 #define AP_RESET_STACK_SIZE 64
@@ -632,6 +642,30 @@ MicrocodeDetect (
   IN BOOLEAN                 IsBspCallIn
   );
 
+/**
+  Get AP loop mode.
+
+  @param[out] MonitorFilterSize  Returns the largest monitor-line size in bytes.
+
+  @return The AP loop mode.
+**/
+UINT8
+GetApLoopMode (
+  OUT UINT32                    *MonitorFilterSize
+  );
+
+/**
+  Get the time elapsed since the performance counter had the specified value.
+
+  @param[in] StartTime  The value of the performance counter at the start.
+
+  @return The elapsed time in microseconds.
+**/
+UINT64
+GetElapsedMicroseconds (
+  IN UINT64                     StartTime
+  );
+
 /**
   Detect whether Mwait-monitor feature is supported.
 